@@ -0,0 +1,434 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "action_cache.h"
+
+#include "command.h"
+
+#include <sw/support/filesystem.h>
+#include <sw/support/trace.h>
+
+#include <nlohmann/json.hpp>
+#include <primitives/exceptions.h>
+#include <primitives/lock.h>
+#include <primitives/templates.h>
+#include <xxhash.h>
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "action_cache");
+
+// number of different implicit input sets kept for the same inputs
+#define MAX_MANIFEST_ENTRIES 16
+
+namespace sw
+{
+
+static String to_hex(XXH128_hash_t h)
+{
+    char buf[33];
+    snprintf(buf, sizeof(buf), "%016llx%016llx", (unsigned long long)h.high64, (unsigned long long)h.low64);
+    return buf;
+}
+
+static String hash_string(const String &s)
+{
+    return to_hex(XXH3_128bits(s.data(), s.size()));
+}
+
+static String hash_file(const path &p)
+{
+    ScopedFile f(p, "rb");
+    auto state = XXH3_createState();
+    if (!state)
+        throw SW_RUNTIME_ERROR("Cannot create hash state");
+    SCOPE_EXIT
+    {
+        XXH3_freeState(state);
+    };
+    XXH3_128bits_reset(state);
+    std::vector<char> buf(64 * 1024);
+    while (auto n = fread(buf.data(), 1, buf.size(), f.getHandle()))
+        XXH3_128bits_update(state, buf.data(), n);
+    if (ferror(f.getHandle()))
+        throw SW_RUNTIME_ERROR("Cannot read file: " + to_string(p));
+    return to_hex(XXH3_128bits_digest(state));
+}
+
+static path from_json_path(const nlohmann::json &j)
+{
+    auto s = j.get<String>();
+    return (const char8_t *)s.c_str();
+}
+
+static void touch(const path &p)
+{
+    std::error_code ec;
+    fs::last_write_time(p, fs::file_time_type::clock::now(), ec);
+}
+
+ActionCache::ActionCache(const path &dir, uintmax_t max_size)
+    : dir(dir), max_size(max_size)
+{
+    fs::create_directories(dir);
+}
+
+ActionCache::~ActionCache()
+{
+}
+
+path ActionCache::getManifestFilename(const String &key) const
+{
+    return dir / "manifests" / key.substr(0, 2) / key;
+}
+
+path ActionCache::getActionFilename(const String &key) const
+{
+    return dir / "actions" / key.substr(0, 2) / key;
+}
+
+path ActionCache::getBlobFilename(const String &key) const
+{
+    return dir / "blobs" / key.substr(0, 2) / key;
+}
+
+std::optional<String> ActionCache::getInputsKey(const builder::Command &c) const
+{
+    if (c.outputs.empty())
+        return {};
+
+    // both halves, a collision here restores outputs of another command
+    auto ch = c.getFullHash();
+    String s = std::to_string(builder::Command::hash_version) + "\n" + std::to_string(ch.high) + "\n" + std::to_string(ch.low) + "\n";
+    for (auto &i : FilesSorted(c.inputs.begin(), c.inputs.end()))
+    {
+        auto h = c.getContentHash(i);
+        if (!h)
+            return {};
+        s += to_string(normalize_path(i)) + "\n" + std::to_string(h) + "\n";
+    }
+    return hash_string(s);
+}
+
+static FilesSorted getSortedPaths(const PathIds &ids)
+{
+    auto &t = getPathTable();
+    FilesSorted files;
+    for (auto id : ids)
+        files.insert(t.getPath(id));
+    return files;
+}
+
+std::optional<String> ActionCache::getActionKey(const builder::Command &c, const String &inputs_key, const PathIds &implicit_inputs) const
+{
+    String s = inputs_key + "\n";
+    for (auto &i : getSortedPaths(implicit_inputs))
+    {
+        auto h = c.getContentHash(i);
+        if (!h)
+            return {};
+        s += to_string(normalize_path(i)) + "\n" + std::to_string(h) + "\n";
+    }
+    return hash_string(s);
+}
+
+bool ActionCache::restore(builder::Command &c)
+{
+    SW_TRACE_ZONE("action cache restore");
+    auto miss = [this]()
+    {
+        stats.misses++;
+        return false;
+    };
+
+    auto k = getInputsKey(c);
+    if (!k)
+        return miss();
+    auto mf = getManifestFilename(*k);
+    if (!fs::exists(mf))
+        return miss();
+
+    nlohmann::json m;
+    try
+    {
+        m = nlohmann::json::parse(read_file(mf));
+    }
+    catch (std::exception &e)
+    {
+        LOG_DEBUG(logger, "Bad manifest " << to_string(mf) << ": " << e.what());
+        return miss();
+    }
+
+    for (auto &e : m["entries"])
+    {
+        PathIds implicit_inputs;
+        for (auto &p : e["implicit_inputs"])
+            implicit_inputs.push_back(getPathTable().intern(from_json_path(p)));
+        auto ak = getActionKey(c, *k, implicit_inputs);
+        if (!ak || *ak != e["action"].get<String>())
+            continue;
+        try
+        {
+            if (!restoreAction(c, *ak))
+                continue;
+        }
+        catch (std::exception &e)
+        {
+            LOG_DEBUG(logger, "Cannot restore action " << *ak << ": " << e.what());
+            continue;
+        }
+        c.implicit_inputs = implicit_inputs;
+        stats.hits++;
+        return true;
+    }
+    return miss();
+}
+
+bool ActionCache::restoreAction(builder::Command &c, const String &key)
+{
+    auto af = getActionFilename(key);
+    if (!fs::exists(af))
+        return false;
+    auto a = nlohmann::json::parse(read_file(af));
+
+    std::unordered_set<String> outputs;
+    for (auto &o : c.outputs)
+        outputs.insert(to_string(normalize_path(o)));
+    if (outputs.size() != a["outputs"].size())
+        return false;
+
+    // check everything before touching outputs
+    std::error_code ec;
+    for (auto &o : a["outputs"])
+    {
+        if (!outputs.contains(o["path"].get<String>()))
+            return false;
+        auto b = getBlobFilename(o["blob"].get<String>());
+        if (fs::file_size(b, ec) != o["size"].get<uintmax_t>() || ec)
+            return false;
+    }
+    for (auto s : { "stdout", "stderr" })
+    {
+        if (!a[s].get<String>().empty() && !fs::exists(getBlobFilename(a[s].get<String>())))
+            return false;
+    }
+
+    for (auto &o : a["outputs"])
+    {
+        auto b = getBlobFilename(o["blob"].get<String>());
+        auto p = from_json_path(o["path"]);
+        fs::create_directories(p.parent_path());
+        fs::remove(p, ec);
+        // never hard link: tools rewriting outputs in place (linkers, strip)
+        // would change the blob for every later restore
+        if (!support::reflink(b, p))
+            fs::copy_file(b, p, fs::copy_options::overwrite_existing);
+        // outputs must look newer than everything built before them
+        touch(p);
+        touch(b);
+    }
+    c.out.text = a["stdout"].get<String>().empty() ? String{} : read_file(getBlobFilename(a["stdout"].get<String>()));
+    c.err.text = a["stderr"].get<String>().empty() ? String{} : read_file(getBlobFilename(a["stderr"].get<String>()));
+    touch(af);
+    return true;
+}
+
+void ActionCache::writeFile(const path &p, const String &s)
+{
+    // other processes may read the file at the same time
+    fs::create_directories(p.parent_path());
+    auto tmp = p.parent_path() / unique_path();
+    write_file(tmp, s);
+    fs::rename(tmp, p);
+    stats.bytes_added += s.size();
+}
+
+String ActionCache::putFileBlob(const path &p)
+{
+    auto sz = fs::file_size(p);
+    // 64 bit content hashes of the file db may collide, blobs are restored without checks
+    auto key = hash_file(p) + "-" + std::to_string(sz);
+    auto b = getBlobFilename(key);
+    if (fs::exists(b))
+    {
+        touch(b);
+        return key;
+    }
+
+    // do not link blob to the output, it may be changed in place later
+    fs::create_directories(b.parent_path());
+    auto tmp = b.parent_path() / unique_path();
+    if (!support::reflink(p, tmp))
+        fs::copy_file(p, tmp);
+    fs::rename(tmp, b);
+    stats.bytes_added += sz;
+    return key;
+}
+
+String ActionCache::putStringBlob(const String &s)
+{
+    if (s.empty())
+        return {};
+    auto key = hash_string(s);
+    auto b = getBlobFilename(key);
+    if (fs::exists(b))
+        touch(b);
+    else
+        writeFile(b, s);
+    return key;
+}
+
+void ActionCache::store(const builder::Command &c)
+{
+    SW_TRACE_ZONE("action cache store");
+    auto k = getInputsKey(c);
+    if (!k)
+        return;
+    auto ak = getActionKey(c, *k, c.implicit_inputs);
+    if (!ak)
+        return;
+
+    nlohmann::json a;
+    for (auto &o : c.outputs)
+    {
+        // directories and other special outputs are not cached
+        std::error_code ec;
+        if (!fs::is_regular_file(o, ec))
+            return;
+        nlohmann::json jo;
+        jo["path"] = to_string(normalize_path(o));
+        jo["blob"] = putFileBlob(o);
+        jo["size"] = fs::file_size(o);
+        a["outputs"].push_back(jo);
+    }
+    a["stdout"] = putStringBlob(c.out.text);
+    a["stderr"] = putStringBlob(c.err.text);
+    writeFile(getActionFilename(*ak), a.dump());
+
+    nlohmann::json e;
+    for (auto &i : getSortedPaths(c.implicit_inputs))
+        e["implicit_inputs"].push_back(to_string(i));
+    e["action"] = *ak;
+
+    auto mf = getManifestFilename(*k);
+    fs::create_directories(mf.parent_path());
+    ScopedFileLock lk(mf);
+    nlohmann::json m;
+    if (fs::exists(mf))
+    {
+        try
+        {
+            m = nlohmann::json::parse(read_file(mf));
+        }
+        catch (std::exception &)
+        {
+        }
+    }
+    nlohmann::json entries;
+    entries.push_back(e);
+    for (auto &e2 : m["entries"])
+    {
+        if (entries.size() < MAX_MANIFEST_ENTRIES && e2["action"] != *ak)
+            entries.push_back(e2);
+    }
+    m["entries"] = entries;
+    writeFile(mf, m.dump());
+
+    stats.stores++;
+}
+
+void ActionCache::trim()
+{
+    if (!stats.bytes_added)
+        return;
+
+    ScopedFileLock lk(dir / "trim");
+
+    struct Entry
+    {
+        path p;
+        fs::file_time_type t;
+        uintmax_t size;
+    };
+
+    std::vector<Entry> entries;
+    uintmax_t size = 0;
+    auto scan = [this, &entries, &size]()
+    {
+        for (auto d : { "blobs", "actions", "manifests" })
+        {
+            if (!fs::exists(dir / d))
+                continue;
+            for (auto &f : fs::recursive_directory_iterator(dir / d))
+            {
+                std::error_code ec;
+                if (!f.is_regular_file(ec))
+                    continue;
+                Entry e{ f.path(), f.last_write_time(ec), f.file_size(ec) };
+                if (ec)
+                    continue;
+                size += e.size;
+                entries.push_back(e);
+            }
+        }
+    };
+
+    // avoid full scan on every build, keep approximate size on disk
+    auto size_fn = dir / "size";
+    bool known = false;
+    if (fs::exists(size_fn))
+    {
+        try
+        {
+            size = std::stoull(read_file(size_fn)) + stats.bytes_added;
+            known = true;
+        }
+        catch (std::exception &)
+        {
+        }
+    }
+    if (!known || size > max_size)
+    {
+        size = 0;
+        scan();
+    }
+
+    if (size > max_size)
+    {
+        std::sort(entries.begin(), entries.end(), [](const auto &e1, const auto &e2) { return e1.t < e2.t; });
+        // leave some room for the next builds
+        auto target = max_size / 10 * 9;
+        size_t removed = 0;
+        for (auto &e : entries)
+        {
+            if (size <= target)
+                break;
+            std::error_code ec;
+            fs::remove(e.p, ec);
+            if (ec)
+                continue;
+            size -= e.size;
+            removed++;
+        }
+        LOG_DEBUG(logger, "Action cache: removed " << removed << " files");
+    }
+
+    write_file(size_fn, std::to_string(size));
+    stats.bytes_added = 0;
+}
+
+}
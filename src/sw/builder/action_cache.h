@@ -0,0 +1,85 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "path_table.h"
+
+#include <primitives/filesystem.h>
+
+#include <atomic>
+#include <optional>
+
+namespace sw
+{
+
+namespace builder
+{
+
+struct Command;
+
+}
+
+/// Local content-addressed cache of command results.
+/// It is shared between build directories and sw invocations.
+/// Keys are made from command hash and content hashes of inputs and implicit inputs.
+/// Output blobs are named by 128 bit digest of their contents and size.
+struct SW_BUILDER_API ActionCache
+{
+    struct Stats
+    {
+        std::atomic_size_t hits{ 0 };
+        std::atomic_size_t misses{ 0 };
+        std::atomic_size_t stores{ 0 };
+        std::atomic_uint64_t bytes_added{ 0 };
+    };
+
+    ActionCache(const path &dir, uintmax_t max_size);
+    ActionCache(const ActionCache &) = delete;
+    ActionCache &operator=(const ActionCache &) = delete;
+    ~ActionCache();
+
+    /// restores outputs, stdout/stderr and implicit inputs of the command
+    /// on miss removes outputs that share data with the cache, so they won't be written in place
+    bool restore(builder::Command &);
+    /// stores results of successfully executed command
+    void store(const builder::Command &);
+    /// removes least recently used entries when cache is over the size limit
+    void trim();
+
+    const Stats &getStats() const { return stats; }
+
+private:
+    path dir;
+    uintmax_t max_size;
+    Stats stats;
+
+    std::optional<String> getInputsKey(const builder::Command &) const;
+    std::optional<String> getActionKey(const builder::Command &, const String &inputs_key, const PathIds &implicit_inputs) const;
+    bool restoreAction(builder::Command &, const String &action_key);
+
+    path getManifestFilename(const String &key) const;
+    path getActionFilename(const String &key) const;
+    path getBlobFilename(const String &key) const;
+
+    String putFileBlob(const path &);
+    String putStringBlob(const String &);
+    void writeFile(const path &, const String &);
+};
+
+}
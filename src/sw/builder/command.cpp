@@ -21,10 +21,15 @@
 #define BOOST_THREAD_VERSION 5
 #include "command.h"
 
+#include "action_cache.h"
+#include "command_arena.h"
+#include "command_executor.h"
 #include "command_storage.h"
+#include "deps_parser.h"
 #include "file.h"
 #include "file_storage.h"
 #include "jumppad.h"
+#include "mapped_table.h"
 #include "os.h"
 //#include "program.h"
 #include "sw_context.h"
@@ -32,6 +37,7 @@
 #include <sw/manager/settings.h>
 #include <sw/support/filesystem.h>
 #include <sw/support/hash.h>
+#include <sw/support/trace.h>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/dll.hpp>
@@ -41,9 +47,17 @@
 #include <primitives/symbol.h>
 #include <primitives/templates.h>
 #include <primitives/sw/settings_program_name.h>
-#include <pystring.h>
+#include <xxhash.h>
 
-#include <regex>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <signal.h>
+#include <unistd.h>
+#endif
 
 #include <primitives/log.h>
 DECLARE_STATIC_LOGGER(logger, "command");
@@ -51,7 +65,56 @@ DECLARE_STATIC_LOGGER(logger, "command");
 namespace sw
 {
 
-static Files process_deps_msvc(builder::Command &c)
+#ifdef __linux__
+// stopped processes cannot fork anymore, so the tree does not change while we walk it
+static void stop_children(int pid, std::vector<int> &pids)
+{
+    std::error_code ec;
+    for (auto &t : fs::directory_iterator("/proc/" + std::to_string(pid) + "/task", ec))
+    {
+        std::ifstream ifs(t.path() / "children");
+        int child;
+        while (ifs >> child)
+        {
+            if (kill(child, SIGSTOP) != 0)
+                continue;
+            pids.push_back(child);
+            stop_children(child, pids);
+        }
+    }
+}
+#endif
+
+// compiler drivers spawn their own processes (cc1plus, as, lto plugins),
+// they must go together with the parent
+static void kill_process_tree(int pid)
+{
+#ifdef _WIN32
+    // processes are not placed into job objects, so only the process itself is killed
+    if (auto h = OpenProcess(PROCESS_TERMINATE, FALSE, pid))
+    {
+        TerminateProcess(h, 1);
+        CloseHandle(h);
+    }
+#else
+    // process is a group leader, the whole group goes at once
+    if (getpgid(pid) == pid)
+    {
+        kill(-pid, SIGKILL);
+        return;
+    }
+#ifdef __linux__
+    kill(pid, SIGSTOP);
+    std::vector<int> pids;
+    stop_children(pid, pids);
+    for (auto p : pids)
+        kill(p, SIGKILL);
+#endif
+    kill(pid, SIGKILL);
+#endif
+}
+
+static PathIds process_deps_msvc(builder::Command &c)
 {
     // deps are placed into command output,
     // so we can't skip this filtering
@@ -62,30 +125,42 @@ static Files process_deps_msvc(builder::Command &c)
     if (prefix.empty())
         throw SW_RUNTIME_ERROR("msvc prefix is not set");
 
-    Files deps;
-    auto perform = [&deps, &prefix](auto &text, bool out)
+    PathIds deps;
+    auto &t = getPathTable();
+    auto perform = [&deps, &prefix, &t](auto &text, bool out)
     {
-        std::deque<String> lines;
-        boost::split(lines, text, boost::is_any_of("\n"));
-        text.clear();
-        if (out)
+        String filtered;
+        filtered.reserve(text.size());
+        std::string_view s = text;
+        // remove filename
+        bool skip = out;
+        while (1)
         {
-            // remove filename
-            lines.pop_front();
-        }
-
-        for (auto &line : lines)
-        {
-            if (line.find(prefix) != 0)
+            auto p = s.find('\n');
+            auto line = s.substr(0, p);
+            if (skip)
+                skip = false;
+            else if (line.substr(0, prefix.size()) != prefix)
             {
-                text += line + "\n";
-                continue;
+                filtered += line;
+                filtered += '\n';
+            }
+            else
+            {
+                auto include = line.substr(prefix.size());
+                while (!include.empty() && isspace((unsigned char)include.front()))
+                    include.remove_prefix(1);
+                while (!include.empty() && isspace((unsigned char)include.back()))
+                    include.remove_suffix(1);
+                //if (fs::exists(include)) // slow check? but correct?
+                if (!include.empty())
+                    deps.push_back(t.intern(path((const char8_t *)include.data(), (const char8_t *)include.data() + include.size())));
             }
-            auto include = line.substr(prefix.size());
-            boost::trim(include);
-            //if (fs::exists(include)) // slow check? but correct?
-            deps.insert(include);
+            if (p == s.npos)
+                break;
+            s.remove_prefix(p + 1);
         }
+        text = std::move(filtered);
     };
 
     // on errors msvc puts everything to stderr instead of stdout
@@ -98,7 +173,7 @@ static Files process_deps_msvc(builder::Command &c)
     return deps;
 }
 
-static Files process_deps_gnu(builder::Command &c, const path &deps_file)
+static PathIds process_deps_gnu(builder::Command &c, const path &deps_file)
 {
     if (deps_file.empty())
         return {};
@@ -108,8 +183,6 @@ static Files process_deps_gnu(builder::Command &c, const path &deps_file)
         return {};
     }
 
-    static const std::regex space_r("[^\\\\] ");
-
     // deps file is a make in form
     // target: dependencies
     // deps are split by spaces on several lines with \ at the end of each line except the last one
@@ -121,73 +194,25 @@ static Files process_deps_gnu(builder::Command &c, const path &deps_file)
     //  dep3.h \
     //  dep4.h
     //
+    // file is mapped and scanned in place, paths go directly into path table
 
-    auto f = read_file(deps_file);
-
-    // skip target
-    //  use exactly ": " because on windows target is 'C:/path/to/file: '
-    //                                           skip up to this space ^
-    f = f.substr(f.find(": ") + 1);
-
-    FilesOrdered files;
-
-    enum
+    MappedFile f(deps_file);
+    PathIds deps;
+    auto &t = getPathTable();
+    parseDepsFile(std::string_view((const char *)f.data(), f.size()), [&deps, &t](std::string_view s)
     {
-        EMPTY,
-        FILE,
-    };
-    int state = EMPTY;
-    auto p = f.c_str();
-    auto begin = p;
-    while (*p)
-    {
-        switch (state)
-        {
-        case EMPTY:
-            if (isspace(*p) || *p == '\\')
-                break;
-            state = FILE;
-            begin = p;
-            break;
-        case FILE:
-            if (!isspace(*p))
-                break;
-            if (*(p - 1) == '\\')
-                break;
-            String s(begin, p);
-            if (!s.empty())
-            {
-                boost::replace_all(s, "\\ ", " ");
-                if (pystring::endswith(s, "\\\n")) // protobuf does not put space after filename
-                    s.resize(s.size() - 2);
-                files.push_back((const char8_t *)s.c_str());
-            }
-            state = EMPTY;
-            break;
-        }
-        p++;
-    }
-
-    Files deps;
-#ifndef _WIN32
-    for (auto &f : files)
-        deps.insert(f);
-#else
-    for (auto &f2 : files)
-    {
-        auto f3 = to_path_string(normalize_path(f2));
-#ifdef CPPAN_OS_WINDOWS_NO_CYGWIN
-        static const auto cyg = u8"/cygdrive/"s;
-        if (f3.find(cyg) == 0)
+#if defined(_WIN32) && defined(CPPAN_OS_WINDOWS_NO_CYGWIN)
+        static const auto cyg = "/cygdrive/"sv;
+        if (s.substr(0, cyg.size()) == cyg && s.size() > cyg.size())
         {
-            f3 = f3.substr(cyg.size());
-            f3 = toupper(f3[0]) + u8":" + f3.substr(1);
+            s.remove_prefix(cyg.size());
+            auto f3 = String(1, (char)toupper(s[0])) + ":" + String(s.substr(1));
+            deps.push_back(t.intern((const char8_t *)f3.c_str()));
+            return;
         }
 #endif
-        //if (!fs::exists(fs::u8path(f3)))
-        deps.insert(f3);
-    }
-#endif
+        deps.push_back(t.intern(path((const char8_t *)s.data(), (const char8_t *)s.data() + s.size())));
+    });
     return deps;
 }
 
@@ -257,6 +282,8 @@ bool Command::check_if_file_newer(const path &p, const String &what, bool throw_
 
 bool Command::isOutdated() const
 {
+    SW_TRACE_ZONE("isOutdated");
+
     if (always)
     {
         if (isExplainNeeded())
@@ -271,22 +298,24 @@ bool Command::isOutdated() const
         return true;
     }
 
-    auto k = getHash();
-    auto r = command_storage->insert(k);
-    if (r.second)
+    auto k = getFullHash();
+    fs::file_time_type t;
+    PathIds ii;
+    ContentHashes ch;
+    auto content = sw::Settings::get_user_settings().check_content_hashes;
+    if (!command_storage->find((size_t)k.low, k.high, t, ii, content ? &ch : nullptr))
     {
-        // we have insertion, no previous value available
+        // no previous value available
         // so outdated
         if (isExplainNeeded())
             EXPLAIN_OUTDATED("command", true, "new command (command_storage = " + to_string(command_storage->root) + "): " + print(), getCommandId(*this));
         return true;
     }
-    else
-    {
-        ((Command*)(this))->mtime = r.first->mtime;
-        ((Command*)(this))->implicit_inputs = r.first->getImplicitInputs(command_storage->getInternalStorage());
-        return isTimeChanged();
-    }
+    ((Command*)(this))->mtime = t;
+    ((Command*)(this))->implicit_inputs = std::move(ii);
+    if (content)
+        return isContentChanged(ch);
+    return isTimeChanged();
 }
 
 bool Command::isTimeChanged() const
@@ -299,8 +328,46 @@ bool Command::isTimeChanged() const
                std::any_of(outputs.begin(), outputs.end(), [this](const auto &i) {
                    return check_if_file_newer(i, "output", false);
                }) ||
-               std::any_of(implicit_inputs.begin(), implicit_inputs.end(), [this](const auto &i) {
-                   return check_if_file_newer(i, "implicit input", true);
+               std::any_of(implicit_inputs.begin(), implicit_inputs.end(), [this](auto id) {
+                   return check_if_file_newer(getPathTable().getPath(id), "implicit input", true);
+               });
+    }
+    catch (std::exception &e)
+    {
+        String s = "Command: " + getName() + "\n";
+        s += e.what();
+        throw SW_RUNTIME_ERROR(s);
+    }
+}
+
+bool Command::isContentChanged(const ContentHashes &prev) const
+{
+    auto check = [this, &prev](const path &p, const String &what)
+    {
+        auto h = getContentHash(p);
+        auto i = prev.find(CommandStorage::getFileHash(p));
+        if (i != prev.end() && i->second == h)
+            return false;
+        if (isExplainNeeded())
+        {
+            String s = i == prev.end() ? "no previous content hash" : (h ? "content is different" : "file is missing");
+            EXPLAIN_OUTDATED("command", true, what + " changed " + to_string(p) + " (command_storage = " +
+                to_string(command_storage->root) + ") : " + s, getCommandId(*this));
+        }
+        return true;
+    };
+
+    // dependents of regenerated but identical outputs stop here (early cutoff)
+    try
+    {
+        return std::any_of(inputs.begin(), inputs.end(), [&check](const auto &i) {
+                   return check(i, "input");
+               }) ||
+               std::any_of(outputs.begin(), outputs.end(), [&check](const auto &i) {
+                   return check(i, "output");
+               }) ||
+               std::any_of(implicit_inputs.begin(), implicit_inputs.end(), [&check](auto id) {
+                   return check(getPathTable().getPath(id), "implicit input");
                });
     }
     catch (std::exception &e)
@@ -311,59 +378,117 @@ bool Command::isTimeChanged() const
     }
 }
 
+uint64_t Command::getContentHash(const path &p) const
+{
+    File f(p, getContext().getFileStorage());
+    f.isChanged();
+    return command_storage->getContentHash(p, f.getFileData());
+}
+
+namespace
+{
+
+// streaming 128-bit hash, parts are length prefixed, so ("ab", "c") != ("a", "bc")
+struct CommandHasher
+{
+    CommandHasher()
+    {
+        state = XXH3_createState();
+        if (!state)
+            throw SW_RUNTIME_ERROR("Cannot create hash state");
+        XXH3_128bits_reset(state);
+    }
+
+    CommandHasher(const CommandHasher &) = delete;
+    CommandHasher &operator=(const CommandHasher &) = delete;
+
+    ~CommandHasher()
+    {
+        XXH3_freeState(state);
+    }
+
+    void add(const void *p, size_t sz)
+    {
+        addInt(sz);
+        XXH3_128bits_update(state, p, sz);
+    }
+
+    void add(const String &s) { add(s.data(), s.size()); }
+    void add(const path &p) { add(p.native().data(), p.native().size() * sizeof(path::value_type)); }
+    void add(const CommandHash &h)
+    {
+        addInt(h.low);
+        addInt(h.high);
+    }
+
+    void addInt(uint64_t v) { XXH3_128bits_update(state, &v, sizeof(v)); }
+
+    template <class It>
+    void addArguments(It begin, It end)
+    {
+        addInt(end - begin);
+        for (auto a = begin; a != end; a++)
+            add((*a)->toString());
+    }
+
+    CommandHash digest() const
+    {
+        auto h = XXH3_128bits_digest(state);
+        return { h.low64, h.high64 };
+    }
+
+private:
+    XXH3_state_t *state;
+};
+
+}
+
 size_t Command::getHash() const
 {
-    if (hash != 0)
+    return (size_t)getFullHash().low;
+}
+
+CommandHash Command::getFullHash() const
+{
+    if (hash)
         return hash;
     return getHash1();
 }
 
-size_t Command::getHash1() const
+CommandHash Command::getHash1() const
 {
-    size_t h = 0;
-    hash_combine(h, std::hash<path>()(getProgram()));
+    CommandHasher h;
+    h.add(getProgram());
 
-    // must sort arguments first
-    // because some command may generate args in unspecified order
-    // actually no, we do not allow unspecified order anymore
-    // actually we have different deps order -> different defs, idir order, libs order
-    // FIXME: ^
-    std::set<String> args_sorted;
-    Strings sa;
-    for (auto &a : arguments)
-        args_sorted.insert(a->toString());
-    for (auto &a : args_sorted)
-        hash_combine(h, std::hash<String>()(a));
-    //for (auto &a : arguments)
-        //hash_combine(h, std::hash<String>()(a->toString()));
+    // arguments are hashed in their order,
+    // different deps order gives different defs, idirs, libs order and so different command
+    h.addArguments(arguments.begin(), arguments.end());
 
     // redirections are also considered as arguments
-    if (!in.file.empty())
-        hash_combine(h, std::hash<path>()(in.file));
-    if (!out.file.empty())
-        hash_combine(h, std::hash<path>()(out.file));
-    if (!err.file.empty())
-        hash_combine(h, std::hash<path>()(err.file));
+    h.add(in.file);
+    h.add(out.file);
+    h.add(err.file);
 
-    hash_combine(h, std::hash<path>()(working_directory));
+    h.add(working_directory);
 
     // read other env vars? some of them may have influence
+    h.addInt(environment.size());
     for (auto &[k, v] : environment)
     {
-        hash_combine(h, std::hash<String>()(k));
-        hash_combine(h, std::hash<String>()(v));
+        h.add(k);
+        h.add(v);
     }
 
     // command may depend on files not listed on the command line (dlls)?
     //for (auto &i : inputs)
         //hash_combine(h, std::hash<path>()(i));
 
-    return h;
+    return h.digest();
 }
 
-size_t Command::getHashAndSave() const
+CommandHash Command::getHashAndSave() const
 {
-    return hash = getHash();
+    return hash = getHash1();
 }
 
 void Command::clean() const
@@ -392,7 +517,7 @@ void Command::addImplicitInput(const path &p)
 {
     if (p.empty())
         return;
-    implicit_inputs.insert(p);
+    implicit_inputs.push_back(getPathTable().intern(p));
 }
 
 void Command::addImplicitInput(const Files &files)
@@ -401,6 +526,16 @@ void Command::addImplicitInput(const Files &files)
         addImplicitInput(f);
 }
 
+void Command::addImplicitInput(PathId id)
+{
+    implicit_inputs.push_back(id);
+}
+
+void Command::addImplicitInput(const PathIds &ids)
+{
+    implicit_inputs.insert(implicit_inputs.end(), ids.begin(), ids.end());
+}
+
 void Command::addOutput(const path &p)
 {
     if (p.empty())
@@ -537,6 +672,12 @@ void Command::execute0(std::error_code *ec)
         }
     }
 
+    // plan is stopped, but this command was already scheduled
+    if (terminated_.v)
+        throw SW_RUNTIME_ERROR("Interrupted: " + getName());
+
+    SW_TRACE_ZONE("command", [this] { return getName(); });
+
     SCOPE_EXIT
     {
         if (pool && executed_.v)
@@ -545,10 +686,48 @@ void Command::execute0(std::error_code *ec)
 
     if (!beforeCommand())
         return;
-    execute1(ec); // main thing
+    auto ac = getActionCache();
+    bool restored = false;
+    try
+    {
+        if (ac && ac->restore(*this))
+        {
+            restored = true;
+            printOutputs();
+        }
+        else
+            execute1(ec); // main thing
+    }
+    catch (...)
+    {
+        if (progress)
+            progress->finish(estimated_cost);
+        throw;
+    }
+    if (progress)
+        progress->finish(estimated_cost);
     if (ec && *ec)
         return;
     afterCommand();
+    if (ac && !restored)
+    {
+        try
+        {
+            ac->store(*this);
+        }
+        catch (std::exception &e)
+        {
+            LOG_WARN(logger, "Cannot store command results in action cache: " << e.what());
+        }
+    }
+}
+
+ActionCache *Command::getActionCache() const
+{
+    // chains, shared outputs and always running commands are not cached
+    if (always || !command_storage || prev || next || !simultaneous_outputs.empty())
+        return nullptr;
+    return getContext().getActionCache();
 }
 
 bool Command::beforeCommand()
@@ -568,6 +747,8 @@ bool Command::beforeCommand()
     {
         executed_ = true;
         (*current_command)++;
+        if (progress)
+            progress->skip(estimated_cost);
         return false;
     }
 
@@ -588,6 +769,8 @@ bool Command::beforeCommand()
 
 void Command::afterCommand()
 {
+    SW_TRACE_ZONE("afterCommand");
+
     // command executed successfully
 
     //if (always)
@@ -607,6 +790,11 @@ void Command::afterCommand()
         File f(i, getContext().getFileStorage());
         auto &fr = f.getFileData();
         fr.refreshed = FileData::RefreshType::Unrefreshed;
+        {
+            // contents may change without mtime change
+            std::unique_lock lk(fr.m_content_hash);
+            fr.content_hash = {};
+        }
         f.isChanged();
         if (!fs::exists(i))
         {
@@ -622,9 +810,9 @@ void Command::afterCommand()
     // sometimes, implicit input was not created before it is registered with File(fn) - configureFile() etc.
     // in this case here we have fr.last_write_time == min()
     // so, we must register this file again
-    for (auto &i : implicit_inputs)
+    for (auto id : implicit_inputs)
     {
-        File f(i, getContext().getFileStorage());
+        File f(getPathTable().getPath(id), getContext().getFileStorage());
         auto &fr = f.getFileData();
         if (fr.last_write_time == fs::file_time_type::min())
         {
@@ -642,11 +830,29 @@ void Command::afterCommand()
     // On the next run command times won't be compared with missing deps,
     // so outdated command will not be re-runned
 
-    auto k = getHash();
-    auto &r = *command_storage->insert(k).first;
-    r.hash = k;
+    auto k = getFullHash();
+    auto &r = *command_storage->insert((size_t)k.low, k.high).first;
+    r.hash = (size_t)k.low;
+    r.hash_high = k.high;
     r.mtime = mtime;
+    if (t_end > t_begin)
+        r.duration.add((double)std::chrono::duration_cast<std::chrono::nanoseconds>(t_end - t_begin).count());
+    // short commands are not measured, keep old value then
+    if (process_stats.peak_rss)
+        r.peak_memory = process_stats.peak_rss;
     r.setImplicitInputs(implicit_inputs, command_storage->getInternalStorage());
+    r.content_hashes.clear();
+    if (sw::Settings::get_user_settings().check_content_hashes)
+    {
+        for (auto *files : { &inputs, &outputs })
+        {
+            for (auto &i : *files)
+                r.content_hashes[CommandStorage::getFileHash(i)] = getContentHash(i);
+        }
+        auto &t = getPathTable();
+        for (auto id : implicit_inputs)
+            r.content_hashes[t.getHash(id)] = getContentHash(t.getPath(id));
+    }
     command_storage->async_command_log(r);
 }
 
@@ -655,6 +861,49 @@ path Command::getResponseFilename() const
     return unique_path() += ".rsp";
 }
 
+path Command::writeResponseFile(bool &temporary) const
+{
+    if (!command_storage)
+    {
+        temporary = true;
+        auto t = support::temp_directory_path() / getResponseFilename();
+        auto fn = t.filename();
+        t = t.parent_path();
+        auto rsp_file = t / getProgramName() / "rsp" / fn;
+        write_file(rsp_file, getResponseFileContents(true));
+        return rsp_file;
+    }
+
+    // content addressed: the same arguments get the same file on every run,
+    // so it is written only once
+    temporary = false;
+    auto rsp = getResponseFileContents(true);
+    auto h = XXH3_128bits(rsp.data(), rsp.size());
+    char name[64];
+    snprintf(name, sizeof(name), "%016llx%016llx.rsp", (unsigned long long)h.high64, (unsigned long long)h.low64);
+    auto rsp_file = command_storage->root / "rsp" / getProgramName() / name;
+    std::error_code ec;
+    if (fs::exists(rsp_file))
+    {
+        // files that are not used for long time are removed on command db compaction
+        fs::last_write_time(rsp_file, fs::file_time_type::clock::now(), ec);
+        return rsp_file;
+    }
+
+    // other processes may write it at the same time,
+    // they write the same contents, so the last rename wins
+    auto tmp = path(rsp_file) += "." + to_string(unique_path().u8string());
+    write_file(tmp, rsp);
+    fs::rename(tmp, rsp_file, ec);
+    if (ec)
+    {
+        fs::remove(tmp, ec);
+        if (!fs::exists(rsp_file))
+            throw SW_RUNTIME_ERROR("Cannot write response file: " + to_string(rsp_file.u8string()));
+    }
+    return rsp_file;
+}
+
 String Command::getResponseFileContents(bool showIncludes) const
 {
     String rsp;
@@ -692,6 +941,7 @@ const Command::Arguments &Command::getArguments() const
 
 void Command::execute1(std::error_code *ec)
 {
+    trace::Zone zone("run command");
     primitives::ScopedThreadName tn(": " + getName(), true);
 
     if (remove_outputs_before_execution)
@@ -707,23 +957,41 @@ void Command::execute1(std::error_code *ec)
     // Some systems have limitation on its length.
 
     path rsp_file;
+    bool temporary_rsp_file = false;
     if (needsResponseFile())
     {
-        auto t = support::temp_directory_path() / getResponseFilename();
-        auto fn = t.filename();
-        t = t.parent_path();
-        rsp_file = t / getProgramName() / "rsp" / fn;
-        write_file(rsp_file, getResponseFileContents(true));
+        rsp_file = writeResponseFile(temporary_rsp_file);
 
+        // commands of resident builds are executed many times,
+        // so these are not placed in the arena
+        rsp_args.clear();
         for (int i = 0; i < getFirstResponseFileArgument(); i++)
-            rsp_args.push_back(arguments[i]->clone());
+            rsp_args.push_back(arguments[i]->toString());
         rsp_args.push_back("@" + to_string(to_path_string(rsp_file)));
     }
 
+    // big outputs are not kept in memory, when they are not parsed
+    auto head_size = truncate_output ? 64 * 1024 : OutputCapture::unlimited;
+    OutputCapture out_capture(support::temp_directory_path() / "out", head_size);
+    OutputCapture err_capture(support::temp_directory_path() / "out", head_size);
+    setupOutputCapture(out_capture, err_capture);
+
     SCOPE_EXIT
     {
-        if (!rsp_file.empty())
+        if (temporary_rsp_file)
             fs::remove(rsp_file);
+        out.action = {};
+        err.action = {};
+    };
+
+    // full outputs are kept only for error messages
+    auto finish_capture = [this, &out_capture, &err_capture](bool failed)
+    {
+        // remote executors set texts themselves
+        if (!output_streamed)
+            return;
+        out.text = out_capture.finish(failed);
+        err.text = err_capture.finish(failed);
     };
 
     auto make_error_string = [this]()
@@ -740,11 +1008,40 @@ void Command::execute1(std::error_code *ec)
 
     LOG_TRACE(logger, print());
 
+    auto run = [this](std::error_code &ec)
+    {
+        if (executor && executor->execute(*this, ec))
+            return;
+        Base::execute(ec);
+    };
+
+    // executors store results when deps are known
+    bool succeeded = false;
+    SCOPE_EXIT
+    {
+        if (executor)
+            executor->finished(*this, succeeded);
+    };
+
+    // killed by terminate(), do not touch deps and command storage,
+    // the command will be outdated on the next run
+    auto killed = [this]()
+    {
+        if (!terminated_.v)
+            return false;
+        removePartialOutputs();
+        return true;
+    };
+
     if (ec)
     {
-        Base::execute(*ec);
+        run(*ec);
+        finish_capture((bool)*ec);
+        zone.setDetail([this] { return process_stats.toString(); });
         if (ec)
         {
+            if (killed())
+                return;
             // TODO: save error string
             make_error_string();
             return;
@@ -753,9 +1050,13 @@ void Command::execute1(std::error_code *ec)
     else
     {
         std::error_code ec;
-        Base::execute(ec);
+        run(ec);
+        finish_capture((bool)ec);
+        zone.setDetail([this] { return process_stats.toString(); });
         if (ec)
         {
+            if (killed())
+                throw SW_RUNTIME_ERROR("Interrupted: " + getName());
             auto err = make_error_string();
             throw SW_RUNTIME_ERROR(err);
         }
@@ -767,12 +1068,94 @@ void Command::execute1(std::error_code *ec)
     }
 
     postProcess(); // process deps
+    succeeded = true;
     printOutputs();
 }
 
+void Command::removePartialOutputs()
+{
+    // mtime of partially written output is newer than inputs' one,
+    // so it must be removed
+    std::error_code ec;
+    for (auto &o : outputs)
+    {
+        fs::remove(o, ec);
+        File f(o, getContext().getFileStorage());
+        f.getFileData().refreshed = FileData::RefreshType::Unrefreshed;
+    }
+    if (!deps_file.empty())
+        fs::remove(deps_file, ec);
+}
+
+void Command::setupOutputCapture(OutputCapture &out_capture, OutputCapture &err_capture)
+{
+    output_streamed = false;
+    output_printed = false;
+    streamed_deps.clear();
+
+    if (deps_processor == DepsProcessor::Msvc)
+    {
+        if (msvc_prefix.empty())
+            throw SW_RUNTIME_ERROR("msvc prefix is not set");
+        auto filter = [this](std::string_view line)
+        {
+            if (line.substr(0, msvc_prefix.size()) != msvc_prefix)
+                return true;
+            auto include = line.substr(msvc_prefix.size());
+            while (!include.empty() && isspace((unsigned char)include.front()))
+                include.remove_prefix(1);
+            while (!include.empty() && isspace((unsigned char)include.back()))
+                include.remove_suffix(1);
+            if (!include.empty())
+                streamed_deps.push_back(getPathTable().intern(path((const char8_t *)include.data(), (const char8_t *)include.data() + include.size())));
+            return false;
+        };
+        // remove filename
+        out_capture.filter = [filter, first = true](std::string_view line) mutable
+        {
+            if (!first)
+                return filter(line);
+            first = false;
+            return false;
+        };
+        err_capture.filter = filter;
+    }
+
+    // lines of one command go in order, but they may interleave with other commands' lines
+    if (show_output && !write_output_to_file)
+    {
+        auto print = [this](std::string_view line)
+        {
+            if (!output_printed)
+            {
+                output_printed = true;
+                LOG_INFO(logger, log_string);
+            }
+            if (!line.empty() && line.back() == '\r')
+                line.remove_suffix(1);
+            LOG_INFO(logger, String(line));
+        };
+        out_capture.on_line = print;
+        err_capture.on_line = print;
+    }
+
+    auto stream = [this](Stream &s, OutputCapture &c)
+    {
+        s.action = [this, &s, &c](const String &chunk, bool)
+        {
+            output_streamed = true;
+            c.add(chunk);
+            // keep memory bounded if chunks are appended to text too
+            s.text.clear();
+        };
+    };
+    stream(out, out_capture);
+    stream(err, err_capture);
+}
+
 void Command::printOutputs()
 {
-    if (!show_output)
+    if (!show_output || output_printed)
         return;
     boost::trim(out.text);
     boost::trim(err.text);
@@ -1053,8 +1436,12 @@ void Command::postProcess(bool ok)
     switch (deps_processor)
     {
     case DepsProcessor::Msvc:
-        // process anyway to filter out deps
-        addImplicitInput(process_deps_msvc(*this));
+        // streamed outputs are filtered already
+        if (output_streamed)
+            addImplicitInput(streamed_deps);
+        else
+            // process anyway to filter out deps
+            addImplicitInput(process_deps_msvc(*this));
         break;
     case DepsProcessor::Gnu:
         if (ok)
@@ -1071,10 +1458,61 @@ void Command::postProcess(bool ok)
     default:
         break;
     }
+
+    // several processors or repeated lines may give the same file twice
+    std::sort(implicit_inputs.begin(), implicit_inputs.end());
+    implicit_inputs.erase(std::unique(implicit_inputs.begin(), implicit_inputs.end()), implicit_inputs.end());
 }
 
+#ifdef __linux__
+// execve() limits: arguments and environment with their pointers must fit into ARG_MAX,
+// every single string into MAX_ARG_STRLEN
+static bool fits_into_execve(const Command &c)
+{
+    static constexpr size_t max_arg_strlen = 32 * 4096;
+    static const size_t arg_max = []() -> size_t
+    {
+        auto m = sysconf(_SC_ARG_MAX);
+        if (m <= 0)
+            return 128 * 1024; // old fixed limit
+        // our environment is inherited
+        size_t env = 0;
+        for (auto e = environ; e && *e; e++)
+            env += strlen(*e) + 1 + sizeof(char *);
+        // and some space for aux vector and alignment
+        return (size_t)m > env + 4096 ? m - env - 4096 : 0;
+    }();
+
+    size_t sz = 0;
+    auto add = [&sz](size_t n)
+    {
+        sz += n + 1 + sizeof(char *);
+        return n < max_arg_strlen;
+    };
+    if (!add(c.getProgram().native().size()))
+        return false;
+    for (auto &a : c.arguments)
+    {
+        if (!add(a->toString().size()))
+            return false;
+    }
+    for (auto &[k, v] : c.environment)
+    {
+        if (!add(k.size() + 1 + v.size()))
+            return false;
+    }
+    return sz <= arg_max;
+}
+#endif
+
 bool Command::needsResponseFile() const
 {
+#ifdef __linux__
+    // real limits are known here
+    if (!use_response_files)
+        return !fits_into_execve(*this);
+#endif
+
     // we do not use system(), so we really do not care when using exec*
     // we care on windows where CreateProcess has limit of 32K in total
 
@@ -1131,6 +1569,15 @@ String Command::getName() const
     return s;
 }
 
+static String format_time_left(std::chrono::nanoseconds d)
+{
+    auto s = std::chrono::duration_cast<std::chrono::seconds>(d).count();
+    auto two = [](auto v) { return (v < 10 ? "0" : "") + std::to_string(v); };
+    if (s >= 3600)
+        return std::to_string(s / 3600) + ":" + two(s / 60 % 60) + ":" + two(s % 60);
+    return std::to_string(s / 60) + ":" + two(s % 60);
+}
+
 void Command::printLog() const
 {
     if (silent)
@@ -1138,9 +1585,12 @@ void Command::printLog() const
     static Executor eprinter(1);
     if (current_command)
     {
-        eprinter.push([c = std::static_pointer_cast<const Command>(shared_from_this())]
+        String eta;
+        if (progress && progress->remaining)
+            eta = ", ETA " + format_time_left(progress->getTimeLeft());
+        eprinter.push([c = std::static_pointer_cast<const Command>(shared_from_this()), eta]
         {
-            c->log_string = "[" + std::to_string((*c->current_command)++) + "/" + std::to_string(c->total_commands->load()) + "] " + c->getName();
+            c->log_string = "[" + std::to_string((*c->current_command)++) + "/" + std::to_string(c->total_commands->load()) + eta + "] " + c->getName();
 
             // we cannot use this one because we must sync with printOutputs() call, both must use the same logger or (synced)stdout
             //std::cout << "\r" << log_string;
@@ -1203,15 +1653,66 @@ bool Command::lessDuringExecution(const CommandNode &in) const
     return dependent_commands.size() > dependent_commands.size();
 }
 
+std::chrono::nanoseconds Command::getEstimatedDuration() const
+{
+    if (!command_storage)
+        return {};
+    auto d = command_storage->getDuration(getHash());
+    if (!d)
+        return {};
+    return std::chrono::nanoseconds((int64_t)d->mean);
+}
+
+uint64_t Command::getEstimatedMemory() const
+{
+    if (memory_estimate || !command_storage)
+        return memory_estimate;
+    return command_storage->getPeakMemory(getHash());
+}
+
+void Command::resetExecution()
+{
+    executed_ = false;
+    terminated_ = false;
+    running_ = false;
+    t_begin = {};
+    t_end = {};
+    process_stats = {};
+    pid = -1;
+    exit_code.reset();
+    out.text.clear();
+    err.text.clear();
+    rsp_args.clear();
+    mtime = fs::file_time_type::min();
+}
+
 void Command::onBeforeRun() noexcept
 {
     tid = std::this_thread::get_id();
     t_begin = Clock::now();
+    running_ = true;
+    process_stats = {};
+    if (swctx)
+        swctx->getProcessMonitor().add(*this);
 }
 
 void Command::onEnd() noexcept
 {
     t_end = Clock::now();
+    running_ = false;
+    if (swctx)
+        swctx->getProcessMonitor().remove(*this);
+}
+
+void Command::terminate()
+{
+    terminated_ = true;
+    if (!running_.v)
+        return;
+    // pid is not set yet when we are between onBeforeRun() and spawn,
+    // such process is not killed and runs to the end
+    if (auto p = getPid(); p > 0)
+        kill_process_tree(p);
 }
 
 Command &Command::operator|(Command &c2)
@@ -1233,6 +1734,14 @@ const SwBuilderContext &Command::getContext() const
     return *swctx;
 }
 
+void Command::push_back(const String &s)
+{
+    if (swctx)
+        arguments.push_back(ArenaArgument::create(swctx->getCommandArena(), s));
+    else
+        Base::push_back(s);
+}
+
 void Command::setContext(const SwBuilderContext &in)
 {
     if (swctx && swctx != &in)
@@ -1254,12 +1763,20 @@ void CommandSequence::execute1(std::error_code *ec)
     }
 }
 
-size_t CommandSequence::getHash1() const
+void CommandSequence::terminate()
 {
-    size_t h = 0;
+    Command::terminate();
     for (auto &c : commands)
-        hash_combine(h, c->getHash());
-    return h;
+        c->terminate();
+}
+
+CommandHash CommandSequence::getHash1() const
+{
+    CommandHasher h;
+    h.addInt(commands.size());
+    for (auto &c : commands)
+        h.add(c->getFullHash());
+    return h.digest();
 }
 
 void CommandSequence::prepare()
@@ -1326,7 +1843,7 @@ void BuiltinCommand::execute1(std::error_code *ec)
         Strings{ sa.begin() + start + 3, sa.end() });
 }
 
-size_t BuiltinCommand::getHash1() const
+CommandHash BuiltinCommand::getHash1() const
 {
     // we have args:
     // 0: prog
@@ -1335,21 +1852,11 @@ size_t BuiltinCommand::getHash1() const
     // 3: function name
     // 4: version
 
-    size_t h = 0;
-
-    // must sort arguments first
-    // because some command may generate args in unspecified order
-    std::set<String> args_sorted;
-
     // we ignore args 0-2 inclusive, so our start arg is 3
     auto start = 3;
-    for (auto a = arguments.begin() + start; a != arguments.end(); a++)
-        args_sorted.insert((*a)->toString());
-
-    for (auto &a : args_sorted)
-        hash_combine(h, std::hash<String>()(a));
-
-    return h;
+    CommandHasher h;
+    h.addArguments(arguments.begin() + start, arguments.end());
+    return h.digest();
 }
 
 String getInternalCallBuiltinFunctionName()
@@ -20,9 +20,13 @@
 
 #include "command_node.h"
 #include "node.h"
+#include "output_capture.h"
+#include "path_table.h"
+#include "process_monitor.h"
 
 #include <primitives/command.h>
 
+#include <atomic>
 #include <condition_variable>
 #include <mutex>
 
@@ -32,6 +36,7 @@ namespace sw
 struct Program;
 struct SwBuilderContext;
 struct CommandStorage;
+struct ActionCache;
 
 struct SW_BUILDER_API ResourcePool
 {
@@ -88,12 +93,25 @@ struct SW_BUILDER_API ResolvableCommand : ::primitives::Command
 
 }
 
+/// 128-bit command hash, low half is used as command key
+struct CommandHash
+{
+    uint64_t low = 0;
+    uint64_t high = 0;
+
+    bool operator==(const CommandHash &) const = default;
+    explicit operator bool() const { return low || high; }
+};
+
 struct SW_BUILDER_API Command : ICastable, CommandNode, detail::ResolvableCommand // hide?
 {
     using Base = detail::ResolvableCommand;
     using Clock = std::chrono::high_resolution_clock;
     using ImplicitDependenciesProcessor = std::function<Files(Command &)>;
 
+    /// bump when hashed contents or algorithm change, command db is keyed by it
+    static constexpr int hash_version = 1;
+
     enum class DepsProcessor
     {
         Undefined,
@@ -120,8 +138,8 @@ public:
     // then these files are inputs to other programs, so those programs must wait for all
     // commands that write to such files
     Files simultaneous_outputs;
-    //
-    Files implicit_inputs;
+    // interned, use getPathTable() to get paths
+    PathIds implicit_inputs;
 
     // additional create dirs
     Files output_dirs;
@@ -136,8 +154,17 @@ public:
     bool silent = false; // no log record
     bool show_output = false; // no command output
     bool write_output_to_file = false;
+    // keep only head and tail of big outputs in out/err texts,
+    // for commands whose outputs are read by humans only
+    bool truncate_output = false;
     int strict_order = 0; // used to execute this before other commands
     std::shared_ptr<ResourcePool> pool;
+    // weights for execution plan budgets
+    uint64_t memory_estimate = 0; // bytes, learned from previous runs when zero
+    int thread_count = 1; // e.g., lto jobs
+
+    // filled by process monitor during execution
+    ProcessStats process_stats;
 
     std::thread::id tid;
     Clock::time_point t_begin;
@@ -166,21 +193,33 @@ public:
     void execute(std::error_code &ec) override;
     void clean() const;
     bool isExecuted() const { return pid != -1 || executed_.v; }
+    /// pid is written by primitives::Command after spawn, read it from other threads with this
+    int getPid() const { return std::atomic_ref(const_cast<int &>(pid)).load(std::memory_order_relaxed); }
+    /// kills running process with all its children, thread safe
+    void terminate() override;
+    bool isTerminated() const { return terminated_.v; }
 
     String getName() const override;
     size_t getHash() const override;
+    CommandHash getFullHash() const;
 
     virtual bool isOutdated() const;
+    /// returns 0 for missing files
+    uint64_t getContentHash(const path &) const;
     bool needsResponseFile() const;
     bool needsResponseFile(size_t sz) const;
 
     using Base::push_back;
+    /// argument is placed in the context arena when context is set
+    void push_back(const String &);
     using Base::setProgram;
     //void setProgram(std::shared_ptr<Program> p);
     void addInput(const path &p);
     void addInput(const Files &p);
     void addImplicitInput(const path &p);
     void addImplicitInput(const Files &p);
+    void addImplicitInput(PathId);
+    void addImplicitInput(const PathIds &);
     void addOutput(const path &p);
     void addOutput(const Files &p);
     path redirectStdin(const path &p);
@@ -190,6 +229,10 @@ public:
     path writeCommand(const path &basename, bool print_name = true) const;
 
     bool lessDuringExecution(const CommandNode &rhs) const override;
+    std::chrono::nanoseconds getEstimatedDuration() const override;
+    uint64_t getEstimatedMemory() const override;
+    int getNumberOfThreads() const override { return thread_count; }
+    void resetExecution() override;
 
     void onBeforeRun() noexcept override;
     void onEnd() noexcept override;
@@ -221,29 +264,42 @@ protected:
         //operator const T &() const { return v; }
     };
     simple_atomic<std::atomic_bool> executed_{ false };
+    simple_atomic<std::atomic_bool> terminated_{ false };
+    // process is started and not yet finished
+    simple_atomic<std::atomic_bool> running_{ false };
 
     virtual bool check_if_file_newer(const path &, const String &what, bool throw_on_missing) const;
 
 private:
     const SwBuilderContext *swctx = nullptr;
-    mutable size_t hash = 0;
+    mutable CommandHash hash;
     Arguments rsp_args;
     mutable String log_string;
+    // outputs were passed through OutputCapture
+    bool output_streamed = false;
+    bool output_printed = false;
+    // msvc includes filtered out of streamed output
+    PathIds streamed_deps;
 
     void execute0(std::error_code *ec);
+    path writeResponseFile(bool &temporary) const;
+    void setupOutputCapture(OutputCapture &out, OutputCapture &err);
     virtual void execute1(std::error_code *ec = nullptr);
-    virtual size_t getHash1() const;
+    virtual CommandHash getHash1() const;
 
     void postProcess(bool ok = true);
     bool beforeCommand();
     void afterCommand();
     bool isTimeChanged() const;
+    bool isContentChanged(const std::unordered_map<size_t, uint64_t> &) const;
+    ActionCache *getActionCache() const;
     void printLog() const;
-    size_t getHashAndSave() const;
+    CommandHash getHashAndSave() const;
     String makeErrorString();
     String makeErrorString(const String &e);
     String saveCommand() const;
     void printOutputs();
+    void removePartialOutputs();
 };
 
 struct SW_BUILDER_API CommandSequence : Command
@@ -262,11 +318,13 @@ struct SW_BUILDER_API CommandSequence : Command
 
     const std::vector<std::shared_ptr<Command>> &getCommands() { return commands; }
 
+    void terminate() override;
+
 private:
     std::vector<std::shared_ptr<Command>> commands;
 
     void execute1(std::error_code *ec = nullptr) override;
-    size_t getHash1() const override;
+    CommandHash getHash1() const override;
     void prepare() override;
 };
 
@@ -287,7 +345,7 @@ struct SW_BUILDER_API BuiltinCommand : Command
 
 private:
     void execute1(std::error_code *ec = nullptr) override;
-    size_t getHash1() const override;
+    CommandHash getHash1() const override;
     void prepare() override {}
 
 #ifdef BOOST_SERIALIZATION_ACCESS_HPP
@@ -0,0 +1,142 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "command_arena.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// thread chunk, bigger objects are allocated from the shared resource directly
+#define CHUNK_SIZE (16 * 1024)
+
+namespace sw
+{
+
+static std::atomic_uint64_t next_arena_id;
+
+CommandArena *CommandArena::create()
+{
+    return new CommandArena;
+}
+
+CommandArena::CommandArena()
+    : id(++next_arena_id), r(64 * 1024)
+{
+}
+
+CommandArena::~CommandArena()
+{
+}
+
+void CommandArena::release()
+{
+    if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        delete this;
+}
+
+void *CommandArena::allocateShared(size_t sz, size_t align)
+{
+    std::unique_lock lk(m);
+    used += sz;
+    return r.allocate(sz, align);
+}
+
+void *CommandArena::allocate(size_t sz, size_t align)
+{
+    if (sz > CHUNK_SIZE / 4)
+        return allocateShared(sz, align);
+
+    thread_local struct
+    {
+        uint64_t arena_id = 0;
+        uintptr_t p = 0;
+        uintptr_t end = 0;
+    } chunk;
+    auto p = (chunk.p + align - 1) & ~(uintptr_t)(align - 1);
+    if (chunk.arena_id != id || p + sz > chunk.end)
+    {
+        // the rest of the old chunk is wasted
+        chunk.arena_id = id;
+        chunk.p = (uintptr_t)allocateShared(CHUNK_SIZE, alignof(std::max_align_t));
+        chunk.end = chunk.p + CHUNK_SIZE;
+        p = (chunk.p + align - 1) & ~(uintptr_t)(align - 1);
+    }
+    chunk.p = p + sz;
+    return (void *)p;
+}
+
+std::string_view CommandArena::copy(std::string_view s)
+{
+    if (s.empty())
+        return {};
+    auto p = (char *)allocate(s.size(), 1);
+    memcpy(p, s.data(), s.size());
+    return { p, s.size() };
+}
+
+std::unique_ptr<::primitives::command::Argument> ArenaArgument::create(CommandArena &a, std::string_view s)
+{
+    return std::unique_ptr<::primitives::command::Argument>(new (a) ArenaArgument(a, a.copy(s)));
+}
+
+ArenaArgument::ArenaArgument(CommandArena &arena, std::string_view text)
+    : arena(arena), text(text)
+{
+}
+
+// arena pointer is kept before the object, so it is available after destruction
+static constexpr size_t arena_header_size = alignof(std::max_align_t);
+
+void *ArenaArgument::operator new(size_t sz, CommandArena &a)
+{
+    static_assert(alignof(ArenaArgument) <= arena_header_size);
+    auto p = (char *)a.allocate(arena_header_size + sz, arena_header_size);
+    *(CommandArena **)p = &a;
+    a.addRef();
+    return p + arena_header_size;
+}
+
+void ArenaArgument::operator delete(void *p)
+{
+    // may free the memory, so nothing is touched afterwards
+    (*(CommandArena **)((char *)p - arena_header_size))->release();
+}
+
+void ArenaArgument::operator delete(void *p, CommandArena &)
+{
+    operator delete(p);
+}
+
+String ArenaArgument::toString() const
+{
+    return String(text);
+}
+
+String ArenaArgument::quote(::primitives::command::QuoteType t) const
+{
+    // rare, used for response files and printing
+    return ::primitives::command::SimpleArgument(toString()).quote(t);
+}
+
+std::unique_ptr<::primitives::command::Argument> ArenaArgument::clone() const
+{
+    return std::unique_ptr<::primitives::command::Argument>(new (arena) ArenaArgument(arena, text));
+}
+
+}
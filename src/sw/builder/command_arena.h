@@ -0,0 +1,92 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <primitives/command.h>
+
+#include <atomic>
+#include <memory_resource>
+#include <mutex>
+#include <string_view>
+
+namespace sw
+{
+
+/// Per build memory for command arguments.
+///
+/// Allocations are never freed one by one, everything is released at once
+/// when the owner (build context) and all objects placed here are gone.
+///
+/// Threads take chunks from the shared resource and allocate from them without locking.
+struct SW_BUILDER_API CommandArena
+{
+    /// returns arena with one reference
+    static CommandArena *create();
+
+    CommandArena(const CommandArena &) = delete;
+    CommandArena &operator=(const CommandArena &) = delete;
+
+    void addRef() { refs.fetch_add(1, std::memory_order_relaxed); }
+    void release();
+
+    void *allocate(size_t sz, size_t align);
+    std::string_view copy(std::string_view);
+
+    /// bytes taken from the shared resource: thread chunks and big objects,
+    /// unused tails of chunks and allocator overhead are included
+    size_t getMemoryUsage() const { return used; }
+
+private:
+    // identifies arena in thread chunks, addresses may be reused
+    const uint64_t id;
+    std::atomic_size_t refs{ 1 };
+    std::mutex m;
+    std::pmr::monotonic_buffer_resource r;
+    std::atomic_size_t used{ 0 };
+
+    void *allocateShared(size_t sz, size_t align);
+
+    CommandArena();
+    ~CommandArena();
+};
+
+/// Argument with object and text placed in command arena.
+/// Every object keeps arena alive, clones share the text.
+struct SW_BUILDER_API ArenaArgument : ::primitives::command::Argument
+{
+    static std::unique_ptr<::primitives::command::Argument> create(CommandArena &, std::string_view);
+
+    String toString() const override;
+    String quote(::primitives::command::QuoteType = ::primitives::command::QuoteType::Simple) const override;
+    std::unique_ptr<::primitives::command::Argument> clone() const override;
+
+    // memory belongs to arena, only its reference is dropped
+    static void operator delete(void *);
+
+private:
+    CommandArena &arena;
+    std::string_view text;
+
+    ArenaArgument(CommandArena &, std::string_view);
+
+    static void *operator new(size_t, CommandArena &);
+    static void operator delete(void *, CommandArena &);
+};
+
+}
@@ -1,6 +1,6 @@
 /*
  * SW - Build System and Package Manager
- * Copyright (C) 2017-2020 Egor Pugin
+ * Copyright (C) 2020 Egor Pugin
  *
  * This program is free software: you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
@@ -16,30 +16,33 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
-#include "concurrent_map.h"
+#pragma once
+
+#include <system_error>
 
 namespace sw
 {
 
-SW_DEFINE_GLOBAL_STATIC_FUNCTION(ConcurrentContext, getConcurrentContext)
+namespace builder
+{
 
-ConcurrentContext createConcurrentContext()
-{
-    return junction::DefaultQSBR.createContext();
-}
+struct Command;
 
-void destroyConcurrentContext(ConcurrentContext ctx)
-{
-    junction::DefaultQSBR.destroyContext(ctx);
 }
 
-void updateConcurrentContext()
-{
-    // Update the QSBR context for this thread.
-    // In a larger application, this should be called periodically, for each thread, at a moment
-    // when the thread is quiescent  that is, not in the middle of any operation that uses a
-    // Junction data structure.
-    junction::DefaultQSBR.update(getConcurrentContext());
-}
+/// Backend of execution plan that runs commands instead of local processes,
+/// e.g. on remote workers.
+struct SW_BUILDER_API CommandExecutor
+{
+    virtual ~CommandExecutor() = default;
+
+    /// Fills outputs, out/err streams and exit code like local execution does.
+    /// Returns false if command must be executed locally.
+    virtual bool execute(builder::Command &, std::error_code &) = 0;
+
+    /// Called at the end of every command execution, when implicit inputs are processed.
+    /// ok = false on failures and interruptions.
+    virtual void finished(builder::Command &, bool ok) {}
+};
 
 }
@@ -18,6 +18,9 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <string>
 #include <unordered_set>
@@ -25,6 +28,39 @@
 namespace sw
 {
 
+struct CommandExecutor;
+
+// shared between commands of single execution
+struct ExecutionProgress
+{
+    using Clock = std::chrono::steady_clock;
+
+    Clock::time_point start = Clock::now();
+    size_t jobs = 1;
+    // sums of estimated command durations, ns
+    std::atomic_uint64_t remaining{ 0 };
+    std::atomic_uint64_t done{ 0 };
+
+    // up-to-date commands are not real work
+    void skip(uint64_t cost) { remaining -= cost; }
+    void finish(uint64_t cost)
+    {
+        remaining -= cost;
+        done += cost;
+    }
+
+    std::chrono::nanoseconds getTimeLeft() const
+    {
+        auto r = remaining.load();
+        auto d = done.load();
+        if (!d)
+            return std::chrono::nanoseconds(r / std::max<size_t>(jobs, 1));
+        // calibrate estimates by real speed observed so far (including parallelism)
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start);
+        return std::chrono::nanoseconds((int64_t)(elapsed.count() * ((double)r / d)));
+    }
+};
+
 struct SW_BUILDER_API CommandNode : std::enable_shared_from_this<CommandNode>
 {
     using Ptr = CommandNode*;
@@ -39,6 +75,9 @@ public:
 
     std::atomic_size_t *current_command = nullptr;
     std::atomic_size_t *total_commands = nullptr;
+    ExecutionProgress *progress = nullptr;
+    uint64_t estimated_cost = 0; // ns, set by execution plan
+    CommandExecutor *executor = nullptr; // set by execution plan, null for local execution
 
     CommandNode();
     CommandNode(const CommandNode &);
@@ -51,6 +90,16 @@ public:
     virtual void prepare() = 0; // some internal preparations, command may not be executed still
     //virtual void markForExecution() {} // not command can be sure, it will be executed
     virtual bool lessDuringExecution(const CommandNode &) const = 0;
+    // expected execution time, zero when unknown
+    virtual std::chrono::nanoseconds getEstimatedDuration() const { return {}; }
+    // expected peak memory, bytes, zero when unknown
+    virtual uint64_t getEstimatedMemory() const { return 0; }
+    // cpu threads taken during execution
+    virtual int getNumberOfThreads() const { return 1; }
+    // forget results of previous execution, so the same node can run again
+    virtual void resetExecution() {}
+    // kill running execution and do not start a new one, called from other threads
+    virtual void terminate() {}
 
     void addDependency(CommandNode &);
     //void addDependency(const std::shared_ptr<CommandNode> &);
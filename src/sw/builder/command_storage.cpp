@@ -18,10 +18,11 @@
 
 #include "command_storage.h"
 
+#include "command.h"
+
 #include "file_storage.h"
 #include "sw_context.h"
 
-#include <boost/thread/lock_types.hpp>
 #include <primitives/emitter.h>
 #include <primitives/executor.h>
 #include <primitives/date_time.h>
@@ -33,7 +34,10 @@
 #include <primitives/log.h>
 DECLARE_STATIC_LOGGER(logger, "db_file");
 
-#define COMMAND_DB_FORMAT_VERSION 8
+#define COMMAND_DB_FORMAT_VERSION 14
+
+// response files not used for this long are removed on compaction
+#define RSP_FILE_MAX_AGE std::chrono::hours(24 * 30)
 
 namespace sw
 {
@@ -53,15 +57,36 @@ static path getDir(const path &root)
     return root / "db";
 }
 
+static path getDbDir(const path &root)
+{
+    // records are keyed by command hashes, so new hash gives new db
+    return getDir(root) / (std::to_string(COMMAND_DB_FORMAT_VERSION) + "." + std::to_string(builder::Command::hash_version));
+}
+
 static path getCommandsDbFilename(const path &root)
 {
-    return getDir(root) / std::to_string(COMMAND_DB_FORMAT_VERSION) / "commands.bin";
+    return getDbDir(root) / "commands";
+}
+
+static path getFilesDbFilename(const path &root)
+{
+    return getDbDir(root) / "files";
+}
+
+static path getHashesDbFilename(const path &root)
+{
+    return getDbDir(root) / "hashes";
+}
+
+static path getDbLockFilename(const path &root)
+{
+    return getDbDir(root) / "db";
 }
 
 static path getCommandsLogFileName(const path &root)
 {
     auto cfg = shorten_hash(blake2b_512(getCurrentModuleNameHash()), 12);
-    return getDir(root) / std::to_string(COMMAND_DB_FORMAT_VERSION) / ("cmd_log_" + cfg + ".bin");
+    return getDbDir(root) / ("cmd_log_" + cfg + ".bin");
 }
 
 template <class T>
@@ -81,41 +106,116 @@ static void write_str(std::vector<uint8_t> &vec, const String &val)
     memcpy(&vec[vsz], &val[0], sz);
 }
 
-Files CommandRecord::getImplicitInputs(detail::Storage &s) const
+namespace
 {
-    Files files;
-    for (auto &h : implicit_inputs)
+
+// command record as written by FileDb::write(), read in place from the mapped db
+struct CommandRecordView
+{
+    static constexpr size_t hash_high_offset = sizeof(size_t);
+    static constexpr size_t mtime_offset = hash_high_offset + sizeof(uint64_t);
+    static constexpr size_t duration_offset = mtime_offset + sizeof(fs::file_time_type);
+    static constexpr size_t peak_memory_offset = duration_offset + sizeof(double) * 2 + sizeof(uint32_t);
+    static constexpr size_t n_offset = peak_memory_offset + sizeof(uint64_t);
+    static constexpr size_t implicit_inputs_offset = n_offset + sizeof(size_t);
+
+    std::string_view data;
+
+    bool valid() const
     {
-        boost::upgrade_lock lk(s.m_file_storage_by_hash);
-        auto i = s.file_storage_by_hash.find(h);
-        if (i == s.file_storage_by_hash.end())
-            throw SW_RUNTIME_ERROR("no such file");
-        auto p = i->second;
-        lk.unlock();
-        if (!p.empty())
-            files.insert(p);
+        return data.size() >= implicit_inputs_offset + sizeof(size_t) &&
+            getNumberOfImplicitInputs() <= data.size() / sizeof(size_t) &&
+            data.size() >= getContentHashesOffset() &&
+            data.size() == getContentHashesOffset() + getNumberOfContentHashes() * (sizeof(size_t) + sizeof(uint64_t));
     }
-    return files;
+
+    uint64_t getHashHigh() const { return read<uint64_t>(hash_high_offset); }
+    fs::file_time_type getMtime() const { return read<fs::file_time_type>(mtime_offset); }
+
+    CommandDuration getDuration() const
+    {
+        CommandDuration d;
+        d.mean = read<double>(duration_offset);
+        d.variance = read<double>(duration_offset + sizeof(double));
+        d.n = read<uint32_t>(duration_offset + sizeof(double) * 2);
+        return d;
+    }
+
+    uint64_t getPeakMemory() const { return read<uint64_t>(peak_memory_offset); }
+
+    size_t getNumberOfImplicitInputs() const { return read<size_t>(n_offset); }
+    size_t getImplicitInput(size_t i) const { return read<size_t>(implicit_inputs_offset + i * sizeof(size_t)); }
+
+    size_t getNumberOfContentHashes() const { return read<size_t>(getContentHashesOffset() - sizeof(size_t)); }
+    std::pair<size_t, uint64_t> getContentHash(size_t i) const
+    {
+        auto o = getContentHashesOffset() + i * (sizeof(size_t) + sizeof(uint64_t));
+        return { read<size_t>(o), read<uint64_t>(o + sizeof(size_t)) };
+    }
+
+    void getContentHashes(ContentHashes &hashes) const
+    {
+        hashes.clear();
+        for (size_t i = 0, n = getNumberOfContentHashes(); i < n; i++)
+            hashes.insert(getContentHash(i));
+    }
+
+private:
+    size_t getContentHashesOffset() const
+    {
+        return implicit_inputs_offset + getNumberOfImplicitInputs() * sizeof(size_t) + sizeof(size_t);
+    }
+
+    template <class T>
+    T read(size_t offset) const
+    {
+        T v;
+        memcpy(&v, data.data() + offset, sizeof(v));
+        return v;
+    }
+};
+
 }
 
-void CommandRecord::setImplicitInputs(const Files &files, detail::Storage &s)
+void CommandDuration::add(double x)
 {
-    implicit_inputs.clear(); // clear first!
+    // incremental exponentially weighted mean and variance,
+    // equals to plain mean and variance while n <= window
+    n = std::min(n + 1, window);
+    auto alpha = 1.0 / n;
+    auto delta = x - mean;
+    mean += alpha * delta;
+    variance = (1 - alpha) * (variance + alpha * delta * delta);
+}
 
-    for (auto &f : files)
+std::optional<PathId> detail::Storage::getFile(size_t h) const
+{
     {
-        auto str = normalize_path(f);
-        auto h = std::hash<path>()(str);
-        implicit_inputs.insert(h);
-
-        boost::upgrade_lock lk(s.m_file_storage_by_hash);
-        auto i = s.file_storage_by_hash.find(h);
-        if (i == s.file_storage_by_hash.end())
-        {
-            boost::upgrade_to_unique_lock lk2(lk);
-            s.file_storage_by_hash[h] = str;
-        }
+        std::shared_lock lk(m_ids);
+        auto i = ids_by_hash.find(h);
+        if (i != ids_by_hash.end())
+            return i->second;
     }
+    if (!files_db)
+        return {};
+    auto v = files_db->find(h);
+    if (!v)
+        return {};
+    // db keeps normalized paths
+    auto id = getPathTable().internNormalized(path((const char8_t *)v->data(), (const char8_t *)v->data() + v->size()));
+    std::unique_lock lk(m_ids);
+    ids_by_hash.emplace(h, id);
+    return id;
+}
+
+void CommandRecord::setImplicitInputs(const PathIds &files, detail::Storage &s)
+{
+    implicit_inputs = files;
+
+    auto &t = getPathTable();
+    std::unique_lock lk(s.m_ids);
+    for (auto id : files)
+        s.ids_by_hash.emplace(t.getHash(id), id);
 }
 
 FileDb::FileDb(const SwBuilderContext &swctx)
@@ -136,19 +236,25 @@ void FileDb::write(std::vector<uint8_t> &v, const CommandRecord &f, const detail
         //throw SW_RUNTIME_ERROR("x");
 
     write_int(v, f.hash);
+    write_int(v, f.hash_high);
     write_int(v, f.mtime);
+    write_int(v, f.duration.mean);
+    write_int(v, f.duration.variance);
+    write_int(v, f.duration.n);
+    write_int(v, f.peak_memory);
 
+    // hashes are already taken from normalized paths
     auto n = f.implicit_inputs.size();
     write_int(v, n);
-    for (auto &h : f.implicit_inputs)
+    for (auto id : f.implicit_inputs)
+        write_int(v, getPathTable().getHash(id));
+
+    n = f.content_hashes.size();
+    write_int(v, n);
+    for (auto &[k, h] : f.content_hashes)
     {
-        boost::upgrade_lock lk(s.m_file_storage_by_hash);
-        auto i = s.file_storage_by_hash.find(h);
-        if (i == s.file_storage_by_hash.end())
-            throw SW_RUNTIME_ERROR("no such file");
-        auto p = i->second;
-        lk.unlock();
-        write_int(v, file_hash(normalize_path(p)));
+        write_int(v, k);
+        write_int(v, h);
     }
 }
 
@@ -157,7 +263,8 @@ static String getFilesSuffix()
     return ".files";
 }
 
-static void load(const path &fn, Files &files, std::unordered_map<size_t, path> &files2, ConcurrentCommandStorage &commands)
+// replays logs left by crashed or killed processes
+static void loadLog(const path &fn, detail::Storage &s)
 {
     // files
     auto fn_with_suffix = path(fn) += getFilesSuffix();
@@ -179,12 +286,10 @@ static void load(const path &fn, Files &files, std::unordered_map<size_t, path>
                 continue;
 
             // file
-            String s;
-            b.read(s);
-            path p = (const char8_t *)s.c_str();
-            files.insert(p);
-
-            files2[file_hash(p)] = p;
+            String str;
+            b.read(str);
+            auto id = getPathTable().internNormalized((const char8_t *)str.c_str());
+            s.ids_by_hash[getPathTable().getHash(id)] = id;
         }
     }
 
@@ -210,82 +315,145 @@ static void load(const path &fn, Files &files, std::unordered_map<size_t, path>
             size_t h;
             b.read(h);
 
-            auto r = commands.insert(h);
+            auto r = s.storage.insert(h);
             r.first->hash = h;
 
-            //if (!std::is_trivially_copyable_v<decltype(r.first->mtime)>)
-                //throw SW_RUNTIME_ERROR("x");
-
+            b.read(r.first->hash_high);
             b.read(r.first->mtime);
+            b.read(r.first->duration.mean);
+            b.read(r.first->duration.variance);
+            b.read(r.first->duration.n);
+            b.read(r.first->peak_memory);
 
             size_t n;
             b.read(n);
+            r.first->implicit_inputs.clear();
             r.first->implicit_inputs.reserve(n);
             while (n--)
             {
                 b.read(h);
-                auto &f = files2[h];
-                if (!f.empty())
-                {
-                    //r.first->implicit_inputs.insert(files2[h]);
-                    r.first->implicit_inputs.insert(h);
-                }
+                if (auto id = s.getFile(h))
+                    r.first->implicit_inputs.push_back(*id);
+            }
+
+            b.read(n);
+            r.first->content_hashes.clear();
+            while (n--)
+            {
+                uint64_t ch;
+                b.read(h);
+                b.read(ch);
+                r.first->content_hashes[h] = ch;
             }
         }
     }
 }
 
-void FileDb::load(Files &files, std::unordered_map<size_t, path> &files2, ConcurrentCommandStorage &commands, const path &root) const
+void FileDb::load(detail::Storage &s, const path &root) const
 {
-    sw::load(getCommandsDbFilename(root), files, files2, commands);
-    sw::load(getCommandsLogFileName(root), files, files2, commands);
+    auto open = [&s, &root]()
+    {
+        s.commands_db = std::make_unique<MappedTable>(getCommandsDbFilename(root));
+        s.files_db = std::make_unique<MappedTable>(getFilesDbFilename(root));
+        s.hashes_db = std::make_unique<MappedTable>(getHashesDbFilename(root));
+    };
+
+    try
+    {
+        open();
+    }
+    catch (std::exception &e)
+    {
+        LOG_WARN(logger, "Command db is broken, recreating: " << e.what());
+        ScopedFileLock lk(getDbLockFilename(root));
+        s.commands_db.reset();
+        s.files_db.reset();
+        s.hashes_db.reset();
+        for (auto &p : fs::directory_iterator(getDbDir(root)))
+        {
+            // keep locks and logs of other processes
+            auto fn = p.path().filename().string();
+            if (fn.starts_with("commands.") || fn.starts_with("files.") || fn.starts_with("hashes."))
+                fs::remove(p);
+        }
+        open();
+    }
+
+    loadLog(getCommandsLogFileName(root), s);
 }
 
-void FileDb::save(const Files &files, const detail::Storage &s, ConcurrentCommandStorage &commands, const path &root) const
+void FileDb::save(detail::Storage &s, const path &root) const
 {
-    std::vector<uint8_t> v;
+    // other processes may append to the same db
+    ScopedFileLock lk(getDbLockFilename(root));
 
-    // files
+    // files go first, commands refer to them
     {
-        primitives::BinaryStream b(10'000'000); // reserve amount
-        for (auto &f : files)
+        std::shared_lock lk(s.m_ids);
+        for (auto &[h, id] : s.ids_by_hash)
         {
-            auto s = to_string(normalize_path(f));
-            auto sz = s.size() + 1;
-            b.write(sz);
-            b.write(s);
-        }
-        if (!b.empty())
-        {
-            auto p = getCommandsDbFilename(root) += getFilesSuffix();
-            fs::create_directories(p.parent_path());
-            b.save(p);
+            if (!s.files_db->find(h))
+                s.files_db->insert(h, to_string(getPathTable().getPath(id)));
         }
     }
+    s.files_db->flush();
 
-    // commands
+    // only records of this run are written, everything else is already in the db
+    std::vector<uint8_t> v;
+    for (const auto &[k, r] : s.storage)
     {
-        primitives::BinaryStream b(10'000'000); // reserve amount
-        for (const auto &[k, r] : commands)
-        {
-            write(v, r, s);
-            auto sz = v.size();
-            b.write(sz);
-            b.write(v.data(), v.size());
-        }
-        if (!b.empty())
-        {
-            auto p = getCommandsDbFilename(root);
-            fs::create_directories(p.parent_path());
-            b.save(p);
-        }
+        write(v, r, s);
+        if (v.empty())
+            continue;
+        s.commands_db->insert(k, std::string_view((const char *)v.data(), v.size()));
     }
+    s.commands_db->flush();
+
+    for (const auto &[k, h] : s.content_hashes)
+        s.hashes_db->insert(k, std::string_view((const char *)&h, sizeof(h)));
+    s.hashes_db->flush();
 
     error_code ec;
     fs::remove(getCommandsLogFileName(root), ec);
     fs::remove(getCommandsLogFileName(root) += getFilesSuffix(), ec);
 }
 
+bool FileDb::needsCompaction(const detail::Storage &s) const
+{
+    return s.commands_db && s.commands_db->needsCompaction() ||
+        s.files_db && s.files_db->needsCompaction() ||
+        s.hashes_db && s.hashes_db->needsCompaction();
+}
+
+// response files are named by their contents (see Command::writeResponseFile()),
+// so files of changed commands are left behind; used files are touched on every run
+static void removeOldResponseFiles(const path &root)
+{
+    auto dir = root / "rsp";
+    error_code ec;
+    if (!fs::exists(dir, ec))
+        return;
+    auto old = fs::file_time_type::clock::now() - RSP_FILE_MAX_AGE;
+    for (auto &e : fs::recursive_directory_iterator(dir, ec))
+    {
+        if (e.is_regular_file(ec) && e.last_write_time(ec) < old && !ec)
+            fs::remove(e.path(), ec);
+    }
+}
+
+void FileDb::compact(const path &root) const
+{
+    ScopedFileLock lk(getDbLockFilename(root));
+    // reopen to see the latest state
+    if (MappedTable(getCommandsDbFilename(root)).needsCompaction())
+        MappedTable::compact(getCommandsDbFilename(root));
+    if (MappedTable(getFilesDbFilename(root)).needsCompaction())
+        MappedTable::compact(getFilesDbFilename(root));
+    if (MappedTable(getHashesDbFilename(root)).needsCompaction())
+        MappedTable::compact(getHashesDbFilename(root));
+    removeOldResponseFiles(root);
+}
+
 detail::FileHolder::FileHolder(const path &fn)
     : /*lk(fn)
     , */f(fn, "ab")
@@ -320,9 +488,10 @@ CommandStorage::CommandStorage(const SwBuilderContext &swctx, const path &root)
 
 CommandStorage::~CommandStorage()
 {
+    if (compaction.joinable())
+        compaction.join();
     save();
 }
-
 void CommandStorage::async_command_log(const CommandRecord &r)
 {
     static std::vector<uint8_t> v;
@@ -346,12 +515,11 @@ void CommandStorage::async_command_log(const CommandRecord &r)
 
         {
             auto &l = s.getFileLog(swctx, root);
-            for (auto &f : r.getImplicitInputs(s))
+            for (auto id : r.implicit_inputs)
             {
-                auto r = s.file_storage.insert(f);
-                if (!r.second)
+                if (!s.logged_files.insert(id).second)
                     continue;
-                auto s = to_string(normalize_path(f));
+                auto s = to_string(getPathTable().getPath(id));
                 auto sz = s.size() + 1;
                 fwrite(&sz, sizeof(sz), 1, l.f.getHandle());
                 fwrite(&s[0], sz, 1, l.f.getHandle());
@@ -422,12 +590,28 @@ detail::FileHolder &detail::Storage::getFileLog(const SwBuilderContext &swctx, c
 
 void CommandStorage::load()
 {
-    fdb.load(s.file_storage, s.file_storage_by_hash, s.storage, root);
+    fdb.load(s, root);
+
+    // compaction writes new generation of files, readers keep using the old one
+    if (fdb.needsCompaction(s))
+    {
+        compaction = std::thread([this]
+        {
+            try
+            {
+                fdb.compact(root);
+            }
+            catch (std::exception &e)
+            {
+                LOG_WARN(logger, "Error during command db compaction: " << e.what());
+            }
+        });
+    }
 }
 
 void CommandStorage::save1()
 {
-    fdb.save(s.file_storage, s, s.storage, root);
+    fdb.save(s, root);
 }
 
 ConcurrentCommandStorage &CommandStorage::getStorage()
@@ -440,9 +624,164 @@ detail::Storage &CommandStorage::getInternalStorage()
     return s;
 }
 
-std::pair<CommandRecord *, bool> CommandStorage::insert(size_t hash)
+std::pair<CommandRecord *, bool> CommandStorage::insert(size_t hash, uint64_t hash_high)
 {
-    return getStorage().insert(hash);
+    auto r = getStorage().insert(hash);
+    if (!r.second || !s.commands_db)
+        return r;
+
+    // bring previous state into this run (duration history etc.)
+    auto v = s.commands_db->find(hash);
+    if (!v)
+        return r;
+    CommandRecordView rv{ *v };
+    if (!rv.valid() || rv.getHashHigh() != hash_high)
+        return r;
+    r.first->mtime = rv.getMtime();
+    r.first->duration = rv.getDuration();
+    r.first->peak_memory = rv.getPeakMemory();
+    for (size_t i = 0, n = rv.getNumberOfImplicitInputs(); i < n; i++)
+    {
+        if (auto id = s.getFile(rv.getImplicitInput(i)))
+            r.first->implicit_inputs.push_back(*id);
+    }
+    rv.getContentHashes(r.first->content_hashes);
+    r.first->hash = hash;
+    return r;
+}
+
+bool CommandStorage::find(size_t hash, uint64_t hash_high, fs::file_time_type &mtime, PathIds &implicit_inputs, ContentHashes *content_hashes)
+{
+    if (hash == 0)
+        return false;
+
+    // records of this run go first
+    if (auto r = getStorage().find(hash); r && r->hash)
+    {
+        if (r->hash_high != hash_high)
+            return false;
+        mtime = r->mtime;
+        implicit_inputs = r->implicit_inputs;
+        if (content_hashes)
+            *content_hashes = r->content_hashes;
+        return true;
+    }
+
+    if (!s.commands_db)
+        return false;
+    auto v = s.commands_db->find(hash);
+    if (!v)
+        return false;
+    CommandRecordView r{ *v };
+    if (!r.valid() || r.getHashHigh() != hash_high)
+        return false;
+
+    mtime = r.getMtime();
+    implicit_inputs.clear();
+    implicit_inputs.reserve(r.getNumberOfImplicitInputs());
+    for (size_t i = 0, n = r.getNumberOfImplicitInputs(); i < n; i++)
+    {
+        // files missing from db are dropped like in old loader
+        if (auto id = s.getFile(r.getImplicitInput(i)))
+            implicit_inputs.push_back(*id);
+    }
+    if (content_hashes)
+        r.getContentHashes(*content_hashes);
+    return true;
+}
+
+std::optional<CommandDuration> CommandStorage::getDuration(size_t hash)
+{
+    if (hash == 0)
+        return {};
+    if (auto r = getStorage().find(hash); r && r->hash)
+        return r->duration;
+    if (!s.commands_db)
+        return {};
+    auto v = s.commands_db->find(hash);
+    if (!v)
+        return {};
+    CommandRecordView r{ *v };
+    if (!r.valid())
+        return {};
+    return r.getDuration();
+}
+
+uint64_t CommandStorage::getPeakMemory(size_t hash)
+{
+    if (hash == 0)
+        return 0;
+    if (auto r = getStorage().find(hash); r && r->hash)
+        return r->peak_memory;
+    if (!s.commands_db)
+        return 0;
+    auto v = s.commands_db->find(hash);
+    if (!v)
+        return 0;
+    CommandRecordView r{ *v };
+    if (!r.valid())
+        return 0;
+    return r.getPeakMemory();
+}
+
+size_t CommandStorage::getFileHash(const path &p)
+{
+    return file_hash(normalize_path(p));
+}
+
+uint64_t CommandStorage::getContentHash(const path &p, FileData &d)
+{
+    std::unique_lock lk(d.m_content_hash);
+    if (d.last_write_time == fs::file_time_type::min())
+        return 0;
+    if (d.content_hash.hash && d.content_hash.key.mtime == d.last_write_time)
+        return d.content_hash.hash;
+
+    auto key = getFileContentKey(p);
+    if (!key)
+        return 0;
+
+    auto k = getFileHash(p);
+    auto find_cached = [this, k]() -> std::optional<FileContentHash>
+    {
+        {
+            std::shared_lock lk(s.m_content_hashes);
+            if (auto h = s.content_hashes.find(k))
+                return *h;
+        }
+        if (!s.hashes_db)
+            return {};
+        auto v = s.hashes_db->find(k);
+        if (!v || v->size() != sizeof(FileContentHash))
+            return {};
+        FileContentHash h;
+        memcpy(&h, v->data(), sizeof(h));
+        return h;
+    };
+    if (auto h = find_cached(); h && h->key == *key && h->hash)
+    {
+        d.content_hash = *h;
+        return h->hash;
+    }
+
+    FileContentHash h;
+    h.key = *key;
+    h.hash = getFileContentHash(p);
+    if (h.hash == 0)
+        h.hash = 1; // 0 is reserved for missing files
+    d.content_hash = h;
+
+    // file may still be written within the same mtime tick,
+    // so do not remember too fresh hashes across runs
+    if (fs::file_time_type::clock::now() - key->mtime > std::chrono::seconds(2))
+    {
+        {
+            std::unique_lock lk(s.m_content_hashes);
+            *s.content_hashes.insert(k).first = h;
+        }
+        changed = true;
+    }
+    return h.hash;
 }
 
 path CommandStorage::getLockFileName() const
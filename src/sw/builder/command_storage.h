@@ -19,12 +19,18 @@
 #pragma once
 
 #include "concurrent_map.h"
+#include "file.h"
+#include "mapped_table.h"
+#include "path_table.h"
 
-#include <boost/thread/shared_mutex.hpp>
 #include <primitives/lock.h>
 #include <primitives/templates.h>
 
 #include <atomic>
+#include <cmath>
+#include <optional>
+#include <shared_mutex>
+#include <thread>
 
 namespace sw
 {
@@ -47,15 +53,36 @@ struct FileHolder
 
 }
 
+// rolling statistics of command execution time
+struct CommandDuration
+{
+    // after this number of runs old values start to fade out
+    static constexpr uint32_t window = 8;
+
+    double mean = 0; // ns
+    double variance = 0;
+    uint32_t n = 0;
+
+    void add(double ns);
+    double stddev() const { return std::sqrt(variance); }
+};
+
+// normalized file path hash -> content hash
+using ContentHashes = std::unordered_map<size_t, uint64_t>;
+
 struct CommandRecord
 {
     size_t hash = 0;
+    // rest of 128-bit command hash, records with the same key but other high half are not ours
+    uint64_t hash_high = 0;
     fs::file_time_type mtime = fs::file_time_type::min();
-    //Files implicit_inputs;
-    std::unordered_set<size_t> implicit_inputs;
+    CommandDuration duration;
+    uint64_t peak_memory = 0; // bytes, of the last measured run
+    PathIds implicit_inputs;
+    // filled in content hash mode only
+    ContentHashes content_hashes;
 
-    Files getImplicitInputs(detail::Storage &) const;
-    void setImplicitInputs(const Files &, detail::Storage &);
+    void setImplicitInputs(const PathIds &, detail::Storage &);
 };
 
 using ConcurrentCommandStorage = ConcurrentMap<size_t, CommandRecord>;
@@ -66,17 +93,32 @@ namespace detail
 
 struct Storage
 {
+    // records written during this run
     ConcurrentCommandStorage storage;
     std::unique_ptr<FileHolder> commands;
 
-    Files file_storage;
-    mutable boost::upgrade_mutex m_file_storage_by_hash;
-    std::unordered_map<size_t, path> file_storage_by_hash;
+    // records of previous runs, looked up in place
+    std::unique_ptr<MappedTable> commands_db;
+    std::unique_ptr<MappedTable> files_db;
+
+    // content hashes cache, (inode, size, mtime) -> hash
+    std::unique_ptr<MappedTable> hashes_db;
+    // values are read and written from executor threads
+    std::shared_mutex m_content_hashes;
+    ConcurrentMap<size_t, FileContentHash> content_hashes;
+
+    // file hash -> id, files of this run and files looked up in the db
+    mutable std::shared_mutex m_ids;
+    mutable std::unordered_map<size_t, PathId> ids_by_hash;
+    // accessed from log writer thread only
+    std::unordered_set<PathId> logged_files;
     std::unique_ptr<FileHolder> files;
 
     void closeLogs();
     FileHolder &getCommandLog(const SwBuilderContext &swctx, const path &root);
     FileHolder &getFileLog(const SwBuilderContext &swctx, const path &root);
+
+    std::optional<PathId> getFile(size_t hash) const;
 };
 
 }
@@ -87,8 +129,10 @@ struct FileDb
 
     FileDb(const SwBuilderContext &swctx);
 
-    void load(Files &files, std::unordered_map<size_t, path> &files2, ConcurrentCommandStorage &commands, const path &root) const;
-    void save(const Files &files, const detail::Storage &, ConcurrentCommandStorage &commands, const path &root) const;
+    void load(detail::Storage &, const path &root) const;
+    void save(detail::Storage &, const path &root) const;
+    bool needsCompaction(const detail::Storage &) const;
+    void compact(const path &root) const;
 
     static void write(std::vector<uint8_t> &, const CommandRecord &, const detail::Storage &);
 };
@@ -108,7 +152,18 @@ struct SW_BUILDER_API CommandStorage
     void async_command_log(const CommandRecord &r);
     void add_user();
     void free_user();
-    std::pair<CommandRecord *, bool> insert(size_t hash);
+    /// previous state is taken only when hash_high matches
+    std::pair<CommandRecord *, bool> insert(size_t hash, uint64_t hash_high);
+
+    /// does not insert anything, returns false for unknown commands
+    bool find(size_t hash, uint64_t hash_high, fs::file_time_type &mtime, PathIds &implicit_inputs, ContentHashes *content_hashes = nullptr);
+    std::optional<CommandDuration> getDuration(size_t hash);
+    /// returns 0 when unknown
+    uint64_t getPeakMemory(size_t hash);
+
+    /// returns 0 for missing files
+    uint64_t getContentHash(const path &, FileData &);
+    static size_t getFileHash(const path &);
 
 private:
     FileDb fdb;
@@ -116,8 +171,9 @@ private:
     std::atomic_int n_users{ 0 };
     std::mutex m;
     std::unique_ptr<ScopedFileLock> lock;
+    std::thread compaction;
     bool saved = false;
-    bool changed = false;
+    std::atomic_bool changed{ false };
 
     void closeLogs();
 
@@ -18,204 +18,310 @@
 
 #pragma once
 
-#include <junction/ConcurrentMap_Leapfrog.h>
-#include <primitives/exceptions.h>
-#include <primitives/templates.h>
-
+#include <atomic>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <tuple>
+#include <utility>
+#include <vector>
 
 namespace sw
 {
 
-using ConcurrentContext = junction::QSBR::Context;
-
-template <class K, class V>
-struct ConcurrentMap
+namespace detail
 {
-    using MapType = junction::ConcurrentMap_Leapfrog<K, V*>;
-    //using MapType = std::unordered_map<K, V*>;
-    using value_type = std::pair<K, V>;
-    using insert_type = std::pair<V*, bool>;
 
-    ConcurrentMap()
+/// Append only storage with stable addresses.
+/// Appends are serialized by the owner, readers walk chunks without locks.
+template <class T>
+struct ConcurrentArena
+{
+    struct Chunk
     {
-        clear();
-    }
+        T *items;
+        size_t capacity;
+        // published by writer with release, read with acquire
+        std::atomic<size_t> n{ 0 };
+        std::atomic<Chunk *> next{ nullptr };
+
+        Chunk(size_t capacity)
+            : items(std::allocator<T>().allocate(capacity)), capacity(capacity)
+        {
+        }
+
+        ~Chunk()
+        {
+            for (size_t i = 0, e = n.load(); i < e; i++)
+                items[i].~T();
+            std::allocator<T>().deallocate(items, capacity);
+        }
+    };
+
+    static constexpr size_t min_chunk_size = 16;
+    static constexpr size_t max_chunk_size = 4096;
+
+    std::atomic<Chunk *> first{ nullptr };
 
-    ~ConcurrentMap()
+    ConcurrentArena() = default;
+    ConcurrentArena(const ConcurrentArena &) = delete;
+    ConcurrentArena &operator=(const ConcurrentArena &) = delete;
+    ~ConcurrentArena() { clear(); }
+
+    template <class ... Args>
+    T *emplace(Args && ... args)
     {
-        // causes crashes
-        /*if (!map)
-            return;
-        for (auto i = getIterator(); i.isValid(); i.next())
-            delete i.getValue();
-        map.reset();*/
+        if (!last)
+        {
+            last = new Chunk(min_chunk_size);
+            first.store(last, std::memory_order_release);
+        }
+        auto n = last->n.load(std::memory_order_relaxed);
+        if (n == last->capacity)
+        {
+            auto c = new Chunk(std::min(last->capacity * 2, max_chunk_size));
+            last->next.store(c, std::memory_order_release);
+            last = c;
+            n = 0;
+        }
+        auto v = new (last->items + n) T(std::forward<Args>(args)...);
+        last->n.store(n + 1, std::memory_order_release);
+        return v;
     }
 
+    /// no concurrent access is allowed
     void clear()
     {
-        map = std::make_unique<MapType>();
+        for (auto c = first.exchange(nullptr); c;)
+        {
+            auto next = c->next.load();
+            delete c;
+            c = next;
+        }
+        last = nullptr;
     }
 
-    insert_type insert(const value_type &v)
-    {
-        return insert(v.first, v.second);
-    }
+private:
+    Chunk *last = nullptr;
+};
 
-    template <class Deleter>
-    insert_type insert(K k, const V &v, Deleter &&d)
-    {
-        if (k == 0)
-            throw SW_RUNTIME_ERROR("ConcurrentMap: zero key");
+}
 
-        //std::unique_lock lk(m);
-        return insert_no_lock(k, v, d);
-    }
+/// Concurrent hash map with stable value addresses.
+///
+/// Keys are hashed to one of the shards, every shard is an open addressing table
+/// guarded by its own shared mutex. Full keys are stored, so hash collisions are resolved.
+/// Values live in per shard arenas and are never moved or erased individually,
+/// pointers returned by insert() and find() are valid until clear() or destruction.
+/// Iteration does not lock and may be done while other threads insert,
+/// it visits at least all values inserted before it started.
+template <class K, class V, class Hash = std::hash<K>, class KeyEqual = std::equal_to<K>>
+struct ConcurrentMap
+{
+    using value_type = std::pair<const K, V>;
+    using insert_type = std::pair<V*, bool>;
 
-    template <class Deleter>
-    insert_type insert_no_lock(K k, const V &v, Deleter &&d)
-    {
-        if (k == 0)
-            throw SW_RUNTIME_ERROR("ConcurrentMap: zero key");
+    static constexpr size_t shard_bits = 6;
+    static constexpr size_t n_shards = 1 << shard_bits;
 
-        /*auto i = map->find(k);
-        if (i == map->end())
-        {
-            auto value = new V(v);
-            map->emplace(k, value);
-            return { value, true };
-        }
-        return { i->second, false };*/
+    ConcurrentMap() = default;
+    ConcurrentMap(const ConcurrentMap &) = delete;
+    ConcurrentMap &operator=(const ConcurrentMap &) = delete;
 
-        auto i = map->insertOrFind(k);
-        auto value = i.getValue();
-        if (!value)
+    /// returns existing value or constructs new one from args
+    template <class ... Args>
+    insert_type try_emplace(const K &k, Args && ... args)
+    {
+        auto h = hash(k);
+        auto &s = getShard(h);
         {
-            value = new V(v);
-            auto oldValue = i.exchangeValue(value);
-            if (oldValue)
-            {
-                *value = *oldValue;
-                std::forward<Deleter>(d)(oldValue);
-                return { value, false };
-            }
-            return { value, true };
+            std::shared_lock lk(s.m);
+            if (auto v = s.find(h, k))
+                return { &v->second, false };
         }
-        return { value, false };
+        std::unique_lock lk(s.m);
+        if (auto v = s.find(h, k))
+            return { &v->second, false };
+        auto v = s.values.emplace(std::piecewise_construct,
+            std::forward_as_tuple(k), std::forward_as_tuple(std::forward<Args>(args)...));
+        s.add(h, v);
+        return { &v->second, true };
     }
 
-    insert_type insert(K k, const V &v = V())
+    insert_type insert(const K &k)
     {
-        if constexpr (std::is_pointer_v<V>)
-            return insert(k, v, [](auto *v)
-        {
-            junction::DefaultQSBR.enqueue(&V::destroy, v);
-        });
-        else
-            return insert(k, v, [](auto *v) {});
+        return try_emplace(k);
     }
 
-    insert_type insert_ptr(K k, const V &v = V())
+    insert_type insert(const K &k, const V &v)
     {
-        if constexpr (std::is_pointer_v<V>)
-            return insert(k, v, [](auto *v) { delete *v; });
-        else
-            return insert(k, v, [](auto *v) {});
+        return try_emplace(k, v);
     }
 
-    V &operator[](K k)
+    V &operator[](const K &k)
     {
         return *insert(k).first;
     }
 
-    const V &operator[](K k) const
+    /// does not insert
+    V *find(const K &k) const
     {
-        return *insert(k).first;
+        auto h = hash(k);
+        auto &s = getShard(h);
+        std::shared_lock lk(s.m);
+        auto v = s.find(h, k);
+        return v ? &v->second : nullptr;
+    }
+
+    size_t size() const
+    {
+        size_t n = 0;
+        for (auto &s : shards)
+        {
+            std::shared_lock lk(s.m);
+            n += s.n;
+        }
+        return n;
     }
 
-    auto getIterator()
+    /// frees all values at once, no concurrent access is allowed
+    void clear()
     {
-        return typename MapType::Iterator(*map);
+        for (auto &s : shards)
+        {
+            std::unique_lock lk(s.m);
+            s.slots.clear();
+            s.slots.shrink_to_fit();
+            s.n = 0;
+            s.values.clear();
+        }
     }
 
     struct end_iterator {};
     struct iterator
     {
-        typename MapType::Iterator i;
-
-        iterator(typename MapType::Iterator i) : i(i) {}
+        iterator(const ConcurrentMap &m) : m(&m) { enter(0); }
 
-        bool operator!=(const end_iterator &e) const { return i.isValid(); }
-        std::pair<K, V&> operator*() { return { i.getKey(), *i.getValue() }; }
-        void operator++() { i.next(); }
-    };
-
-    iterator begin() { return getIterator(); }
-    end_iterator end() { return {}; }
+        bool operator!=(const end_iterator &) const { return c; }
+        std::pair<const K &, V &> operator*() const { auto &v = c->items[i]; return { v.first, v.second }; }
+        void operator++()
+        {
+            if (++i < n)
+                return;
+            for (c = c->next.load(std::memory_order_acquire); c; c = c->next.load(std::memory_order_acquire))
+            {
+                i = 0;
+                n = c->n.load(std::memory_order_acquire);
+                if (n)
+                    return;
+            }
+            enter(shard + 1);
+        }
 
-    // for usual maps
-    //iterator begin() { return map->begin(); }
-    //iterator end() { return map->end(); }
+    private:
+        using Chunk = typename detail::ConcurrentArena<value_type>::Chunk;
 
-    //auto begin() const { return map->begin(); }
-    //auto end() const { return map->end(); }
+        const ConcurrentMap *m;
+        size_t shard = 0;
+        Chunk *c = nullptr;
+        size_t i = 0;
+        size_t n = 0;
 
+        void enter(size_t first_shard)
+        {
+            for (shard = first_shard; shard < n_shards; shard++)
+            {
+                auto &a = m->shards[shard].values;
+                for (c = a.first.load(std::memory_order_acquire); c; c = c->next.load(std::memory_order_acquire))
+                {
+                    i = 0;
+                    n = c->n.load(std::memory_order_acquire);
+                    if (n)
+                        return;
+                }
+            }
+            c = nullptr;
+        }
+    };
 
-    /*for (auto i = getIterator(); i.isValid(); i.next())
-    {
-        b.write(i.getKey());
-        b.write(*i.getValue()->mtime);
-    }*/
+    iterator begin() const { return *this; }
+    end_iterator end() const { return {}; }
 
 private:
-    std::unique_ptr<MapType> map;
-    //std::mutex m;
-};
+    struct Slot
+    {
+        size_t hash = 0;
+        value_type *value = nullptr;
+    };
 
-template <class V>
-using ConcurrentMapSimple = ConcurrentMap<size_t, V>;
+    struct alignas(64) Shard
+    {
+        mutable std::shared_mutex m;
+        // power of two size, half empty at most
+        std::vector<Slot> slots;
+        size_t n = 0;
+        mutable detail::ConcurrentArena<value_type> values;
 
-template <class K, class V>
-struct ConcurrentHashMap : ConcurrentMapSimple<V>
-{
-    using Base = ConcurrentMapSimple<V>;
-    using Base::operator[];
-    using value_type = std::pair<K, V>;
-    using insert_type = typename Base::insert_type;
+        value_type *find(size_t h, const K &k) const
+        {
+            if (slots.empty())
+                return nullptr;
+            auto mask = slots.size() - 1;
+            for (auto i = h & mask;; i = (i + 1) & mask)
+            {
+                auto &s = slots[i];
+                if (!s.value)
+                    return nullptr;
+                if (s.hash == h && KeyEqual()(s.value->first, k))
+                    return s.value;
+            }
+        }
 
-    using Base::insert;
+        void add(size_t h, value_type *v)
+        {
+            if ((n + 1) * 2 > slots.size())
+            {
+                std::vector<Slot> old(std::max<size_t>(16, slots.size() * 2));
+                old.swap(slots);
+                for (auto &s : old)
+                {
+                    if (s.value)
+                        place(s);
+                }
+            }
+            place({ h, v });
+            n++;
+        }
 
-    insert_type insert(const K &k, const V &v = V())
-    {
-        return insert(value_type{ k, v });
-    }
+    private:
+        void place(const Slot &s)
+        {
+            auto mask = slots.size() - 1;
+            auto i = s.hash & mask;
+            while (slots[i].value)
+                i = (i + 1) & mask;
+            slots[i] = s;
+        }
+    };
 
-    insert_type insert(const value_type &v)
-    {
-        return Base::insert(std::hash<K>()(v.first), v.second);
-    }
+    mutable Shard shards[n_shards];
 
-    V &operator[](const K &k)
+    static size_t hash(const K &k)
     {
-        return *insert(k).first;
+        // keys are often hashes already and std::hash of integers is identity,
+        // so spread bits with splitmix64 finalizer
+        uint64_t x = Hash()(k);
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return (size_t)(x ^ (x >> 31));
     }
 
-    const V &operator[](const K &k) const
+    Shard &getShard(size_t h) const
     {
-        return *insert(k).first;
+        // slots use low bits
+        return shards[(h >> (sizeof(size_t) * 8 - shard_bits)) & (n_shards - 1)];
     }
 };
 
-SW_BUILDER_API
-SW_DECLARE_GLOBAL_STATIC_FUNCTION(ConcurrentContext, getConcurrentContext);
-
-SW_BUILDER_API
-ConcurrentContext createConcurrentContext();
-
-SW_BUILDER_API
-void destroyConcurrentContext(ConcurrentContext ctx);
-
-SW_BUILDER_API
-void updateConcurrentContext();
-
 }
@@ -0,0 +1,165 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "deps_parser.h"
+
+#include <bit>
+#include <string>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SW_DEPS_PARSER_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace sw
+{
+
+static bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static bool isDelimiter(char c)
+{
+    return isSpace(c) || c == '\\' || c == '$';
+}
+
+// paths are long, so 16 chars are checked at once
+static const char *findDelimiter(const char *p, const char *end)
+{
+#ifdef SW_DEPS_PARSER_SSE2
+    const auto sp = _mm_set1_epi8(' ');
+    const auto tab = _mm_set1_epi8('\t');
+    const auto nl = _mm_set1_epi8('\n');
+    const auto cr = _mm_set1_epi8('\r');
+    const auto bs = _mm_set1_epi8('\\');
+    const auto dl = _mm_set1_epi8('$');
+    for (; end - p >= 16; p += 16)
+    {
+        auto v = _mm_loadu_si128((const __m128i *)p);
+        auto m = _mm_or_si128(
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, tab)),
+                _mm_or_si128(_mm_cmpeq_epi8(v, nl), _mm_cmpeq_epi8(v, cr))),
+            _mm_or_si128(_mm_cmpeq_epi8(v, bs), _mm_cmpeq_epi8(v, dl)));
+        if (auto mask = _mm_movemask_epi8(m))
+            return p + std::countr_zero((unsigned)mask);
+    }
+#endif
+    for (; p < end; p++)
+    {
+        if (isDelimiter(*p))
+            return p;
+    }
+    return end;
+}
+
+void parseDepsFile(std::string_view contents, const std::function<void(std::string_view)> &f)
+{
+    // deps file is a make in form
+    // target: dependencies
+    // deps are split by spaces on several lines with \ at the end of each line except the last one
+    //
+    // example:
+    //
+    // file.o: dep1.cpp dep2.cpp \
+    //  dep1.h dep2.h \
+    //  dep3.h \
+    //  dep4.h
+    //
+    // spaces in paths are escaped as '\ ', dollars as '$$',
+    // other backslashes are part of paths (windows)
+    //
+    // rule may have several targets (protoc: 'a.pb.cc a.pb.h: a.proto'),
+    // everything up to the first token ending with ':' is a target,
+    // so 'C:/path/to/file.o:' is a single one;
+    // gcc -MP adds phony rules 'dep.h:' without deps, they are skipped the same way
+
+    auto p = contents.data();
+    const auto end = p + contents.size();
+    std::string buf; // unescaped path
+    bool targets = true;
+    while (p < end)
+    {
+        // end of rule
+        if (*p == '\n')
+        {
+            targets = true;
+            p++;
+            continue;
+        }
+        if (isSpace(*p))
+        {
+            p++;
+            continue;
+        }
+        // line continuation
+        if (*p == '\\' && (p + 1 == end || p[1] == '\n' || p[1] == '\r'))
+        {
+            p++;
+            if (p < end && *p == '\r')
+                p++;
+            if (p < end && *p == '\n')
+                p++;
+            continue;
+        }
+
+        auto begin = p;
+        bool escaped = false;
+        while (1)
+        {
+            auto q = findDelimiter(p, end);
+            if (q == end || isSpace(*q) || (*q == '\\' && (q + 1 == end || q[1] == '\n' || q[1] == '\r')))
+            {
+                if (escaped)
+                    buf.append(p, q);
+                p = q;
+                break;
+            }
+            bool dollar = *q == '$' && q + 1 < end && q[1] == '$';
+            bool escaped_char = *q == '\\' && (q[1] == ' ' || q[1] == '#');
+            if (!dollar && !escaped_char)
+            {
+                // literal char
+                if (escaped)
+                    buf.append(p, q + 1);
+                p = q + 1;
+                continue;
+            }
+            if (!escaped)
+            {
+                buf.assign(begin, q);
+                escaped = true;
+            }
+            else
+                buf.append(p, q);
+            buf += q[1];
+            p = q + 2;
+        }
+
+        std::string_view s = escaped ? std::string_view(buf) : std::string_view(begin, p - begin);
+        if (targets)
+        {
+            if (s.back() == ':')
+                targets = false;
+            continue;
+        }
+        f(s);
+    }
+}
+
+}
@@ -0,0 +1,33 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <functional>
+#include <string_view>
+
+namespace sw
+{
+
+/// Scans make style deps file (gcc -MD, clang -MD etc.).
+/// Calls f for every dependency, targets of all rules are skipped.
+/// Views point into contents unless path has escaped chars.
+SW_BUILDER_API
+void parseDepsFile(std::string_view contents, const std::function<void(std::string_view)> &f);
+
+}
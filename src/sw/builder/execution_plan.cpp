@@ -18,15 +18,101 @@
 
 #include "execution_plan.h"
 
+#include "file_storage.h"
+#include "sw_context.h"
+
 #include <sw/support/exceptions.h>
+#include <sw/support/trace.h>
 
 #include <nlohmann/json.hpp>
 #include <primitives/exceptions.h>
 #include <primitives/executor.h>
+#include <primitives/templates.h>
 
 namespace sw
 {
 
+namespace
+{
+
+// admission of commands under resource budget
+//
+// Commands that do not fit are not waited for in executor threads (they would occupy -j slots),
+// they are kept here and given back to the scheduler when running commands release their budget.
+struct Admission
+{
+    struct Lock
+    {
+        uint64_t memory = 0;
+        int threads = 0;
+        bool locked = false;
+    };
+
+    const ExecutionPlan::ResourceBudget &budget;
+
+    Admission(const ExecutionPlan::ResourceBudget &budget)
+        : budget(budget)
+    {
+    }
+
+    /// returns false and keeps the command when it does not fit
+    bool tryLock(CommandNode &c, Lock &l)
+    {
+        if (!budget.memory && !budget.threads)
+            return true;
+        auto mem = c.getEstimatedMemory();
+        auto thr = c.getNumberOfThreads();
+        // check and deferral go under one lock with release(), so deferred command cannot be lost
+        std::unique_lock lk(m);
+        if (!fits(mem, thr))
+        {
+            deferred.push_back(&c);
+            return false;
+        }
+        memory += mem;
+        threads += thr;
+        n++;
+        trace::counter("budget memory, MB", memory >> 20);
+        l = { mem, thr, true };
+        return true;
+    }
+
+    /// returns deferred commands, they must be dispatched again
+    std::vector<CommandNode *> release(Lock &l)
+    {
+        if (!l.locked)
+            return {};
+        l.locked = false;
+        std::unique_lock lk(m);
+        memory -= l.memory;
+        threads -= l.threads;
+        n--;
+        std::vector<CommandNode *> r;
+        r.swap(deferred);
+        return r;
+    }
+
+private:
+    std::mutex m;
+    uint64_t memory = 0;
+    int threads = 0;
+    int n = 0;
+    std::vector<CommandNode *> deferred;
+
+    bool fits(uint64_t mem, int thr) const
+    {
+        if (n == 0)
+            return true;
+        if (budget.memory && memory + mem > budget.memory)
+            return false;
+        if (budget.threads && threads + thr > budget.threads)
+            return false;
+        return true;
+    }
+};
+
+}
+
 ExecutionPlan::ExecutionPlan(USet &cmds)
 {
     init(cmds);
@@ -52,9 +138,14 @@ ExecutionPlan::~ExecutionPlan()
 
 void ExecutionPlan::stop(bool interrupt_running_commands)
 {
-    if (interrupt_running_commands)
-        SW_UNIMPLEMENTED;
     interrupted = true;
+    if (!interrupt_running_commands)
+        return;
+    terminated = true;
+    // not running commands only remember the request,
+    // so already scheduled ones won't start
+    for (auto &c : commands)
+        c->terminate();
 }
 
 void ExecutionPlan::execute(Executor &e) const
@@ -69,18 +160,27 @@ void ExecutionPlan::execute(Executor &e) const
     std::vector<Future<void>> all;
     std::atomic_bool stopped = false;
     interrupted = false;
+    terminated = false;
     std::atomic_int running = 0;
+    std::atomic_size_t processed = 0;
     std::atomic_int64_t askip_errors = skip_errors;
+    Admission admission(budget);
 
     bool build_commands = dynamic_cast<builder::Command *>(*commands.begin());
 
     // set numbers
     std::atomic_size_t current_command = 1;
     std::atomic_size_t total_commands = commands.size();
+    ExecutionProgress progress;
+    progress.jobs = e.numberOfThreads();
+    setEstimatedCosts();
     for (auto &c : commands)
     {
         c->total_commands = &total_commands;
         c->current_command = &current_command;
+        c->progress = &progress;
+        c->executor = command_executor.get();
+        progress.remaining += c->estimated_cost;
         if (build_commands)
         {
             static_cast<builder::Command*>(c)->silent |= silent;
@@ -91,20 +191,58 @@ void ExecutionPlan::execute(Executor &e) const
         //c->markForExecution();
     }
 
+    if (build_commands)
+    {
+        SW_TRACE_ZONE("prefetch files");
+
+        // query file system in batches before commands start to check their files
+        std::unordered_map<FileStorage *, Files> files;
+        for (auto &c : commands)
+        {
+            auto c2 = static_cast<builder::Command *>(c);
+            auto &v = files[&c2->getContext().getFileStorage()];
+            v.insert(c2->inputs.begin(), c2->inputs.end());
+            v.insert(c2->outputs.begin(), c2->outputs.end());
+            for (auto id : c2->implicit_inputs)
+                v.insert(getPathTable().getPath(id));
+        }
+        for (auto &[s, v] : files)
+            s->prefetch(v, &e);
+    }
+
+    if (scheduler == SchedulerType::WorkStealing)
+        return executeWorkStealing(e);
+
     std::function<void(PtrT)> run;
-    run = [this, &askip_errors, &e, &run, &fs, &all, &m, &running, &stopped](T *c)
+    auto dispatch = [&e, &run, &fs, &all, &m](T *c)
+    {
+        std::unique_lock<std::mutex> lk(m);
+        fs.push_back(e.push([&run, c] {run(c); }));
+        all.push_back(fs.back());
+    };
+    run = [this, &askip_errors, &run, &dispatch, &running, &processed, &stopped, &admission](T *c)
     {
         if (stopped || interrupted)
             return;
+        Admission::Lock al;
+        if (!admission.tryLock(*c, al))
+            return;
+        SCOPE_EXIT
+        {
+            for (auto d : admission.release(al))
+                dispatch(d);
+        };
         try
         {
-            running++;
+            trace::counter("running commands", ++running);
             c->execute();
-            running--;
+            trace::counter("running commands", --running);
+            processed++;
         }
         catch (...)
         {
-            running--;
+            trace::counter("running commands", --running);
+            processed++;
             if (--askip_errors < 1)
                 stopped = true;
             if (throw_on_errors)
@@ -113,11 +251,7 @@ void ExecutionPlan::execute(Executor &e) const
         for (auto &d : c->dependent_commands)
         {
             if (--d->dependencies_left == 0)
-            {
-                std::unique_lock<std::mutex> lk(m);
-                fs.push_back(e.push([&run, d] {run(d); }));
-                all.push_back(fs.back());
-            }
+                dispatch(d);
         }
 
         if (stop_time && Clock::now() > *stop_time)
@@ -149,10 +283,10 @@ void ExecutionPlan::execute(Executor &e) const
         throw SW_RUNTIME_ERROR("No commands without deps were added");
 
     // wait for all commands until exception
-    int i = 0;
+    // commands deferred by admission are dispatched again, so futures are not counted
     auto sz = commands.size();
     std::vector<std::exception_ptr> eptrs;
-    while (i != sz)
+    while (processed != sz)
     {
         std::vector<Future<void>> fs2;
         {
@@ -161,10 +295,7 @@ void ExecutionPlan::execute(Executor &e) const
             fs.clear();
         }
         for (auto &f : fs2)
-        {
-            i++;
             f.wait();
-        }
         if (stopped || fs2.empty() || interrupted)
             break;
     }
@@ -180,17 +311,307 @@ void ExecutionPlan::execute(Executor &e) const
             eptrs.push_back(f.state->eptr);
     }
 
+    // killed commands fail too, do not report them one by one
+    if (terminated)
+        throw SW_RUNTIME_ERROR("Interrupted");
+
     // ... or it will crash here in throw
     if (!eptrs.empty() && throw_on_errors)
         throw support::ExceptionVector(eptrs);
 
-    if (i != sz)
+    if (processed != sz)
+    {
+        if (stop_time && Clock::now() > *stop_time && stopped)
+            throw SW_RUNTIME_ERROR("Time limit exceeded");
+        if (interrupted)
+            throw SW_RUNTIME_ERROR("Interrupted");
+        throw SW_RUNTIME_ERROR("Executor did not perform all steps (" + std::to_string(processed) + "/" + std::to_string(sz) + ")");
+    }
+}
+
+void ExecutionPlan::reset() const
+{
+    for (auto &c : commands)
+    {
+        c->resetExecution();
+        c->dependencies_left = c->getDependencies().size();
+    }
+}
+
+void ExecutionPlan::setEstimatedCosts() const
+{
+    // commands without history get mean known duration
+    uint64_t known_sum = 0;
+    size_t known = 0;
+    for (auto &c : commands)
+    {
+        auto d = c->getEstimatedDuration().count();
+        c->estimated_cost = d > 0 ? d : 0;
+        if (d <= 0)
+            continue;
+        known_sum += d;
+        known++;
+    }
+    const uint64_t default_cost = known ? known_sum / known : 1;
+    for (auto &c : commands)
+    {
+        if (!c->estimated_cost)
+            c->estimated_cost = default_cost;
+    }
+}
+
+std::vector<uint64_t> ExecutionPlan::getCriticalPathLengths() const
+{
+    // bottom level of each command:
+    // its own estimated duration + the longest path through its dependents
+
+    const auto n = commands.size();
+    std::unordered_map<PtrT, size_t> idx;
+    idx.reserve(n);
+    for (size_t i = 0; i < n; i++)
+        idx[commands[i]] = i;
+
+    // reverse topological order
+    std::vector<size_t> left(n);
+    std::vector<size_t> q;
+    for (size_t i = 0; i < n; i++)
+    {
+        for (auto &d : commands[i]->dependent_commands)
+            left[i] += idx.contains(d);
+        if (!left[i])
+            q.push_back(i);
+    }
+
+    std::vector<uint64_t> len(n);
+    while (!q.empty())
+    {
+        auto i = q.back();
+        q.pop_back();
+
+        uint64_t m = 0;
+        for (auto &d : commands[i]->dependent_commands)
+        {
+            if (auto it = idx.find(d); it != idx.end())
+                m = std::max(m, len[it->second]);
+        }
+        len[i] = commands[i]->estimated_cost + m;
+
+        for (auto &d : commands[i]->getDependencies())
+        {
+            if (auto it = idx.find(d); it != idx.end() && --left[it->second] == 0)
+                q.push_back(it->second);
+        }
+    }
+    return len;
+}
+
+void ExecutionPlan::executeWorkStealing(Executor &e) const
+{
+    using Item = std::pair<uint64_t, PtrT>; // priority, command
+
+    // every worker owns a heap of ready commands ordered by critical path length,
+    // idle workers steal the most critical command from others
+    struct Worker
+    {
+        std::mutex m;
+        std::vector<Item> q;
+        Clock::duration idle{};
+        size_t steals = 0;
+    };
+
+    const auto nworkers = std::max<size_t>(1, e.numberOfThreads());
+    const auto prio = getCriticalPathLengths();
+    std::unordered_map<PtrT, uint64_t> prio_by_command;
+    prio_by_command.reserve(commands.size());
+    for (size_t i = 0; i < commands.size(); i++)
+        prio_by_command[commands[i]] = prio[i];
+
+    std::vector<Worker> workers(nworkers);
+    std::atomic_size_t ready = 0;
+    std::atomic_size_t running = 0;
+    std::atomic_size_t processed = 0;
+    std::atomic_bool stopped = false;
+    std::atomic_bool done = false;
+    std::atomic_int64_t askip_errors = skip_errors;
+    std::mutex wait_mutex;
+    std::condition_variable cv;
+    std::mutex eptrs_mutex;
+    std::vector<std::exception_ptr> eptrs;
+    Admission admission(budget);
+
+    auto wake = [&wait_mutex, &cv](bool all)
+    {
+        // take the lock, so waiters won't miss the notification
+        {
+            std::unique_lock lk(wait_mutex);
+        }
+        if (all)
+            cv.notify_all();
+        else
+            cv.notify_one();
+    };
+
+    auto push = [&workers, &prio_by_command, &ready, &wake](size_t w, PtrT c)
+    {
+        {
+            auto &wk = workers[w];
+            std::unique_lock lk(wk.m);
+            auto i = prio_by_command.find(c);
+            wk.q.emplace_back(i != prio_by_command.end() ? i->second : 0, c);
+            std::push_heap(wk.q.begin(), wk.q.end(), [](auto &a, auto &b) { return a.first < b.first; });
+            // under the same lock as pop, so ready never goes below zero
+            ready++;
+        }
+        wake(false);
+    };
+
+    auto pop = [&workers, &running, &ready](size_t w) -> PtrT
+    {
+        auto try_pop = [&running, &ready](Worker &wk) -> PtrT
+        {
+            std::unique_lock lk(wk.m);
+            if (wk.q.empty())
+                return nullptr;
+            std::pop_heap(wk.q.begin(), wk.q.end(), [](auto &a, auto &b) { return a.first < b.first; });
+            auto c = wk.q.back().second;
+            wk.q.pop_back();
+            // keep order: running must be visible before ready is decreased
+            running++;
+            ready--;
+            return c;
+        };
+
+        if (auto c = try_pop(workers[w]))
+            return c;
+        for (size_t i = 1; i < workers.size(); i++)
+        {
+            if (auto c = try_pop(workers[(w + i) % workers.size()]))
+            {
+                workers[w].steals++;
+                return c;
+            }
+        }
+        return nullptr;
+    };
+
+    auto run = [this, &push, &running, &ready, &processed, &stopped, &done, &askip_errors, &eptrs_mutex, &eptrs, &wake, &admission](size_t w, PtrT c)
+    {
+        // pushed again by the command releasing budget, it is still running,
+        // so running cannot drop to zero here
+        Admission::Lock al;
+        if (!admission.tryLock(*c, al))
+        {
+            running--;
+            return;
+        }
+
+        bool release = true;
+        try
+        {
+            c->execute();
+        }
+        catch (...)
+        {
+            if (--askip_errors < 1)
+                stopped = true;
+            {
+                std::unique_lock lk(eptrs_mutex);
+                eptrs.push_back(std::current_exception());
+            }
+            // don't go futher on DAG by default
+            release = !throw_on_errors;
+        }
+        for (auto d : admission.release(al))
+            push(w, d);
+        processed++;
+
+        if (release)
+        {
+            for (auto &d : c->dependent_commands)
+            {
+                if (--d->dependencies_left == 0)
+                    push(w, d);
+            }
+        }
+
+        if (stop_time && Clock::now() > *stop_time)
+            stopped = true;
+
+        // nothing is running and nothing can be started
+        if (--running == 0 && ready == 0)
+            done = true;
+        if (done || stopped)
+            wake(true);
+    };
+
+    auto worker = [this, &workers, &pop, &run, &ready, &stopped, &done, &wait_mutex, &cv](size_t w)
+    {
+        while (!done && !stopped && !interrupted)
+        {
+            if (auto c = pop(w))
+            {
+                run(w, c);
+                continue;
+            }
+
+            auto t0 = Clock::now();
+            {
+                std::unique_lock lk(wait_mutex);
+                // timeout is used to notice external interruption
+                cv.wait_for(lk, std::chrono::milliseconds(100), [this, &ready, &stopped, &done]
+                {
+                    return ready > 0 || done || stopped || interrupted;
+                });
+            }
+            workers[w].idle += Clock::now() - t0;
+        }
+    };
+
+    // run commands without deps
+    size_t w = 0;
+    for (auto &c : commands)
+    {
+        if (!c->getDependencies().empty())
+            continue;
+        push(w++ % nworkers, c);
+    }
+    if (!ready)
+        throw SW_RUNTIME_ERROR("No commands without deps were added");
+
+    auto t0 = Clock::now();
+    std::vector<Future<void>> fs;
+    for (size_t i = 0; i < nworkers; i++)
+        fs.push_back(e.push([&worker, i] { worker(i); }));
+    for (auto &f : fs)
+        f.wait();
+
+    scheduler_stats = {};
+    scheduler_stats.workers = nworkers;
+    scheduler_stats.wall_time = Clock::now() - t0;
+    for (auto &wk : workers)
+    {
+        scheduler_stats.idle_time += wk.idle;
+        scheduler_stats.steals += wk.steals;
+    }
+
+    for (auto &f : fs)
+    {
+        if (f.state->eptr)
+            eptrs.push_back(f.state->eptr);
+    }
+    if (terminated)
+        throw SW_RUNTIME_ERROR("Interrupted");
+    if (!eptrs.empty() && throw_on_errors)
+        throw support::ExceptionVector(eptrs);
+
+    auto sz = commands.size();
+    if (processed != sz)
     {
         if (stop_time && Clock::now() > *stop_time && stopped)
             throw SW_RUNTIME_ERROR("Time limit exceeded");
         if (interrupted)
             throw SW_RUNTIME_ERROR("Interrupted");
-        throw SW_RUNTIME_ERROR("Executor did not perform all steps (" + std::to_string(i) + "/" + std::to_string(sz) + ")");
+        throw SW_RUNTIME_ERROR("Executor did not perform all steps (" + std::to_string(processed) + "/" + std::to_string(sz) + ")");
     }
 }
 
@@ -242,12 +663,105 @@ void ExecutionPlan::saveChromeTrace(const path &p) const
             e["args"]["command_line"].push_back(a->toString());
         for (auto &[k, v] : c2->environment)
             e["args"]["environment"][k] = v;
+        e["args"]["resources"] = c2->process_stats.toString();
         events.push_back(e);
     }
     trace["traceEvents"] = events;
     write_file(p, trace.dump(2));
 }
 
+void ExecutionPlan::saveBuildStats(const path &p, const std::function<String(const builder::Command &)> &get_target) const
+{
+    struct Group
+    {
+        size_t commands = 0;
+        uint64_t wall_time = 0; // ns
+        uint64_t max_peak_rss = 0;
+        ProcessStats sum;
+
+        void add(const builder::Command &c, uint64_t wall)
+        {
+            commands++;
+            wall_time += wall;
+            max_peak_rss = std::max(max_peak_rss, c.process_stats.peak_rss);
+            sum += c.process_stats;
+        }
+
+        nlohmann::json toJson() const
+        {
+            auto s = [](uint64_t ns) { return ns / 1'000'000'000.0; };
+            nlohmann::json j;
+            j["commands"] = commands;
+            j["wall_time"] = s(wall_time);
+            j["user_time"] = s(sum.user_time);
+            j["system_time"] = s(sum.system_time);
+            // > 1 for multithreaded programs, much less than 1 when waiting for io or memory
+            j["cpu_utilization"] = wall_time ? (double)(sum.user_time + sum.system_time) / wall_time : 0.0;
+            j["max_peak_rss"] = max_peak_rss;
+            j["read_bytes"] = sum.read_bytes;
+            j["write_bytes"] = sum.write_bytes;
+            j["voluntary_context_switches"] = sum.voluntary_context_switches;
+            j["involuntary_context_switches"] = sum.involuntary_context_switches;
+            return j;
+        }
+    };
+
+    Group total;
+    std::map<String, Group> targets;
+    std::map<String, Group> programs;
+    // +rss at start, -rss at end
+    std::vector<std::pair<builder::Command::Clock::time_point, int64_t>> rss_events;
+    nlohmann::json jcommands = nlohmann::json::array();
+    for (auto &c : commands)
+    {
+        auto c2 = dynamic_cast<builder::Command *>(c);
+        // not executed (up to date, failed dependencies) or restored from action cache
+        if (!c2 || c2->t_begin.time_since_epoch().count() == 0 || c2->t_end < c2->t_begin)
+            continue;
+
+        auto wall = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(c2->t_end - c2->t_begin).count();
+        auto target = get_target ? get_target(*c2) : String{};
+        auto program = to_string(c2->getProgram().filename().u8string());
+
+        total.add(*c2, wall);
+        targets[target].add(*c2, wall);
+        programs[program].add(*c2, wall);
+        rss_events.emplace_back(c2->t_begin, (int64_t)c2->process_stats.peak_rss);
+        rss_events.emplace_back(c2->t_end, -(int64_t)c2->process_stats.peak_rss);
+
+        Group g;
+        g.add(*c2, wall);
+        auto j = g.toJson();
+        j.erase("commands");
+        j["name"] = c2->getName();
+        j["target"] = target;
+        j["program"] = program;
+        j["peak_rss"] = c2->process_stats.peak_rss;
+        j.erase("max_peak_rss");
+        jcommands.push_back(j);
+    }
+
+    // upper bound, as if all peaks happen at the same time
+    std::sort(rss_events.begin(), rss_events.end());
+    int64_t rss = 0, max_rss = 0;
+    for (auto &[_, v] : rss_events)
+    {
+        rss += v;
+        max_rss = std::max(max_rss, rss);
+    }
+
+    nlohmann::json j;
+    j["total"] = total.toJson();
+    j["total"]["max_concurrent_peak_rss"] = max_rss;
+    j["total"]["physical_memory"] = getPhysicalMemory();
+    for (auto &[k, g] : targets)
+        j["targets"][k] = g.toJson();
+    for (auto &[k, g] : programs)
+        j["programs"][k] = g.toJson();
+    j["commands"] = std::move(jcommands);
+    write_file(p, j.dump(2));
+}
+
 bool ExecutionPlan::isValid() const
 {
     return unprocessed_commands.empty();
@@ -407,8 +921,77 @@ std::tuple<ExecutionPlan::Graph, ExecutionPlan::VertexMap> ExecutionPlan::transi
     return { tr, vm };
 }
 
+// runs f(i) for i in [0, n) on the caller and executor threads, rethrows first exception
+// prepare() may be called from executor tasks, so the caller never waits for helpers
+// that did not start, it waits only for chunks taken by others
+template <class F>
+static void parallel_for(size_t n, F &&f)
+{
+    // small plans are not worth scheduling tasks
+    static constexpr size_t min_parallel = 4096;
+    static constexpr size_t chunk = 256;
+
+    auto &e = getExecutor();
+    size_t nthreads = n < min_parallel ? 1 : std::max<size_t>(1, e.numberOfThreads());
+    if (nthreads == 1)
+    {
+        for (size_t i = 0; i < n; i++)
+            f(i);
+        return;
+    }
+
+    // helpers may run after we return, so state is shared
+    struct State
+    {
+        std::atomic_size_t next = 0;
+        std::atomic_bool failed = false;
+        size_t chunks_left;
+        std::exception_ptr eptr;
+        std::mutex m;
+        std::condition_variable cv;
+    };
+    auto st = std::make_shared<State>();
+    st->chunks_left = (n + chunk - 1) / chunk;
+
+    // late helpers find nothing to take and do not touch f
+    auto work = [st, n, &f]
+    {
+        while (1)
+        {
+            auto b = st->next.fetch_add(chunk);
+            if (b >= n)
+                break;
+            try
+            {
+                // after an error remaining chunks are only counted
+                for (auto i = b, e = std::min(b + chunk, n); i < e && !st->failed; i++)
+                    f(i);
+            }
+            catch (...)
+            {
+                std::unique_lock lk(st->m);
+                if (!st->eptr)
+                    st->eptr = std::current_exception();
+                st->failed = true;
+            }
+            std::unique_lock lk(st->m);
+            if (--st->chunks_left == 0)
+                st->cv.notify_all();
+        }
+    };
+    for (size_t i = 1; i < nthreads; i++)
+        e.push(work);
+    work();
+    std::unique_lock lk(st->m);
+    st->cv.wait(lk, [&st] { return st->chunks_left == 0; });
+    if (st->eptr)
+        std::rethrow_exception(st->eptr);
+}
+
 void ExecutionPlan::prepare(USet &cmds)
 {
+    SW_TRACE_ZONE("ExecutionPlan::prepare");
+
     // prepare commands
     for (auto &c : cmds)
         c->prepare();
@@ -416,6 +999,7 @@ void ExecutionPlan::prepare(USet &cmds)
     // 1. check that we have all of deps too
     // 2. check that we do not have duplicates by hash
     std::unordered_set<size_t> hashes;
+    hashes.reserve(cmds.size());
     for (auto &c : cmds)
     {
         if (!hashes.emplace(c->getHash()).second)
@@ -431,34 +1015,55 @@ void ExecutionPlan::prepare(USet &cmds)
     // some commands get its i/o deps in wrong order,
     // so we explicitly call this once more
     // do not remove!
-    std::unordered_map<path, CommandNode *> generators;
-    std::unordered_map<path, std::unordered_set<CommandNode *>> simultaneous_generators;
-    generators.reserve(cmds.size());
+    std::vector<builder::Command *> bcmds;
+    bcmds.reserve(cmds.size());
     for (auto &c : cmds)
     {
-        auto c1 = dynamic_cast<builder::Command *>(c);
-        if (!c1)
-            continue;
+        if (auto c1 = dynamic_cast<builder::Command *>(c))
+            bcmds.push_back(c1);
+    }
+
+    // output -> producer, maps are sharded by path hash and filled in parallel
+    static constexpr size_t n_shards = 64;
+    struct Shard
+    {
+        std::mutex m;
+        std::unordered_map<path, CommandNode *> generators;
+        std::unordered_map<path, std::vector<CommandNode *>> simultaneous_generators;
+    };
+    std::vector<Shard> shards(n_shards);
+    auto get_shard = [&shards](const path &p) -> Shard & { return shards[std::hash<path>()(p) % n_shards]; };
+
+    parallel_for(bcmds.size(), [&bcmds, &get_shard](size_t i)
+    {
+        auto c1 = bcmds[i];
         for (auto &o : c1->outputs)
         {
-            if (!generators.emplace(o, c1).second)
+            auto &s = get_shard(o);
+            std::unique_lock lk(s.m);
+            if (!s.generators.emplace(o, c1).second)
                 throw SW_RUNTIME_ERROR("Output file is generated with more than one command: " + to_printable_string(o));
         }
         for (auto &o : c1->simultaneous_outputs)
-            simultaneous_generators[o].insert(c1);
-    }
-    for (auto &c : cmds)
+        {
+            auto &s = get_shard(o);
+            std::unique_lock lk(s.m);
+            s.simultaneous_generators[o].push_back(c1);
+        }
+    });
+
+    // maps are read only now, every command changes only its own dependencies
+    parallel_for(bcmds.size(), [&bcmds, &get_shard](size_t i)
     {
-        auto c1 = dynamic_cast<builder::Command *>(c);
-        if (!c1)
-            continue;
-        auto f = [&generators, &simultaneous_generators, &c1](auto &inputs)
+        auto c1 = bcmds[i];
+        auto f = [&get_shard, &c1](auto &inputs)
         {
             for (auto &i : inputs)
             {
-                if (auto it = generators.find(i); it != generators.end())
+                auto &s = get_shard(i);
+                if (auto it = s.generators.find(i); it != s.generators.end())
                     c1->addDependency(*it->second);
-                if (auto it = simultaneous_generators.find(i); it != simultaneous_generators.end())
+                if (auto it = s.simultaneous_generators.find(i); it != s.simultaneous_generators.end())
                 {
                     for (auto &&c : it->second)
                         c1->addDependency(*c);
@@ -467,36 +1072,177 @@ void ExecutionPlan::prepare(USet &cmds)
         };
         f(c1->inputs);
         f(c1->inputs_without_timestamps);
-    }
+    });
 }
 
 void ExecutionPlan::init(USet &cmds)
 {
-    while (!cmds.empty())
+    SW_TRACE_ZONE("ExecutionPlan::init");
+    trace::counter("commands", cmds.size());
+
+    // dense ids
+    const auto n = cmds.size();
+    VecT nodes(cmds.begin(), cmds.end());
+    std::unordered_map<PtrT, uint32_t> ids;
+    ids.reserve(n);
+    for (uint32_t i = 0; i < n; i++)
+        ids[nodes[i]] = i;
+
+    // dependency -> dependents in CSR layout
+    std::vector<uint32_t> offsets(n + 1);
+    std::vector<uint32_t> deps_left(n);
+    for (uint32_t i = 0; i < n; i++)
+    {
+        for (auto &d : nodes[i]->getDependencies())
+        {
+            if (auto it = ids.find(d); it != ids.end())
+            {
+                offsets[it->second + 1]++;
+                deps_left[i]++;
+            }
+        }
+    }
+    for (size_t i = 0; i < n; i++)
+        offsets[i + 1] += offsets[i];
+    std::vector<uint32_t> edges(offsets[n]);
     {
-        bool added = false;
-        for (auto it = cmds.begin(); it != cmds.end();)
+        auto pos = offsets;
+        for (uint32_t i = 0; i < n; i++)
         {
-            // count number of deps
-            auto n = std::count_if((*it)->getDependencies().begin(), (*it)->getDependencies().end(),
-                [this, &cmds](auto &d) { return cmds.find(d) != cmds.end(); });
-            if (n)
+            for (auto &d : nodes[i]->getDependencies())
             {
-                it++;
+                if (auto it = ids.find(d); it != ids.end())
+                    edges[pos[it->second]++] = i;
+            }
+        }
+    }
+
+    // Kahn: roots go first, so executor can start them before anything else
+    std::vector<uint32_t> order;
+    order.reserve(n);
+    for (uint32_t i = 0; i < n; i++)
+    {
+        if (!deps_left[i])
+            order.push_back(i);
+    }
+    std::sort(order.begin(), order.end(), [&nodes](auto a, auto b)
+    {
+        return nodes[a]->lessDuringExecution(*nodes[b]);
+    });
+    for (size_t q = 0; q < order.size(); q++)
+    {
+        auto v = order[q];
+        for (auto e = offsets[v]; e < offsets[v + 1]; e++)
+        {
+            if (--deps_left[edges[e]] == 0)
+                order.push_back(edges[e]);
+        }
+    }
+
+    if (order.size() != n)
+    {
+        commands.reserve(order.size());
+        for (auto i : order)
+        {
+            commands.push_back(nodes[i]);
+            cmds.erase(nodes[i]);
+        }
+        unprocessed_commands.insert(unprocessed_commands.end(), cmds.begin(), cmds.end());
+        unprocessed_commands_set = cmds;
+
+        // Tarjan on what is left, only strong components with several nodes are cycles,
+        // other unprocessed commands just depend on them
+        const uint32_t undef = -1;
+        std::vector<uint32_t> index(n, undef), low(n), stack;
+        std::vector<bool> on_stack(n);
+        std::vector<std::pair<uint32_t, uint32_t>> calls; // node, next edge
+        std::vector<std::vector<uint32_t>> sccs;
+        uint32_t counter = 0;
+        auto visit = [&](uint32_t v)
+        {
+            index[v] = low[v] = counter++;
+            stack.push_back(v);
+            on_stack[v] = true;
+            calls.emplace_back(v, offsets[v]);
+        };
+        for (uint32_t s = 0; s < n; s++)
+        {
+            if (!deps_left[s] || index[s] != undef)
                 continue;
+            visit(s);
+            while (!calls.empty())
+            {
+                auto v = calls.back().first;
+                if (calls.back().second < offsets[v + 1])
+                {
+                    auto w = edges[calls.back().second++];
+                    if (!deps_left[w])
+                        continue;
+                    if (index[w] == undef)
+                        visit(w);
+                    else if (on_stack[w])
+                        low[v] = std::min(low[v], index[w]);
+                    continue;
+                }
+                if (low[v] == index[v])
+                {
+                    std::vector<uint32_t> scc;
+                    uint32_t w;
+                    do
+                    {
+                        w = stack.back();
+                        stack.pop_back();
+                        on_stack[w] = false;
+                        scc.push_back(w);
+                    } while (w != v);
+                    if (scc.size() > 1)
+                        sccs.push_back(std::move(scc));
+                }
+                calls.pop_back();
+                if (!calls.empty())
+                    low[calls.back().first] = std::min(low[calls.back().first], low[v]);
             }
-            added = true;
-            commands.push_back(*it);
-            it = cmds.erase(it);
         }
-        if (!added)
+
+        // shortest cycle through the first node of every component (bfs over dependents)
+        std::vector<uint32_t> scc_id(n, undef), parent(n, undef);
+        for (uint32_t k = 0; k < sccs.size(); k++)
         {
-            // We failed with stupid algorithm, now we must perform smarter.
-            // Shall we?
-            unprocessed_commands.insert(unprocessed_commands.end(), cmds.begin(), cmds.end());
-            unprocessed_commands_set = cmds;
-            return;
+            for (auto v : sccs[k])
+                scc_id[v] = k;
+        }
+        for (uint32_t k = 0; k < sccs.size(); k++)
+        {
+            auto s = sccs[k][0];
+            std::vector<uint32_t> q{ s };
+            uint32_t last = undef;
+            for (size_t qi = 0; qi < q.size() && last == undef; qi++)
+            {
+                auto v = q[qi];
+                for (auto e = offsets[v]; e < offsets[v + 1]; e++)
+                {
+                    auto w = edges[e];
+                    if (scc_id[w] != k)
+                        continue;
+                    if (w == s)
+                    {
+                        last = v;
+                        break;
+                    }
+                    if (parent[w] != undef)
+                        continue;
+                    parent[w] = v;
+                    q.push_back(w);
+                }
+            }
+            // v is a dependent of parent[v], so walking back gives dependency order
+            VecT cycle;
+            for (auto v = last; v != s; v = parent[v])
+                cycle.push_back(nodes[v]);
+            cycle.push_back(nodes[s]);
+            cycles.push_back(std::move(cycle));
         }
+        return;
     }
 
     // setup
@@ -508,17 +1254,35 @@ void ExecutionPlan::init(USet &cmds)
     //transitiveReduction();
 
     // set number of deps and dependent commands
-    for (auto &c : commands)
+    commands.reserve(n);
+    for (auto i : order)
     {
+        auto c = nodes[i];
+        commands.push_back(c);
         c->dependencies_left = c->getDependencies().size();
-        for (auto &d : c->getDependencies())
-            d->dependent_commands.insert(c);
+        for (auto e = offsets[i]; e < offsets[i + 1]; e++)
+            c->dependent_commands.insert(nodes[edges[e]]);
     }
+    cmds.clear();
+}
 
-    std::sort(commands.begin(), commands.end(), [](const auto &c1, const auto &c2)
+String ExecutionPlan::getCyclesReport(size_t max_cycles) const
+{
+    String s;
+    s += std::to_string(cycles.size()) + " dependency cycle(s) found, " +
+        std::to_string(unprocessed_commands.size()) + " command(s) cannot be executed\n";
+    for (size_t i = 0; i < cycles.size() && i < max_cycles; i++)
     {
-        return c1->lessDuringExecution(*c2);
-    });
+        auto &c = cycles[i];
+        s += "cycle " + std::to_string(i + 1) + " (" + std::to_string(c.size()) + " commands):\n";
+        s += "    " + c[0]->getName() + "\n";
+        for (size_t j = 1; j < c.size(); j++)
+            s += "      depends on " + c[j]->getName() + "\n";
+        s += "      depends on " + c[0]->getName() + "\n";
+    }
+    if (cycles.size() > max_cycles)
+        s += "... and " + std::to_string(cycles.size() - max_cycles) + " more\n";
+    return s;
 }
 
 void ExecutionPlan::setTimeLimit(const Clock::duration &d)
@@ -19,6 +19,7 @@
 #pragma once
 
 #include "command.h"
+#include "command_executor.h"
 
 #include <boost/graph/graph_traits.hpp>
 #include <boost/graph/adjacency_list.hpp>
@@ -58,6 +59,33 @@ struct SW_BUILDER_API ExecutionPlan
 
     using Clock = std::chrono::steady_clock;
 
+    enum class SchedulerType
+    {
+        // every ready command is pushed into shared executor queue (FIFO)
+        Default,
+        // per-worker ready queues with stealing,
+        // commands on the longest remaining path go first
+        WorkStealing,
+    };
+
+    // machine budget shared by running commands, zero is unlimited
+    // a command starts only when its weights fit,
+    // a command bigger than the whole budget runs alone
+    struct ResourceBudget
+    {
+        uint64_t memory = 0; // bytes
+        int threads = 0;
+    };
+
+    struct SchedulerStats
+    {
+        size_t workers = 0;
+        size_t steals = 0;
+        Clock::duration wall_time{};
+        // sum of time when workers had nothing to do
+        Clock::duration idle_time{};
+    };
+
 public:
     int64_t skip_errors = 0;
     bool throw_on_errors = true;
@@ -65,6 +93,10 @@ public:
     bool silent = false;
     bool show_output = false;
     bool write_output_to_file = false;
+    SchedulerType scheduler = SchedulerType::Default;
+    ResourceBudget budget;
+    // runs commands instead of local processes when set
+    std::shared_ptr<CommandExecutor> command_executor;
 
     ExecutionPlan(USet &cmds);
     ExecutionPlan(const ExecutionPlan &rhs) = delete;
@@ -73,22 +105,34 @@ public:
 
     //
     void execute(Executor &e) const;
+    // prepare executed plan to be run again (resident builds)
+    void reset() const;
 
-    // external request to stop execution
-    // running commands will be finished
-    // TODO: break running commands too
+    // external request to stop execution, returns immediately
+    // running commands will be finished, or killed with their child processes
+    // when interrupt_running_commands is set, their partial outputs are removed
     void stop(bool interrupt_running_commands = false);
 
     // functions for builder::Command's
+    // type: 0 - binary (mapped on load), 1 - text archive (old format)
+    // load() detects format by itself
     static Commands load(const path &, const SwBuilderContext &, int type = 0);
     void save(const path &, int type = 0) const;
 
     void saveChromeTrace(const path &) const;
+    /// resource usage of executed commands in json: every command, totals,
+    /// sums per target (given by get_target) and per program
+    void saveBuildStats(const path &, const std::function<String(const builder::Command &)> &get_target = {}) const;
     void setTimeLimit(const Clock::duration &);
+    const SchedulerStats &getSchedulerStats() const { return scheduler_stats; }
 
     const VecT &getCommands() const { return commands; }
     const VecT &getUnprocessedCommands() const { return unprocessed_commands; }
     const USet &getUnprocessedCommandsSet() const { return unprocessed_commands_set; }
+    /// dependency cycles found by init(), every cycle is ordered: c[i] depends on c[i + 1], last one on the first
+    const Vec<VecT> &getCycles() const { return cycles; }
+    /// human readable description of cycles
+    String getCyclesReport(size_t max_cycles = 10) const;
 
     bool isValid() const;
 
@@ -142,10 +186,14 @@ private:
     VecT commands;
     VecT unprocessed_commands;
     USet unprocessed_commands_set;
+    Vec<VecT> cycles;
     mutable std::atomic_bool interrupted;
+    // running commands were killed
+    mutable std::atomic_bool terminated;
 
     //
     std::optional<Clock::time_point> stop_time;
+    mutable SchedulerStats scheduler_stats;
 
     static GraphMapping getGraphMapping(const VecT &v);
     static Graph getGraph(const VecT &v, GraphMapping &gm);
@@ -153,6 +201,9 @@ private:
     static std::tuple<Graph, VertexMap> transitiveReduction(const Graph &g);
     static void prepare(USet &cmds);
     void init(USet &cmds);
+    void executeWorkStealing(Executor &e) const;
+    void setEstimatedCosts() const;
+    std::vector<uint64_t> getCriticalPathLengths() const;
 };
 
 extern template SW_BUILDER_API void ExecutionPlan::printGraph(const ExecutionPlan::Graph &, const path &base, const ExecutionPlan::VecT &, bool);
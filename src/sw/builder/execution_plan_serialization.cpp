@@ -21,19 +21,22 @@
 #include <boost/serialization/base_object.hpp>
 #include <boost/serialization/export.hpp>
 
-#include <boost/archive/binary_iarchive.hpp>
-#include <boost/archive/binary_oarchive.hpp>
 #include <boost/archive/text_iarchive.hpp>
 #include <boost/archive/text_oarchive.hpp>
 
+#include "command_arena.h"
 #include "command_storage.h"
 //
 
 #include "execution_plan.h"
 
+#include "mapped_table.h"
 #include "sw_context.h"
 
 #include <sw/support/serialization.h>
+#include <sw/support/trace.h>
+
+#include <cstring>
 
 #define SERIALIZATION_TYPE sw::builder::Command
 SERIALIZATION_BEGIN_UNIFIED
@@ -66,6 +69,8 @@ SERIALIZATION_BEGIN_UNIFIED
     ar & v.always;
     ar & v.remove_outputs_before_execution;
     ar & v.strict_order;
+    ar & v.memory_estimate;
+    ar & v.thread_count;
     ar & v.output_dirs;
 
     ar & v.inputs;
@@ -86,8 +91,8 @@ SERIALIZATION_BEGIN_SPLIT
         v.push_back(std::make_unique<primitives::command::SimpleArgument>(s));
     }
 SERIALIZATION_SPLIT_CONTINUE
-    ar & v.size();
-    for (auto &a : v)
+    ar & v.size();
+    for (auto &a : v)
         ar & a->toString();
 SERIALIZATION_SPLIT_END
 
@@ -95,8 +100,8 @@ SERIALIZATION_SPLIT_END
 SERIALIZATION_BEGIN_SPLIT
     SW_UNIMPLEMENTED;
 SERIALIZATION_SPLIT_CONTINUE
-    ar & v.size();
-    for (auto &a : v)
+    ar & v.size();
+    for (auto &a : v)
         ar & (sw::builder::Command&)*a;
 SERIALIZATION_SPLIT_END
 
@@ -117,34 +122,425 @@ SERIALIZATION_SPLIT_END
 namespace sw
 {
 
-Commands ExecutionPlan::load(const path &p, const SwBuilderContext &swctx, int type)
+// binary plan format
+//
+// header
+// commands     - CommandRecord[n_commands]
+// indices      - u32[n_indices], lists of string ids and command ids referenced from commands
+// offsets      - u64[n_strings + 1], string i is data[offsets[i], offsets[i + 1])
+// data         - string table, paths are stored once
+//
+// Strings are not zero terminated. String 0 is empty.
+// Everything is read in place from mapped file.
+namespace
 {
-    Commands commands;
 
-    auto load = [&commands](auto &ar)
+static constexpr char explan_magic[8] = { 's', 'w', 'e', 'x', 'p', 'l', 'n', '\0' };
+static constexpr uint32_t explan_version = 2;
+// old text plans, bump when serialization of command changes
+static constexpr uint32_t text_plan_version = 1;
+
+struct ExplanHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t n_strings;
+    uint32_t n_commands;
+    uint32_t n_indices;
+    uint32_t current_path;
+    uint32_t reserved = 0;
+    uint64_t commands_offset;
+    uint64_t indices_offset;
+    uint64_t offsets_offset;
+    uint64_t data_offset;
+};
+
+struct ExplanRange
+{
+    uint32_t begin = 0;
+    uint32_t size = 0;
+};
+
+struct ExplanCommand
+{
+    enum : uint32_t
     {
-        path cp;
-        ar >> cp;
-        fs::current_path(cp);
-        ar >> commands;
+        HasCommandStorage               = 1 << 0,
+        Always                          = 1 << 1,
+        RemoveOutputsBeforeExecution    = 1 << 2,
+        OutAppend                       = 1 << 3,
+        ErrAppend                       = 1 << 4,
     };
 
-    type = 1;
-    if (type == 0)
-    {
-        std::ifstream ifs(p, std::ios_base::in | std::ios_base::binary);
-        if (!ifs)
-            throw SW_RUNTIME_ERROR("Cannot read file: " + to_string(p));
-        boost::archive::binary_iarchive ar(ifs);
-        load(ar);
+    uint32_t flags;
+    uint32_t deps_processor;
+    int32_t first_response_file_argument;
+    int32_t strict_order;
+    int32_t thread_count;
+    uint32_t reserved = 0;
+    uint64_t memory_estimate;
+
+    // strings
+    uint32_t name;
+    uint32_t command_storage_root;
+    uint32_t working_directory;
+    uint32_t in;
+    uint32_t out;
+    uint32_t err;
+    uint32_t deps_module;
+    uint32_t deps_function;
+    uint32_t deps_file;
+    uint32_t msvc_prefix;
+
+    // string lists
+    ExplanRange arguments;
+    ExplanRange environment; // key, value pairs
+    ExplanRange inputs;
+    ExplanRange inputs_without_timestamps;
+    ExplanRange outputs;
+    ExplanRange simultaneous_outputs;
+    ExplanRange output_dirs;
+    // command ids
+    ExplanRange dependencies;
+};
+
+static_assert(std::is_trivially_copyable_v<ExplanHeader> && std::is_trivially_copyable_v<ExplanCommand>);
+
+static size_t align8(size_t n)
+{
+    return (n + 7) & ~(size_t)7;
+}
+
+struct ExplanWriter
+{
+    std::unordered_map<String, uint32_t> string_ids;
+    std::vector<uint64_t> offsets{ 0, 0 };
+    String data;
+    std::vector<uint32_t> indices;
+
+    uint32_t add(const String &s)
+    {
+        if (s.empty())
+            return 0;
+        auto [i, inserted] = string_ids.emplace(s, (uint32_t)string_ids.size() + 1);
+        if (inserted)
+        {
+            data += s;
+            offsets.push_back(data.size());
+        }
+        return i->second;
+    }
+
+    uint32_t add(const path &p)
+    {
+        return add(to_string(to_path_string(p)));
+    }
+
+    template <class C>
+    ExplanRange addList(const C &c)
+    {
+        ExplanRange r{ (uint32_t)indices.size(), 0 };
+        for (auto &v : c)
+        {
+            indices.push_back(add(v));
+            r.size++;
+        }
+        return r;
+    }
+};
+
+struct ExplanReader
+{
+    MappedFile f;
+    const ExplanHeader *h = nullptr;
+    const ExplanCommand *commands = nullptr;
+    const uint32_t *indices = nullptr;
+    const uint64_t *offsets = nullptr;
+    const char *data = nullptr;
+    path fn;
+
+    ExplanReader(const path &fn)
+        : f(fn), fn(fn)
+    {
+        if (f.size() < sizeof(ExplanHeader))
+            error("too small");
+        h = (const ExplanHeader *)f.data();
+        if (memcmp(h->magic, explan_magic, sizeof(explan_magic)) != 0)
+            error("bad magic");
+        if (h->version != explan_version)
+            error("unsupported version " + std::to_string(h->version));
+        auto check = [this](uint64_t off, uint64_t sz)
+        {
+            if (off > f.size() || sz > f.size() - off || off % 8)
+                error("bad section");
+        };
+        check(h->commands_offset, (uint64_t)h->n_commands * sizeof(ExplanCommand));
+        check(h->indices_offset, (uint64_t)h->n_indices * sizeof(uint32_t));
+        check(h->offsets_offset, ((uint64_t)h->n_strings + 1) * sizeof(uint64_t));
+        commands = (const ExplanCommand *)(f.data() + h->commands_offset);
+        indices = (const uint32_t *)(f.data() + h->indices_offset);
+        offsets = (const uint64_t *)(f.data() + h->offsets_offset);
+        check(h->data_offset, offsets[h->n_strings]);
+        data = (const char *)f.data() + h->data_offset;
+    }
+
+    [[noreturn]]
+    void error(const String &e) const
+    {
+        throw SW_RUNTIME_ERROR("Bad execution plan file " + to_string(fn) + ": " + e);
+    }
+
+    std::string_view getString(uint32_t i) const
+    {
+        if (i >= h->n_strings)
+            error("bad string id");
+        if (offsets[i] > offsets[i + 1])
+            error("bad string offset");
+        return { data + offsets[i], data + offsets[i + 1] };
+    }
+
+    path getPath(uint32_t i) const
+    {
+        auto s = getString(i);
+        return path((const char8_t *)s.data(), (const char8_t *)s.data() + s.size());
+    }
+
+    template <class F>
+    void iterate(const ExplanRange &r, F &&f) const
+    {
+        if (r.begin > h->n_indices || r.size > h->n_indices - r.begin)
+            error("bad range");
+        for (auto i = r.begin; i < r.begin + r.size; i++)
+            f(indices[i]);
+    }
+
+    void getPaths(const ExplanRange &r, Files &files) const
+    {
+        files.reserve(r.size);
+        iterate(r, [this, &files](auto i) { files.insert(getPath(i)); });
+    }
+};
+
+}
+
+static Commands loadBinary(const path &p, const SwBuilderContext &swctx)
+{
+    ExplanReader r(p);
+    fs::current_path(r.getPath(r.h->current_path));
+
+    std::vector<std::shared_ptr<builder::Command>> cmds(r.h->n_commands);
+    for (auto &c : cmds)
+        c = std::make_shared<builder::Command>();
+    for (uint32_t i = 0; i < r.h->n_commands; i++)
+    {
+        auto &rc = r.commands[i];
+        auto &c = *cmds[i];
+        c.setContext(swctx);
+
+        c.name = r.getString(rc.name);
+        if (rc.flags & ExplanCommand::HasCommandStorage)
+        {
+            c.command_storage_root = r.getPath(rc.command_storage_root);
+            c.command_storage = &swctx.getCommandStorage(c.command_storage_root);
+        }
+        c.always = rc.flags & ExplanCommand::Always;
+        c.remove_outputs_before_execution = rc.flags & ExplanCommand::RemoveOutputsBeforeExecution;
+        c.first_response_file_argument = rc.first_response_file_argument;
+        c.strict_order = rc.strict_order;
+        c.thread_count = rc.thread_count;
+        c.memory_estimate = rc.memory_estimate;
+
+        c.deps_processor = (builder::Command::DepsProcessor)rc.deps_processor;
+        c.deps_module = r.getPath(rc.deps_module);
+        c.deps_function = r.getString(rc.deps_function);
+        c.deps_file = r.getPath(rc.deps_file);
+        c.msvc_prefix = r.getString(rc.msvc_prefix);
+
+        c.working_directory = r.getPath(rc.working_directory);
+        c.in.file = r.getPath(rc.in);
+        c.out.file = r.getPath(rc.out);
+        c.out.append = rc.flags & ExplanCommand::OutAppend;
+        c.err.file = r.getPath(rc.err);
+        c.err.append = rc.flags & ExplanCommand::ErrAppend;
+
+        c.arguments.reserve(rc.arguments.size);
+        r.iterate(rc.arguments, [&r, &c, &arena = swctx.getCommandArena()](auto i)
+        {
+            c.arguments.push_back(ArenaArgument::create(arena, r.getString(i)));
+        });
+        if (rc.environment.size % 2)
+            r.error("bad environment");
+        std::optional<String> key;
+        r.iterate(rc.environment, [&r, &c, &key](auto i)
+        {
+            if (!key)
+                key = r.getString(i);
+            else
+            {
+                c.environment[*key] = r.getString(i);
+                key.reset();
+            }
+        });
+
+        r.getPaths(rc.inputs, c.inputs);
+        r.getPaths(rc.inputs_without_timestamps, c.inputs_without_timestamps);
+        r.getPaths(rc.outputs, c.outputs);
+        r.getPaths(rc.simultaneous_outputs, c.simultaneous_outputs);
+        r.getPaths(rc.output_dirs, c.output_dirs);
+
+        // edges are stored, so producers are known without matching outputs
+        r.iterate(rc.dependencies, [&r, &c, &cmds](auto i)
+        {
+            if (i >= cmds.size())
+                r.error("bad dependency");
+            c.addDependency(*cmds[i]);
+        });
+    }
+    return Commands(cmds.begin(), cmds.end());
+}
+
+static void saveBinary(const path &p, const ExecutionPlan::VecT &commands)
+{
+    ExplanWriter w;
+
+    std::unordered_map<CommandNode *, uint32_t> ids;
+    ids.reserve(commands.size());
+    for (auto &c : commands)
+        ids.emplace(c, (uint32_t)ids.size());
+
+    std::vector<ExplanCommand> records;
+    records.reserve(commands.size());
+    for (auto &c0 : commands)
+    {
+        auto &c = static_cast<const builder::Command &>(*c0);
+        auto &rc = records.emplace_back();
+
+        rc.flags = 0;
+        if (c.command_storage)
+        {
+            rc.flags |= ExplanCommand::HasCommandStorage;
+            rc.command_storage_root = w.add(c.command_storage->root);
+        }
+        else
+            rc.command_storage_root = 0;
+        if (c.always)
+            rc.flags |= ExplanCommand::Always;
+        if (c.remove_outputs_before_execution)
+            rc.flags |= ExplanCommand::RemoveOutputsBeforeExecution;
+        if (c.out.append)
+            rc.flags |= ExplanCommand::OutAppend;
+        if (c.err.append)
+            rc.flags |= ExplanCommand::ErrAppend;
+        rc.first_response_file_argument = c.first_response_file_argument;
+        rc.strict_order = c.strict_order;
+        rc.thread_count = c.thread_count;
+        rc.memory_estimate = c.memory_estimate;
+
+        rc.name = w.add(c.name);
+        rc.deps_processor = (uint32_t)c.deps_processor;
+        rc.deps_module = w.add(c.deps_module);
+        rc.deps_function = w.add(c.deps_function);
+        rc.deps_file = w.add(c.deps_file);
+        rc.msvc_prefix = w.add(c.msvc_prefix);
+
+        rc.working_directory = w.add(c.working_directory);
+        rc.in = w.add(c.in.file);
+        rc.out = w.add(c.out.file);
+        rc.err = w.add(c.err.file);
+
+        Strings args;
+        args.reserve(c.arguments.size());
+        for (auto &a : c.arguments)
+            args.push_back(a->toString());
+        rc.arguments = w.addList(args);
+        Strings env;
+        for (auto &[k, v] : c.environment)
+        {
+            env.push_back(k);
+            env.push_back(v);
+        }
+        rc.environment = w.addList(env);
+
+        // sorted, so plan files of the same build are equal
+        rc.inputs = w.addList(FilesSorted(c.inputs.begin(), c.inputs.end()));
+        rc.inputs_without_timestamps = w.addList(FilesSorted(c.inputs_without_timestamps.begin(), c.inputs_without_timestamps.end()));
+        rc.outputs = w.addList(FilesSorted(c.outputs.begin(), c.outputs.end()));
+        rc.simultaneous_outputs = w.addList(FilesSorted(c.simultaneous_outputs.begin(), c.simultaneous_outputs.end()));
+        rc.output_dirs = w.addList(FilesSorted(c.output_dirs.begin(), c.output_dirs.end()));
+
+        std::vector<uint32_t> deps;
+        for (auto &d : c.getDependencies())
+        {
+            auto i = ids.find(d);
+            if (i == ids.end())
+                throw SW_RUNTIME_ERROR("Dependency is not in the plan: " + d->getName());
+            deps.push_back(i->second);
+        }
+        std::sort(deps.begin(), deps.end());
+        rc.dependencies = { (uint32_t)w.indices.size(), (uint32_t)deps.size() };
+        w.indices.insert(w.indices.end(), deps.begin(), deps.end());
     }
-    else if (type == 1)
-    {
+
+    ExplanHeader h;
+    memcpy(h.magic, explan_magic, sizeof(explan_magic));
+    h.version = explan_version;
+    h.current_path = w.add(fs::current_path());
+    h.n_strings = (uint32_t)w.offsets.size() - 1;
+    h.n_commands = (uint32_t)records.size();
+    h.n_indices = (uint32_t)w.indices.size();
+    h.commands_offset = align8(sizeof(h));
+    h.indices_offset = align8(h.commands_offset + records.size() * sizeof(ExplanCommand));
+    h.offsets_offset = align8(h.indices_offset + w.indices.size() * sizeof(uint32_t));
+    h.data_offset = align8(h.offsets_offset + w.offsets.size() * sizeof(uint64_t));
+
+    String out(h.data_offset + w.data.size(), 0);
+    memcpy(out.data(), &h, sizeof(h));
+    memcpy(out.data() + h.commands_offset, records.data(), records.size() * sizeof(ExplanCommand));
+    memcpy(out.data() + h.indices_offset, w.indices.data(), w.indices.size() * sizeof(uint32_t));
+    memcpy(out.data() + h.offsets_offset, w.offsets.data(), w.offsets.size() * sizeof(uint64_t));
+    memcpy(out.data() + h.data_offset, w.data.data(), w.data.size());
+    write_file(p, out);
+}
+
+static bool isBinaryPlan(const path &p)
+{
+    std::ifstream ifs(p, std::ios_base::in | std::ios_base::binary);
+    if (!ifs)
+        throw SW_RUNTIME_ERROR("Cannot read file: " + to_string(p));
+    char m[sizeof(explan_magic)] = {};
+    ifs.read(m, sizeof(m));
+    return ifs && memcmp(m, explan_magic, sizeof(m)) == 0;
+}
+
+Commands ExecutionPlan::load(const path &p, const SwBuilderContext &swctx, int type)
+{
+    SW_TRACE_ZONE("ExecutionPlan::load");
+
+    if (isBinaryPlan(p))
+        return loadBinary(p, swctx);
+
+    // old text plans
+    Commands commands;
+    {
         std::ifstream ifs(p);
         if (!ifs)
-            throw SW_RUNTIME_ERROR("Cannot read file: " + to_string(p));
+            throw SW_RUNTIME_ERROR("Cannot read file: " + to_string(p));
         boost::archive::text_iarchive ar(ifs);
-        load(ar);
+        // plans without version start with a path
+        uint32_t version = 0;
+        try
+        {
+            ar >> version;
+        }
+        catch (boost::archive::archive_exception &)
+        {
+        }
+        if (version != text_plan_version)
+            throw SW_RUNTIME_ERROR("Unsupported execution plan version: " + to_string(p));
+        path cp;
+        ar >> cp;
+        fs::current_path(cp);
+        ar >> commands;
     }
 
     // some setup
@@ -158,31 +554,20 @@ Commands ExecutionPlan::load(const path &p, const SwBuilderContext &swctx, int t
 
 void ExecutionPlan::save(const path &p, int type) const
 {
-    fs::create_directories(p.parent_path());
+    SW_TRACE_ZONE("ExecutionPlan::save");
 
-    auto save = [this](auto &ar)
-    {
-        ar << fs::current_path();
-        ar << commands;
-    };
+    fs::create_directories(p.parent_path());
 
-    type = 1;
     if (type == 0)
-    {
-        std::ofstream ofs(p, std::ios_base::out | std::ios_base::binary);
-        if (!ofs)
-            throw SW_RUNTIME_ERROR("Cannot write file: " + to_string(p));
-        boost::archive::binary_oarchive ar(ofs);
-        save(ar);
-    }
-    else if (type == 1)
-    {
-        std::ofstream ofs(p);
-        if (!ofs)
-            throw SW_RUNTIME_ERROR("Cannot write file: " + to_string(p));
-        boost::archive::text_oarchive ar(ofs);
-        save(ar);
-    }
+        return saveBinary(p, commands);
+
+    std::ofstream ofs(p);
+    if (!ofs)
+        throw SW_RUNTIME_ERROR("Cannot write file: " + to_string(p));
+    boost::archive::text_oarchive ar(ofs);
+    ar << text_plan_version;
+    ar << fs::current_path();
+    ar << commands;
 }
 
 }
@@ -23,7 +23,19 @@
 
 #include <sw/manager/settings.h>
 
+#include <primitives/exceptions.h>
 #include <primitives/executor.h>
+#include <primitives/templates.h>
+#include <xxhash.h>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
 
 #include <fstream>
 #include <sstream>
@@ -77,6 +89,7 @@ FileData &FileData::operator=(const FileData &rhs)
     //flags = rhs.flags;
 
     refreshed = rhs.refreshed.load();
+    content_hash = rhs.content_hash;
 
     // if we copy data during refresh() we get bad state
     // FIXME: later we must delete file data
@@ -114,35 +127,91 @@ const FileData &File::getFileData() const
     return *data;
 }
 
-void FileData::refresh(const path &file)
+bool FileData::startRefresh()
 {
     FileData::RefreshType r = FileData::RefreshType::Unrefreshed;
-    if (!refreshed.compare_exchange_strong(r, FileData::RefreshType::InProcess))
-        return;
+    return refreshed.compare_exchange_strong(r, FileData::RefreshType::InProcess);
+}
 
+void FileData::endRefresh(fs::file_type type, const fs::file_time_type &t)
+{
     bool changed = false;
-    auto s = fs::status(file);
-    if (s.type() != fs::file_type::regular)
+    if (type != fs::file_type::regular)
     {
-        if (s.type() != fs::file_type::not_found)
-            LOG_TRACE(logger, "checking for non-regular file: " << file);
         // we skip non regular files at the moment
         last_write_time = fs::file_time_type::min();
         changed = true;
     }
-    else
+    else if (t > last_write_time)
     {
-        auto t = fs::last_write_time(file);
-        if (t > last_write_time)
-        {
-            last_write_time = t;
-            changed = true;
-        }
+        last_write_time = t;
+        changed = true;
     }
 
     refreshed = changed ? FileData::RefreshType::Changed : FileData::RefreshType::NotChanged;
 }
 
+bool FileData::refresh(const path &file)
+{
+    if (!startRefresh())
+        return false;
+
+    fs::file_time_type t;
+    auto type = getFileStatus(file, t);
+    if (type != fs::file_type::regular && type != fs::file_type::not_found)
+        LOG_TRACE(logger, "checking for non-regular file: " << file);
+    endRefresh(type, t);
+    return true;
+}
+
+std::optional<FileContentKey> getFileContentKey(const path &p)
+{
+    FileContentKey k;
+#ifdef _WIN32
+    auto h = CreateFileW(p.wstring().c_str(), FILE_READ_ATTRIBUTES,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, 0);
+    if (h == INVALID_HANDLE_VALUE)
+        return {};
+    BY_HANDLE_FILE_INFORMATION i;
+    auto r = GetFileInformationByHandle(h, &i);
+    CloseHandle(h);
+    if (!r)
+        return {};
+    k.inode = ((uint64_t)i.nFileIndexHigh << 32) | i.nFileIndexLow;
+    k.size = ((uint64_t)i.nFileSizeHigh << 32) | i.nFileSizeLow;
+#else
+    struct stat st;
+    if (stat(p.c_str(), &st) != 0)
+        return {};
+    k.inode = st.st_ino;
+    k.size = st.st_size;
+#endif
+    std::error_code ec;
+    k.mtime = fs::last_write_time(p, ec);
+    if (ec)
+        return {};
+    return k;
+}
+
+uint64_t getFileContentHash(const path &p)
+{
+    ScopedFile f(p, "rb");
+    auto state = XXH3_createState();
+    if (!state)
+        throw SW_RUNTIME_ERROR("Cannot create hash state");
+    SCOPE_EXIT
+    {
+        XXH3_freeState(state);
+    };
+    XXH3_64bits_reset(state);
+    std::vector<char> buf(64 * 1024);
+    while (auto n = fread(buf.data(), 1, buf.size(), f.getHandle()))
+        XXH3_64bits_update(state, buf.data(), n);
+    if (ferror(f.getHandle()))
+        throw SW_RUNTIME_ERROR("Cannot read file: " + to_string(p));
+    return XXH3_64bits_digest(state);
+}
+
 bool File::isChanged() const
 {
     while (data->refreshed < FileData::RefreshType::NotChanged)
@@ -38,6 +38,22 @@ struct Command;
 
 struct FileStorage;
 
+// identity of file contents on disk, content hash is reused while it is the same
+struct FileContentKey
+{
+    uint64_t inode = 0;
+    uint64_t size = 0;
+    fs::file_time_type mtime = fs::file_time_type::min();
+
+    bool operator==(const FileContentKey &) const = default;
+};
+
+struct FileContentHash
+{
+    FileContentKey key;
+    uint64_t hash = 0;
+};
+
 struct FileData
 {
     enum class RefreshType : uint8_t
@@ -62,12 +78,20 @@ struct FileData
     std::atomic<RefreshType> refreshed{ RefreshType::Unrefreshed };
     //mutable std::mutex m;
 
+    // content hash mode, valid while content_hash.key.mtime == last_write_time
+    std::mutex m_content_hash;
+    FileContentHash content_hash;
+
     FileData() = default;
     FileData(const FileData &);
     FileData &operator=(const FileData &rhs);
 
     void reset();
-    void refresh(const path &file);
+    /// returns true if file system was queried by this call
+    bool refresh(const path &file);
+    /// used by batched queries, file data is updated only if start returned true
+    bool startRefresh();
+    void endRefresh(fs::file_type, const fs::file_time_type &);
 };
 
 struct SW_BUILDER_API File : virtual ICastable
@@ -95,6 +119,14 @@ private:
     mutable FileData *data = nullptr;
 };
 
+/// single file system query, mtime is set for regular files only
+SW_BUILDER_API
+fs::file_type getFileStatus(const path &, fs::file_time_type &);
+SW_BUILDER_API
+std::optional<FileContentKey> getFileContentKey(const path &);
+SW_BUILDER_API
+uint64_t getFileContentHash(const path &);
+
 #define EXPLAIN_OUTDATED(subject, outdated, reason, name) \
     explainMessage(subject, outdated, reason, name)
 
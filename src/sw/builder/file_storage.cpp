@@ -21,12 +21,79 @@
 #include "file.h"
 #include "sw_context.h"
 
+#include <primitives/executor.h>
+#include <primitives/templates.h>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include <primitives/log.h>
 DECLARE_STATIC_LOGGER(logger, "file_storage");
 
+// directories with less requested files are not listed
+#define MIN_FILES_TO_LIST_DIR 16
+
 namespace sw
 {
 
+#ifdef _WIN32
+static fs::file_type getFileStatus(DWORD attrs, const FILETIME &ft, fs::file_time_type &t)
+{
+    if (attrs & FILE_ATTRIBUTE_DIRECTORY)
+        return fs::file_type::directory;
+    // file clock has the same epoch and resolution
+    t = fs::file_time_type(fs::file_time_type::duration(((int64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime));
+    return fs::file_type::regular;
+}
+#else
+static fs::file_type getFileStatus(const struct stat &st, fs::file_time_type &t)
+{
+    if (S_ISDIR(st.st_mode))
+        return fs::file_type::directory;
+    if (!S_ISREG(st.st_mode))
+        return fs::file_type::unknown;
+#ifdef __APPLE__
+    auto &ts = st.st_mtimespec;
+#else
+    auto &ts = st.st_mtim;
+#endif
+    auto st_time = std::chrono::sys_time<std::chrono::nanoseconds>(std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec));
+    t = std::chrono::time_point_cast<fs::file_time_type::duration>(std::chrono::file_clock::from_sys(st_time));
+    return fs::file_type::regular;
+}
+#endif
+
+fs::file_type getFileStatus(const path &p, fs::file_time_type &t)
+{
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA d;
+    if (!GetFileAttributesExW(p.wstring().c_str(), GetFileExInfoStandard, &d))
+        return fs::file_type::not_found;
+    if (!(d.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+        return getFileStatus(d.dwFileAttributes, d.ftLastWriteTime, t);
+    // follow links
+    std::error_code ec;
+    auto s = fs::status(p, ec);
+    if (s.type() == fs::file_type::regular)
+        t = fs::last_write_time(p, ec);
+    return ec ? fs::file_type::not_found : s.type();
+#else
+    struct stat st;
+    if (stat(p.c_str(), &st) != 0)
+        return fs::file_type::not_found;
+    return getFileStatus(st, t);
+#endif
+}
+
 void FileStorage::clear()
 {
     files.clear();
@@ -38,13 +105,126 @@ void FileStorage::reset()
         f.reset();
 }
 
+void FileStorage::reset(const path &f)
+{
+    if (auto d = files.find(normalize_path(f)))
+        d->reset();
+}
+
 FileData &FileStorage::registerFile(const path &in_f)
 {
     auto p = normalize_path(in_f);
     auto d = files.insert(p);
-    if (d.second)
-        d.first->refresh(in_f);
+    if (!d.second)
+    {
+        stats.saved++;
+        return *d.first;
+    }
+    // may be in process of prefetching
+    while (d.first->refreshed < FileData::RefreshType::NotChanged)
+    {
+        if (d.first->refresh(in_f))
+            stats.issued++;
+    }
     return *d.first;
 }
 
+void FileStorage::prefetch(const Files &in, Executor *e)
+{
+    std::unordered_map<path, std::vector<std::pair<path, FileData *>>> dirs;
+    for (auto &f : in)
+    {
+        auto p = normalize_path(f);
+        auto &d = *files.insert(p).first;
+        if (d.refreshed != FileData::RefreshType::Unrefreshed)
+            continue;
+        auto dir = p.parent_path();
+        dirs[dir].emplace_back(std::move(p), &d);
+    }
+
+    if (!e || dirs.size() < 2)
+    {
+        for (auto &[dir, v] : dirs)
+            prefetch(dir, v);
+        return;
+    }
+
+    Futures<void> futures;
+    for (auto &[dir, v] : dirs)
+        futures.push_back(e->push([this, &dir = dir, &v = v] { prefetch(dir, v); }));
+    waitAndGet(futures);
+}
+
+void FileStorage::prefetch(const path &dir, const std::vector<std::pair<path, FileData *>> &files)
+{
+#ifdef _WIN32
+    for (auto &[p, d] : files)
+    {
+        if (d->refresh(p))
+            stats.issued++;
+    }
+#else
+    // queries relative to directory skip path resolution
+    auto dfd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    stats.issued++;
+    if (dfd == -1)
+    {
+        bool missing = errno == ENOENT || errno == ENOTDIR;
+        for (auto &[p, d] : files)
+        {
+            if (!missing)
+            {
+                if (d->refresh(p))
+                    stats.issued++;
+            }
+            else if (d->startRefresh())
+            {
+                d->endRefresh(fs::file_type::not_found, {});
+                stats.saved++;
+            }
+        }
+        return;
+    }
+    SCOPE_EXIT
+    {
+        close(dfd);
+    };
+
+    // missing files of large batches are found without stat
+    std::unordered_set<String> names;
+    bool listed = false;
+    if (files.size() >= MIN_FILES_TO_LIST_DIR)
+    {
+        if (auto d = fdopendir(dup(dfd)))
+        {
+            while (auto e = readdir(d))
+                names.insert(e->d_name);
+            closedir(d);
+            listed = true;
+            stats.listed_dirs++;
+        }
+    }
+
+    for (auto &[p, d] : files)
+    {
+        if (!d->startRefresh())
+            continue;
+        auto fn = p.filename().string();
+        if (listed && !names.contains(fn))
+        {
+            d->endRefresh(fs::file_type::not_found, {});
+            stats.saved++;
+            continue;
+        }
+        struct stat st;
+        fs::file_time_type t;
+        auto type = fs::file_type::not_found;
+        if (fstatat(dfd, fn.c_str(), &st, 0) == 0)
+            type = getFileStatus(st, t);
+        stats.issued++;
+        d->endRefresh(type, t);
+    }
+#endif
+}
+
 }
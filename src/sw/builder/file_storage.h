@@ -22,6 +22,10 @@
 
 #include <primitives/filesystem.h>
 
+#include <atomic>
+
+struct Executor;
+
 namespace sw
 {
 
@@ -30,14 +34,36 @@ struct SwBuilderContext;
 
 struct SW_BUILDER_API FileStorage
 {
-    using FileDataHashMap = ConcurrentHashMap<path, FileData>;
+    using FileDataHashMap = ConcurrentMap<path, FileData>;
+
+    struct Stats
+    {
+        // file system queries
+        std::atomic_uint64_t issued{ 0 };
+        // answered from cache or from directory listings
+        std::atomic_uint64_t saved{ 0 };
+        std::atomic_uint64_t listed_dirs{ 0 };
+    };
 
     FileDataHashMap files;
 
     void clear(); // remove?
     void reset(); // remove?
+    // forget cached state of single file, does nothing for unknown files
+    void reset(const path &f);
 
     FileData &registerFile(const path &f);
+
+    /// Queries files that are not known yet, grouped by directories.
+    /// Directories are processed in parallel when executor is passed.
+    void prefetch(const Files &, Executor * = nullptr);
+
+    const Stats &getStats() const { return stats; }
+
+private:
+    Stats stats;
+
+    void prefetch(const path &dir, const std::vector<std::pair<path, FileData *>> &);
 };
 
 }
@@ -0,0 +1,148 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "file_watcher.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <cstring>
+#include <unistd.h>
+#endif
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "file_watcher");
+
+namespace sw
+{
+
+FileWatcher::FileWatcher()
+{
+#ifdef __linux__
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd == -1)
+        LOG_WARN(logger, "Cannot init inotify: " << strerror(errno));
+#endif
+}
+
+FileWatcher::~FileWatcher()
+{
+#ifdef __linux__
+    if (fd != -1)
+        close(fd);
+#endif
+}
+
+bool FileWatcher::isSupported() const
+{
+    return fd != -1;
+}
+
+void FileWatcher::add(const path &in)
+{
+    if (!isSupported())
+        return;
+
+    auto dir = normalize_path(in);
+    std::unique_lock lk(m);
+    if (dirs.contains(dir))
+        return;
+#ifdef __linux__
+    auto wd = inotify_add_watch(fd, to_string(dir).c_str(),
+        IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+        IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+    if (wd == -1)
+    {
+        // missing dirs are not watched, but their parents are
+        LOG_TRACE(logger, "Cannot watch " << dir << ": " << strerror(errno));
+        return;
+    }
+    dirs[dir] = wd;
+    watches[wd] = dir;
+#endif
+}
+
+void FileWatcher::clear()
+{
+    std::unique_lock lk(m);
+#ifdef __linux__
+    for (auto &[wd, _] : watches)
+        inotify_rm_watch(fd, wd);
+#endif
+    dirs.clear();
+    watches.clear();
+}
+
+bool FileWatcher::poll(std::vector<Event> &events)
+{
+    if (!isSupported())
+        return false;
+
+    bool ok = true;
+#ifdef __linux__
+    std::unique_lock lk(m);
+    alignas(inotify_event) char buf[64 * 1024];
+    while (1)
+    {
+        auto n = read(fd, buf, sizeof(buf));
+        if (n <= 0)
+        {
+            if (n == -1 && errno != EAGAIN && errno != EINTR)
+            {
+                LOG_WARN(logger, "Cannot read inotify events: " << strerror(errno));
+                ok = false;
+            }
+            if (n == -1 && errno == EINTR)
+                continue;
+            break;
+        }
+        for (auto p = buf; p < buf + n;)
+        {
+            auto e = (const inotify_event *)p;
+            p += sizeof(inotify_event) + e->len;
+
+            if (e->mask & IN_Q_OVERFLOW)
+            {
+                ok = false;
+                continue;
+            }
+            auto i = watches.find(e->wd);
+            if (i == watches.end())
+                continue;
+            if (e->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+            {
+                events.push_back({ i->second, true });
+                if (e->mask & IN_IGNORED)
+                {
+                    dirs.erase(i->second);
+                    watches.erase(i);
+                }
+                continue;
+            }
+            if (!e->len)
+                continue;
+            Event ev;
+            ev.file = i->second / e->name;
+            ev.structural = e->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
+            events.push_back(ev);
+        }
+    }
+#endif
+    return ok;
+}
+
+}
@@ -0,0 +1,65 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <primitives/filesystem.h>
+
+#include <mutex>
+#include <unordered_map>
+
+namespace sw
+{
+
+/// Watches directories (non-recursively) for file changes.
+/// Uses inotify on linux, on other systems nothing is reported
+/// and every poll() tells that changes are unknown.
+struct SW_BUILDER_API FileWatcher
+{
+    struct Event
+    {
+        path file;
+        // file was created, removed or renamed,
+        // otherwise its contents or attributes are changed
+        bool structural = false;
+    };
+
+    FileWatcher();
+    FileWatcher(const FileWatcher &) = delete;
+    FileWatcher &operator=(const FileWatcher &) = delete;
+    ~FileWatcher();
+
+    bool isSupported() const;
+
+    /// does nothing for already watched dirs
+    void add(const path &dir);
+    void clear();
+
+    /// appends events happened since last call
+    /// returns false when some events were lost or watching is not supported,
+    /// everything must be rechecked then
+    bool poll(std::vector<Event> &);
+
+private:
+    int fd = -1;
+    std::mutex m;
+    std::unordered_map<path, int> dirs;
+    std::unordered_map<int, path> watches;
+};
+
+}
@@ -0,0 +1,434 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "mapped_table.h"
+
+#include <primitives/exceptions.h>
+
+#include <atomic>
+#include <fstream>
+
+#define MAPPED_TABLE_MAGIC 0x454c42415457535fULL // "_SWTABLE"
+#define MAPPED_TABLE_FORMAT_VERSION 1
+
+namespace sw
+{
+
+struct MappedTable::Header
+{
+    uint64_t magic;
+    uint64_t version;
+    uint64_t capacity; // power of two
+    uint64_t count;
+    uint64_t data_size; // committed bytes in data file, tail after it is garbage of interrupted writes
+    uint64_t garbage; // bytes of overwritten records
+};
+
+namespace
+{
+
+// slot value = record offset << 24 | record size
+struct Slot
+{
+    uint64_t key;
+    uint64_t value;
+};
+
+constexpr auto size_bits = 24;
+constexpr uint64_t max_record_size = (1ULL << size_bits) - 1;
+constexpr auto record_header_size = sizeof(uint64_t) + sizeof(uint32_t);
+constexpr uint64_t initial_capacity = 1024;
+
+uint64_t mix(uint64_t k)
+{
+    // murmur3 finalizer
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+Slot *getSlots(uint8_t *index)
+{
+    return (Slot *)(index + sizeof(uint64_t) * 6);
+}
+
+uint64_t load(const uint64_t &v)
+{
+    return std::atomic_ref<uint64_t>(const_cast<uint64_t &>(v)).load(std::memory_order_acquire);
+}
+
+void store(uint64_t &v, uint64_t nv)
+{
+    std::atomic_ref<uint64_t>(v).store(nv, std::memory_order_release);
+}
+
+void createIndex(const path &fn, uint64_t capacity)
+{
+    {
+        std::ofstream ofs(fn, std::ios::binary | std::ios::trunc);
+        if (!ofs)
+            throw SW_RUNTIME_ERROR("Cannot create file: " + to_string(fn));
+    }
+    fs::resize_file(fn, sizeof(uint64_t) * 6 + capacity * sizeof(Slot));
+}
+
+}
+
+MappedTable::MappedTable(const path &basename)
+    : basename(basename)
+{
+    reopen();
+}
+
+MappedTable::MappedTable(const path &basename, uint64_t gen)
+    : basename(basename), gen(gen), follow_gen(false)
+{
+    openIndex();
+    remapData();
+}
+
+MappedTable::~MappedTable()
+{
+}
+
+static path getGenerationFilename(const path &basename)
+{
+    return path(basename) += ".gen";
+}
+
+static path getDataFilename(const path &basename, uint64_t gen)
+{
+    return path(basename) += "." + std::to_string(gen) + ".dat";
+}
+
+static path getIndexFilename(const path &basename, uint64_t gen)
+{
+    return path(basename) += "." + std::to_string(gen) + ".idx";
+}
+
+static uint64_t readGeneration(const path &basename)
+{
+    auto fn = getGenerationFilename(basename);
+    if (!fs::exists(fn))
+        return 0;
+    return std::stoull(read_file(fn));
+}
+
+path MappedTable::getDataFilename() const
+{
+    return sw::getDataFilename(basename, gen);
+}
+
+path MappedTable::getIndexFilename() const
+{
+    return sw::getIndexFilename(basename, gen);
+}
+
+void MappedTable::reopen()
+{
+    // pick up changes made by other processes: compaction, index growth
+    if (follow_gen)
+    {
+        auto g = readGeneration(basename);
+        if (g != gen && data)
+            old_data.push_back(std::move(data));
+        gen = g;
+    }
+    openIndex();
+    remapData();
+}
+
+void MappedTable::openIndex()
+{
+    auto fn = getIndexFilename();
+    fs::create_directories(fn.parent_path());
+    if (!fs::exists(fn))
+    {
+        // build into temp file, so others never see half-initialized index
+        auto tmp = path(fn) += ".tmp" + std::to_string(mix((uint64_t)this));
+        createIndex(tmp, initial_capacity);
+        {
+            MappedFile f(tmp);
+            auto &h = *(Header *)f.data();
+            h.magic = MAPPED_TABLE_MAGIC;
+            h.version = MAPPED_TABLE_FORMAT_VERSION;
+            h.capacity = initial_capacity;
+        }
+        error_code ec;
+        fs::rename(tmp, fn, ec);
+        if (ec)
+            fs::remove(tmp, ec); // someone else was faster
+    }
+    index = MappedFile(fn);
+    if (index.size() < sizeof(Header) ||
+        header().magic != MAPPED_TABLE_MAGIC ||
+        header().version != MAPPED_TABLE_FORMAT_VERSION ||
+        index.size() != sizeof(Header) + header().capacity * sizeof(Slot))
+    {
+        throw SW_RUNTIME_ERROR("Bad table index: " + to_string(fn));
+    }
+}
+
+void MappedTable::remapData() const
+{
+    auto fn = getDataFilename();
+    if (!fs::exists(fn))
+        return;
+    MappedFile f(fn);
+    if (f.size() <= data.size())
+        return;
+    if (data)
+        old_data.push_back(std::move(data));
+    data = std::move(f);
+}
+
+MappedTable::Header &MappedTable::header() const
+{
+    return *(Header *)index.data();
+}
+
+size_t MappedTable::capacity() const
+{
+    return header().capacity;
+}
+
+MappedTable::Key MappedTable::slotKey(size_t i) const
+{
+    return load(getSlots(index.data())[i].key);
+}
+
+uint64_t MappedTable::slotValue(size_t i) const
+{
+    return load(getSlots(index.data())[i].value);
+}
+
+std::optional<size_t> MappedTable::findSlot(Key k) const
+{
+    const auto cap = capacity();
+    const auto mask = cap - 1;
+    for (size_t i = mix(k) & mask, n = 0; n < cap; i = (i + 1) & mask, n++)
+    {
+        auto key = slotKey(i);
+        if (!key)
+            return {};
+        if (key == k)
+            return i;
+    }
+    return {};
+}
+
+std::optional<std::string_view> MappedTable::read(Key k, uint64_t value) const
+{
+    auto offset = value >> size_bits;
+    auto size = value & max_record_size;
+    if (offset + record_header_size + size > data.size())
+        return {};
+    auto p = data.data() + offset;
+    uint64_t key;
+    uint32_t sz;
+    memcpy(&key, p, sizeof(key));
+    memcpy(&sz, p + sizeof(key), sizeof(sz));
+    if (key != k || sz != size)
+        return {};
+    return std::string_view((const char *)p + record_header_size, size);
+}
+
+std::optional<std::string_view> MappedTable::find(Key k) const
+{
+    if (!k)
+        return {};
+    {
+        std::shared_lock lk(m);
+        auto i = findSlot(k);
+        if (!i)
+            return {};
+        if (auto v = read(k, slotValue(*i)))
+            return v;
+    }
+    // record was appended after we mapped data file
+    std::unique_lock lk(m);
+    remapData();
+    auto i = findSlot(k);
+    if (!i)
+        return {};
+    return read(k, slotValue(*i));
+}
+
+void MappedTable::insert(Key k, std::string_view v)
+{
+    if (!k)
+        throw SW_RUNTIME_ERROR("MappedTable: zero key");
+    if (v.size() > max_record_size)
+        throw SW_RUNTIME_ERROR("MappedTable: record is too big");
+    std::unique_lock lk(m);
+    pending.emplace_back(k, String(v));
+}
+
+void MappedTable::flush()
+{
+    std::unique_lock lk(m);
+    if (pending.empty())
+        return;
+    reopen();
+
+    // drop tail of interrupted write
+    auto fn = getDataFilename();
+    auto data_size = header().data_size;
+    if (fs::exists(fn) && fs::file_size(fn) != data_size)
+        fs::resize_file(fn, data_size);
+
+    String buf;
+    std::vector<uint64_t> offsets;
+    offsets.reserve(pending.size());
+    for (auto &[k, v] : pending)
+    {
+        offsets.push_back(data_size + buf.size());
+        uint32_t sz = v.size();
+        buf.append((const char *)&k, sizeof(k));
+        buf.append((const char *)&sz, sizeof(sz));
+        buf += v;
+    }
+    {
+        ScopedFile f(fn, "ab");
+        if (fwrite(buf.data(), buf.size(), 1, f.getHandle()) != 1)
+            throw SW_RUNTIME_ERROR("Cannot write file: " + to_string(fn));
+        fflush(f.getHandle());
+    }
+
+    // data goes first, then index
+    for (size_t i = 0; i < pending.size(); i++)
+        put(pending[i].first, offsets[i], pending[i].second.size());
+    store(header().data_size, data_size + buf.size());
+    pending.clear();
+    remapData();
+}
+
+void MappedTable::put(Key k, uint64_t offset, size_t size)
+{
+    if ((header().count + 1) * 2 > capacity())
+        grow();
+
+    auto value = offset << size_bits | size;
+    auto slots = getSlots(index.data());
+    const auto mask = capacity() - 1;
+    for (size_t i = mix(k) & mask;; i = (i + 1) & mask)
+    {
+        auto key = slotKey(i);
+        if (key == k)
+        {
+            header().garbage += record_header_size + (slotValue(i) & max_record_size);
+            store(slots[i].value, value);
+            return;
+        }
+        if (!key)
+        {
+            // value first, readers check key
+            store(slots[i].value, value);
+            store(slots[i].key, k);
+            header().count++;
+            return;
+        }
+    }
+}
+
+void MappedTable::grow()
+{
+    auto fn = getIndexFilename();
+    auto tmp = path(fn) += ".tmp";
+    auto cap = capacity() * 2;
+    createIndex(tmp, cap);
+    {
+        MappedFile f(tmp);
+        auto &h = *(Header *)f.data();
+        h = header();
+        h.capacity = cap;
+        auto slots = getSlots(f.data());
+        const auto mask = cap - 1;
+        for (size_t i = 0, n = capacity(); i < n; i++)
+        {
+            auto k = slotKey(i);
+            if (!k)
+                continue;
+            auto j = mix(k) & mask;
+            while (slots[j].key)
+                j = (j + 1) & mask;
+            slots[j].key = k;
+            slots[j].value = slotValue(i);
+        }
+    }
+    // others keep old mapping until reopen
+    index = MappedFile();
+    fs::rename(tmp, fn);
+    index = MappedFile(fn);
+}
+
+size_t MappedTable::size() const
+{
+    return header().count;
+}
+
+size_t MappedTable::getDataSize() const
+{
+    return header().data_size;
+}
+
+size_t MappedTable::getGarbageSize() const
+{
+    return header().garbage;
+}
+
+bool MappedTable::needsCompaction() const
+{
+    static constexpr auto min_size = 16 * 1024 * 1024;
+    return getDataSize() > min_size && getGarbageSize() * 2 > getDataSize();
+}
+
+void MappedTable::compact(const path &basename)
+{
+    const auto old_gen = readGeneration(basename);
+    const auto new_gen = old_gen + 1;
+
+    // remove leftovers of interrupted compaction
+    error_code ec;
+    fs::remove(sw::getDataFilename(basename, new_gen), ec);
+    fs::remove(sw::getIndexFilename(basename, new_gen), ec);
+
+    {
+        MappedTable t(basename, old_gen);
+        MappedTable n(basename, new_gen);
+        t.for_each([&n](auto k, auto v)
+        {
+            n.insert(k, v);
+        });
+        n.flush();
+    }
+
+    auto genfn = getGenerationFilename(basename);
+    auto tmp = path(genfn) += ".tmp";
+    write_file(tmp, std::to_string(new_gen));
+    fs::rename(tmp, genfn);
+
+    // may fail on windows when others still use these files
+    fs::remove(sw::getDataFilename(basename, old_gen), ec);
+    fs::remove(sw::getIndexFilename(basename, old_gen), ec);
+}
+
+}
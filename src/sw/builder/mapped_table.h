@@ -0,0 +1,107 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <sw/support/mapped_file.h>
+
+#include <shared_mutex>
+#include <string_view>
+
+namespace sw
+{
+
+/// persistent append-only key -> blob table
+///
+/// files:
+///   <basename>.gen         - current generation number (changed by compaction)
+///   <basename>.<gen>.dat   - records: u64 key, u32 size, data
+///   <basename>.<gen>.idx   - header + open addressing hash table of (key, record offset)
+///
+/// Opening does not read the data, both files are mapped and looked up in place.
+/// Writers (insert(), compact()) must hold an inter-process lock.
+struct SW_BUILDER_API MappedTable
+{
+    using Key = uint64_t;
+
+    MappedTable(const path &basename);
+    MappedTable(const MappedTable &) = delete;
+    MappedTable &operator=(const MappedTable &) = delete;
+    ~MappedTable();
+
+    /// returned view is valid during table lifetime
+    /// key 0 is reserved
+    std::optional<std::string_view> find(Key) const;
+    void insert(Key, std::string_view);
+    void flush();
+
+    template <class F>
+    void for_each(F &&f) const
+    {
+        std::shared_lock lk(m);
+        auto n = capacity();
+        for (size_t i = 0; i < n; i++)
+        {
+            auto k = slotKey(i);
+            if (!k)
+                continue;
+            if (auto v = read(k, slotValue(i)))
+                f(k, *v);
+        }
+    }
+
+    size_t size() const;
+    size_t getDataSize() const;
+    size_t getGarbageSize() const;
+    bool needsCompaction() const;
+
+    /// rewrites live records into the next generation
+    static void compact(const path &basename);
+
+private:
+    struct Header;
+
+    path basename;
+    uint64_t gen = 0;
+    bool follow_gen = true;
+    mutable std::shared_mutex m;
+    MappedFile index;
+    mutable MappedFile data;
+    // remapped data files, views into them must stay valid
+    mutable std::vector<MappedFile> old_data;
+    std::vector<std::pair<Key, String>> pending;
+
+    MappedTable(const path &basename, uint64_t gen);
+
+    path getDataFilename() const;
+    path getIndexFilename() const;
+
+    Header &header() const;
+    size_t capacity() const;
+    Key slotKey(size_t i) const;
+    uint64_t slotValue(size_t i) const;
+    std::optional<size_t> findSlot(Key) const;
+    std::optional<std::string_view> read(Key, uint64_t value) const;
+    void put(Key, uint64_t offset, size_t size);
+    void reopen();
+    void openIndex();
+    void remapData() const;
+    void grow();
+};
+
+}
@@ -0,0 +1,156 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "output_capture.h"
+
+namespace sw
+{
+
+RingBuffer::RingBuffer(size_t capacity)
+    : buf(capacity)
+{
+}
+
+void RingBuffer::append(std::string_view s)
+{
+    if (buf.empty())
+        return;
+    // only the last bytes survive
+    if (s.size() > buf.size())
+        s.remove_prefix(s.size() - buf.size());
+    auto first = std::min(s.size(), buf.size() - pos);
+    memcpy(buf.data() + pos, s.data(), first);
+    memcpy(buf.data(), s.data() + first, s.size() - first);
+    pos = (pos + s.size()) % buf.size();
+    n = std::min(n + s.size(), buf.size());
+}
+
+String RingBuffer::str() const
+{
+    String s;
+    s.reserve(n);
+    auto begin = (pos + buf.size() - n) % std::max<size_t>(buf.size(), 1);
+    auto first = std::min(n, buf.size() - begin);
+    s.append(buf.data() + begin, first);
+    s.append(buf.data(), n - first);
+    return s;
+}
+
+OutputCapture::OutputCapture(const path &spill_dir, size_t head_size, size_t tail_size)
+    : spill_dir(spill_dir), head_size(head_size), tail(tail_size)
+{
+}
+
+OutputCapture::~OutputCapture()
+{
+    if (!is_spilled || keep_spill_file)
+        return;
+    spill.reset();
+    error_code ec;
+    fs::remove(spill_file, ec);
+}
+
+void OutputCapture::add(std::string_view s)
+{
+    while (!s.empty())
+    {
+        auto p = s.find('\n');
+        if (p == s.npos)
+        {
+            partial += s;
+            // do not grow on output without line ends
+            if (partial.size() >= max_line_size)
+            {
+                addLine(partial, false);
+                partial.clear();
+            }
+            return;
+        }
+        if (partial.empty())
+            addLine(s.substr(0, p));
+        else
+        {
+            partial += s.substr(0, p);
+            addLine(partial);
+            partial.clear();
+        }
+        s.remove_prefix(p + 1);
+    }
+}
+
+void OutputCapture::addLine(std::string_view line, bool eol)
+{
+    if (filter && !filter(line))
+        return;
+    if (on_line)
+        on_line(line);
+
+    total += line.size() + eol;
+    if (!spill && head.size() + line.size() + 1 <= head_size)
+    {
+        head += line;
+        if (eol)
+            head += '\n';
+        return;
+    }
+
+    if (!spill)
+    {
+        spill_file = spill_dir / (unique_path() += ".txt");
+        fs::create_directories(spill_dir);
+        spill = std::make_unique<ScopedFile>(spill_file, "wb");
+        is_spilled = true;
+        fwrite(head.data(), head.size(), 1, spill->getHandle());
+    }
+    fwrite(line.data(), line.size(), 1, spill->getHandle());
+    tail.append(line);
+    if (eol)
+    {
+        fputc('\n', spill->getHandle());
+        tail.append("\n");
+    }
+}
+
+String OutputCapture::finish(bool keep_spill_file)
+{
+    // the last line has no line end
+    if (!partial.empty())
+    {
+        addLine(partial, false);
+        partial.clear();
+    }
+    if (!is_spilled)
+        return head;
+    this->keep_spill_file = keep_spill_file;
+
+    spill.reset(); // flush
+    auto t = tail.str();
+    // tail may start in the middle of a line
+    if (tail.size() < total - head.size())
+    {
+        auto p = t.find('\n');
+        t = p == t.npos ? String{} : t.substr(p + 1);
+    }
+    auto skipped = total - head.size() - t.size();
+    auto note = "... " + std::to_string(skipped) + " bytes skipped";
+    if (keep_spill_file)
+        note += ", full output: " + to_string(spill_file.u8string());
+    return head + note + "\n" + t;
+}
+
+} // namespace sw
@@ -0,0 +1,100 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <primitives/filesystem.h>
+
+#include <functional>
+#include <limits>
+#include <memory>
+#include <string_view>
+
+namespace sw
+{
+
+/// Fixed size buffer keeping the last written bytes.
+struct SW_BUILDER_API RingBuffer
+{
+    RingBuffer(size_t capacity);
+
+    void append(std::string_view);
+    /// contents in write order
+    String str() const;
+    size_t size() const { return n; }
+    void clear() { pos = n = 0; }
+
+private:
+    std::vector<char> buf;
+    size_t pos = 0; // next write position
+    size_t n = 0;
+};
+
+/// Bounded capture of one output stream of a command.
+///
+/// The first head_size and the last tail_size bytes are kept in memory.
+/// When output is bigger, it goes to a spill file in spill_dir as a whole.
+/// With head_size = unlimited output is kept whole.
+/// Chunks are split into lines, so filter and live handler see whole lines only
+/// (without line end, very long lines are split).
+struct SW_BUILDER_API OutputCapture
+{
+    // return false to drop the line
+    using LineFilter = std::function<bool(std::string_view)>;
+    using LineHandler = std::function<void(std::string_view)>;
+
+    static constexpr size_t max_line_size = 64 * 1024;
+    static constexpr size_t unlimited = std::numeric_limits<size_t>::max();
+
+    LineFilter filter;
+    // lines passed the filter, in order
+    LineHandler on_line;
+
+    OutputCapture(const path &spill_dir, size_t head_size = 64 * 1024, size_t tail_size = 64 * 1024);
+    OutputCapture(const OutputCapture &) = delete;
+    OutputCapture &operator=(const OutputCapture &) = delete;
+    ~OutputCapture();
+
+    void add(std::string_view chunk);
+    /// Processes the last line, returns output passed the filter.
+    /// Spilled output is returned as head and tail with a note about skipped part.
+    /// Spill file is removed in destructor unless it is kept and mentioned in the note.
+    String finish(bool keep_spill_file = false);
+
+    bool spilled() const { return is_spilled; }
+    /// empty when output was not spilled
+    const path &getSpillFile() const { return spill_file; }
+    /// bytes passed the filter
+    uint64_t size() const { return total; }
+
+private:
+    path spill_dir;
+    path spill_file;
+    size_t head_size;
+    String partial;
+    String head;
+    RingBuffer tail;
+    uint64_t total = 0;
+    std::unique_ptr<ScopedFile> spill;
+    bool is_spilled = false;
+    bool keep_spill_file = false;
+
+    void addLine(std::string_view, bool eol = true);
+};
+
+} // namespace sw
@@ -0,0 +1,112 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "path_table.h"
+
+#include <primitives/exceptions.h>
+
+namespace sw
+{
+
+PathTable::PathTable()
+    : chunks(std::make_unique<std::atomic<Entry *>[]>(n_chunks))
+{
+}
+
+PathTable::~PathTable()
+{
+    for (size_t i = 0; i < n_chunks; i++)
+        delete[] chunks[i].load();
+}
+
+PathTable::Id PathTable::intern(const path &p)
+{
+    return internNormalized(normalize_path(p));
+}
+
+PathTable::Id PathTable::internNormalized(const path &p)
+{
+    auto h = std::hash<path>()(p);
+    auto &s = shards[h % n_shards];
+    {
+        std::shared_lock lk(s.m);
+        auto [b, e] = s.ids.equal_range(h);
+        for (auto i = b; i != e; ++i)
+        {
+            if (get(i->second).p == p)
+                return i->second;
+        }
+    }
+    std::unique_lock lk(s.m);
+    auto [b, e] = s.ids.equal_range(h);
+    for (auto i = b; i != e; ++i)
+    {
+        if (get(i->second).p == p)
+            return i->second;
+    }
+    auto id = add(path(p), h);
+    s.ids.emplace(h, id);
+    return id;
+}
+
+PathTable::Id PathTable::add(path &&p, size_t hash)
+{
+    auto id = n++;
+    if (id == std::numeric_limits<Id>::max())
+        throw SW_RUNTIME_ERROR("Too many paths");
+    auto &c = chunks[id >> chunk_bits];
+    auto chunk = c.load(std::memory_order_acquire);
+    if (!chunk)
+    {
+        std::unique_lock lk(m_chunks);
+        chunk = c.load(std::memory_order_acquire);
+        if (!chunk)
+        {
+            chunk = new Entry[chunk_size];
+            c.store(chunk, std::memory_order_release);
+        }
+    }
+    // published to others through shard lock
+    auto &e = chunk[id & (chunk_size - 1)];
+    e.p = std::move(p);
+    e.hash = hash;
+    return id;
+}
+
+const PathTable::Entry &PathTable::get(Id id) const
+{
+    return chunks[id >> chunk_bits].load(std::memory_order_acquire)[id & (chunk_size - 1)];
+}
+
+const path &PathTable::getPath(Id id) const
+{
+    return get(id).p;
+}
+
+size_t PathTable::getHash(Id id) const
+{
+    return get(id).hash;
+}
+
+PathTable &getPathTable()
+{
+    static PathTable t;
+    return t;
+}
+
+}
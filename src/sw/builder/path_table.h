@@ -0,0 +1,87 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <primitives/filesystem.h>
+
+#include <array>
+#include <atomic>
+#include <shared_mutex>
+#include <unordered_map>
+
+namespace sw
+{
+
+/// Process wide table of normalized paths.
+/// Every path gets small id which is stable while process is running.
+struct SW_BUILDER_API PathTable
+{
+    using Id = uint32_t;
+
+    PathTable();
+    PathTable(const PathTable &) = delete;
+    PathTable &operator=(const PathTable &) = delete;
+    ~PathTable();
+
+    /// path is normalized before lookup
+    Id intern(const path &);
+    Id internNormalized(const path &);
+
+    const path &getPath(Id) const;
+    /// same as std::hash of normalized path
+    size_t getHash(Id) const;
+
+    size_t size() const { return n; }
+
+private:
+    struct Entry
+    {
+        path p;
+        size_t hash;
+    };
+
+    struct Shard
+    {
+        std::shared_mutex m;
+        std::unordered_multimap<size_t, Id> ids;
+    };
+
+    static constexpr size_t chunk_bits = 16;
+    static constexpr size_t chunk_size = 1 << chunk_bits;
+    static constexpr size_t n_chunks = 1 << (32 - chunk_bits);
+    static constexpr size_t n_shards = 64;
+
+    // entries never move, so references are valid
+    std::unique_ptr<std::atomic<Entry *>[]> chunks;
+    std::array<Shard, n_shards> shards;
+    std::mutex m_chunks;
+    std::atomic<Id> n{ 0 };
+
+    const Entry &get(Id) const;
+    Id add(path &&, size_t hash);
+};
+
+SW_BUILDER_API
+PathTable &getPathTable();
+
+using PathId = PathTable::Id;
+/// without duplicates
+using PathIds = std::vector<PathId>;
+
+}
@@ -0,0 +1,313 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "process_monitor.h"
+
+#include "command.h"
+
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace sw
+{
+
+struct ProcessSample
+{
+    int pid;
+    // times and io include waited children
+    ProcessStats stats;
+};
+
+#ifdef __linux__
+static bool read_process(int pid, ProcessStats &st)
+{
+    static const uint64_t ns_per_tick = 1'000'000'000 / sysconf(_SC_CLK_TCK);
+
+    auto dir = "/proc/" + std::to_string(pid);
+    {
+        std::ifstream ifs(dir + "/stat");
+        String s;
+        if (!std::getline(ifs, s))
+            return false;
+        // name may contain spaces and parentheses
+        auto p = s.rfind(')');
+        if (p == s.npos)
+            return false;
+        std::istringstream iss(s.substr(p + 1));
+        // utime, stime, cutime, cstime are fields 14-17, state is field 3
+        uint64_t times[4]{};
+        String f;
+        for (int i = 3; i <= 17 && iss >> f; i++)
+        {
+            if (i >= 14)
+                times[i - 14] = std::stoull(f);
+        }
+        st.user_time = (times[0] + times[2]) * ns_per_tick;
+        st.system_time = (times[1] + times[3]) * ns_per_tick;
+    }
+    {
+        std::ifstream ifs(dir + "/status");
+        String line;
+        auto get = [&line](const char *key, uint64_t &v)
+        {
+            auto n = strlen(key);
+            if (line.compare(0, n, key) != 0)
+                return;
+            v = std::stoull(line.substr(n));
+        };
+        while (std::getline(ifs, line))
+        {
+            // VmHWM:     1234 kB
+            get("VmHWM:", st.peak_rss);
+            get("voluntary_ctxt_switches:", st.voluntary_context_switches);
+            get("nonvoluntary_ctxt_switches:", st.involuntary_context_switches);
+        }
+        st.peak_rss *= 1024;
+    }
+    {
+        // unreadable for processes of other users (setuid)
+        std::ifstream ifs(dir + "/io");
+        String k;
+        uint64_t v;
+        while (ifs >> k >> v)
+        {
+            if (k == "rchar:")
+                st.read_bytes = v;
+            else if (k == "wchar:")
+                st.write_bytes = v;
+        }
+    }
+    return true;
+}
+
+static void get_children(int pid, std::vector<int> &pids)
+{
+    std::error_code ec;
+    for (auto &t : fs::directory_iterator("/proc/" + std::to_string(pid) + "/task", ec))
+    {
+        std::ifstream ifs(t.path() / "children");
+        int child;
+        while (ifs >> child)
+        {
+            pids.push_back(child);
+            get_children(child, pids);
+        }
+    }
+}
+#endif
+
+#ifdef _WIN32
+static uint64_t to_ns(const FILETIME &t)
+{
+    return (((uint64_t)t.dwHighDateTime << 32) | t.dwLowDateTime) * 100;
+}
+#endif
+
+// returns false when process is gone or platform is not supported
+static bool sample_process_tree(int pid, std::vector<ProcessSample> &samples)
+{
+#if defined(_WIN32)
+    // children are not tracked, compilers and linkers do most of the work in the main process here
+    auto h = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid);
+    if (!h)
+        return false;
+    ProcessSample s{ pid };
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (K32GetProcessMemoryInfo(h, &pmc, sizeof(pmc)))
+        s.stats.peak_rss = pmc.PeakWorkingSetSize;
+    FILETIME creation, exit, kernel, user;
+    if (GetProcessTimes(h, &creation, &exit, &kernel, &user))
+    {
+        s.stats.user_time = to_ns(user);
+        s.stats.system_time = to_ns(kernel);
+    }
+    IO_COUNTERS io;
+    if (GetProcessIoCounters(h, &io))
+    {
+        s.stats.read_bytes = io.ReadTransferCount;
+        s.stats.write_bytes = io.WriteTransferCount;
+    }
+    CloseHandle(h);
+    samples.push_back(s);
+    return true;
+#elif defined(__linux__)
+    // gcc driver itself is tiny, the work is done by cc1plus, lto1, ld etc.
+    ProcessSample s{ pid };
+    if (!read_process(pid, s.stats))
+        return false;
+    samples.push_back(s);
+    std::vector<int> pids;
+    get_children(pid, pids);
+    for (auto p : pids)
+    {
+        ProcessSample s{ p };
+        if (read_process(p, s.stats))
+            samples.push_back(s);
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+ProcessStats &ProcessStats::operator+=(const ProcessStats &rhs)
+{
+    peak_rss += rhs.peak_rss;
+    user_time += rhs.user_time;
+    system_time += rhs.system_time;
+    read_bytes += rhs.read_bytes;
+    write_bytes += rhs.write_bytes;
+    voluntary_context_switches += rhs.voluntary_context_switches;
+    involuntary_context_switches += rhs.involuntary_context_switches;
+    return *this;
+}
+
+std::string ProcessStats::toString() const
+{
+    auto s = [](uint64_t ns) { return ns / 1'000'000'000.0; };
+    auto mb = [](uint64_t b) { return b / 1024.0 / 1024.0; };
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(2);
+    ss << "user " << s(user_time) << " s, sys " << s(system_time) << " s, peak rss " << mb(peak_rss) << " MB";
+    ss << ", read " << mb(read_bytes) << " MB, written " << mb(write_bytes) << " MB";
+    ss << ", context switches " << voluntary_context_switches << "/" << involuntary_context_switches;
+    return ss.str();
+}
+
+uint64_t getPhysicalMemory()
+{
+#ifdef _WIN32
+    MEMORYSTATUSEX s;
+    s.dwLength = sizeof(s);
+    if (!GlobalMemoryStatusEx(&s))
+        return 0;
+    return s.ullTotalPhys;
+#else
+    auto pages = sysconf(_SC_PHYS_PAGES);
+    auto page_size = sysconf(_SC_PAGESIZE);
+    if (pages <= 0 || page_size <= 0)
+        return 0;
+    return (uint64_t)pages * page_size;
+#endif
+}
+
+ProcessMonitor::ProcessMonitor(std::chrono::milliseconds interval)
+    : interval(interval)
+{
+}
+
+ProcessMonitor::~ProcessMonitor()
+{
+    {
+        std::unique_lock lk(m);
+        stopped = true;
+    }
+    cv.notify_all();
+    if (t.joinable())
+        t.join();
+}
+
+void ProcessMonitor::add(builder::Command &c)
+{
+    std::unique_lock lk(m);
+    // started on demand, so contexts without commands have no extra thread
+    if (!t.joinable())
+        t = std::thread([this] { run(); });
+    commands[&c];
+}
+
+void ProcessMonitor::remove(builder::Command &c)
+{
+    std::unique_lock lk(m);
+    commands.erase(&c);
+}
+
+void ProcessMonitor::run()
+{
+    std::unique_lock lk(m);
+    while (!stopped)
+    {
+        if (cv.wait_for(lk, interval, [this] { return stopped; }))
+            break;
+
+        // processes are sampled without the lock, so add() and remove() are not blocked
+        std::vector<std::pair<builder::Command *, int>> pids;
+        for (auto &[c, _] : commands)
+        {
+            // pid is set right after spawn
+            if (auto pid = c->getPid(); pid > 0)
+                pids.emplace_back(c, pid);
+        }
+        lk.unlock();
+        std::vector<std::vector<ProcessSample>> samples(pids.size());
+        for (size_t i = 0; i < pids.size(); i++)
+        {
+            if (!sample_process_tree(pids[i].second, samples[i]))
+                samples[i].clear();
+        }
+        lk.lock();
+
+        for (size_t i = 0; i < pids.size(); i++)
+        {
+            auto &[c, pid] = pids[i];
+            // removed or started again meanwhile
+            auto it = commands.find(c);
+            if (it == commands.end() || c->getPid() != pid || samples[i].empty())
+                continue;
+            update(*c, it->second, samples[i]);
+        }
+    }
+}
+
+void ProcessMonitor::update(builder::Command &c, std::unordered_map<int, Switches> &switches, const std::vector<ProcessSample> &samples)
+{
+    // live processes with everything they have waited for
+    ProcessStats tree;
+    for (auto &s : samples)
+    {
+        tree += s.stats;
+        switches[s.pid] = { s.stats.voluntary_context_switches, s.stats.involuntary_context_switches };
+    }
+
+    auto &st = c.process_stats;
+    st.peak_rss = std::max(st.peak_rss, tree.peak_rss);
+    st.user_time = std::max(st.user_time, tree.user_time);
+    st.system_time = std::max(st.system_time, tree.system_time);
+    st.read_bytes = std::max(st.read_bytes, tree.read_bytes);
+    st.write_bytes = std::max(st.write_bytes, tree.write_bytes);
+    st.voluntary_context_switches = 0;
+    st.involuntary_context_switches = 0;
+    for (auto &[_, s] : switches)
+    {
+        st.voluntary_context_switches += s.voluntary;
+        st.involuntary_context_switches += s.involuntary;
+    }
+}
+
+} // namespace sw
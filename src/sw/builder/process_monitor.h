@@ -0,0 +1,94 @@
+/*
+ * SW - Build System and Package Manager
+ * Copyright (C) 2020 Egor Pugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace sw
+{
+
+namespace builder { struct Command; }
+struct ProcessSample;
+
+// resource usage of a process with its children
+struct ProcessStats
+{
+    uint64_t peak_rss = 0; // bytes
+    uint64_t user_time = 0; // ns
+    uint64_t system_time = 0; // ns
+    // bytes passed through read/write calls, page cache hits included
+    uint64_t read_bytes = 0;
+    uint64_t write_bytes = 0;
+    uint64_t voluntary_context_switches = 0;
+    uint64_t involuntary_context_switches = 0;
+
+    ProcessStats &operator+=(const ProcessStats &);
+    std::string toString() const;
+};
+
+/// zero when unknown
+SW_BUILDER_API
+uint64_t getPhysicalMemory();
+
+/// Periodically samples processes of running commands.
+///
+/// primitives::Command reaps its processes itself,
+/// so exact rusage of wait4() is not available to us.
+/// Peaks between samples are still seen, because peak rss of every process is taken.
+/// Counters are taken from the last sample, so the tail of execution is lost
+/// and commands shorter than interval may stay unmeasured.
+struct SW_BUILDER_API ProcessMonitor
+{
+    ProcessMonitor(std::chrono::milliseconds interval = std::chrono::milliseconds(100));
+    ProcessMonitor(const ProcessMonitor &) = delete;
+    ProcessMonitor &operator=(const ProcessMonitor &) = delete;
+    ~ProcessMonitor();
+
+    // command must stay alive until it is removed
+    void add(builder::Command &);
+    // after this call command's stats are not touched anymore
+    void remove(builder::Command &);
+
+private:
+    struct Switches
+    {
+        uint64_t voluntary = 0;
+        uint64_t involuntary = 0;
+    };
+
+    std::chrono::milliseconds interval;
+    // switches are not inherited from waited children, so we remember every process we saw
+    std::unordered_map<builder::Command *, std::unordered_map<int, Switches>> commands;
+    std::mutex m;
+    std::condition_variable cv;
+    std::thread t;
+    bool stopped = false;
+
+    void run();
+    static void update(builder::Command &, std::unordered_map<int, Switches> &, const std::vector<ProcessSample> &);
+};
+
+} // namespace sw
@@ -18,8 +18,11 @@
 
 #include "sw_context.h"
 
+#include "action_cache.h"
+#include "command_arena.h"
 #include "command_storage.h"
 #include "file_storage.h"
+#include "process_monitor.h"
 
 #include <boost/thread/lock_types.hpp>
 #include <boost/thread/shared_mutex.hpp>
@@ -36,10 +39,14 @@ namespace sw
 SwBuilderContext::SwBuilderContext()
 {
     file_storage_executor = std::make_unique<Executor>("async log writer", 1);
+    process_monitor = std::make_unique<ProcessMonitor>();
+    command_arena = CommandArena::create();
 }
 
 SwBuilderContext::~SwBuilderContext()
 {
+    // commands may still be alive, they keep arena too
+    command_arena->release();
 }
 
 Executor &SwBuilderContext::getFileStorageExecutor() const
@@ -63,6 +70,11 @@ CommandStorage &SwBuilderContext::getCommandStorage(const path &root) const
     return *cs;
 }
 
+void SwBuilderContext::setActionCache(std::unique_ptr<ActionCache> c)
+{
+    action_cache = std::move(c);
+}
+
 void SwBuilderContext::clearFileStorages()
 {
     file_storage.reset();
@@ -28,8 +28,11 @@ struct Executor;
 namespace sw
 {
 
+struct ActionCache;
+struct CommandArena;
 struct CommandStorage;
 struct FileStorage;
+struct ProcessMonitor;
 
 namespace builder::detail { struct ResolvableCommand; }
 
@@ -41,6 +44,11 @@ struct SW_BUILDER_API SwBuilderContext
     FileStorage &getFileStorage() const;
     Executor &getFileStorageExecutor() const;
     CommandStorage &getCommandStorage(const path &root) const;
+    ActionCache *getActionCache() const { return action_cache.get(); }
+    void setActionCache(std::unique_ptr<ActionCache>);
+    ProcessMonitor &getProcessMonitor() const { return *process_monitor; }
+    /// memory for command arguments, released with context and its commands
+    CommandArena &getCommandArena() const { return *command_arena; }
 
     void clearFileStorages();
     void clearCommandStorages();
@@ -49,6 +57,9 @@ private:
     // keep order
     mutable std::unordered_map<path, std::unique_ptr<CommandStorage>> command_storages;
     mutable std::unique_ptr<FileStorage> file_storage;
+    std::unique_ptr<ActionCache> action_cache;
+    std::unique_ptr<ProcessMonitor> process_monitor;
+    CommandArena *command_arena;
     std::unique_ptr<Executor> file_storage_executor; // after everything!
 
     mutable std::mutex csm;
@@ -0,0 +1,469 @@
+// SPDX-License-Identifier: AGPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#include "remote_executor.h"
+
+#include <sw/builder/command.h>
+
+#include <grpcpp/grpcpp.h>
+#include <primitives/exceptions.h>
+#include <primitives/executor.h>
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "builder.distributed.executor");
+
+// actions
+#define MAX_BATCH_SIZE 64
+// bytes of blobs in single request
+#define MAX_BLOBS_BATCH_SIZE (64 * 1024 * 1024)
+
+namespace sw::builder::distributed
+{
+
+static path from_string(const String &s)
+{
+    return (const char8_t *)s.c_str();
+}
+
+static bool is_executable(const path &p)
+{
+    return (fs::status(p).permissions() & fs::perms::owner_exec) != fs::perms::none;
+}
+
+static void check_status(const ::grpc::Status &s, const String &method)
+{
+    if (!s.ok())
+        throw SW_RUNTIME_ERROR(method + " failed: " + s.error_message());
+}
+
+RemoteExecutor::RemoteExecutor(const String &endpoint, bool execute_remotely)
+    : execute_remotely(execute_remotely)
+{
+    grpc::ChannelArguments args;
+    args.SetMaxReceiveMessageSize(max_message_size);
+    args.SetMaxSendMessageSize(max_message_size);
+    stub = ::sw::api::build::DistributedBuildService::NewStub(
+        grpc::CreateCustomChannel(endpoint, grpc::InsecureChannelCredentials(), args));
+
+    // several batches may be in flight
+    rpc_executor = std::make_unique<Executor>("remote executor", 16);
+    dispatcher = std::thread([this] { dispatch(); });
+}
+
+RemoteExecutor::~RemoteExecutor()
+{
+    {
+        std::unique_lock lk(m);
+        stopped = true;
+    }
+    cv.notify_all();
+    dispatcher.join();
+
+    LOG_INFO(logger, "Remote execution: " << stats.cache_hits << " cache hits, "
+        << stats.executed << " executed in " << stats.batches << " batches, "
+        << stats.local << " local, "
+        << stats.uploaded / 1024 / 1024 << " MB uploaded, " << stats.downloaded / 1024 / 1024 << " MB downloaded");
+}
+
+std::optional<Action> RemoteExecutor::createAction(builder::Command &c)
+{
+    // nothing to bring back
+    if (c.outputs.empty())
+        return {};
+
+    Action a;
+    auto &cmd = *a.mutable_command();
+    // implicit inputs are not known before execution, they are added separately
+    FilesSorted inputs(c.inputs.begin(), c.inputs.end());
+    for (auto &arg : c.getArguments())
+    {
+        auto s = arg->toString();
+        // response files
+        if (s.starts_with("@"))
+            inputs.insert(from_string(s.substr(1)));
+        cmd.add_arguments(s);
+    }
+    cmd.set_working_directory(to_string(c.working_directory));
+    for (auto &[k, v] : c.environment)
+        (*cmd.mutable_environment())[k] = v;
+
+    FilesSorted outputs(c.outputs.begin(), c.outputs.end());
+    if (!c.deps_file.empty())
+        outputs.insert(c.deps_file);
+    if (!c.in.file.empty())
+    {
+        cmd.mutable_in()->set_file(to_string(c.in.file));
+        inputs.insert(c.in.file);
+    }
+    if (!c.out.file.empty())
+    {
+        cmd.mutable_out()->set_file(to_string(c.out.file));
+        outputs.insert(c.out.file);
+    }
+    if (!c.err.file.empty())
+    {
+        cmd.mutable_err()->set_file(to_string(c.err.file));
+        outputs.insert(c.err.file);
+    }
+
+    for (auto &i : inputs)
+    {
+        std::error_code ec;
+        if (!fs::is_regular_file(i, ec))
+            continue;
+        auto d = digests.get(i);
+        if (d.size() > max_message_size / 2)
+            return {};
+        auto f = a.add_inputs();
+        f->set_path(to_string(i));
+        *f->mutable_digest() = d;
+        f->set_is_executable(is_executable(i));
+    }
+    for (auto &o : outputs)
+        a.add_outputs(to_string(o));
+    return a;
+}
+
+// returns false when some input cannot be sent
+bool RemoteExecutor::addImplicitInputs(Action &a, const Strings &files)
+{
+    for (auto &i : files)
+    {
+        auto p = from_string(i);
+        std::error_code ec;
+        if (!fs::is_regular_file(p, ec))
+            return false;
+        auto d = digests.get(p);
+        if (d.size() > max_message_size / 2)
+            return false;
+        auto f = a.add_inputs();
+        f->set_path(i);
+        *f->mutable_digest() = d;
+        f->set_is_executable(is_executable(p));
+    }
+    return true;
+}
+
+std::optional<ActionResult> RemoteExecutor::getActionResult(const String &key)
+{
+    ::sw::api::build::GetActionResultRequest req;
+    req.set_action_key(key);
+    ActionResult r;
+    grpc::ClientContext ctx;
+    auto s = stub->GetActionResult(&ctx, req, &r);
+    if (s.error_code() == ::grpc::StatusCode::NOT_FOUND)
+        return {};
+    check_status(s, "GetActionResult");
+    return r;
+}
+
+bool RemoteExecutor::execute(builder::Command &c, std::error_code &ec)
+{
+    if (!available)
+        return false;
+    auto a = createAction(c);
+    if (!a)
+    {
+        stats.local++;
+        return false;
+    }
+
+    try
+    {
+        std::optional<ActionResult> r;
+        if (auto manifest = getActionResult(getActionKey(*a)))
+        {
+            // when some deps of the last execution are gone, the command would discover new ones
+            auto a2 = *a;
+            Strings ii(manifest->implicit_inputs().begin(), manifest->implicit_inputs().end());
+            if (addImplicitInputs(a2, ii))
+                r = getActionResult(getActionKey(a2));
+        }
+        if (r)
+            stats.cache_hits++;
+        else
+        {
+            // result is stored in finished()
+            {
+                std::unique_lock lk(pending_mutex);
+                pending[&c] = *a;
+            }
+            if (!execute_remotely)
+            {
+                stats.local++;
+                c.Base::execute(ec);
+                return true;
+            }
+
+            // implicit inputs of the previous run are sent to workers as a hint,
+            // new ones must be found there
+            auto a2 = *a;
+            Strings ii;
+            for (auto id : c.implicit_inputs)
+                ii.push_back(to_string(getPathTable().getPath(id)));
+            Request req{ &*a };
+            if (addImplicitInputs(a2, ii))
+                req.action = &a2;
+            auto f = req.result.get_future();
+            {
+                std::unique_lock lk(m);
+                queue.push_back(&req);
+            }
+            cv.notify_all();
+            r = f.get();
+            stats.executed++;
+        }
+
+        // implicit inputs may be incomplete on workers, so errors are checked locally
+        if (r->exit_code() != 0)
+        {
+            LOG_DEBUG(logger, "Remote execution failed, running locally: " << c.getName());
+            stats.local++;
+            return false;
+        }
+
+        download(*r);
+        c.out.text = r->out();
+        c.err.text = r->err();
+        c.exit_code = r->exit_code();
+        ec.clear();
+        return true;
+    }
+    catch (std::exception &e)
+    {
+        if (available.exchange(false))
+            LOG_WARN(logger, "Remote execution is not available, falling back to local builds: " << e.what());
+    }
+    stats.local++;
+    return false;
+}
+
+void RemoteExecutor::dispatch()
+{
+    while (1)
+    {
+        std::vector<Request *> batch;
+        {
+            std::unique_lock lk(m);
+            cv.wait(lk, [this] { return stopped || !queue.empty(); });
+            if (queue.empty())
+                return;
+            // let other plan workers to add their ready commands
+            cv.wait_for(lk, std::chrono::milliseconds(2), [this] { return stopped || queue.size() >= MAX_BATCH_SIZE; });
+            auto n = std::min<size_t>(queue.size(), MAX_BATCH_SIZE);
+            batch.assign(queue.begin(), queue.begin() + n);
+            queue.erase(queue.begin(), queue.begin() + n);
+        }
+        rpc_executor->push([this, batch]
+        {
+            try
+            {
+                executeBatch(batch);
+            }
+            catch (...)
+            {
+                for (auto r : batch)
+                    r->result.set_exception(std::current_exception());
+            }
+        });
+    }
+}
+
+void RemoteExecutor::executeBatch(const std::vector<Request *> &batch)
+{
+    std::vector<const FileNode *> files;
+    ::sw::api::build::ExecuteRequest req;
+    for (auto r : batch)
+    {
+        for (auto &f : r->action->inputs())
+            files.push_back(&f);
+        *req.add_actions() = *r->action;
+    }
+    upload(files);
+
+    ::sw::api::build::ExecuteResponse resp;
+    grpc::ClientContext ctx;
+    check_status(stub->Execute(&ctx, req, &resp), "Execute");
+    if (resp.results_size() != batch.size())
+        throw SW_RUNTIME_ERROR("Bad number of results");
+    stats.batches++;
+    for (size_t i = 0; i < batch.size(); i++)
+        batch[i]->result.set_value(resp.results(i));
+}
+
+void RemoteExecutor::upload(const std::vector<const FileNode *> &files)
+{
+    std::unordered_map<String, const FileNode *> by_hash;
+    ::sw::api::build::FindMissingBlobsRequest req;
+    for (auto f : files)
+    {
+        if (by_hash.emplace(f->digest().hash(), f).second)
+            *req.add_digests() = f->digest();
+    }
+    if (by_hash.empty())
+        return;
+
+    ::sw::api::build::FindMissingBlobsResponse missing;
+    {
+        grpc::ClientContext ctx;
+        check_status(stub->FindMissingBlobs(&ctx, req, &missing), "FindMissingBlobs");
+    }
+
+    ::sw::api::build::BatchUpdateBlobsRequest blobs;
+    size_t sz = 0;
+    auto flush = [this, &blobs, &sz]()
+    {
+        if (!blobs.blobs_size())
+            return;
+        ::google::protobuf::Empty e;
+        grpc::ClientContext ctx;
+        check_status(stub->BatchUpdateBlobs(&ctx, blobs, &e), "BatchUpdateBlobs");
+        stats.uploaded += sz;
+        blobs.Clear();
+        sz = 0;
+    };
+    for (auto &d : missing.digests())
+    {
+        if (sz + d.size() > MAX_BLOBS_BATCH_SIZE)
+            flush();
+        auto b = blobs.add_blobs();
+        *b->mutable_digest() = d;
+        b->set_data(read_file(from_string(by_hash.at(d.hash())->path())));
+        sz += d.size();
+    }
+    flush();
+}
+
+void RemoteExecutor::download(const ActionResult &r)
+{
+    // on shared file systems (localhost workers) outputs are already in place
+    std::vector<const FileNode *> files;
+    for (auto &o : r.outputs())
+    {
+        auto p = from_string(o.path());
+        std::error_code ec;
+        if (!fs::exists(p, ec) || !equals(digests.get(p), o.digest()))
+            files.push_back(&o);
+    }
+
+    ::sw::api::build::BatchReadBlobsRequest req;
+    std::vector<const FileNode *> requested;
+    size_t sz = 0;
+    auto flush = [this, &req, &requested, &sz]()
+    {
+        if (requested.empty())
+            return;
+        ::sw::api::build::BatchReadBlobsResponse resp;
+        grpc::ClientContext ctx;
+        check_status(stub->BatchReadBlobs(&ctx, req, &resp), "BatchReadBlobs");
+        if (resp.blobs_size() != requested.size())
+            throw SW_RUNTIME_ERROR("Bad number of blobs");
+        for (size_t i = 0; i < requested.size(); i++)
+        {
+            auto &b = resp.blobs(i);
+            if (!equals(getDigest(b.data()), requested[i]->digest()))
+                throw SW_RUNTIME_ERROR("Digest mismatch: " + requested[i]->path());
+            auto p = from_string(requested[i]->path());
+            fs::create_directories(p.parent_path());
+            auto tmp = p.parent_path() / unique_path();
+            write_file(tmp, b.data());
+            if (requested[i]->is_executable())
+                fs::permissions(tmp, fs::perms::owner_exec | fs::perms::group_exec | fs::perms::others_exec, fs::perm_options::add);
+            fs::rename(tmp, p);
+            stats.downloaded += b.data().size();
+        }
+        req.Clear();
+        requested.clear();
+        sz = 0;
+    };
+    for (auto f : files)
+    {
+        if (sz + f->digest().size() > MAX_BLOBS_BATCH_SIZE)
+            flush();
+        *req.add_digests() = f->digest();
+        requested.push_back(f);
+        sz += f->digest().size();
+    }
+    flush();
+
+    // outputs must look newer than everything built before them
+    for (auto &o : r.outputs())
+    {
+        std::error_code ec;
+        fs::last_write_time(from_string(o.path()), fs::file_time_type::clock::now(), ec);
+    }
+}
+
+void RemoteExecutor::finished(builder::Command &c, bool ok)
+{
+    Action a;
+    {
+        std::unique_lock lk(pending_mutex);
+        auto i = pending.find(&c);
+        if (i == pending.end())
+            return;
+        a = std::move(i->second);
+        pending.erase(i);
+    }
+    if (!ok || !available)
+        return;
+
+    try
+    {
+        // explicit inputs keep digests they had before execution
+        auto manifest_key = getActionKey(a);
+        Strings ii;
+        for (auto id : c.implicit_inputs)
+            ii.push_back(to_string(getPathTable().getPath(id)));
+        std::sort(ii.begin(), ii.end());
+        if (!addImplicitInputs(a, ii))
+            return;
+
+        // result goes first, so manifest never points to missing result
+        if (!updateActionResult(c, a, getActionKey(a)))
+            return;
+        ::sw::api::build::UpdateActionResultRequest req;
+        req.set_action_key(manifest_key);
+        for (auto &i : ii)
+            req.mutable_result()->add_implicit_inputs(i);
+        ::google::protobuf::Empty e;
+        grpc::ClientContext ctx;
+        check_status(stub->UpdateActionResult(&ctx, req, &e), "UpdateActionResult");
+    }
+    catch (std::exception &e)
+    {
+        LOG_DEBUG(logger, "Cannot store result of " << c.getName() << ": " << e.what());
+    }
+}
+
+bool RemoteExecutor::updateActionResult(builder::Command &c, const Action &a, const String &key)
+{
+    ::sw::api::build::UpdateActionResultRequest req;
+    req.set_action_key(key);
+    auto &r = *req.mutable_result();
+    r.set_out(c.out.text);
+    r.set_err(c.err.text);
+
+    std::vector<const FileNode *> files;
+    for (auto &o : a.outputs())
+    {
+        auto p = from_string(o);
+        std::error_code ec;
+        // such actions are not cached
+        if (!fs::is_regular_file(p, ec))
+            return false;
+        auto f = r.add_outputs();
+        f->set_path(o);
+        *f->mutable_digest() = digests.get(p);
+        f->set_is_executable(is_executable(p));
+        files.push_back(f);
+    }
+    upload(files);
+
+    ::google::protobuf::Empty e;
+    grpc::ClientContext ctx;
+    check_status(stub->UpdateActionResult(&ctx, req, &e), "UpdateActionResult");
+    return true;
+}
+
+}
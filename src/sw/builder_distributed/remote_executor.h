@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: AGPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#pragma once
+
+#include "storage.h"
+
+#include <sw/builder/command_executor.h>
+#include <sw/protocol/build.grpc.pb.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+struct Executor;
+
+namespace sw::builder::distributed
+{
+
+/// Execution plan backend that sends commands to distributed build server.
+/// Ready commands coming from plan workers are grouped into batches.
+/// Results are looked up in the remote action cache first.
+///
+/// Cache has two levels: action without implicit inputs (command and explicit inputs)
+/// gives manifest with inputs discovered by the last execution, action with their current
+/// digests added gives the result. Results are stored only after execution, when deps are known.
+struct SW_BUILDER_DISTRIBUTED_API RemoteExecutor : CommandExecutor
+{
+    struct Stats
+    {
+        std::atomic_size_t cache_hits{ 0 };
+        std::atomic_size_t executed{ 0 };
+        std::atomic_size_t batches{ 0 };
+        std::atomic_size_t local{ 0 };
+        std::atomic_uint64_t uploaded{ 0 };
+        std::atomic_uint64_t downloaded{ 0 };
+    };
+
+    /// when execute_remotely = false, server is used only as a cache,
+    /// results of local executions are uploaded
+    RemoteExecutor(const String &endpoint, bool execute_remotely = true);
+    ~RemoteExecutor();
+
+    bool execute(builder::Command &, std::error_code &) override;
+    void finished(builder::Command &, bool ok) override;
+
+    const Stats &getStats() const { return stats; }
+
+private:
+    struct Request
+    {
+        const Action *action;
+        std::promise<ActionResult> result;
+    };
+
+    std::unique_ptr<::sw::api::build::DistributedBuildService::Stub> stub;
+    bool execute_remotely;
+    std::atomic_bool available{ true };
+    FileDigestCache digests;
+    Stats stats;
+
+    std::mutex m;
+    std::condition_variable cv;
+    std::vector<Request *> queue;
+    bool stopped = false;
+    std::unique_ptr<Executor> rpc_executor;
+    std::thread dispatcher;
+
+    // actions (without implicit inputs) of cache misses waiting for their deps
+    std::mutex pending_mutex;
+    std::unordered_map<const builder::Command *, Action> pending;
+
+    std::optional<Action> createAction(builder::Command &);
+    bool addImplicitInputs(Action &, const Strings &);
+    std::optional<ActionResult> getActionResult(const String &key);
+    void dispatch();
+    void executeBatch(const std::vector<Request *> &);
+    void upload(const std::vector<const FileNode *> &);
+    void download(const ActionResult &);
+    bool updateActionResult(builder::Command &, const Action &, const String &key);
+};
+
+}
@@ -7,6 +7,7 @@
 
 #include <grpcpp/grpcpp.h>
 #include <primitives/exceptions.h>
+#include <primitives/executor.h>
 
 #include <primitives/log.h>
 DECLARE_STATIC_LOGGER(logger, "builder.distributed.server");
@@ -16,30 +17,213 @@ DECLARE_STATIC_LOGGER(logger, "builder.distributed.server");
 namespace sw::builder::distributed
 {
 
+static path from_string(const String &s)
+{
+    return (const char8_t *)s.c_str();
+}
+
 DEFINE_SERVICE_METHOD(DistributedBuildService, ExecuteCommand, ::sw::api::build::Command, ::sw::api::build::CommandResult)
 {
-    // fan mode: send to workers in round robin mode
+    // plain command without inputs and outputs
+    Action a;
+    *a.mutable_command() = *request;
+    auto r = server.execute({ &a })[0];
+    response->set_exit_code(r.exit_code());
+    response->set_out(r.out());
+    response->set_err(r.err());
+    GRPC_RETURN_OK();
+}
 
-    SW_UNIMPLEMENTED;
+DEFINE_SERVICE_METHOD(DistributedBuildService, FindMissingBlobs, ::sw::api::build::FindMissingBlobsRequest, ::sw::api::build::FindMissingBlobsResponse)
+{
+    for (auto &d : request->digests())
+    {
+        if (!server.getStorage().has(d))
+            *response->add_digests() = d;
+    }
+    GRPC_RETURN_OK();
+}
 
-    Command c;
-    //c.in.file = fs::u8path(request->in().file());
-    //c.in.file = fs::u8path(request->in().file());
-    //c.in.file = fs::u8path(request->in().file());
+DEFINE_SERVICE_METHOD(DistributedBuildService, BatchUpdateBlobs, ::sw::api::build::BatchUpdateBlobsRequest, ::google::protobuf::Empty)
+{
+    try
+    {
+        for (auto &b : request->blobs())
+            server.getStorage().put(b.digest(), b.data());
+    }
+    catch (std::exception &e)
+    {
+        return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, e.what());
+    }
+    GRPC_RETURN_OK();
+}
+
+DEFINE_SERVICE_METHOD(DistributedBuildService, BatchReadBlobs, ::sw::api::build::BatchReadBlobsRequest, ::sw::api::build::BatchReadBlobsResponse)
+{
+    for (auto &d : request->digests())
+    {
+        auto data = server.getStorage().get(d);
+        if (!data)
+            return ::grpc::Status(::grpc::StatusCode::NOT_FOUND, "No such blob: " + d.hash());
+        auto b = response->add_blobs();
+        *b->mutable_digest() = d;
+        b->set_data(std::move(*data));
+    }
+    GRPC_RETURN_OK();
+}
+
+DEFINE_SERVICE_METHOD(DistributedBuildService, GetActionResult, ::sw::api::build::GetActionResultRequest, ::sw::api::build::ActionResult)
+{
+    auto r = server.getStorage().getActionResult(request->action_key());
+    if (!r)
+        return ::grpc::Status(::grpc::StatusCode::NOT_FOUND, "");
+    *response = std::move(*r);
+    GRPC_RETURN_OK();
+}
 
-    c.execute();
+DEFINE_SERVICE_METHOD(DistributedBuildService, UpdateActionResult, ::sw::api::build::UpdateActionResultRequest, ::google::protobuf::Empty)
+{
+    // only successful results are cached
+    if (request->result().exit_code() != 0)
+        return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Cannot cache failed action");
+    try
+    {
+        server.getStorage().updateActionResult(request->action_key(), request->result());
+    }
+    catch (std::exception &e)
+    {
+        return ::grpc::Status(::grpc::StatusCode::FAILED_PRECONDITION, e.what());
+    }
+    GRPC_RETURN_OK();
+}
 
+DEFINE_SERVICE_METHOD(DistributedBuildService, Execute, ::sw::api::build::ExecuteRequest, ::sw::api::build::ExecuteResponse)
+{
+    std::vector<const Action *> actions;
+    for (auto &a : request->actions())
+        actions.push_back(&a);
+    for (auto &r : server.execute(actions))
+        *response->add_results() = std::move(r);
     GRPC_RETURN_OK();
 }
 
-Server::Server()
+Worker::Worker(Storage &storage, FileDigestCache &digests)
+    : storage(storage), digests(digests)
+{
+}
+
+void Worker::materialize(const FileNode &f)
 {
+    auto p = from_string(f.path());
+    std::error_code ec;
+    if (fs::exists(p, ec) && equals(digests.get(p), f.digest()))
+        return;
+    auto data = storage.get(f.digest());
+    if (!data)
+        throw SW_RUNTIME_ERROR("Missing input blob: " + f.path());
+    // other workers may read the file
+    fs::create_directories(p.parent_path());
+    auto tmp = p.parent_path() / unique_path();
+    write_file(tmp, *data);
+    if (f.is_executable())
+        fs::permissions(tmp, fs::perms::owner_exec | fs::perms::group_exec | fs::perms::others_exec, fs::perm_options::add);
+    fs::rename(tmp, p);
+}
+
+ActionResult Worker::execute(const Action &a)
+{
+    ActionResult r;
+    for (auto &f : a.inputs())
+        materialize(f);
+    for (auto &o : a.outputs())
+        fs::create_directories(from_string(o).parent_path());
+
+    auto &cmd = a.command();
+    primitives::Command c;
+    for (auto &arg : cmd.arguments())
+        c.push_back(arg);
+    c.working_directory = from_string(cmd.working_directory());
+    for (auto &[k, v] : cmd.environment())
+        c.environment[k] = v;
+    if (!cmd.in().file().empty())
+        c.in.file = from_string(cmd.in().file());
+    c.in.text = cmd.in().text();
+    if (!cmd.out().file().empty())
+        c.out.file = from_string(cmd.out().file());
+    if (!cmd.err().file().empty())
+        c.err.file = from_string(cmd.err().file());
+
+    std::error_code ec;
+    c.execute(ec);
+    r.set_out(c.out.text);
+    r.set_err(c.err.text);
+    if (c.exit_code)
+        r.set_exit_code(*c.exit_code);
+    else if (ec)
+    {
+        r.set_exit_code(-1);
+        r.set_err(r.err() + "\n" + ec.message());
+    }
+    if (r.exit_code() != 0)
+        return r;
+
+    for (auto &o : a.outputs())
+    {
+        auto p = from_string(o);
+        if (!fs::is_regular_file(p, ec))
+            continue;
+        auto d = digests.get(p);
+        storage.putFile(d, p);
+        auto f = r.add_outputs();
+        f->set_path(o);
+        *f->mutable_digest() = d;
+        f->set_is_executable((fs::status(p).permissions() & fs::perms::owner_exec) != fs::perms::none);
+    }
+    return r;
+}
+
+Server::Server(const path &root, int n_workers)
+    : dbs(*this), storage(root)
+{
+    if (n_workers <= 0)
+        n_workers = std::thread::hardware_concurrency();
+    for (int i = 0; i < n_workers; i++)
+        workers.push_back(std::make_unique<Worker>(storage, digests));
+    executor = std::make_unique<Executor>("distributed worker", n_workers);
 }
 
 Server::~Server()
 {
 }
 
+std::vector<ActionResult> Server::execute(const std::vector<const Action *> &actions)
+{
+    std::vector<ActionResult> results(actions.size());
+    std::vector<Future<void>> futures;
+    for (size_t i = 0; i < actions.size(); i++)
+    {
+        futures.push_back(executor->push([this, &actions, &results, i]
+        {
+            auto &w = *workers[next_worker++ % workers.size()];
+            auto &a = *actions[i];
+            try
+            {
+                // not stored here: inputs of the action are incomplete before execution,
+                // clients store results under keys with discovered inputs
+                results[i] = w.execute(a);
+            }
+            catch (std::exception &e)
+            {
+                results[i].set_exit_code(-1);
+                results[i].set_err(e.what());
+            }
+        }));
+    }
+    for (auto &f : futures)
+        f.wait();
+    return results;
+}
+
 void Server::start(const String &server_address/*, const String &cert*/)
 {
     grpc::SslServerCredentialsOptions ssl_options;
@@ -51,11 +235,14 @@ void Server::start(const String &server_address/*, const String &cert*/)
         //builder.AddListeningPort(server_address, grpc::SslServerCredentials(ssl_options));
     //else
     builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
+    builder.SetMaxReceiveMessageSize(max_message_size);
+    builder.SetMaxSendMessageSize(max_message_size);
 
     builder.RegisterService(&dbs);
     server = builder.BuildAndStart();
     if (!server)
         throw SW_RUNTIME_ERROR("Cannot start grpc server");
+    LOG_INFO(logger, "Distributed builder is listening on " << server_address << " with " << workers.size() << " workers");
 }
 
 void Server::wait()
@@ -3,21 +3,42 @@
 
 #pragma once
 
+#include "storage.h"
+
 #include <sw/protocol/build.grpc.pb.h>
 #include <sw/protocol/grpc_helpers.h>
 
 #include <grpcpp/server.h>
 #include <primitives/string.h>
 
+#include <atomic>
 #include <memory>
 #include <vector>
 
+struct Executor;
+
 namespace sw::builder::distributed
 {
 
+struct Server;
+
 class DistributedBuildServiceImpl : public ::sw::api::build::DistributedBuildService::Service
 {
+    Server &server;
+
     DECLARE_SERVICE_METHOD(ExecuteCommand, ::sw::api::build::Command, ::sw::api::build::CommandResult);
+
+    DECLARE_SERVICE_METHOD(FindMissingBlobs, ::sw::api::build::FindMissingBlobsRequest, ::sw::api::build::FindMissingBlobsResponse);
+    DECLARE_SERVICE_METHOD(BatchUpdateBlobs, ::sw::api::build::BatchUpdateBlobsRequest, ::google::protobuf::Empty);
+    DECLARE_SERVICE_METHOD(BatchReadBlobs, ::sw::api::build::BatchReadBlobsRequest, ::sw::api::build::BatchReadBlobsResponse);
+
+    DECLARE_SERVICE_METHOD(GetActionResult, ::sw::api::build::GetActionResultRequest, ::sw::api::build::ActionResult);
+    DECLARE_SERVICE_METHOD(UpdateActionResult, ::sw::api::build::UpdateActionResultRequest, ::google::protobuf::Empty);
+
+    DECLARE_SERVICE_METHOD(Execute, ::sw::api::build::ExecuteRequest, ::sw::api::build::ExecuteResponse);
+
+public:
+    DistributedBuildServiceImpl(Server &server) : server(server) {}
 };
 
 struct SW_BUILDER_DISTRIBUTED_API Client
@@ -30,9 +51,20 @@ struct SW_BUILDER_DISTRIBUTED_API Session
     std::unique_ptr<Client> client;
 };
 
+/// Runs actions on this host.
+/// Inputs are placed at their original absolute paths, so workers must have the same layout
+/// (or share file system with clients as localhost workers do).
 struct SW_BUILDER_DISTRIBUTED_API Worker
 {
+    Worker(Storage &, FileDigestCache &);
 
+    ActionResult execute(const Action &);
+
+private:
+    Storage &storage;
+    FileDigestCache &digests;
+
+    void materialize(const FileNode &);
 };
 
 struct SW_BUILDER_DISTRIBUTED_API Server
@@ -42,12 +74,23 @@ struct SW_BUILDER_DISTRIBUTED_API Server
     std::vector<std::unique_ptr<Session>> sessions;
     std::vector<std::unique_ptr<Worker>> workers;
 
-    Server();
+    /// n_workers = 0 - use number of hardware threads
+    Server(const path &root, int n_workers = 0);
     ~Server();
 
     void start(const String &endpoint/*, const String &cert = {}*/);
     void wait();
     void stop();
+
+    Storage &getStorage() { return storage; }
+    /// dispatches actions to workers, results go in the same order
+    std::vector<ActionResult> execute(const std::vector<const Action *> &);
+
+private:
+    Storage storage;
+    FileDigestCache digests;
+    std::unique_ptr<Executor> executor;
+    std::atomic_size_t next_worker{ 0 };
 };
 
 }
@@ -0,0 +1,181 @@
+// SPDX-License-Identifier: AGPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#include "storage.h"
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <primitives/exceptions.h>
+#include <primitives/templates.h>
+#include <xxhash.h>
+
+namespace sw::builder::distributed
+{
+
+static String to_hex(XXH128_hash_t h)
+{
+    char buf[33];
+    snprintf(buf, sizeof(buf), "%016llx%016llx", (unsigned long long)h.high64, (unsigned long long)h.low64);
+    return buf;
+}
+
+Digest getDigest(const String &data)
+{
+    Digest d;
+    d.set_hash(to_hex(XXH3_128bits(data.data(), data.size())));
+    d.set_size(data.size());
+    return d;
+}
+
+Digest getFileDigest(const path &p)
+{
+    ScopedFile f(p, "rb");
+    auto state = XXH3_createState();
+    if (!state)
+        throw SW_RUNTIME_ERROR("Cannot create hash state");
+    SCOPE_EXIT
+    {
+        XXH3_freeState(state);
+    };
+    XXH3_128bits_reset(state);
+    std::vector<char> buf(64 * 1024);
+    int64_t sz = 0;
+    while (auto n = fread(buf.data(), 1, buf.size(), f.getHandle()))
+    {
+        XXH3_128bits_update(state, buf.data(), n);
+        sz += n;
+    }
+    if (ferror(f.getHandle()))
+        throw SW_RUNTIME_ERROR("Cannot read file: " + to_string(p));
+    Digest d;
+    d.set_hash(to_hex(XXH3_128bits_digest(state)));
+    d.set_size(sz);
+    return d;
+}
+
+bool equals(const Digest &d1, const Digest &d2)
+{
+    return d1.hash() == d2.hash() && d1.size() == d2.size();
+}
+
+String getActionKey(const Action &a)
+{
+    // maps (environment) must be written in the same order every time
+    String s;
+    {
+        google::protobuf::io::StringOutputStream sos(&s);
+        google::protobuf::io::CodedOutputStream cos(&sos);
+        cos.SetSerializationDeterministic(true);
+        if (!a.SerializeToCodedStream(&cos))
+            throw SW_RUNTIME_ERROR("Cannot serialize action");
+    }
+    return getDigest(s).hash();
+}
+
+Digest FileDigestCache::get(const path &p)
+{
+    auto k = getFileContentKey(p);
+    if (!k)
+        throw SW_RUNTIME_ERROR("Cannot stat file: " + to_string(p));
+    {
+        std::shared_lock lk(m);
+        auto i = digests.find(p);
+        if (i != digests.end() && i->second.first == *k)
+            return i->second.second;
+    }
+    auto d = getFileDigest(p);
+    std::unique_lock lk(m);
+    digests[p] = { *k, d };
+    return d;
+}
+
+Storage::Storage(const path &root)
+    : root(root)
+{
+    fs::create_directories(root);
+}
+
+path Storage::getBlobFilename(const Digest &d) const
+{
+    if (d.hash().size() < 2)
+        throw SW_RUNTIME_ERROR("Bad digest: " + d.hash());
+    return root / "cas" / d.hash().substr(0, 2) / (d.hash() + "-" + std::to_string(d.size()));
+}
+
+path Storage::getActionFilename(const String &key) const
+{
+    if (key.size() < 2)
+        throw SW_RUNTIME_ERROR("Bad action key: " + key);
+    return root / "ac" / key.substr(0, 2) / key;
+}
+
+void Storage::writeFile(const path &p, const String &data) const
+{
+    // readers must not see partial files
+    fs::create_directories(p.parent_path());
+    auto tmp = p.parent_path() / unique_path();
+    write_file(tmp, data);
+    fs::rename(tmp, p);
+}
+
+bool Storage::has(const Digest &d) const
+{
+    return fs::exists(getBlobFilename(d));
+}
+
+void Storage::put(const Digest &d, const String &data)
+{
+    auto d2 = getDigest(data);
+    if (d2.hash() != d.hash() || d2.size() != d.size())
+        throw SW_RUNTIME_ERROR("Digest mismatch: " + d.hash());
+    if (!has(d))
+        writeFile(getBlobFilename(d), data);
+}
+
+void Storage::putFile(const Digest &d, const path &p)
+{
+    if (has(d))
+        return;
+    auto fn = getBlobFilename(d);
+    fs::create_directories(fn.parent_path());
+    auto tmp = fn.parent_path() / unique_path();
+    fs::copy_file(p, tmp);
+    fs::rename(tmp, fn);
+}
+
+std::optional<String> Storage::get(const Digest &d) const
+{
+    auto fn = getBlobFilename(d);
+    if (!fs::exists(fn))
+        return {};
+    return read_file(fn);
+}
+
+std::optional<ActionResult> Storage::getActionResult(const String &key) const
+{
+    auto fn = getActionFilename(key);
+    if (!fs::exists(fn))
+        return {};
+    ActionResult r;
+    if (!r.ParseFromString(read_file(fn)))
+        return {};
+    // blobs may be removed
+    for (auto &o : r.outputs())
+    {
+        if (!has(o.digest()))
+            return {};
+    }
+    return r;
+}
+
+void Storage::updateActionResult(const String &key, const ActionResult &r)
+{
+    for (auto &o : r.outputs())
+    {
+        if (!has(o.digest()))
+            throw SW_RUNTIME_ERROR("Missing output blob: " + o.path());
+    }
+    writeFile(getActionFilename(key), r.SerializeAsString());
+}
+
+}
@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: AGPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#pragma once
+
+#include <sw/builder/file.h>
+#include <sw/protocol/build.pb.h>
+
+#include <primitives/filesystem.h>
+
+#include <optional>
+#include <shared_mutex>
+
+namespace sw::builder::distributed
+{
+
+using ::sw::api::build::Action;
+using ::sw::api::build::ActionResult;
+using ::sw::api::build::Digest;
+using ::sw::api::build::FileNode;
+
+// blobs go in batches
+inline constexpr int max_message_size = 256 * 1024 * 1024;
+
+SW_BUILDER_DISTRIBUTED_API
+Digest getDigest(const String &data);
+SW_BUILDER_DISTRIBUTED_API
+Digest getFileDigest(const path &);
+SW_BUILDER_DISTRIBUTED_API
+bool equals(const Digest &, const Digest &);
+/// stable between runs and hosts
+SW_BUILDER_DISTRIBUTED_API
+String getActionKey(const Action &);
+
+/// Digests of local files, recomputed only when (inode, size, mtime) changes.
+struct SW_BUILDER_DISTRIBUTED_API FileDigestCache
+{
+    Digest get(const path &);
+
+private:
+    std::shared_mutex m;
+    std::unordered_map<path, std::pair<FileContentKey, Digest>> digests;
+};
+
+/// Content addressed blobs and action results kept on disk.
+struct SW_BUILDER_DISTRIBUTED_API Storage
+{
+    Storage(const path &root);
+
+    bool has(const Digest &) const;
+    /// throws on digest mismatch
+    void put(const Digest &, const String &data);
+    void putFile(const Digest &, const path &);
+    std::optional<String> get(const Digest &) const;
+    path getBlobFilename(const Digest &) const;
+
+    std::optional<ActionResult> getActionResult(const String &key) const;
+    void updateActionResult(const String &key, const ActionResult &);
+
+private:
+    path root;
+
+    path getActionFilename(const String &key) const;
+    void writeFile(const path &, const String &) const;
+};
+
+}
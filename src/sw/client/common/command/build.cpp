@@ -5,6 +5,9 @@
 
 #include <sw/builder/execution_plan.h>
 #include <sw/core/input.h>
+#include <sw/protocol/build.grpc.pb.h>
+
+#include <grpcpp/grpcpp.h>
 
 #include <primitives/log.h>
 DECLARE_STATIC_LOGGER(logger, "build");
@@ -89,8 +92,29 @@ static void isolated_build(SwClientContext &swctx)
     }
 }
 
+static void daemon_build(const String &endpoint)
+{
+    auto stub = ::sw::api::build::BuildDaemonService::NewStub(grpc::CreateChannel(endpoint, grpc::InsecureChannelCredentials()));
+    ::sw::api::build::BuildRequest request;
+    request.set_working_directory(to_string(normalize_path(fs::current_path())));
+    ::sw::api::build::BuildResponse response;
+    grpc::ClientContext context;
+    auto s = stub->Build(&context, request, &response);
+    if (!s.ok())
+        throw SW_RUNTIME_ERROR("Cannot send request to build daemon at " + endpoint + ": " + s.error_message());
+    if (!response.success())
+        throw SW_RUNTIME_ERROR(response.error());
+    LOG_INFO(logger, "Build finished in " << response.time() << " ms" << (response.reprepared() ? " (prepared again)" : ""));
+}
+
 SUBCOMMAND_DECL(build)
 {
+    if (!getOptions().options_build.build_daemon.empty())
+    {
+        daemon_build(getOptions().options_build.build_daemon);
+        return;
+    }
+
     if (!getOptions().options_build.build_explan.empty())
     {
         auto b = createBuild();
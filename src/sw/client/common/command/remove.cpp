@@ -21,12 +21,24 @@ static sw::PackageIdSet getMatchingPackagesSet(const sw::StorageWithPackagesData
 
 SUBCOMMAND_DECL(remove)
 {
+    auto &s = getContext().getLocalStorage();
     for (auto &a : getOptions().options_remove.remove_arg)
     {
-        for (auto &p : getMatchingPackagesSet(getContext().getLocalStorage(), a))
+        for (auto &p : getMatchingPackagesSet(s, a))
         {
             LOG_INFO(logger, "Removing " << p.toString());
-            getContext().getLocalStorage().remove(sw::LocalPackage(getContext().getLocalStorage(), p));
+            s.remove(sw::LocalPackage(s, p));
         }
     }
+
+    // both scan the whole store
+    if (getOptions().options_remove.remove_unused_blobs)
+    {
+        auto freed = s.getBlobStore().collectGarbage();
+        LOG_INFO(logger, "Removed unused files: " << freed / 1024 / 1024 << " MB");
+        auto st = s.getBlobStore().getStats();
+        LOG_INFO(logger, "Package sources store: " << st.blobs << " files, "
+            << st.stored_bytes / 1024 / 1024 << " MB on disk, "
+            << st.getSavedBytes() / 1024 / 1024 << " MB saved by deduplication");
+    }
 }
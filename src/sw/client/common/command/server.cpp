@@ -3,13 +3,237 @@
 
 #include "../commands.h"
 
+#include <sw/builder/execution_plan.h>
+#include <sw/builder/file_storage.h>
+#include <sw/builder/file_watcher.h>
 #include <sw/builder_distributed/server.h>
+#include <sw/core/input.h>
+#include <sw/protocol/build.grpc.pb.h>
+#include <sw/protocol/grpc_helpers.h>
+
+#include <grpcpp/grpcpp.h>
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "server");
+
+// Keeps contexts, targets and execution plan of the build in memory.
+// Between requests only changed files are rechecked,
+// build is prepared again when config or set of files changes.
+struct BuildDaemon
+{
+    BuildDaemon(SwClientContext &swctx) : swctx(swctx) {}
+
+    void prepare();
+    void build(const ::sw::api::build::BuildRequest &, ::sw::api::build::BuildResponse &);
+
+private:
+    SwClientContext &swctx;
+    std::mutex m;
+    std::unique_ptr<sw::SwBuild> b;
+    std::unique_ptr<sw::ExecutionPlan> p;
+    sw::FileWatcher watcher;
+    std::unordered_set<path> config_files;
+    std::unordered_set<path> inputs;
+    std::unordered_set<path> outputs;
+    fs::file_time_type prepare_time;
+
+    bool isPrepareNeeded();
+    bool isIgnored(const path &) const;
+    void watchImplicitInputs();
+};
+
+void BuildDaemon::prepare()
+{
+    // old build saves its command storages on destruction
+    p.reset();
+    b.reset();
+    watcher.clear();
+    config_files.clear();
+    inputs.clear();
+    outputs.clear();
+
+    prepare_time = fs::file_time_type::clock::now();
+    b = swctx.createBuildWithDefaultInputs();
+    b->loadInputs();
+    b->setTargetsToBuild();
+    b->resolvePackages();
+    b->loadPackages();
+    b->prepare();
+    p = b->getExecutionPlan();
+
+    for (auto &i : b->getInputs())
+    {
+        for (auto &f : i.getInput().getInput().getSpecification().getFiles())
+        {
+            config_files.insert(normalize_path(f));
+            watcher.add(f.parent_path());
+        }
+    }
+    for (auto &c : p->getCommands())
+    {
+        auto c2 = dynamic_cast<sw::builder::Command *>(c);
+        if (!c2)
+            continue;
+        for (auto &f : c2->inputs)
+        {
+            inputs.insert(normalize_path(f));
+            watcher.add(f.parent_path());
+        }
+        for (auto &f : c2->outputs)
+            outputs.insert(normalize_path(f));
+    }
+    if (!watcher.isSupported())
+        LOG_WARN(logger, "File watching is not supported, new and removed files require daemon restart");
+}
+
+void BuildDaemon::watchImplicitInputs()
+{
+    // known after execution only
+    for (auto &c : p->getCommands())
+    {
+        auto c2 = dynamic_cast<sw::builder::Command *>(c);
+        if (!c2)
+            continue;
+        for (auto id : c2->implicit_inputs)
+        {
+            auto &f = sw::getPathTable().getPath(id);
+            if (inputs.insert(f).second)
+                watcher.add(f.parent_path());
+        }
+    }
+}
+
+bool BuildDaemon::isIgnored(const path &f) const
+{
+    auto fn = to_string(f.filename());
+    // editor backups and temporary files
+    if (fn.empty() || fn[0] == '.' || fn.back() == '~')
+        return true;
+    // our own writes
+    auto s = to_string(f);
+    for (auto &d : { b->getBuildDirectory(), swctx.getContext().getLocalStorage().storage_dir })
+    {
+        if (s.starts_with(to_string(normalize_path(d))))
+            return true;
+    }
+    return false;
+}
+
+bool BuildDaemon::isPrepareNeeded()
+{
+    if (!b || !p)
+        return true;
+
+    std::vector<sw::FileWatcher::Event> events;
+    if (!watcher.poll(events))
+    {
+        // changes are unknown, recheck all files
+        b->getFileStorage().reset();
+        for (auto &f : config_files)
+        {
+            std::error_code ec;
+            auto t = fs::last_write_time(f, ec);
+            if (ec || t > prepare_time)
+                return true;
+        }
+        return false;
+    }
+
+    bool r = false;
+    for (auto &e : events)
+    {
+        auto f = normalize_path(e.file);
+        b->getFileStorage().reset(f);
+        if (r)
+            continue;
+        if (config_files.contains(f))
+        {
+            LOG_DEBUG(logger, "Config file changed: " << f);
+            r = true;
+        }
+        // new or removed files may change targets
+        else if (e.structural && !inputs.contains(f) && !outputs.contains(f) && !isIgnored(f))
+        {
+            LOG_DEBUG(logger, "Set of files changed: " << f);
+            r = true;
+        }
+    }
+    return r;
+}
+
+void BuildDaemon::build(const ::sw::api::build::BuildRequest &request, ::sw::api::build::BuildResponse &response)
+{
+    std::unique_lock lk(m);
+    auto start = std::chrono::steady_clock::now();
+    try
+    {
+        auto cwd = to_string(normalize_path(fs::current_path()));
+        if (request.working_directory() != cwd)
+            throw SW_RUNTIME_ERROR("Daemon builds " + cwd + ", not " + request.working_directory());
+        if (isPrepareNeeded())
+        {
+            LOG_INFO(logger, "Preparing build");
+            prepare();
+            response.set_reprepared(true);
+        }
+        else
+        {
+            p->reset();
+            b->overrideBuildState(sw::BuildState::Prepared);
+        }
+        b->execute(*p);
+        response.set_success(true);
+    }
+    catch (std::exception &e)
+    {
+        response.set_error(e.what());
+    }
+    if (p)
+        watchImplicitInputs();
+    else
+        b.reset(); // failed during prepare, start from scratch next time
+    response.set_time(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+class BuildDaemonServiceImpl : public ::sw::api::build::BuildDaemonService::Service
+{
+    BuildDaemon &daemon;
+
+    DECLARE_SERVICE_METHOD(Build, ::sw::api::build::BuildRequest, ::sw::api::build::BuildResponse);
+
+public:
+    BuildDaemonServiceImpl(BuildDaemon &daemon) : daemon(daemon) {}
+};
+
+DEFINE_SERVICE_METHOD(BuildDaemonService, Build, ::sw::api::build::BuildRequest, ::sw::api::build::BuildResponse)
+{
+    daemon.build(*request, *response);
+    GRPC_RETURN_OK();
+}
+
+static void run_daemon(SwClientContext &swctx, const String &endpoint)
+{
+    BuildDaemon d(swctx);
+    d.prepare();
+
+    BuildDaemonServiceImpl service(d);
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort(endpoint, grpc::InsecureServerCredentials());
+    builder.RegisterService(&service);
+    auto server = builder.BuildAndStart();
+    if (!server)
+        throw SW_RUNTIME_ERROR("Cannot start grpc server");
+    LOG_INFO(logger, "Build daemon is listening on " << endpoint);
+    server->Wait();
+}
 
 SUBCOMMAND_DECL(server)
 {
     if (getOptions().options_server.distributed_builder)
     {
-        sw::builder::distributed::Server s;
+        sw::builder::distributed::Server s(
+            getContext(false).getLocalStorage().storage_dir_tmp / "distributed",
+            getOptions().options_server.workers);
         s.start(getOptions().options_server.endpoint);
         s.wait();
         // TODO: handle interrupts properly
@@ -17,5 +241,11 @@ SUBCOMMAND_DECL(server)
         return;
     }
 
+    if (getOptions().options_server.daemon)
+    {
+        run_daemon(*this, getOptions().options_server.endpoint);
+        return;
+    }
+
     SW_UNIMPLEMENTED;
 }
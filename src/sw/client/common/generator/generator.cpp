@@ -1291,7 +1291,8 @@ void RawBootstrapBuildGenerator::generate(const sw::SwBuild &b)
     {
         auto &c = dynamic_cast<const sw::builder::Command &>(*c1);
         files.insert(c.inputs.begin(), c.inputs.end());
-        files.insert(c.implicit_inputs.begin(), c.implicit_inputs.end());
+        for (auto id : c.implicit_inputs)
+            files.insert(sw::getPathTable().getPath(id));
     }
 
     LOG_INFO(logger, "Filtering files");
@@ -12,6 +12,7 @@
 #include <primitives/emitter.h>
 #include <primitives/executor.h>
 #include <primitives/http.h>
+#include <sw/builder_distributed/remote_executor.h>
 #include <sw/core/build.h>
 #include <sw/core/input.h>
 #include <sw/core/sw_context.h>
@@ -426,6 +427,16 @@ std::unique_ptr<sw::SwBuild> SwClientContext::createBuildInternal()
         bs["skip_errors"] = std::to_string(options.skip_errors);
 
     SET_BOOL_OPTION(time_trace);
+    SET_BOOL_OPTION(build_stats);
+    SET_BOOL_OPTION(action_cache);
+    if (options.action_cache_size)
+        bs["action_cache_size"] = std::to_string(options.action_cache_size);
+    if (!options.scheduler.empty())
+        bs["scheduler"] = options.scheduler;
+    if (!options.memory_limit.empty())
+        bs["memory_limit"] = options.memory_limit;
+    if (options.cpu_limit)
+        bs["cpu_limit"] = std::to_string(options.cpu_limit);
     SET_BOOL_OPTION(show_output);
     SET_BOOL_OPTION(write_output_to_file);
 
@@ -461,6 +472,8 @@ std::unique_ptr<sw::SwBuild> SwClientContext::createBuildInternal()
         bs["D"][t.substr(0, p)] = t.substr(p + 1);
     }
     b->setSettings(bs);
+    if (!options.remote_executor.empty())
+        b->setCommandExecutor(std::make_shared<sw::builder::distributed::RemoteExecutor>(options.remote_executor, !options.remote_cache_only));
 
     return b;
 }
@@ -798,6 +811,7 @@ sw::SwContext &SwClientContext::getContext(bool in_allow_network)
         u.explain_outdated = getOptions().explain_outdated;
         u.explain_outdated_full = getOptions().explain_outdated_full;
         u.gExplainOutdatedToTrace = getOptions().explain_outdated_to_trace;
+        u.check_content_hashes = getOptions().content_hash;
 
         u.save_command_format = getOptions().save_command_format;
 
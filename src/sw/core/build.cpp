@@ -7,9 +7,13 @@
 #include "input.h"
 #include "sw_context.h"
 
+#include <sw/builder/action_cache.h>
 #include <sw/builder/execution_plan.h>
+#include <sw/builder/file_storage.h>
 #include <sw/builder/jumppad.h>
+#include <sw/builder/process_monitor.h>
 #include <sw/manager/storage.h>
+#include <sw/support/trace.h>
 
 #include <boost/current_function.hpp>
 #include <magic_enum.hpp>
@@ -245,6 +249,30 @@ static ExecutionPlan::Clock::duration parseTimeLimit(String tl)
     return d;
 }
 
+// 512M, 16G etc., plain number is megabytes
+static uint64_t parseMemorySize(const String &s)
+{
+    size_t idx = 0;
+    uint64_t n = std::stoull(s, &idx);
+    if (idx == s.size())
+        return n << 20;
+    if (idx + 1 != s.size())
+        throw SW_RUNTIME_ERROR("Bad memory size: " + s);
+    switch (std::toupper(s[idx]))
+    {
+    case 'K':
+        return n << 10;
+    case 'M':
+        return n << 20;
+    case 'G':
+        return n << 30;
+    case 'T':
+        return n << 40;
+    default:
+        throw SW_RUNTIME_ERROR("Unknown memory size specifier: '"s + s[idx] + "'");
+    }
+}
+
 SwBuild::SwBuild(SwContext &swctx, const path &build_dir)
     : swctx(swctx)
     , build_dir(build_dir)
@@ -265,7 +293,7 @@ void SwBuild::stop()
 {
     stopped = true;
     if (current_explan)
-        current_explan->stop();
+        current_explan->stop(true);
 }
 
 void SwBuild::build()
@@ -287,12 +315,27 @@ void SwBuild::build()
 
     ScopedTime t;
 
+    bool time_trace = build_settings["time_trace"] == "true";
+    if (time_trace)
+        trace::enable();
+
     // this is all in one call
     while (step())
         ;
 
     if (build_settings["measure"] == "true")
         LOG_DEBUG(logger, BOOST_CURRENT_FUNCTION << " time: " << t.getTimeFloat() << " s.");
+
+    if (time_trace)
+    {
+        trace::disable();
+        auto d = getBuildDirectory() / "misc";
+        trace::saveChromeTrace(d / "time_trace.json");
+        auto s = trace::getSummary();
+        write_file(d / "time_trace.txt", s);
+        LOG_INFO(logger, s);
+        trace::clear();
+    }
 }
 
 bool SwBuild::step()
@@ -344,6 +387,7 @@ void SwBuild::overrideBuildState(BuildState s) const
 void SwBuild::loadInputs()
 {
     CHECK_STATE_AND_CHANGE(BuildState::NotStarted, BuildState::InputsLoaded);
+    SW_TRACE_ZONE("SwBuild::loadInputs");
 
     std::set<Input *> iv;
     for (auto &i : inputs)
@@ -415,6 +459,7 @@ void SwBuild::resolvePackages()
 void SwBuild::resolvePackages(const std::vector<IDependency*> &udeps)
 {
     CHECK_STATE_AND_CHANGE(BuildState::PackagesResolved, BuildState::PackagesResolved);
+    SW_TRACE_ZONE("SwBuild::resolvePackages");
 
     // this is simple lock file: u->p
     //
@@ -532,16 +577,10 @@ void SwBuild::resolvePackages(const std::vector<IDependency*> &udeps)
     // install goes here - after saved configs, lock files etc.
     {
         // mass (threaded) install!
-        auto &e = getExecutor();
-        Futures<void> fs;
+        std::vector<ResolveRequest *> prrs;
         for (auto &rr : rrs)
-        {
-            fs.push_back(e.push([this, &rr]
-            {
-                getContext().install(rr);
-            }));
-        }
-        waitAndGet(fs);
+            prrs.push_back(&rr);
+        getContext().install(prrs);
     }
 
     // now we know all drivers
@@ -568,6 +607,7 @@ void SwBuild::resolvePackages(const std::vector<IDependency*> &udeps)
 void SwBuild::loadPackages()
 {
     CHECK_STATE_AND_CHANGE(BuildState::PackagesResolved, BuildState::PackagesLoaded);
+    SW_TRACE_ZONE("SwBuild::loadPackages");
 
     // load
     auto usc = can_use_saved_configs(*this);
@@ -576,7 +616,8 @@ void SwBuild::loadPackages()
     int r = 1;
     while (!stopped)
     {
-        LOG_TRACE(logger, "build id " << this << " " << BOOST_CURRENT_FUNCTION << " round " << r++);
+        LOG_TRACE(logger, "build id " << this << " " << BOOST_CURRENT_FUNCTION << " round " << r);
+        SW_TRACE_ZONE("loadPackages round", std::to_string(r++));
 
         std::map<PackageSettings, std::pair<PackageId, TargetContainer *>> load;
         std::map<PackageSettings, std::pair<UnresolvedPackage, InputLoader *>> load2;
@@ -706,6 +747,8 @@ void SwBuild::loadPackages()
 
 bool SwBuild::prepareStep()
 {
+    SW_TRACE_ZONE("SwBuild::prepareStep");
+
     std::atomic_bool next_pass = false;
 
     auto &e = getPrepareExecutor();
@@ -716,6 +759,7 @@ bool SwBuild::prepareStep()
         {
             fs.push_back(e.push([tgt, &next_pass]
             {
+                SW_TRACE_ZONE("target prepare", [&tgt] { return tgt->getPackage().toString(); });
                 if (tgt->prepare())
                     next_pass = true;
             }));
@@ -729,6 +773,7 @@ bool SwBuild::prepareStep()
 void SwBuild::prepare()
 {
     CHECK_STATE_AND_CHANGE(BuildState::PackagesLoaded, BuildState::Prepared);
+    SW_TRACE_ZONE("SwBuild::prepare");
 
     while (prepareStep() && !stopped)
         ;
@@ -781,6 +826,7 @@ void SwBuild::execute() const
 void SwBuild::execute(ExecutionPlan &p) const
 {
     CHECK_STATE_AND_CHANGE(BuildState::Prepared, BuildState::Executed);
+    SW_TRACE_ZONE("SwBuild::execute");
 
     SwapAndRestore sr(current_explan, &p);
 
@@ -790,15 +836,64 @@ void SwBuild::execute(ExecutionPlan &p) const
         p.skip_errors = std::stoll(build_settings["skip_errors"].getValue());
     if (build_settings["time_limit"].isValue())
         p.setTimeLimit(parseTimeLimit(build_settings["time_limit"].getValue()));
+    if (build_settings["scheduler"].isValue())
+    {
+        auto sch = build_settings["scheduler"].getValue();
+        if (sch == "work_stealing" || sch == "ws")
+            p.scheduler = ExecutionPlan::SchedulerType::WorkStealing;
+        else if (sch != "default")
+            throw SW_RUNTIME_ERROR("Unknown scheduler: " + sch);
+    }
+    // commands without measured peak memory weigh nothing, so it is safe to have it on by default
+    p.budget.memory = getPhysicalMemory();
+    if (build_settings["memory_limit"].isValue())
+        p.budget.memory = parseMemorySize(build_settings["memory_limit"].getValue());
+    if (build_settings["cpu_limit"].isValue())
+        p.budget.threads = std::stoi(build_settings["cpu_limit"].getValue());
+
+    p.command_executor = command_executor;
 
     ScopedTime t;
     p.execute(getBuildExecutor());
     if (build_settings["measure"] == "true")
         LOG_DEBUG(logger, BOOST_CURRENT_FUNCTION << " time: " << t.getTimeFloat() << " s.");
 
-    if (build_settings["time_trace"] == "true")
+    if (p.scheduler == ExecutionPlan::SchedulerType::WorkStealing)
+    {
+        auto &st = p.getSchedulerStats();
+        auto to_s = [](auto d) { return std::chrono::duration_cast<std::chrono::duration<double>>(d).count(); };
+        auto total = to_s(st.wall_time) * st.workers;
+        LOG_INFO(logger, "Idle core time: " << to_s(st.idle_time) << " s. of " << total << " s. ("
+            << (total > 0 ? to_s(st.idle_time) * 100 / total : 0) << "%), "
+            << st.workers << " workers, " << st.steals << " steals");
+    }
+
+    {
+        auto &st = getFileStorage().getStats();
+        LOG_DEBUG(logger, "File system queries: " << st.issued << " issued, " << st.saved << " saved, "
+            << st.listed_dirs << " directories listed");
+    }
+
+    if (auto ac = getActionCache())
+    {
+        auto &st = ac->getStats();
+        LOG_INFO(logger, "Action cache: " << st.hits << " hits, " << st.misses << " misses, " << st.stores << " stores");
+        ac->trim();
+    }
+
+    // whole build trace is saved by build()
+    if (build_settings["time_trace"] == "true" && !trace::isEnabled())
         p.saveChromeTrace(getBuildDirectory() / "misc" / "time_trace.json");
 
+    if (build_settings["build_stats"] == "true")
+    {
+        p.saveBuildStats(getBuildDirectory() / "misc" / "build_stats.json", [this](const builder::Command &c) -> String
+        {
+            auto i = command_targets.find(&c);
+            return i != command_targets.end() ? i->second : "";
+        });
+    }
+
     path ide_fast_path = build_settings["build_ide_fast_path"].isValue() ? build_settings["build_ide_fast_path"].getValue() : "";
     if (!ide_fast_path.empty())
     {
@@ -821,6 +916,8 @@ void SwBuild::execute(ExecutionPlan &p) const
 
 Commands SwBuild::getCommands() const
 {
+    SW_TRACE_ZONE("SwBuild::getCommands");
+
     // calling this for all targets in any case to set proper command dependencies
     for (const auto &[pkg, tgts] : getTargets())
     {
@@ -941,6 +1038,7 @@ Commands SwBuild::getCommands() const
 
     // gather commands
     Commands cmds;
+    command_targets.clear();
     for (auto &[p, tgts] : ttb)
     {
         for (auto &tgt : tgts)
@@ -949,6 +1047,7 @@ Commands SwBuild::getCommands() const
             for (auto &c2 : c)
             {
                 c2->show_output = cl_show_output || cl_write_output_to_file; // only for selected targets
+                command_targets[c2.get()] = p.toString();
             }
             cmds.insert(c.begin(), c.end());
         }
@@ -1083,44 +1182,19 @@ std::unique_ptr<ExecutionPlan> SwBuild::getExecutionPlan() const
 
 std::unique_ptr<ExecutionPlan> SwBuild::getExecutionPlan(const Commands &cmds) const
 {
+    SW_TRACE_ZONE("SwBuild::getExecutionPlan");
+
     auto ep = ExecutionPlan::create(cmds);
     if (ep->isValid())
         return std::move(ep);
 
     // error!
 
-    auto d = getBuildDirectory() / "misc";
-
-    auto [g, n, sc] = ep->getStrongComponents();
-
-    using Subgraph = boost::subgraph<ExecutionPlan::Graph>;
-
-    // fill copy of g
-    Subgraph root(g.m_vertices.size());
-    for (auto &e : g.m_edges)
-        boost::add_edge(e.m_source, e.m_target, root);
-
-    std::vector<Subgraph*> subs(n);
-    for (decltype(n) i = 0; i < n; i++)
-        subs[i] = &root.create_subgraph();
-    for (int i = 0; i < sc.size(); i++)
-        boost::add_vertex(i, *subs[sc[i]]);
+    auto cyclic_path = getBuildDirectory() / "misc" / "cyclic";
+    write_file(cyclic_path / "cycles.txt", ep->getCyclesReport(-1));
 
-    auto cyclic_path = d / "cyclic";
-    fs::create_directories(cyclic_path);
-    for (decltype(n) i = 0; i < n; i++)
-    {
-        if (subs[i]->m_graph.m_vertices.size() > 1)
-            ExecutionPlan::printGraph(subs[i]->m_graph, cyclic_path / ("cycle_" + std::to_string(i)));
-    }
-
-    ep->printGraph(ep->getGraph(), cyclic_path / "processed", ep->getCommands(), true);
-    ep->printGraph(ep->getGraphUnprocessed(), cyclic_path / "unprocessed", ep->getUnprocessedCommands(), true);
-
-    String error = "Cannot create execution plan because of cyclic dependencies";
-    //String error = "Cannot create execution plan because of cyclic dependencies: strong components = " + std::to_string(n);
-
-    throw SW_RUNTIME_ERROR(error);
+    throw SW_RUNTIME_ERROR("Cannot create execution plan because of cyclic dependencies\n" + ep->getCyclesReport() +
+        "Full report: " + to_string(cyclic_path / "cycles.txt"));
 }
 
 String SwBuild::getHash() const
@@ -1249,6 +1323,14 @@ void SwBuild::setSettings(const PackageSettings &bs)
         build_executor = std::make_unique<Executor>(std::stoi(build_settings["build-jobs"].getValue()));
     if (build_settings["prepare-jobs"])
         prepare_executor = std::make_unique<Executor>(std::stoi(build_settings["prepare-jobs"].getValue()));
+    if (build_settings["action_cache"] == "true")
+    {
+        uintmax_t size = 10 * 1024; // mb
+        if (build_settings["action_cache_size"])
+            size = std::stoull(build_settings["action_cache_size"].getValue());
+        setActionCache(std::make_unique<ActionCache>(
+            getContext().getLocalStorage().storage_dir_tmp / "cache" / "actions", size * 1024 * 1024));
+    }
 }
 
 Executor &SwBuild::getBuildExecutor() const
@@ -1347,9 +1429,20 @@ bool SwBuild::resolve(ResolveRequest &rr) const
     return cached_storage->resolve(rr) || getContext().resolve(rr, false);
 }
 
+bool SwBuild::resolve(const std::vector<ResolveRequest *> &rrs) const
+{
+    std::vector<ResolveRequest *> left;
+    for (auto rr : rrs)
+    {
+        if (!cached_storage->resolve(*rr))
+            left.push_back(rr);
+    }
+    return left.empty() || getContext().resolve(left, false);
+}
+
 void SwBuild::resolveWithDependencies(std::vector<ResolveRequest> &v) const
 {
-    return ::sw::resolveWithDependencies(v, [this](auto &rr) { return resolve(rr); });
+    return ::sw::resolveWithDependencies(v, [this](auto &rrs) { return resolve(rrs); });
 }
 
 }
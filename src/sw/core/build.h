@@ -16,6 +16,7 @@ struct InputWithSettings;
 struct SwContext;
 struct ResolveRequest;
 struct CachedStorage;
+struct CommandExecutor;
 
 enum class BuildState
 {
@@ -62,7 +63,7 @@ struct SW_CORE_API SwBuild : SwBuilderContext
     void prepare();
     void execute() const;
 
-    // stop execution
+    // stop execution, running commands are killed
     void stop();
 
     // tune
@@ -98,6 +99,8 @@ struct SW_CORE_API SwBuild : SwBuilderContext
     const PackageSettings &getExternalVariables() const;
     const PackageSettings &getSettings() const { return build_settings; }
     void setSettings(const PackageSettings &build_settings);
+    // remote execution
+    void setCommandExecutor(std::shared_ptr<CommandExecutor> e) { command_executor = e; }
 
     void setName(const String &);
     String getName() const; // returns temporary object, so no refs
@@ -111,6 +114,7 @@ struct SW_CORE_API SwBuild : SwBuilderContext
 
     // stable resolve during whole build
     bool resolve(ResolveRequest &) const;
+    bool resolve(const std::vector<ResolveRequest *> &) const;
 
 private:
     SwContext &swctx;
@@ -121,11 +125,13 @@ private:
     PackageSettings build_settings;
     mutable BuildState state = BuildState::NotStarted;
     mutable Commands commands_storage; // we need some place to keep copy cmds
+    mutable std::unordered_map<const builder::Command *, String> command_targets; // for build stats
     std::unique_ptr<Executor> build_executor;
     std::unique_ptr<Executor> prepare_executor;
     bool stopped = false;
     mutable ExecutionPlan *current_explan = nullptr;
     std::unique_ptr<CachedStorage> cached_storage;
+    std::shared_ptr<CommandExecutor> command_executor;
 
     // other data
     String name;
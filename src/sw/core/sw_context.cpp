@@ -9,6 +9,7 @@
 #include "driver.h"
 
 #include <sw/manager/storage.h>
+#include <sw/support/trace.h>
 
 #include <primitives/executor.h>
 
@@ -249,6 +250,8 @@ Input *SwContext::getInput(size_t hash) const
 
 void SwContext::loadEntryPointsBatch(const std::set<Input *> &inputs)
 {
+    SW_TRACE_ZONE("SwContext::loadEntryPointsBatch");
+
     std::map<const IDriver *, std::set<Input*>> batch_inputs;
     std::set<Input*> parallel_inputs;
 
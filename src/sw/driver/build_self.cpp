@@ -42,17 +42,13 @@ PackageIdSet load_builtin_packages(SwContext &swctx)
     }
 
     // mass (threaded) install!
-    auto &e = getExecutor();
-    Futures<void> fs;
+    std::vector<ResolveRequest> rrs;
     for (auto &p : builtin_packages)
-    {
-        fs.push_back(e.push([&swctx, &p]
-        {
-            ResolveRequest rr{p};
-            swctx.install(rr);
-        }));
-    }
-    waitAndGet(fs);
+        rrs.emplace_back(p);
+    std::vector<ResolveRequest *> prrs;
+    for (auto &rr : rrs)
+        prrs.push_back(&rr);
+    swctx.install(prrs);
 
     return builtin_packages;
 }
@@ -13,6 +13,7 @@
 #include <sw/manager/storage.h>
 #include <sw/support/filesystem.h>
 #include <sw/support/hash.h>
+#include <sw/support/trace.h>
 
 #include <boost/algorithm/string.hpp>
 #include <nlohmann/json.hpp>
@@ -266,6 +267,8 @@ Check &CheckSet::registerCheck(Check &c) const
 
 void CheckSet::performChecks(const SwBuild &mb, const PackageSettings &ts)
 {
+    SW_TRACE_ZONE("CheckSet::performChecks");
+
     static const auto checks_dir = getChecker().swbld.getContext().getLocalStorage().storage_dir_etc / "sw" / "checks";
 
     if (!t)
@@ -575,7 +578,7 @@ void CheckSet::performChecks(const SwBuild &mb, const PackageSettings &ts)
     auto cyclic_path = d / "cyclic";
     write_file(cyclic_path / "deps_checks.dot", s);
 
-    throw SW_RUNTIME_ERROR("Cannot create execution plan because of cyclic dependencies");
+    throw SW_RUNTIME_ERROR("Cannot create execution plan because of cyclic dependencies\n" + ep->getCyclesReport());
 }
 
 std::unordered_map<String, Check*> CheckSet::getResults(bool allow_partial) const
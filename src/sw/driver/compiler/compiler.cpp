@@ -28,7 +28,7 @@ namespace sw
 static void add_args(driver::Command &c, const Strings &args)
 {
     for (auto &a : args)
-        c.arguments.push_back(a);
+        c.push_back(a);
 }
 
 CompilerBaseProgram::CompilerBaseProgram()
@@ -58,6 +58,8 @@ std::shared_ptr<builder::Command> CompilerBaseProgram::prepareCommand(const Targ
         return cmd;
     cmd->setContext(t.getMainBuild()); // used in prepareCommand1()
     cmd->setProgram(file);
+    // diagnostics only
+    cmd->truncate_output = true;
     prepareCommand1(t);
     prepared = true;
     return cmd;
@@ -24,6 +24,7 @@
 #include <sw/core/sw_context.h>
 #include <sw/manager/storage.h>
 #include <sw/support/serialization.h>
+#include <sw/support/trace.h>
 
 #include <boost/algorithm/string.hpp>
 #include <nlohmann/json.hpp>
@@ -660,6 +661,9 @@ PackageSettings Driver::getDllConfigSettings(SwBuild &b) const
 // not thread-safe
 std::unordered_map<path, PrepareConfigOutputData> Driver::build_configs1(SwContext &swctx, const std::set<Input *> &inputs) const
 {
+    SW_TRACE_ZONE("Driver::build_configs1");
+    trace::counter("config inputs", inputs.size());
+
     auto cfg_storage_dir = swctx.getLocalStorage().storage_dir_tmp / "cfg" / "stamps";
     fs::create_directories(cfg_storage_dir);
 
@@ -4,6 +4,7 @@
 #include "functions.h"
 
 #include <sw/builder/file.h>
+#include <sw/manager/blob_store.h>
 
 #include <primitives/hash.h>
 #include <primitives/http.h>
@@ -30,6 +31,7 @@ void writeFileOnce(const path &fn, const String &content, const path &lock_dir)
     if (!fs::exists(once) || h != read_file(once) || !fs::exists(fn))
     {
         ScopedFileLock fl(lock);
+        BlobStore::unshare(fn);
         write_file_if_different(fn, content);
         write_file_if_different(once, h);
     }
@@ -41,6 +43,7 @@ void writeFileSafe(const path &fn, const String &content, const path &lock_dir)
     const auto lock = lock_dir / hf;
 
     ScopedFileLock fl(lock);
+    BlobStore::unshare(fn);
     write_file_if_different(fn, content);
 }
 
@@ -64,6 +67,8 @@ void replaceInFileOnce(const path &fn, const String &from, const String &to, con
 
     auto s = read_file(fn);
     boost::replace_all(s, from, to);
+    // package sources may share contents with other packages
+    BlobStore::unshare(fn);
     write_file_if_different(fn, s); // if different?
     write_file_if_different(hfn, "");
 }
@@ -88,6 +93,7 @@ void pushFrontToFileOnce(const path &fn, const String &text, const path &lock_di
 
     auto s = read_file(fn);
     s = text + "\n" + s;
+    BlobStore::unshare(fn);
     write_file_if_different(fn, s);
     write_file_if_different(hfn, "");
 }
@@ -112,6 +118,7 @@ void pushBackToFileOnce(const path &fn, const String &text, const path &lock_dir
 
     auto s = read_file(fn);
     s = s + "\n" + text;
+    BlobStore::unshare(fn);
     write_file_if_different(fn, s);
     write_file_if_different(hfn, "");
 }
@@ -134,6 +141,7 @@ bool patch(const path &fn, const String &patch, const path &lock_dir)
         return false;
     }
 
+    BlobStore::unshare(fn);
     write_file(fn, r.second);
     write_file(fn_patch, t); // save orig
 
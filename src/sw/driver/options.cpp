@@ -316,9 +316,9 @@ void NativeCompilerOptions::addDefinitions(builder::Command &c) const
         for (auto &d : a)
         {
             if (d.second.empty())
-                c.arguments.push_back("-D" + d.first);
+                c.push_back("-D" + d.first);
             else
-                c.arguments.push_back("-D" + d.first + "=" + d.second);
+                c.push_back("-D" + d.first + "=" + d.second);
         }
     };
 
@@ -364,7 +364,7 @@ void NativeCompilerOptions::addCompileOptions(builder::Command &c) const
     auto print_idir = [&c](const auto &a, auto &flag)
     {
         for (auto &d : a)
-            c.arguments.push_back(flag + to_string(normalize_path(d)));
+            c.push_back(flag + to_string(normalize_path(d)));
     };
 
     print_idir(System.CompileOptions, "");
@@ -462,7 +462,7 @@ void NativeLinkerOptions::addEverything(builder::Command &c) const
     auto print_idir = [&c](const auto &a, auto &flag)
     {
         for (auto &d : a)
-            c.arguments.push_back(flag + to_string(normalize_path(d)));
+            c.push_back(flag + to_string(normalize_path(d)));
     };
 
     print_idir(System.LinkOptions, "");
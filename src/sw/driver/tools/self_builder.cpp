@@ -91,7 +91,7 @@ String write_build_script_headers(SwCoreContext &swctx)
             prepkgs.emplace_back(String(SW_DRIVER_NAME));
         }
 
-        resolveWithDependencies(prepkgs, [&swctx](auto &rr) { return swctx.resolve(rr, true); });
+        resolveWithDependencies(prepkgs, [&swctx](auto &rrs) { return swctx.resolve(rrs, true); });
     }
 
     primitives::CppEmitter ctx;
@@ -211,19 +211,13 @@ int main(int argc, char **argv)
     //
     SwCoreContext swctx(Settings::get_user_settings().storage_dir, true);
     auto m_rrs = get_base_rr_vector();
-    resolveWithDependencies(m_rrs, [&swctx](auto &rr) { return swctx.resolve(rr, true); });
+    resolveWithDependencies(m_rrs, [&swctx](auto &rrs) { return swctx.resolve(rrs, true); });
     {
         // mass (threaded) install!
-        auto &e = getExecutor();
-        Futures<void> fs;
+        std::vector<ResolveRequest *> prrs;
         for (auto &rr : m_rrs)
-        {
-            fs.push_back(e.push([&swctx, &rr]
-            {
-                swctx.install(rr);
-            }));
-        }
-        waitAndGet(fs);
+            prrs.push_back(&rr);
+        swctx.install(prrs);
     }
     auto t1 = write_required_packages(m_rrs);
     write_file(packages, t1);
@@ -234,7 +228,7 @@ int main(int argc, char **argv)
     //auto m_headers_rrs = get_base_rr_vector();
     //m_headers_rrs.emplace_back("org.sw.demo.llvm_project.libcxx"s); // other needed stuff (libcxx)
     //m_headers_rrs.emplace_back("org.sw.demo.qtproject.qt.base.tools.moc"s); // for gui
-    //resolveWithDependencies(m_headers_rrs, [&swctx](auto &rr) { return swctx.resolve(rr, true); });
+    //resolveWithDependencies(m_headers_rrs, [&swctx](auto &rrs) { return swctx.resolve(rrs, true); });
 
     auto t2 = write_build_script_headers(swctx);
     auto t3 = write_build_script(swctx, m_rrs);
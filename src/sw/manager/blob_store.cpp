@@ -0,0 +1,244 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#include "blob_store.h"
+
+#include <sw/support/filesystem.h>
+
+#include <primitives/exceptions.h>
+#include <primitives/lock.h>
+#include <primitives/templates.h>
+#include <xxhash.h>
+
+#include <cstdio>
+#include <map>
+#include <unordered_set>
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "blob_store");
+
+namespace sw
+{
+
+static String get_blob_name(const path &fn, uint64_t size)
+{
+    ScopedFile f(fn, "rb");
+    auto state = XXH3_createState();
+    if (!state)
+        throw SW_RUNTIME_ERROR("Cannot create hash state");
+    SCOPE_EXIT
+    {
+        XXH3_freeState(state);
+    };
+    XXH3_128bits_reset(state);
+    std::vector<char> buf(64 * 1024);
+    while (auto n = fread(buf.data(), 1, buf.size(), f.getHandle()))
+        XXH3_128bits_update(state, buf.data(), n);
+    if (ferror(f.getHandle()))
+        throw SW_RUNTIME_ERROR("Cannot read file: " + to_string(fn));
+    auto h = XXH3_128bits_digest(state);
+
+    char s[64];
+    snprintf(s, sizeof(s), "%016llx%016llx-%llu",
+        (unsigned long long)h.high64, (unsigned long long)h.low64, (unsigned long long)size);
+    String name = s;
+#ifndef _WIN32
+    // links share permissions, so executables are stored separately
+    if ((fs::status(fn).permissions() & fs::perms::owner_exec) != fs::perms::none)
+        name += "x";
+#endif
+    return name;
+}
+
+static void set_read_only(const path &fn, bool ro)
+{
+    error_code ec;
+    fs::permissions(fn, fs::perms::owner_write | fs::perms::group_write | fs::perms::others_write,
+        ro ? fs::perm_options::remove : fs::perm_options::add, ec);
+}
+
+BlobStore::BlobStore(const path &root)
+    : root(root)
+{
+}
+
+path BlobStore::getBlobPath(const String &name) const
+{
+    return root / name.substr(0, 2) / name;
+}
+
+std::unique_ptr<ScopedFileLock> BlobStore::lock() const
+{
+    // lock file is placed near the root, so it is not taken for a blob
+    fs::create_directories(root);
+    return std::make_unique<ScopedFileLock>(root);
+}
+
+Strings BlobStore::checkin(const path &dir) const
+{
+    // files are replaced below, so do not iterate over changing directory
+    // contents are hashed before taking the lock
+    std::map<path, String> files;
+    for (auto &e : fs::recursive_directory_iterator(dir))
+    {
+        // symlinks are left as is
+        if (!fs::is_regular_file(e.symlink_status()))
+            continue;
+        auto size = fs::file_size(e.path());
+        if (size == 0)
+            continue;
+        files.emplace(e.path(), get_blob_name(e.path(), size));
+    }
+
+    auto lk = lock();
+    Strings names;
+    for (auto &[fn, name] : files)
+    {
+        auto blob = getBlobPath(name);
+        error_code ec;
+        fs::create_directories(blob.parent_path(), ec);
+
+        // new contents: file itself becomes a blob
+        // if another unpack was faster, link to its blob below
+        if (!fs::exists(blob))
+        {
+            // copy-on-write file systems: file keeps its own inode
+            auto tmp = blob.parent_path() / unique_path();
+            if (support::reflink(fn, tmp))
+            {
+                set_read_only(tmp, true);
+                fs::rename(tmp, blob, ec);
+                if (ec)
+                    fs::remove(tmp, ec);
+                else
+                    names.push_back(name);
+                continue;
+            }
+            fs::create_hard_link(fn, blob, ec);
+            if (!ec)
+            {
+                // links share contents, so they must not be changed in place
+                set_read_only(blob, true);
+                names.push_back(name);
+                continue;
+            }
+            if (!fs::exists(blob))
+            {
+                LOG_TRACE(logger, "Cannot add file to blob store: " << fn << ", error: " << ec.message());
+                continue;
+            }
+        }
+
+        // link is created aside and moved over the file,
+        // so the file is never missing
+        auto tmp = path(fn) += ".blob";
+        if (support::reflink(blob, tmp))
+            set_read_only(tmp, false);
+        else
+        {
+            fs::create_hard_link(blob, tmp, ec);
+            if (ec)
+            {
+                LOG_TRACE(logger, "Cannot link blob: " << blob << " to " << fn << ", error: " << ec.message());
+                continue;
+            }
+        }
+        fs::rename(tmp, fn, ec);
+        if (ec)
+        {
+            fs::remove(tmp, ec);
+            continue;
+        }
+        names.push_back(name);
+    }
+    return names;
+}
+
+uint64_t BlobStore::release(const Strings &blobs) const
+{
+    if (blobs.empty())
+        return 0;
+    auto lk = lock();
+    uint64_t freed = 0;
+    std::unordered_set<String> seen;
+    for (auto &name : blobs)
+    {
+        if (!seen.insert(name).second)
+            continue;
+        auto blob = getBlobPath(name);
+        error_code ec;
+        // still linked to other packages or already removed
+        if (fs::hard_link_count(blob, ec) != 1 || ec)
+            continue;
+        auto size = fs::file_size(blob, ec);
+        if (fs::remove(blob, ec))
+            freed += size;
+    }
+    return freed;
+}
+
+uint64_t BlobStore::collectGarbage() const
+{
+    uint64_t freed = 0;
+    if (!fs::exists(root))
+        return freed;
+    auto lk = lock();
+    for (auto &e : fs::recursive_directory_iterator(root))
+    {
+        if (!e.is_regular_file())
+            continue;
+        error_code ec;
+        if (e.hard_link_count(ec) != 1 || ec)
+            continue;
+        auto size = e.file_size(ec);
+        if (fs::remove(e.path(), ec))
+            freed += size;
+    }
+    return freed;
+}
+
+BlobStore::Stats BlobStore::getStats() const
+{
+    Stats s;
+    if (!fs::exists(root))
+        return s;
+    for (auto &e : fs::recursive_directory_iterator(root))
+    {
+        if (!e.is_regular_file())
+            continue;
+        error_code ec;
+        auto links = e.hard_link_count(ec);
+        if (ec)
+            continue;
+        auto size = e.file_size(ec);
+        if (ec)
+            continue;
+        s.blobs++;
+        s.stored_bytes += size;
+        // store itself holds one link
+        if (links == 1)
+            s.unused_blobs++;
+        s.linked_bytes += size * (links - 1);
+    }
+    return s;
+}
+
+void BlobStore::unshare(const path &fn)
+{
+    error_code ec;
+    auto links = fs::hard_link_count(fn, ec);
+    if (ec)
+        return;
+    // blob is gone already
+    if (links <= 1)
+    {
+        set_read_only(fn, false);
+        return;
+    }
+    auto tmp = path(fn) += ".unshare";
+    fs::copy_file(fn, tmp, fs::copy_options::overwrite_existing);
+    set_read_only(tmp, false);
+    fs::rename(tmp, fn);
+}
+
+}
@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#pragma once
+
+#include <primitives/filesystem.h>
+
+#include <memory>
+
+struct ScopedFileLock;
+
+namespace sw
+{
+
+/// Content addressed store of unpacked package files.
+///
+/// Files of package source trees are hard links to blobs of this store,
+/// so equal files of different packages (versions) occupy disk space once.
+/// Link count of a blob is its reference count: blob with one link is not used anymore.
+/// Linked files are read-only, writers must unshare() them first.
+///
+/// On copy-on-write file systems files are reflinked instead: they keep their own inodes
+/// and share only extents with blobs, so they can be changed freely.
+/// Such blobs look unused and may be removed by release() and collectGarbage()
+/// without affecting packages.
+///
+/// Checkin, release and garbage collection are serialized between processes by a file lock.
+///
+/// layout:
+///   <root>/<2 hex>/<xxh3 128 hex>-<size>
+struct SW_MANAGER_API BlobStore
+{
+    struct Stats
+    {
+        size_t blobs = 0;
+        size_t unused_blobs = 0;
+        // size of blobs on disk
+        uint64_t stored_bytes = 0;
+        // size of all files of package trees linked to blobs
+        uint64_t linked_bytes = 0;
+
+        uint64_t getSavedBytes() const { return linked_bytes > stored_bytes ? linked_bytes - stored_bytes : 0; }
+    };
+
+    BlobStore(const path &root);
+
+    /// Replaces regular files under dir with links to blobs, new contents are moved into the store.
+    /// Files that cannot be linked (other file system, link limit) are kept as is.
+    /// Returns names of used blobs.
+    Strings checkin(const path &dir) const;
+
+    /// removes blobs that are not linked anymore, returns freed bytes
+    uint64_t release(const Strings &blobs) const;
+    /// scans the whole store, returns freed bytes
+    uint64_t collectGarbage() const;
+
+    Stats getStats() const;
+
+    /// Gives file its own writable copy of contents, so it can be changed in place
+    /// without touching other packages.
+    static void unshare(const path &fn);
+
+private:
+    path root;
+
+    path getBlobPath(const String &name) const;
+    std::unique_ptr<ScopedFileLock> lock() const;
+};
+
+}
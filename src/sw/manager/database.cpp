@@ -12,6 +12,7 @@
 #include <sw/support/hash.h>
 
 #include <primitives/command.h>
+#include <primitives/executor.h>
 #include <primitives/lock.h>
 #include <primitives/pack.h>
 #include <primitives/templates.h>
@@ -209,27 +210,72 @@ void PackagesDatabase::open(bool read_only, bool in_memory)
 {
     Database::open(read_only, in_memory);
     pps = std::make_unique<PreparedStatements>(*db);
+    clearVersionsCache();
 }
 
-std::optional<PackageId> PackagesDatabase::resolve(const UnresolvedPackage &pkg) const
+std::vector<std::shared_ptr<const VersionSet>> PackagesDatabase::getVersions(const std::vector<PackagePath> &paths) const
 {
-    auto pid = getPackageId(pkg.ppath);
-    if (!pid)
-        return {};
+    std::vector<std::shared_ptr<const VersionSet>> r(paths.size());
+    Strings keys;
+    keys.reserve(paths.size());
+    for (auto &p : paths)
+        keys.push_back(p.toStringLower());
 
-    VersionSet versions;
-    UnorderedVersionMap<db::PackageVersionId> version_ids;
+    std::vector<size_t> missing;
+    {
+        std::shared_lock lk(m_versions);
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            auto it = versions_cache.find(keys[i]);
+            if (it != versions_cache.end())
+                r[i] = it->second;
+            else
+                missing.push_back(i);
+        }
+    }
+    if (missing.empty())
+        return r;
 
+    // single query for all missing packages
+    std::unordered_map<String, std::shared_ptr<VersionSet>> loaded;
+    Strings query_paths;
+    for (auto i : missing)
+    {
+        if (loaded.emplace(keys[i], std::make_shared<VersionSet>()).second)
+            query_paths.push_back(keys[i]);
+    }
+    // path column has nocase collation, so lowercase paths match
     for (const auto &row : (*db)(
-        select(pkg_ver.packageVersionId, pkg_ver.version)
-        .from(pkg_ver)
-        .where(pkg_ver.packageId == pid)))
+        select(pkgs.path, pkg_ver.version)
+        .from(pkg_ver.join(pkgs).on(pkg_ver.packageId == pkgs.packageId))
+        .where(pkgs.path.in(sqlpp::value_list(query_paths)))))
+    {
+        auto i = loaded.find(PackagePath(row.path.value()).toStringLower());
+        if (i != loaded.end())
+            i->second->insert(row.version.value());
+    }
+
+    std::unique_lock lk(m_versions);
+    for (auto i : missing)
     {
-        versions.insert(row.version.value());
-        version_ids[row.version.value()] = row.packageVersionId.value();
+        auto &v = versions_cache[keys[i]];
+        if (!v)
+            v = loaded[keys[i]];
+        r[i] = v;
     }
+    return r;
+}
+
+void PackagesDatabase::clearVersionsCache() const
+{
+    std::unique_lock lk(m_versions);
+    versions_cache.clear();
+}
 
-    auto v = pkg.range.getMaxSatisfyingVersion(versions);
+std::optional<PackageId> PackagesDatabase::resolve(const UnresolvedPackage &pkg) const
+{
+    auto versions = getVersions({ pkg.ppath });
+    auto v = pkg.range.getMaxSatisfyingVersion(*versions[0]);
     if (!v)
         return {};
 
@@ -243,13 +289,45 @@ std::optional<PackageId> PackagesDatabase::resolve(ResolveRequest &rr) const
 
 std::unordered_map<UnresolvedPackage, PackageId> PackagesDatabase::resolve(const UnresolvedPackages &in_pkgs, UnresolvedPackages &unresolved_pkgs) const
 {
-    std::unordered_map<UnresolvedPackage, PackageId> r;
+    std::vector<const UnresolvedPackage *> pkgs;
+    std::vector<PackagePath> paths;
     for (auto &pkg : in_pkgs)
     {
-        if (auto r2 = resolve(pkg))
-            r.emplace(pkg, *r2);
+        pkgs.push_back(&pkg);
+        paths.push_back(pkg.ppath);
+    }
+    auto versions = getVersions(paths);
+
+    std::vector<std::optional<Version>> resolved(pkgs.size());
+    auto resolve_range = [&pkgs, &versions, &resolved](size_t begin, size_t end)
+    {
+        for (auto i = begin; i < end; i++)
+            resolved[i] = pkgs[i]->range.getMaxSatisfyingVersion(*versions[i]);
+    };
+    const size_t chunk_size = 256;
+    if (pkgs.size() <= chunk_size)
+        resolve_range(0, pkgs.size());
+    else
+    {
+        auto &e = getExecutor();
+        Futures<void> fs;
+        for (size_t i = 0; i < pkgs.size(); i += chunk_size)
+        {
+            fs.push_back(e.push([&resolve_range, i, n = std::min(i + chunk_size, pkgs.size())]
+            {
+                resolve_range(i, n);
+            }));
+        }
+        waitAndGet(fs);
+    }
+
+    std::unordered_map<UnresolvedPackage, PackageId> r;
+    for (size_t i = 0; i < pkgs.size(); i++)
+    {
+        if (resolved[i])
+            r.emplace(*pkgs[i], PackageId{ pkgs[i]->ppath, *resolved[i] });
         else
-            unresolved_pkgs.insert(pkg);
+            unresolved_pkgs.insert(*pkgs[i]);
     }
     return r;
 }
@@ -328,6 +406,11 @@ bool PackagesDatabase::isPackageInstalled(const Package &p) const
 void PackagesDatabase::installPackage(const PackageId &p, const PackageData &d)
 {
     std::lock_guard lk(m);
+    // after commit
+    SCOPE_EXIT
+    {
+        clearVersionsCache();
+    };
     auto tr = sqlpp11_transaction_manual(*db);
 
     int64_t package_id = 0;
@@ -462,6 +545,7 @@ void PackagesDatabase::deletePackage(const PackageId &p) const
         remove_from(pkg_ver)
         .where(pkg_ver.packageId == getPackageId(p.getPath()) && pkg_ver.version == p.getVersion().toString())
         );
+    clearVersionsCache();
 }
 
 void PackagesDatabase::deleteOverriddenPackageDir(const path &sdir) const
@@ -470,6 +554,7 @@ void PackagesDatabase::deleteOverriddenPackageDir(const path &sdir) const
         remove_from(pkg_ver)
         .where(pkg_ver.sdir == to_string(sdir.u8string()))
         );
+    clearVersionsCache();
 }
 
 std::vector<PackagePath> PackagesDatabase::getMatchingPackages(const String &name, int limit, int offset) const
@@ -10,6 +10,7 @@
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <shared_mutex>
 #include <vector>
 
 namespace sw
@@ -26,9 +27,15 @@ struct SW_MANAGER_API PackagesDatabase : Database
 
     void open(bool read_only = false, bool in_memory = false);
 
+    /// versions of all packages are loaded with one query, ranges of big sets are matched in parallel
     std::unordered_map<UnresolvedPackage, PackageId> resolve(const UnresolvedPackages &pkgs, UnresolvedPackages &unresolved_pkgs) const;
     std::optional<PackageId> resolve(ResolveRequest &rr) const;
 
+    /// versions of packages, missing packages have empty sets
+    /// results are cached until the database is changed through this object
+    std::vector<std::shared_ptr<const VersionSet>> getVersions(const std::vector<PackagePath> &) const;
+    void clearVersionsCache() const;
+
     PackageData getPackageData(const PackageId &) const;
 
     db::PackageVersionId getInstalledPackageId(const PackageId &) const;
@@ -53,6 +60,9 @@ struct SW_MANAGER_API PackagesDatabase : Database
 private:
     std::mutex m;
     std::unique_ptr<struct PreparedStatements> pps;
+    // lowercase package path -> versions
+    mutable std::shared_mutex m_versions;
+    mutable std::unordered_map<String, std::shared_ptr<const VersionSet>> versions_cache;
 
     // add type and config later
     // rename to get package version file hash ()
@@ -0,0 +1,619 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#include "package_index.h"
+
+#include <sw/support/hash.h>
+
+#include <primitives/csv.h>
+#include <primitives/exceptions.h>
+
+#include <fstream>
+#include <map>
+#include <span>
+
+#define PACKAGE_INDEX_MAGIC 0x5845444e4957535fULL // "_SWINDEX"
+#define PACKAGE_INDEX_FORMAT_VERSION 1
+
+namespace sw
+{
+
+namespace
+{
+
+struct Str
+{
+    uint32_t offset;
+    uint32_t size;
+};
+
+struct Header
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t n_packages;
+    uint32_t n_versions;
+    uint32_t n_deps;
+    uint32_t n_buckets; // power of two, at least twice the number of packages
+    uint32_t strings_size;
+};
+
+struct PackageEntry
+{
+    Str path;
+    uint32_t first_version;
+    uint32_t n_versions;
+    uint64_t flags;
+};
+
+struct VersionEntry
+{
+    Str version;
+    Str hash;
+    Str source;
+    Str sdir;
+    uint64_t flags;
+    int32_t prefix;
+    uint32_t first_dep;
+    uint32_t n_deps;
+    uint32_t padding;
+};
+
+struct DependencyEntry
+{
+    Str path;
+    Str range;
+};
+
+// every section stays 8 byte aligned
+static_assert(sizeof(Header) == 32);
+static_assert(sizeof(PackageEntry) == 24);
+static_assert(sizeof(VersionEntry) == 56);
+static_assert(sizeof(DependencyEntry) == 16);
+
+// package paths are case insensitive
+String lower_path(std::string_view s)
+{
+    String r(s);
+    for (auto &c : r)
+    {
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+    }
+    return r;
+}
+
+bool equals_lower(std::string_view s, std::string_view lower)
+{
+    if (s.size() != lower.size())
+        return false;
+    for (size_t i = 0; i < s.size(); i++)
+    {
+        auto c = s[i];
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        if (c != lower[i])
+            return false;
+    }
+    return true;
+}
+
+// fnv-1a, stored in files, must not change between platforms and versions
+uint64_t hash_path(std::string_view lower)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (auto c : lower)
+    {
+        h ^= (uint8_t)c;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+struct VersionRecord
+{
+    String version;
+    uint64_t flags = 0;
+    int prefix = 2;
+    String hash;
+    String source;
+    String sdir;
+    // sorted
+    std::vector<std::pair<String, String>> deps;
+
+    bool operator==(const VersionRecord &) const = default;
+};
+
+struct PackageRecord
+{
+    String path;
+    uint64_t flags = 0;
+    // sorted by version string
+    std::vector<VersionRecord> versions;
+
+    bool operator==(const PackageRecord &) const = default;
+};
+
+// lowercase path -> package
+using PackageRecords = std::map<String, PackageRecord>;
+
+// calls f with column getter for every row, missing and null values are empty
+template <class F>
+void read_csv(const path &fn, F &&f)
+{
+    std::ifstream ifile(fn);
+    if (!ifile)
+        throw SW_RUNTIME_ERROR("Cannot open file " + to_string(fn) + " for reading");
+
+    auto getline = [&ifile](String &s)
+    {
+        if (!std::getline(ifile, s))
+            return false;
+        if (!s.empty() && s.back() == '\r')
+            s.resize(s.size() - 1);
+        return true;
+    };
+    auto split_csv_line = [](const auto &s)
+    {
+        return primitives::csv::parse_line(s, ',', '\"', '\"');
+    };
+
+    String s;
+    if (!getline(s))
+        return;
+    std::unordered_map<String, size_t> cols;
+    auto header = split_csv_line(s);
+    for (size_t i = 0; i < header.size(); i++)
+    {
+        if (header[i])
+            cols[*header[i]] = i;
+    }
+
+    while (getline(s))
+    {
+        if (s.empty())
+            continue;
+        auto row = split_csv_line(s);
+        f([&cols, &row](const String &name) -> String
+        {
+            auto i = cols.find(name);
+            if (i == cols.end() || i->second >= row.size() || !row[i->second])
+                return {};
+            return *row[i->second];
+        });
+    }
+}
+
+int64_t to_int(const String &s, int64_t default_value)
+{
+    return s.empty() ? default_value : std::stoll(s);
+}
+
+PackageRecords read_tables(const path &dir)
+{
+    PackageRecords packages;
+
+    // package_id -> path
+    std::unordered_map<String, String> package_paths;
+    read_csv(dir / "package.csv", [&](auto &&col)
+    {
+        auto p = col("path");
+        package_paths[col("package_id")] = p;
+        auto &r = packages[lower_path(p)];
+        r.path = p;
+        r.flags = to_int(col("flags"), 0);
+    });
+
+    // package_version_id -> lowercase path, version
+    // rows with unknown ids are dropped, they are not reachable from database queries too
+    std::unordered_map<String, std::pair<String, VersionRecord>> versions;
+    read_csv(dir / "package_version.csv", [&](auto &&col)
+    {
+        auto i = package_paths.find(col("package_id"));
+        if (i == package_paths.end())
+            return;
+        auto &[p, v] = versions[col("package_version_id")];
+        p = lower_path(i->second);
+        // as PackageId prints it
+        v.version = Version(col("version")).toString();
+        v.flags = to_int(col("flags"), 0);
+        v.prefix = (int)to_int(col("prefix"), 2);
+        v.sdir = col("sdir");
+    });
+
+    std::unordered_map<String, String> file_hashes;
+    read_csv(dir / "file.csv", [&](auto &&col)
+    {
+        file_hashes[col("file_id")] = col("hash");
+    });
+
+    // first file of version, as packages database takes it
+    std::unordered_set<String> with_file;
+    read_csv(dir / "package_version_file.csv", [&](auto &&col)
+    {
+        auto id = col("package_version_id");
+        auto i = versions.find(id);
+        if (i == versions.end() || !with_file.insert(id).second)
+            return;
+        auto f = file_hashes.find(col("file_id"));
+        if (f == file_hashes.end())
+            throw SW_RUNTIME_ERROR("Unknown file of package version: " + id);
+        i->second.second.hash = f->second;
+        i->second.second.source = col("source");
+    });
+
+    read_csv(dir / "package_version_dependency.csv", [&](auto &&col)
+    {
+        auto i = versions.find(col("package_version_id"));
+        auto p = package_paths.find(col("package_id"));
+        if (i == versions.end() || p == package_paths.end())
+            return;
+        i->second.second.deps.emplace_back(p->second, col("version_range"));
+    });
+
+    for (auto &[id, pv] : versions)
+    {
+        auto &[p, v] = pv;
+        std::sort(v.deps.begin(), v.deps.end());
+        packages[p].versions.push_back(std::move(v));
+    }
+    for (auto &[p, r] : packages)
+    {
+        std::sort(r.versions.begin(), r.versions.end(), [](const auto &a, const auto &b)
+        {
+            return a.version < b.version;
+        });
+    }
+    return packages;
+}
+
+void write_index(const PackageRecords &packages, const path &out)
+{
+    std::vector<PackageEntry> pe;
+    std::vector<VersionEntry> ve;
+    std::vector<DependencyEntry> de;
+    String strings;
+    std::unordered_map<String, Str> string_ids;
+
+    auto add_string = [&strings, &string_ids](const String &s)
+    {
+        auto [i, inserted] = string_ids.try_emplace(s);
+        if (inserted)
+        {
+            i->second = { (uint32_t)strings.size(), (uint32_t)s.size() };
+            strings += s;
+        }
+        return i->second;
+    };
+
+    for (auto &[_, p] : packages)
+    {
+        auto &e = pe.emplace_back();
+        e.path = add_string(p.path);
+        e.first_version = (uint32_t)ve.size();
+        e.n_versions = (uint32_t)p.versions.size();
+        e.flags = p.flags;
+        for (auto &v : p.versions)
+        {
+            VersionEntry x{};
+            x.version = add_string(v.version);
+            x.hash = add_string(v.hash);
+            x.source = add_string(v.source);
+            x.sdir = add_string(v.sdir);
+            x.flags = v.flags;
+            x.prefix = v.prefix;
+            x.first_dep = (uint32_t)de.size();
+            x.n_deps = (uint32_t)v.deps.size();
+            for (auto &[dp, dr] : v.deps)
+                de.push_back({ add_string(dp), add_string(dr) });
+            ve.push_back(x);
+        }
+    }
+    if (strings.size() > UINT32_MAX)
+        throw SW_RUNTIME_ERROR("Too big packages index");
+
+    uint32_t n_buckets = 2;
+    while (n_buckets < pe.size() * 2)
+        n_buckets *= 2;
+    std::vector<uint32_t> buckets(n_buckets);
+    uint32_t idx = 0;
+    for (auto &[lpath, _] : packages)
+    {
+        for (auto i = hash_path(lpath) & (n_buckets - 1);; i = (i + 1) & (n_buckets - 1))
+        {
+            if (!buckets[i])
+            {
+                buckets[i] = ++idx;
+                break;
+            }
+        }
+    }
+
+    Header h{};
+    h.magic = PACKAGE_INDEX_MAGIC;
+    h.version = PACKAGE_INDEX_FORMAT_VERSION;
+    h.n_packages = (uint32_t)pe.size();
+    h.n_versions = (uint32_t)ve.size();
+    h.n_deps = (uint32_t)de.size();
+    h.n_buckets = n_buckets;
+    h.strings_size = (uint32_t)strings.size();
+
+    {
+        std::ofstream o(out, std::ios::binary);
+        if (!o)
+            throw SW_RUNTIME_ERROR("Cannot open file " + to_string(out) + " for writing");
+        auto write = [&o](const auto &v)
+        {
+            o.write((const char *)v.data(), v.size() * sizeof(v[0]));
+        };
+        o.write((const char *)&h, sizeof(h));
+        write(pe);
+        write(ve);
+        write(de);
+        write(buckets);
+        write(strings);
+        if (!o)
+            throw SW_RUNTIME_ERROR("Cannot write file " + to_string(out));
+    }
+    write_file(path(out) += ".hash", support::get_file_hash(out));
+}
+
+}
+
+struct PackageIndex::Snapshot
+{
+    MappedFile f;
+    const Header *h;
+    const PackageEntry *packages;
+    const VersionEntry *versions;
+    const DependencyEntry *deps;
+    const uint32_t *buckets;
+    const char *strings;
+
+    Snapshot(const path &fn)
+        : f(fn, true)
+    {
+        if (f.size() < sizeof(Header))
+            throw SW_RUNTIME_ERROR("Bad packages index: " + to_string(fn));
+        h = (const Header *)f.data();
+        if (h->magic != PACKAGE_INDEX_MAGIC || h->version != PACKAGE_INDEX_FORMAT_VERSION)
+            throw SW_RUNTIME_ERROR("Unknown packages index format: " + to_string(fn));
+        if (!h->n_buckets || (h->n_buckets & (h->n_buckets - 1)) || h->n_buckets < (uint64_t)h->n_packages * 2)
+            throw SW_RUNTIME_ERROR("Bad packages index: " + to_string(fn));
+
+        auto sz = sizeof(Header)
+            + (uint64_t)h->n_packages * sizeof(PackageEntry)
+            + (uint64_t)h->n_versions * sizeof(VersionEntry)
+            + (uint64_t)h->n_deps * sizeof(DependencyEntry)
+            + (uint64_t)h->n_buckets * sizeof(uint32_t)
+            + h->strings_size;
+        if (sz != f.size())
+            throw SW_RUNTIME_ERROR("Truncated packages index: " + to_string(fn));
+
+        auto p = f.data() + sizeof(Header);
+        packages = (const PackageEntry *)p;
+        p += h->n_packages * sizeof(PackageEntry);
+        versions = (const VersionEntry *)p;
+        p += h->n_versions * sizeof(VersionEntry);
+        deps = (const DependencyEntry *)p;
+        p += h->n_deps * sizeof(DependencyEntry);
+        buckets = (const uint32_t *)p;
+        p += h->n_buckets * sizeof(uint32_t);
+        strings = (const char *)p;
+    }
+
+    // contents are checked by hash after download, so only bounds are checked here
+
+    std::string_view str(Str s) const
+    {
+        if ((uint64_t)s.offset + s.size > h->strings_size)
+            throw SW_RUNTIME_ERROR("Bad string in packages index");
+        return { strings + s.offset, s.size };
+    }
+
+    std::span<const VersionEntry> getVersions(const PackageEntry &p) const
+    {
+        if ((uint64_t)p.first_version + p.n_versions > h->n_versions)
+            throw SW_RUNTIME_ERROR("Bad package versions in packages index");
+        return { versions + p.first_version, p.n_versions };
+    }
+
+    std::span<const DependencyEntry> getDependencies(const VersionEntry &v) const
+    {
+        if ((uint64_t)v.first_dep + v.n_deps > h->n_deps)
+            throw SW_RUNTIME_ERROR("Bad package dependencies in packages index");
+        return { deps + v.first_dep, v.n_deps };
+    }
+
+    const PackageEntry *find(const String &lpath, uint64_t hash) const
+    {
+        auto mask = h->n_buckets - 1;
+        for (auto i = hash & mask;; i = (i + 1) & mask)
+        {
+            auto b = buckets[i];
+            if (!b)
+                return nullptr;
+            if (b > h->n_packages)
+                throw SW_RUNTIME_ERROR("Bad hash table in packages index");
+            auto &p = packages[b - 1];
+            if (equals_lower(str(p.path), lpath))
+                return &p;
+        }
+    }
+
+    PackageRecord read(const PackageEntry &p) const
+    {
+        PackageRecord r;
+        r.path = str(p.path);
+        r.flags = p.flags;
+        for (auto &e : getVersions(p))
+        {
+            auto &v = r.versions.emplace_back();
+            v.version = str(e.version);
+            v.flags = e.flags;
+            v.prefix = e.prefix;
+            v.hash = str(e.hash);
+            v.source = str(e.source);
+            v.sdir = str(e.sdir);
+            for (auto &d : getDependencies(e))
+                v.deps.emplace_back(str(d.path), str(d.range));
+        }
+        return r;
+    }
+};
+
+struct PackageIndex::PackageRef
+{
+    const Snapshot *s;
+    const PackageEntry *p;
+};
+
+PackageIndex::PackageIndex(const path &dir)
+{
+    for (auto &f : getFiles(dir))
+        snapshots.push_back(std::make_unique<Snapshot>(f));
+    if (snapshots.empty())
+        throw SW_RUNTIME_ERROR("No packages index in " + to_string(dir));
+}
+
+PackageIndex::~PackageIndex() = default;
+
+std::optional<PackageIndex::PackageRef> PackageIndex::find(const String &lpath) const
+{
+    auto h = hash_path(lpath);
+    for (auto i = snapshots.rbegin(); i != snapshots.rend(); ++i)
+    {
+        auto p = (*i)->find(lpath, h);
+        if (!p)
+            continue;
+        // removed in delta
+        if (!p->n_versions)
+            return {};
+        return PackageRef{ i->get(), p };
+    }
+    return {};
+}
+
+VersionSet PackageIndex::getVersions(const PackagePath &ppath) const
+{
+    VersionSet versions;
+    if (auto r = find(lower_path(ppath.toString())))
+    {
+        for (auto &v : r->s->getVersions(*r->p))
+            versions.insert(String(r->s->str(v.version)));
+    }
+    return versions;
+}
+
+std::optional<PackageId> PackageIndex::resolve(const UnresolvedPackage &pkg) const
+{
+    auto v = pkg.range.getMaxSatisfyingVersion(getVersions(pkg.ppath));
+    if (!v)
+        return {};
+    return PackageId{ pkg.ppath, *v };
+}
+
+PackageDataPtr PackageIndex::getPackageData(const PackageId &id) const
+{
+    if (auto r = find(lower_path(id.getPath().toString())))
+    {
+        auto &s = *r->s;
+        auto version = id.getVersion().toString();
+        for (auto &v : s.getVersions(*r->p))
+        {
+            if (s.str(v.version) != version)
+                continue;
+            auto d = std::make_unique<PackageData>();
+            d->flags = v.flags;
+            d->hash = s.str(v.hash);
+            d->source = s.str(v.source);
+            d->prefix = v.prefix;
+            d->sdir = String(s.str(v.sdir));
+            for (auto &dep : s.getDependencies(v))
+                d->dependencies.emplace(String(s.str(dep.path)), String(s.str(dep.range)));
+            return d;
+        }
+    }
+    throw SW_RUNTIME_ERROR("No such package in db: " + id.toString());
+}
+
+std::vector<path> PackageIndex::getFiles(const path &dir)
+{
+    std::vector<path> files;
+    auto fn = dir / filename;
+    if (!fs::exists(fn))
+        return files;
+    files.push_back(fn);
+    for (int i = 1;; i++)
+    {
+        auto delta = path(fn) += "." + std::to_string(i);
+        if (!fs::exists(delta))
+            break;
+        files.push_back(delta);
+    }
+    return files;
+}
+
+bool PackageIndex::exists(const path &dir)
+{
+    return fs::exists(dir / filename);
+}
+
+bool PackageIndex::verify(const path &dir)
+{
+    auto files = getFiles(dir);
+    if (files.empty())
+        return false;
+    for (auto &f : files)
+    {
+        auto hf = path(f) += ".hash";
+        if (!fs::exists(hf))
+            return false;
+        auto h = read_file(hf);
+        while (!h.empty() && isspace((uint8_t)h.back()))
+            h.resize(h.size() - 1);
+        if (!support::check_file_hash(f, h))
+            return false;
+    }
+    return true;
+}
+
+void PackageIndex::remove(const path &dir)
+{
+    for (auto &f : getFiles(dir))
+    {
+        fs::remove(f);
+        fs::remove(path(f) += ".hash");
+    }
+}
+
+void PackageIndex::build(const path &csv_dir, const path &out, const PackageIndex *base)
+{
+    auto packages = read_tables(csv_dir);
+    if (!base)
+        return write_index(packages, out);
+
+    PackageRecords delta;
+    // removed packages are written without versions
+    for (auto &s : base->snapshots)
+    {
+        for (uint32_t i = 0; i < s->h->n_packages; i++)
+        {
+            auto lpath = lower_path(s->str(s->packages[i].path));
+            if (packages.contains(lpath) || delta.contains(lpath) || !base->find(lpath))
+                continue;
+            auto &r = delta[lpath];
+            r.path = s->str(s->packages[i].path);
+            r.flags = s->packages[i].flags;
+        }
+    }
+    for (auto &[lpath, p] : packages)
+    {
+        auto r = base->find(lpath);
+        if (!r || r->s->read(*r->p) != p)
+            delta.emplace(lpath, std::move(p));
+    }
+    write_index(delta, out);
+}
+
+}
@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#pragma once
+
+#include <sw/support/mapped_file.h>
+#include <sw/support/package.h>
+
+#include <optional>
+
+namespace sw
+{
+
+/// Prebuilt binary snapshot of remote packages database.
+///
+/// Used instead of csv -> sqlite import: files are mapped and looked up in place.
+///
+/// files in database repository:
+///   packages.index        - full snapshot
+///   packages.index.N      - deltas (N = 1, 2, ...), applied in order on top of the snapshot
+///   <file>.hash           - strong file hash of every file above, checked after download
+///
+/// Delta contains changed packages only. Package in a newer file replaces
+/// the whole package (all versions) of older files, package without versions is removed.
+///
+/// file layout (little endian):
+///   header
+///   packages  - sorted by lowercase path: path, flags, versions [first, first + n)
+///   versions  - sorted by version string inside package: version, flags, prefix, hash, source, sdir, deps [first, first + n)
+///   deps      - path, version range
+///   buckets   - open addressing hash table over lowercase paths, package index + 1 (0 is empty)
+///   strings   - blob, all strings are (offset, size) into it
+struct SW_MANAGER_API PackageIndex
+{
+    static constexpr auto filename = "packages.index";
+
+    /// maps snapshot with its deltas, throws on bad files
+    PackageIndex(const path &dir);
+    PackageIndex(const PackageIndex &) = delete;
+    PackageIndex &operator=(const PackageIndex &) = delete;
+    ~PackageIndex();
+
+    std::optional<PackageId> resolve(const UnresolvedPackage &) const;
+    /// throws on missing package
+    PackageDataPtr getPackageData(const PackageId &) const;
+    VersionSet getVersions(const PackagePath &) const;
+
+    static bool exists(const path &dir);
+    /// checks hashes of snapshot and deltas
+    static bool verify(const path &dir);
+    /// removes snapshot and deltas
+    static void remove(const path &dir);
+
+    /// Builds index file and its hash from csv tables of packages database.
+    /// When base is set, only packages differing from it are written (delta).
+    static void build(const path &csv_dir, const path &out, const PackageIndex *base = nullptr);
+
+private:
+    struct Snapshot;
+    struct PackageRef;
+
+    // base snapshot first
+    std::vector<std::unique_ptr<Snapshot>> snapshots;
+
+    std::optional<PackageRef> find(const String &lower_path) const;
+    static std::vector<path> getFiles(const path &dir);
+};
+
+}
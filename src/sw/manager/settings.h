@@ -47,6 +47,14 @@ struct SW_MANAGER_API Settings
     bool explain_outdated_full = false;
     bool gExplainOutdatedToTrace = false;
 
+    // compare file contents instead of modification times
+    bool check_content_hashes = false;
+
+    // package archives downloaded at once
+    int max_concurrent_downloads = 8;
+    // equal files of package sources are stored once and hard linked (read-only)
+    bool deduplicate_package_sources = false;
+
     String save_command_format;
 
 public:
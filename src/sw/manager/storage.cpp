@@ -4,9 +4,13 @@
 #include "storage.h"
 
 #include "package_database.h"
+#include "settings.h"
 
+#include <primitives/executor.h>
 #include <primitives/pack.h>
 
+#include <iomanip>
+
 #include <primitives/log.h>
 DECLARE_STATIC_LOGGER(logger, "storage");
 
@@ -121,6 +125,12 @@ String toUserString(StorageFileType t)
     }
 }
 
+// blobs used by package sources, released on package removal
+static path getBlobsFilename(const LocalPackage &p)
+{
+    return p.getDirInfo() / "source.blobs";
+}
+
 static path getDatabaseRootDir1(const path &root)
 {
     return root / "sw" / "database";
@@ -189,6 +199,22 @@ bool StorageWithPackagesDatabase::resolve(ResolveRequest &rr) const
     return true;
 }
 
+bool StorageWithPackagesDatabase::resolveBatch(const std::vector<ResolveRequest *> &rrs) const
+{
+    UnresolvedPackages pkgs, unresolved;
+    for (auto rr : rrs)
+        pkgs.insert(rr->u);
+    auto m = pkgdb->resolve(pkgs, unresolved);
+    bool resolved = true;
+    for (auto rr : rrs)
+    {
+        if (auto i = m.find(rr->u); i != m.end())
+            rr->setPackage(std::make_unique<Package>(*this, i->second));
+        resolved &= rr->isResolved();
+    }
+    return resolved;
+}
+
 LocalStorageBase::LocalStorageBase(const String &name, const path &db_dir)
     : StorageWithPackagesDatabase(name, db_dir), schema(1, 2)
 {
@@ -222,6 +248,7 @@ LocalStorage::LocalStorage(const path &local_storage_root_dir)
     : Directories(local_storage_root_dir)
     , LocalStorageBase("local", getDatabaseRootDir())
     , ovs(*this, getDatabaseRootDir())
+    , blobs(storage_dir_blb)
 {
 /*#define SW_CURRENT_LOCAL_STORAGE_VERSION 0
 #define SW_CURRENT_LOCAL_STORAGE_VERSION_KEY "storage_version"
@@ -335,7 +362,88 @@ LocalPackage LocalStorage::install(const Package &id) const
     return p;
 }
 
+std::vector<LocalPackage> LocalStorage::install(const std::vector<const Package *> &pkgs) const
+{
+    std::vector<LocalPackage> r;
+    std::vector<const Package *> to_install;
+    std::unordered_set<PackageId> seen;
+    for (auto p : pkgs)
+    {
+        r.emplace_back(*this, *p);
+        if (!seen.insert(*p).second || isPackageInstalled(*p) || isPackageOverridden(*p))
+            continue;
+        to_install.push_back(p);
+    }
+    if (to_install.empty())
+        return r;
+
+    const auto n = to_install.size();
+    std::atomic_size_t n_downloaded = 0;
+    std::atomic_uint64_t bytes = 0;
+    const auto start = std::chrono::steady_clock::now();
+    auto throughput = [&start, &bytes]()
+    {
+        auto s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::ostringstream ss;
+        ss << std::fixed << std::setprecision(1) << bytes / 1024.0 / 1024.0 << " MB, ";
+        ss << (s > 0 ? bytes / 1024.0 / 1024.0 / s : 0) << " MB/s";
+        return ss.str();
+    };
+
+    // transfers wait for network, so they get their own threads
+    // archives are unpacked on the main executor while other transfers go on
+    Executor downloader(std::min<size_t>(n, std::max(1, Settings::get_user_settings().max_concurrent_downloads)));
+    auto &e = getExecutor();
+    std::mutex m;
+    Futures<void> downloads, unpacks;
+    for (auto p : to_install)
+    {
+        downloads.push_back(downloader.push([this, p, n, &e, &m, &unpacks, &n_downloaded, &bytes, &throughput]
+        {
+            const auto t = StorageFileType::SourceArchive;
+            String hash;
+            auto archive = download(static_cast<const IStorage2 &>(p->getStorage()), *p, t, hash);
+            bytes += fs::file_size(archive);
+            LOG_INFO(logger, "Downloaded [" << ++n_downloaded << "/" << n << "]: [" + p->toString() + "], " << throughput());
+
+            std::lock_guard lk(m);
+            unpacks.push_back(e.push([this, p, t, archive, hash]
+            {
+                SCOPE_EXIT
+                {
+                    fs::remove(archive);
+                };
+                unpack(*p, t, archive, hash);
+                getPackagesDatabase().installPackage(*p, p->getData());
+            }));
+        }));
+    }
+    // everything must be finished before errors are thrown, tasks use locals
+    for (auto &f : downloads)
+        f.wait();
+    for (auto &f : unpacks)
+        f.wait();
+    waitAndGet(downloads);
+    waitAndGet(unpacks);
+
+    LOG_INFO(logger, "Installed " << n << " packages: " << throughput());
+    return r;
+}
+
 void LocalStorage::get(const IStorage2 &source, const PackageId &id, StorageFileType t) const
+{
+    String hash;
+    auto archive = download(source, id, t, hash);
+    SCOPE_EXIT
+    {
+        // now move .new to usual archive (or remove archive)
+        // we're removing for now
+        fs::remove(archive);
+    };
+    unpack(id, t, archive, hash);
+}
+
+path LocalStorage::download(const IStorage2 &source, const PackageId &id, StorageFileType t, String &hash) const
 {
     LocalPackage lp(*this, id);
 
@@ -349,45 +457,69 @@ void LocalStorage::get(const IStorage2 &source, const PackageId &id, StorageFile
     }
 
     LOG_INFO(logger, "Downloading: [" + id.toString() + "]/[" + toUserString(t) + "]");
+    fs::create_directories(dst.parent_path());
     auto f = source.getFile(id, t);
     if (!f->copy(dst))
         throw SW_RUNTIME_ERROR("Error downloading file for package: " + id.toString() + ", file: " + toUserString(t));
 
-    SCOPE_EXIT
-    {
-        // now move .new to usual archive (or remove archive)
-        // we're removing for now
-        fs::remove(dst);
-    };
-
-    auto unpack = [&id, &dst, &lp, &t]()
-    {
-        for (auto &d : fs::directory_iterator(lp.getDir()))
-        {
-            if (d.path() != dst)
-                fs::remove_all(d);
-        }
-
-        LOG_INFO(logger, "Unpacking  : [" + id.toString() + "]/[" + toUserString(t) + "]");
-        unpack_file(dst, lp.getDirSrc());
-    };
-
     // at the moment we perform check after download
     // but maybe we can move it before real download?
     if (auto fh = dynamic_cast<const vfs::FileWithHashVerification *>(f.get()))
-    {
-        if (fh->getHash() == lp.getStampHash())
-        {
-            // skip unpack
-            return;
-        }
+        hash = fh->getHash();
+    return dst;
+}
 
-        unpack();
-        write_file(lp.getStampFilename(), fh->getHash());
+void LocalStorage::unpack(const PackageId &id, StorageFileType t, const path &archive, const String &hash) const
+{
+    LocalPackage lp(*this, id);
+
+    if (!hash.empty() && hash == lp.getStampHash())
+    {
+        // skip unpack
         return;
     }
 
-    unpack();
+    LOG_INFO(logger, "Unpacking  : [" + id.toString() + "]/[" + toUserString(t) + "]");
+
+    // sources are unpacked aside and moved in place by rename,
+    // so an interrupted unpack never leaves partial sources
+    auto src = lp.getDirSrc();
+    auto staging = path(src) += ".new";
+    auto old = path(src) += ".old";
+    fs::remove_all(staging);
+    fs::remove_all(old);
+    unpack_file(archive, staging);
+    Strings used_blobs;
+    if (Settings::get_user_settings().deduplicate_package_sources)
+        used_blobs = blobs.checkin(staging);
+    auto blobs_fn = staging / getBlobsFilename(lp).lexically_relative(src);
+    fs::create_directories(blobs_fn.parent_path());
+    String s;
+    for (auto &b : used_blobs)
+        s += b + "\n";
+    write_file(blobs_fn, s);
+    if (!hash.empty())
+    {
+        auto stamp = staging / lp.getStampFilename().lexically_relative(src);
+        fs::create_directories(stamp.parent_path());
+        write_file(stamp, hash);
+    }
+
+    Strings old_blobs;
+    if (fs::exists(getBlobsFilename(lp)))
+        old_blobs = read_lines(getBlobsFilename(lp));
+    for (auto &d : fs::directory_iterator(lp.getDir()))
+    {
+        if (d.path() != archive && d.path() != staging && d.path() != src)
+            fs::remove_all(d);
+    }
+    // directories cannot be renamed over non empty ones,
+    // old sources are moved away whole and removed after the swap
+    if (fs::exists(src))
+        fs::rename(src, old);
+    fs::rename(staging, src);
+    fs::remove_all(old);
+    blobs.release(old_blobs);
 }
 
 OverriddenPackagesStorage &LocalStorage::getOverriddenPackagesStorage()
@@ -405,11 +537,20 @@ bool LocalStorage::resolve(ResolveRequest &rr) const
     return ovs.resolve(rr);
 }
 
+bool LocalStorage::resolveBatch(const std::vector<ResolveRequest *> &rrs) const
+{
+    return ovs.resolveBatch(rrs);
+}
+
 void LocalStorage::remove(const LocalPackage &p) const
 {
     getPackagesDatabase().deletePackage(p);
+    Strings used_blobs;
+    if (fs::exists(getBlobsFilename(p)))
+        used_blobs = read_lines(getBlobsFilename(p));
     error_code ec;
     fs::remove_all(p.getDir(), ec);
+    blobs.release(used_blobs);
 }
 
 OverriddenPackagesStorage::OverriddenPackagesStorage(const LocalStorage &ls, const path &db_dir)
@@ -496,4 +637,23 @@ bool CachingResolver::resolve(ResolveRequest &rr) const
     return false;
 }
 
+bool CachingResolver::resolveBatch(const std::vector<ResolveRequest *> &rrs) const
+{
+    std::vector<ResolveRequest *> left;
+    for (auto rr : rrs)
+    {
+        if (!cache.resolve(*rr))
+            left.push_back(rr);
+    }
+    if (left.empty())
+        return true;
+    bool resolved = Resolver::resolveBatch(left);
+    for (auto rr : left)
+    {
+        if (rr->isResolved())
+            cache.storePackages(*rr);
+    }
+    return resolved;
+}
+
 }
@@ -3,6 +3,7 @@
 
 #pragma once
 
+#include "blob_store.h"
 #include "package.h"
 
 #include <sw/support/settings.h>
@@ -114,9 +115,10 @@ struct SW_MANAGER_API StorageWithPackagesDatabase : Storage
     //void get(const IStorage &source, const PackageId &id, StorageFileType) override;
     //ResolveResult resolve(const UnresolvedPackages &pkgs, UnresolvedPackages &unresolved_pkgs) const override;
     bool resolve(ResolveRequest &) const override;
+    bool resolveBatch(const std::vector<ResolveRequest *> &) const override;
 
 //protected:?
-    PackagesDatabase &getPackagesDatabase() const;
+    virtual PackagesDatabase &getPackagesDatabase() const;
 
 private:
     std::unique_ptr<PackagesDatabase> pkgdb;
@@ -163,6 +165,10 @@ struct SW_MANAGER_API LocalStorage : Directories, LocalStorageBase
     //LocalPackage download(const PackageId &) const override;
     void remove(const LocalPackage &) const;
     LocalPackage install(const Package &) const override;
+    /// Downloads up to Settings::max_concurrent_downloads archives at once,
+    /// verified archives are unpacked in parallel while other transfers go on.
+    /// Result has the same order as input.
+    std::vector<LocalPackage> install(const std::vector<const Package *> &) const;
     LocalPackage installLocalPackage(const PackageId &, const PackageData &);
     void get(const IStorage2 &source, const PackageId &id, StorageFileType) const /* override*/;
     bool isPackageInstalled(const Package &id) const;
@@ -171,15 +177,21 @@ struct SW_MANAGER_API LocalStorage : Directories, LocalStorageBase
     PackageDataPtr loadData(const PackageId &) const override;
     //ResolveResult resolve(const UnresolvedPackages &pkgs, UnresolvedPackages &unresolved_pkgs) const override;
     bool resolve(ResolveRequest &) const override;
+    bool resolveBatch(const std::vector<ResolveRequest *> &) const override;
 
     OverriddenPackagesStorage &getOverriddenPackagesStorage();
     const OverriddenPackagesStorage &getOverriddenPackagesStorage() const;
+    const BlobStore &getBlobStore() const { return blobs; }
 
 private:
     std::unordered_map<PackageId, PackageData> local_packages;
     OverriddenPackagesStorage ovs;
+    BlobStore blobs;
 
     void migrateStorage(int from, int to);
+    /// returns downloaded archive, hash is set for verified files
+    path download(const IStorage2 &source, const PackageId &, StorageFileType, String &hash) const;
+    void unpack(const PackageId &, StorageFileType, const path &archive, const String &hash) const;
 };
 
 //
@@ -225,6 +237,7 @@ struct SW_MANAGER_API CachingResolver : Resolver
     CachingResolver(CachedStorage &cache);
 
     bool resolve(ResolveRequest &) const override;
+    bool resolveBatch(const std::vector<ResolveRequest *> &) const override;
 
 private:
     CachedStorage &cache;
@@ -5,6 +5,7 @@
 
 #include "api.h"
 #include "package_database.h"
+#include "package_index.h"
 #include "remote.h"
 #include "settings.h"
 
@@ -26,33 +27,70 @@ DECLARE_STATIC_LOGGER(logger, "storage");
 #define PACKAGES_DB_DOWNLOAD_TIME_FILE "packages.time"
 
 static const String packages_db_name = "packages.db";
+static const auto db_loaded_var = "db_loaded";
 
 namespace sw
 {
 
+// file:///C:/dir/a%20b.zip -> C:/dir/a b.zip
+// file://server/share/a.zip -> //server/share/a.zip
+static path file_url_to_path(const String &url)
+{
+    auto u = url.substr(7); // file://
+    String host;
+    if (!u.empty() && u[0] != '/')
+    {
+        auto p = u.find('/');
+        host = u.substr(0, p);
+        u = p == u.npos ? "" : u.substr(p);
+    }
+
+    String s;
+    for (size_t i = 0; i < u.size(); i++)
+    {
+        if (u[i] == '%' && i + 2 < u.size() && isxdigit((unsigned char)u[i + 1]) && isxdigit((unsigned char)u[i + 2]))
+        {
+            s += (char)std::stoi(u.substr(i + 1, 2), nullptr, 16);
+            i += 2;
+        }
+        else
+            s += u[i];
+    }
+
+    if (!host.empty() && host != "localhost")
+        return "//" + host + s;
+#ifdef _WIN32
+    // drive letter
+    if (s.size() >= 3 && s[0] == '/' && isalpha((unsigned char)s[1]) && s[2] == ':')
+        s = s.substr(1);
+#endif
+    return s;
+}
+
 RemoteStorage::RemoteStorage(LocalStorage &ls, const Remote &r, bool allow_network)
     : StorageWithPackagesDatabase(r.name, ls.getDatabaseRootDir() / "remote")
     , r(r), ls(ls), allow_network(allow_network)
 {
     db_repo_dir = ls.getDatabaseRootDir() / "remote" / r.name / "repository";
 
-    static const auto db_loaded_var = "db_loaded";
-
     if (isNetworkAllowed())
     {
-        if (!getPackagesDatabase().getIntValue(db_loaded_var))
+        if (!PackageIndex::exists(db_repo_dir) && !StorageWithPackagesDatabase::getPackagesDatabase().getIntValue(db_loaded_var))
         {
             LOG_DEBUG(logger, "Packages database was not found");
             download();
             load();
-            getPackagesDatabase().setIntValue(db_loaded_var, 1);
         }
         else
             updateDb();
     }
 
+    // snapshot from previous runs
+    if (!index && PackageIndex::exists(db_repo_dir))
+        load();
+
     // at the end we always reopen packages db as read only
-    getPackagesDatabase().open(true, true);
+    StorageWithPackagesDatabase::getPackagesDatabase().open(true, true);
 }
 
 RemoteStorage::~RemoteStorage() = default;
@@ -73,7 +111,56 @@ bool RemoteStorage::resolve(ResolveRequest &rr) const
     preInitFindDependencies();
     if (Settings::get_user_settings().gForceServerQuery)
         return false;
-    return StorageWithPackagesDatabase::resolve(rr);
+    std::shared_lock lk(m_index);
+    if (!index)
+        return StorageWithPackagesDatabase::resolve(rr);
+    return resolveFromIndex(rr);
+}
+
+bool RemoteStorage::resolveBatch(const std::vector<ResolveRequest *> &rrs) const
+{
+    preInitFindDependencies();
+    if (Settings::get_user_settings().gForceServerQuery)
+        return false;
+    std::shared_lock lk(m_index);
+    if (!index)
+        return StorageWithPackagesDatabase::resolveBatch(rrs);
+    bool resolved = true;
+    for (auto rr : rrs)
+    {
+        resolveFromIndex(*rr);
+        resolved &= rr->isResolved();
+    }
+    return resolved;
+}
+
+bool RemoteStorage::resolveFromIndex(ResolveRequest &rr) const
+{
+    auto pkg = index->resolve(rr.u);
+    if (!pkg)
+        return false;
+    rr.setPackage(std::make_unique<Package>(*this, *pkg));
+    return true;
+}
+
+PackageDataPtr RemoteStorage::loadData(const PackageId &id) const
+{
+    std::shared_lock lk(m_index);
+    if (!index)
+        return StorageWithPackagesDatabase::loadData(id);
+    return index->getPackageData(id);
+}
+
+PackagesDatabase &RemoteStorage::getPackagesDatabase() const
+{
+    std::shared_lock lk(m_index);
+    std::lock_guard lk2(m_import);
+    if (index && !db_imported)
+    {
+        importCsv();
+        db_imported = true;
+    }
+    return StorageWithPackagesDatabase::getPackagesDatabase();
 }
 
 void RemoteStorage::download() const
@@ -82,26 +169,48 @@ void RemoteStorage::download() const
 
     fs::create_directories(db_repo_dir);
 
+    // snapshot is used only when it is complete and intact
+    auto verify_index = [this]()
+    {
+        if (!PackageIndex::exists(db_repo_dir) || PackageIndex::verify(db_repo_dir))
+            return;
+        LOG_WARN(logger, "Packages index of " + getRemote().name + " remote is damaged, csv tables will be used");
+        PackageIndex::remove(db_repo_dir);
+    };
+
+    // mapped files of other processes stay valid
+    auto install_file = [this](const path &from)
+    {
+        auto to = db_repo_dir / from.filename();
+        auto tmp = path(to) += ".tmp";
+        fs::copy_file(from, tmp, fs::copy_options::overwrite_existing);
+        fs::rename(tmp, to);
+    };
+
     if (!r.db.local_dir.empty())
     {
+        // deltas of older snapshot must not be applied to the new one
+        PackageIndex::remove(db_repo_dir);
         for (auto &p : fs::directory_iterator(r.db.local_dir))
         {
             if (p.is_directory())
                 continue;
-            fs::copy_file(p, db_repo_dir / p.path().filename(), fs::copy_options::overwrite_existing);
+            install_file(p);
         }
+        verify_index();
         writeDownloadTime();
         return;
     }
 
-    auto download_archive = [this]()
+    auto download_archive = [this, &install_file]()
     {
         auto fn = support::get_temp_filename();
         download_file(r.db.url, fn, 1_GB);
         auto unpack_dir = support::get_temp_filename();
         auto files = unpack_file(fn, unpack_dir);
+        PackageIndex::remove(db_repo_dir);
         for (auto &f : files)
-            fs::copy_file(f, db_repo_dir / f.filename(), fs::copy_options::overwrite_existing);
+            install_file(f);
         fs::remove_all(unpack_dir);
         fs::remove(fn);
     };
@@ -148,6 +257,7 @@ void RemoteStorage::download() const
         download_archive();
     }
 
+    verify_index();
     writeDownloadTime();
 }
 
@@ -160,6 +270,34 @@ static std::istream &safe_getline(std::istream &i, String &s)
 }
 
 void RemoteStorage::load() const
+{
+    // snapshot is used in place, csv tables are imported on demand
+    if (openIndex())
+        return;
+    importCsv();
+    StorageWithPackagesDatabase::getPackagesDatabase().setIntValue(db_loaded_var, 1);
+}
+
+bool RemoteStorage::openIndex() const
+{
+    index.reset();
+    if (!PackageIndex::exists(db_repo_dir))
+        return false;
+    try
+    {
+        index = std::make_unique<PackageIndex>(db_repo_dir);
+    }
+    catch (std::exception &e)
+    {
+        LOG_WARN(logger, "Cannot open packages index of " + getRemote().name + " remote, csv tables will be used: " << e.what());
+        return false;
+    }
+    std::lock_guard lk(m_import);
+    db_imported = false;
+    return true;
+}
+
+void RemoteStorage::importCsv() const
 {
     struct Column
     {
@@ -178,7 +316,9 @@ void RemoteStorage::load() const
         return std::find(skip_cols.begin(), skip_cols.end(), std::pair<String, String>{ tablename,name }) != skip_cols.end();
     };
 
-    auto mdb = getPackagesDatabase().db->native_handle();
+    // do not trigger import from itself
+    auto &pkgdb = StorageWithPackagesDatabase::getPackagesDatabase();
+    auto mdb = pkgdb.db->native_handle();
     sqlite3_stmt *stmt = nullptr;
 
     // load only known tables
@@ -186,8 +326,8 @@ void RemoteStorage::load() const
     // but we don't do this
     Strings data_tables;
     sqlite3 *db2;
-    if (sqlite3_open_v2((const char *)getPackagesDatabase().fn.u8string().c_str(), &db2, SQLITE_OPEN_READONLY, 0) != SQLITE_OK)
-        throw SW_RUNTIME_ERROR("cannot open db: " + to_string(getPackagesDatabase().fn));
+    if (sqlite3_open_v2((const char *)pkgdb.fn.u8string().c_str(), &db2, SQLITE_OPEN_READONLY, 0) != SQLITE_OK)
+        throw SW_RUNTIME_ERROR("cannot open db: " + to_string(pkgdb.fn));
     int rc = sqlite3_exec(db2, "select name from sqlite_master as tables where type='table' and name not like '/_%' ESCAPE '/';",
         [](void *o, int, char **cols, char **)
         {
@@ -197,10 +337,10 @@ void RemoteStorage::load() const
         }, &data_tables, 0);
     sqlite3_close(db2);
     if (rc != SQLITE_OK)
-        throw SW_RUNTIME_ERROR("cannot query db for tables: " + to_string(getPackagesDatabase().fn));
+        throw SW_RUNTIME_ERROR("cannot query db for tables: " + to_string(pkgdb.fn));
 
-    getPackagesDatabase().db->execute("PRAGMA foreign_keys = OFF;");
-    getPackagesDatabase().db->execute("BEGIN;");
+    pkgdb.db->execute("PRAGMA foreign_keys = OFF;");
+    pkgdb.db->execute("BEGIN;");
 
     auto split_csv_line = [](const auto &s)
     {
@@ -209,7 +349,7 @@ void RemoteStorage::load() const
 
     for (auto &td : data_tables)
     {
-        getPackagesDatabase().db->execute("delete from " + td);
+        pkgdb.db->execute("delete from " + td);
 
         auto fn = db_repo_dir / (td + ".csv");
         std::ifstream ifile(fn);
@@ -279,8 +419,9 @@ void RemoteStorage::load() const
             throw SW_RUNTIME_ERROR("sqlite3_finalize() failed: "s + sqlite3_errmsg(mdb));
     }
 
-    getPackagesDatabase().db->execute("COMMIT;");
-    getPackagesDatabase().db->execute("PRAGMA foreign_keys = ON;");
+    pkgdb.db->execute("COMMIT;");
+    pkgdb.db->execute("PRAGMA foreign_keys = ON;");
+    pkgdb.clearVersionsCache();
 }
 
 void RemoteStorage::updateDb() const
@@ -294,7 +435,9 @@ void RemoteStorage::updateDb() const
     if (r.db.getVersion() > readPackagesDatabaseVersion(db_repo_dir))
     {
         // multiprocess aware
-        single_process_job(getPackagesDatabase().fn.parent_path() / "db_update", [this] {
+        single_process_job(StorageWithPackagesDatabase::getPackagesDatabase().fn.parent_path() / "db_update", [this] {
+            // mapped snapshot is replaced
+            std::unique_lock lk(m_index);
             download();
             load();
         });
@@ -314,12 +457,12 @@ void RemoteStorage::writeDownloadTime() const
 {
     auto tp = std::chrono::system_clock::now();
     auto time = std::chrono::system_clock::to_time_t(tp);
-    write_file(getPackagesDatabase().fn.parent_path() / PACKAGES_DB_DOWNLOAD_TIME_FILE, std::to_string(time));
+    write_file(StorageWithPackagesDatabase::getPackagesDatabase().fn.parent_path() / PACKAGES_DB_DOWNLOAD_TIME_FILE, std::to_string(time));
 }
 
 TimePoint RemoteStorage::readDownloadTime() const
 {
-    auto fn = getPackagesDatabase().fn.parent_path() / PACKAGES_DB_DOWNLOAD_TIME_FILE;
+    auto fn = StorageWithPackagesDatabase::getPackagesDatabase().fn.parent_path() / PACKAGES_DB_DOWNLOAD_TIME_FILE;
     String ts = "0";
     if (fs::exists(fn))
         ts = read_file(fn);
@@ -413,7 +556,14 @@ struct RemoteFileWithHashVerification : vfs::FileWithHashVerification
             try
             {
                 LOG_TRACE(logger, "Downloading file: " << url);
-                download_file(url, fn);
+                // mirrors on local disk or network shares
+                String u = url;
+                if (u.find("file://") == 0)
+                    fs::copy_file(file_url_to_path(u), fn, fs::copy_options::overwrite_existing);
+                else if (u.find("://") == u.npos && fs::exists(u))
+                    fs::copy_file(u, fn, fs::copy_options::overwrite_existing);
+                else
+                    download_file(url, fn);
             }
             catch (std::exception &e)
             {
@@ -7,9 +7,13 @@
 
 #include <primitives/date_time.h>
 
+#include <shared_mutex>
+
 namespace sw
 {
 
+struct PackageIndex;
+
 // main/web/url etc. storage
 struct SW_MANAGER_API RemoteStorage : StorageWithPackagesDatabase
 {
@@ -24,6 +28,11 @@ struct SW_MANAGER_API RemoteStorage : StorageWithPackagesDatabase
     std::unique_ptr<vfs::File> getFile(const PackageId &id, StorageFileType) const override;
     //ResolveResult resolve(const UnresolvedPackages &pkgs, UnresolvedPackages &unresolved_pkgs) const override;
     bool resolve(ResolveRequest &) const override;
+    bool resolveBatch(const std::vector<ResolveRequest *> &) const override;
+    PackageDataPtr loadData(const PackageId &) const override;
+
+    /// filled from csv tables on first use when packages index is used
+    PackagesDatabase &getPackagesDatabase() const override;
 
     const Remote &getRemote() const { return r; }
 
@@ -35,9 +44,16 @@ private:
     SoftwareNetworkStorageSchema schema;
     path db_repo_dir;
     bool allow_network;
+    mutable std::unique_ptr<PackageIndex> index;
+    mutable std::shared_mutex m_index;
+    mutable std::mutex m_import;
+    mutable bool db_imported = false;
 
     void download() const;
     void load() const;
+    bool openIndex() const;
+    void importCsv() const;
+    bool resolveFromIndex(ResolveRequest &) const;
     void updateDb() const;
     void preInitFindDependencies() const;
     void writeDownloadTime() const;
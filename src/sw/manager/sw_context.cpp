@@ -74,6 +74,14 @@ bool SwManagerContext::resolve(ResolveRequest &rr, bool use_cache) const
         ;
 }
 
+bool SwManagerContext::resolve(const std::vector<ResolveRequest *> &rrs, bool use_cache) const
+{
+    return use_cache
+        ? cr->resolveBatch(rrs)
+        : cr->Resolver::resolveBatch(rrs)
+        ;
+}
+
 void SwManagerContext::install(ResolveRequest &rr) const
 {
     // true for now
@@ -83,6 +91,26 @@ void SwManagerContext::install(ResolveRequest &rr) const
     rr.r = lp.clone(); // force overwrite with local package
 }
 
+void SwManagerContext::install(const std::vector<ResolveRequest *> &rrs) const
+{
+    // true for now
+    if (!resolve(rrs, true))
+    {
+        for (auto rr : rrs)
+        {
+            if (!rr->isResolved())
+                throw SW_RUNTIME_ERROR("Not resolved: " + rr->u.toString());
+        }
+    }
+    std::vector<const Package *> pkgs;
+    pkgs.reserve(rrs.size());
+    for (auto rr : rrs)
+        pkgs.push_back(&rr->getPackage());
+    auto lps = getLocalStorage().install(pkgs);
+    for (size_t i = 0; i < rrs.size(); i++)
+        rrs[i]->r = lps[i].clone(); // force overwrite with local package
+}
+
 LocalPackage SwManagerContext::install(const Package &p) const
 {
     return getLocalStorage().install(p);
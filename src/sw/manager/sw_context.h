@@ -40,9 +40,13 @@ struct SW_MANAGER_API SwManagerContext// : ISwContext
 
     //
     void install(ResolveRequest &) const;
+    /// resolves all requests, then downloads and unpacks packages concurrently
+    void install(const std::vector<ResolveRequest *> &) const;
     // what about ", bool use_cache = true"?
     LocalPackage install(const Package &) const;
     bool resolve(ResolveRequest &, bool use_cache) const;
+    /// all requests are resolved at once, true when every one is resolved
+    bool resolve(const std::vector<ResolveRequest *> &, bool use_cache) const;
 
     // lock file related
     void setCachedPackages(const std::unordered_map<UnresolvedPackage, PackageId> &) const;
@@ -58,6 +62,7 @@ private:
     void addStorage(std::unique_ptr<IStorage>);
 };
 
+// resolve is called with all unresolved requests of a round
 template <typename F>
 void resolveWithDependencies(std::vector<ResolveRequest> &v, F &&resolve)
 {
@@ -66,17 +71,33 @@ void resolveWithDependencies(std::vector<ResolveRequest> &v, F &&resolve)
     UnresolvedPackages s;
     while (1)
     {
+        std::vector<ResolveRequest *> batch;
+        std::vector<bool> was_resolved;
+        for (auto &&rr : v)
+        {
+            was_resolved.push_back(rr.isResolved());
+            if (!rr.isResolved())
+                batch.push_back(&rr);
+        }
+        if (!batch.empty() && !resolve(batch))
+        {
+            for (auto &&rr : batch)
+            {
+                if (!rr->isResolved())
+                    throw SW_RUNTIME_ERROR("Cannot resolve: " + rr->u.toString());
+            }
+        }
+
         bool new_resolve = false;
         std::vector<ResolveRequest *> v2;
-        for (auto &&rr : v)
+        for (size_t i = 0; i < v.size(); i++)
         {
-            if (rr.isResolved())
+            auto &rr = v[i];
+            if (was_resolved[i])
             {
                 s.insert(rr.u);
                 continue;
             }
-            if (!resolve(rr))
-                throw SW_RUNTIME_ERROR("Cannot resolve: " + rr.u.toString());
             auto inserted = s.insert(rr.u).second;
             new_resolve |= inserted;
             if (!inserted)
@@ -11,6 +11,12 @@
 #ifndef _WIN32
 #include <sys/resource.h>
 #endif
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
 
 #define SW_NAME "sw"
 
@@ -107,6 +113,34 @@ void create_directories(const path &p)
     dirs.insert(p);
 }
 
+bool reflink(const path &from, const path &to)
+{
+#ifdef __linux__
+    int src = open(from.c_str(), O_RDONLY);
+    if (src < 0)
+        return false;
+    int dst = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (dst < 0)
+    {
+        close(src);
+        return false;
+    }
+    auto r = ioctl(dst, FICLONE, src);
+    close(src);
+    close(dst);
+    if (r != 0)
+    {
+        std::error_code ec;
+        fs::remove(to, ec);
+        return false;
+    }
+    fs::permissions(to, fs::status(from).permissions());
+    return true;
+#else
+    return false;
+#endif
+}
+
 int set_max_open_files_limit(int new_limit)
 {
 #ifdef _WIN32
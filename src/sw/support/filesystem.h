@@ -39,6 +39,10 @@ path findRootDirectory(const path &p);
 SW_SUPPORT_API
 void create_directories(const path &p);
 
+// copy-on-write copy, fails if filesystem does not support it
+SW_SUPPORT_API
+bool reflink(const path &from, const path &to);
+
 // will not shrink if old limit is lower
 // return old limit?
 SW_SUPPORT_API
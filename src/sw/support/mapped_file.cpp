@@ -0,0 +1,119 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#include "mapped_file.h"
+
+#include <primitives/exceptions.h>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace sw
+{
+
+MappedFile::MappedFile(const path &fn, bool read_only)
+{
+#ifdef _WIN32
+    fh = CreateFileW(fn.wstring().c_str(), read_only ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (fh == INVALID_HANDLE_VALUE)
+    {
+        fh = nullptr;
+        throw SW_RUNTIME_ERROR("Cannot open file: " + to_string(fn));
+    }
+    LARGE_INTEGER li;
+    if (!GetFileSizeEx(fh, &li))
+    {
+        close();
+        throw SW_RUNTIME_ERROR("Cannot get file size: " + to_string(fn));
+    }
+    sz = li.QuadPart;
+    if (!sz)
+        return;
+    mh = CreateFileMappingW(fh, nullptr, read_only ? PAGE_READONLY : PAGE_READWRITE, 0, 0, nullptr);
+    if (mh)
+        p = (uint8_t *)MapViewOfFile(mh, read_only ? FILE_MAP_READ : FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    if (!p)
+    {
+        close();
+        throw SW_RUNTIME_ERROR("Cannot map file: " + to_string(fn));
+    }
+#else
+    auto fd = ::open(fn.c_str(), read_only ? O_RDONLY : O_RDWR);
+    if (fd == -1)
+        throw SW_RUNTIME_ERROR("Cannot open file: " + to_string(fn));
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        ::close(fd);
+        throw SW_RUNTIME_ERROR("Cannot get file size: " + to_string(fn));
+    }
+    sz = st.st_size;
+    if (sz)
+    {
+        auto r = mmap(nullptr, sz, read_only ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (r == MAP_FAILED)
+        {
+            ::close(fd);
+            throw SW_RUNTIME_ERROR("Cannot map file: " + to_string(fn));
+        }
+        p = (uint8_t *)r;
+    }
+    // mapping holds its own reference
+    ::close(fd);
+#endif
+}
+
+MappedFile::MappedFile(MappedFile &&rhs)
+{
+    operator=(std::move(rhs));
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&rhs)
+{
+    if (this == &rhs)
+        return *this;
+    close();
+    std::swap(p, rhs.p);
+    std::swap(sz, rhs.sz);
+#ifdef _WIN32
+    std::swap(fh, rhs.fh);
+    std::swap(mh, rhs.mh);
+#endif
+    return *this;
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+    if (p)
+        UnmapViewOfFile(p);
+    if (mh)
+        CloseHandle(mh);
+    if (fh)
+        CloseHandle(fh);
+    mh = nullptr;
+    fh = nullptr;
+#else
+    if (p)
+        munmap(p, sz);
+#endif
+    p = nullptr;
+    sz = 0;
+}
+
+}
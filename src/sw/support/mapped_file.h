@@ -0,0 +1,38 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#pragma once
+
+#include <primitives/filesystem.h>
+
+namespace sw
+{
+
+/// shared memory mapping of the whole file
+/// read-only mappings must not be written through data()
+struct SW_SUPPORT_API MappedFile
+{
+    MappedFile() = default;
+    MappedFile(const path &fn, bool read_only = false);
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    MappedFile(MappedFile &&);
+    MappedFile &operator=(MappedFile &&);
+    ~MappedFile();
+
+    uint8_t *data() const { return p; }
+    size_t size() const { return sz; }
+    explicit operator bool() const { return p; }
+
+private:
+    uint8_t *p = nullptr;
+    size_t sz = 0;
+#ifdef _WIN32
+    void *fh = nullptr;
+    void *mh = nullptr;
+#endif
+
+    void close();
+};
+
+}
@@ -9,6 +9,8 @@
 #include <nlohmann/json.hpp>
 #include <pystring.h>
 
+#include <unordered_map>
+
 namespace sw
 {
 
@@ -49,11 +51,35 @@ PackageSetting &PackageSetting::operator=(const PackageSetting &rhs)
         reset();
         return *this;
     }
+    // cached value of equal node is taken,
+    // it is read first, so we are never cached while children are not
+    auto h = rhs.hash.get();
     value = rhs.value;
     copy_fields(rhs);
+    adopt();
+    if (hash.parent)
+        hash.parent->invalidate();
+    hash.set(h);
     return *this;
 }
 
+void PackageSetting::adopt()
+{
+    if (auto m = std::get_if<Map>(&value))
+        m->hash.parent = &hash;
+    else if (auto a = std::get_if<Array>(&value))
+    {
+        for (auto &v : *a)
+            v.hash.parent = &hash;
+    }
+}
+
+void PackageSetting::changed()
+{
+    adopt();
+    hash.invalidate();
+}
+
 PackageSetting &PackageSetting::operator[](const PackageSettingKey &k)
 {
     if (value.index() == 0)
@@ -182,11 +208,13 @@ bool PackageSetting::operator<(const PackageSetting &rhs) const
 void PackageSetting::useInHash(bool b)
 {
     used_in_hash = b;
+    hash.invalidate();
 }
 
 void PackageSetting::ignoreInComparison(bool b)
 {
     ignore_in_comparison = b;
+    hash.invalidate();
 }
 
 // rename to serializable?
@@ -256,6 +284,7 @@ void PackageSetting::mergeFromJson(const nlohmann::json &j)
             s.mergeFromJson(e);
             v->push_back(s);
         }
+        changed();
         return;
     }
 
@@ -297,7 +326,9 @@ void PackageSetting::push_back(const ArrayValue &v)
             throw SW_RUNTIME_ERROR("key is not an array (null)");
         *this = Array();
     }
-    return std::get<Array>(value).push_back(v);
+    std::get<Array>(value).push_back(v);
+    // elements could be moved
+    changed();
 }
 
 void PackageSetting::reset()
@@ -336,7 +367,13 @@ PackageSetting::operator bool() const
 
 String PackageSettings::getHash() const
 {
-    return shorten_hash(std::to_string(getHash1()), 6);
+    // there are few distinct settings in a build, but their hashes are asked many times
+    thread_local std::unordered_map<size_t, String> strings;
+    auto h = getHash1();
+    auto i = strings.find(h);
+    if (i != strings.end())
+        return i->second;
+    return strings.emplace(h, shorten_hash(std::to_string(h), 6)).first->second;
 }
 
 void PackageSettings::mergeFromString(const String &s, int type)
@@ -409,46 +446,154 @@ nlohmann::json PackageSettings::toJson() const
 
 size_t PackageSetting::getHash1() const
 {
-    size_t h = 0;
+    return getCachedHash().hash;
+}
+
+detail::SettingsHash::Value PackageSetting::getCachedHash() const
+{
+    if (auto v = hash.get())
+        return *v;
+
+    detail::SettingsHash::Value r;
     switch (value.index())
     {
     case 0:
-        return h;
+        break;
     case 1:
-        return hash_combine(h, getValue());
+        hash_combine(r.hash, getValue());
+        r.comparison_hash = r.hash;
+        break;
     case 2:
         for (auto &v2 : std::get<Array>(value))
-            hash_combine(h, v2.getHash1());
+        {
+            auto h2 = v2.getCachedHash();
+            hash_combine(r.hash, h2.hash);
+            hash_combine(r.comparison_hash, h2.comparison_hash);
+            // elements are compared with their own flags
+            r.exact &= h2.exact && !h2.ignored && !v2.ignore_in_comparison;
+        }
         break;
     case 3:
-        return hash_combine(h, std::get<Map>(value).getHash1());
+    {
+        auto h2 = std::get<Map>(value).getCachedHash();
+        hash_combine(r.hash, h2.hash);
+        hash_combine(r.comparison_hash, h2.comparison_hash);
+        r.ignored = h2.ignored;
+        r.exact = h2.exact;
+        break;
+    }
     case 4:
-        return hash_combine(h, h); // combine 0 and 0
+        hash_combine(r.hash, r.hash); // combine 0 and 0
+        r.comparison_hash = r.hash;
+        break;
     default:
         SW_UNREACHABLE;
     }
-    return h;
+    hash.set(r);
+    return r;
 }
 
 size_t PackageSettings::getHash1() const
 {
-    size_t h = 0;
+    return getCachedHash().hash;
+}
+
+detail::SettingsHash::Value PackageSettings::getCachedHash() const
+{
+    if (auto v = hash.get())
+        return *v;
+
+    detail::SettingsHash::Value r;
     for (auto &[k, v] : *this)
     {
+        // unused values are hashed too, children must be cached before us
+        auto h2 = v.getCachedHash();
+
+        // see operator==
+        if (v.ignore_in_comparison)
+            hash_combine(r.ignored, k);
+        else
+        {
+            r.exact &= h2.exact;
+            if (h2.ignored)
+            {
+                hash_combine(r.ignored, k);
+                hash_combine(r.ignored, h2.ignored);
+            }
+            // missing and empty values are equal
+            if (v)
+            {
+                hash_combine(r.comparison_hash, k);
+                hash_combine(r.comparison_hash, h2.comparison_hash);
+            }
+        }
+
         if (!v.used_in_hash)
             continue;
-        auto h2 = v.getHash1();
-        if (h2 == 0)
+        if (h2.hash == 0)
             continue;
-        hash_combine(h, k);
-        hash_combine(h, h2);
+        hash_combine(r.hash, k);
+        hash_combine(r.hash, h2.hash);
     }
-    return h;
+    hash.set(r);
+    return r;
+}
+
+PackageSettings::PackageSettings(const PackageSettings &rhs)
+{
+    operator=(rhs);
+}
+
+PackageSettings::PackageSettings(PackageSettings &&rhs)
+{
+    operator=(std::move(rhs));
+}
+
+PackageSettings &PackageSettings::operator=(const PackageSettings &rhs)
+{
+    if (this == &rhs)
+        return *this;
+    // see PackageSetting::operator=
+    auto h = rhs.hash.get();
+    settings = rhs.settings;
+    adopt();
+    if (hash.parent)
+        hash.parent->invalidate();
+    hash.set(h);
+    return *this;
+}
+
+PackageSettings &PackageSettings::operator=(PackageSettings &&rhs)
+{
+    if (this == &rhs)
+        return *this;
+    auto h = rhs.hash.get();
+    settings = std::move(rhs.settings);
+    adopt();
+    if (hash.parent)
+        hash.parent->invalidate();
+    hash.set(h);
+    rhs.settings.clear();
+    rhs.hash.invalidate();
+    return *this;
+}
+
+void PackageSettings::adopt()
+{
+    for (auto &[k, v] : settings)
+        v.hash.parent = &hash;
 }
 
 PackageSetting &PackageSettings::operator[](const PackageSettingKey &k)
 {
-    return settings.try_emplace(k, PackageSetting{}).first->second;
+    auto [i, inserted] = settings.try_emplace(k);
+    if (inserted)
+    {
+        // empty value does not change our hash
+        i->second.hash.parent = &hash;
+        i->second.hash.set(detail::SettingsHash::Value{});
+    }
+    return i->second;
 }
 
 const PackageSetting &PackageSettings::operator[](const PackageSettingKey &k) const
@@ -464,6 +609,12 @@ const PackageSetting &PackageSettings::operator[](const PackageSettingKey &k) co
 
 bool PackageSettings::operator==(const PackageSettings &rhs) const
 {
+    // same values are ignored on both sides, so different hashes mean different settings
+    auto h1 = getCachedHash();
+    auto h2 = rhs.getCachedHash();
+    if (h1.exact && h2.exact && h1.ignored == h2.ignored && h1.comparison_hash != h2.comparison_hash)
+        return false;
+
     for (auto &[k, v] : rhs.settings)
     {
         if (v.ignoreInComparison())
@@ -532,12 +683,23 @@ bool PackageSettings::isSubsetOf(const PackageSettings &s) const
 
 void PackageSettings::mergeMissing(const PackageSettings &rhs)
 {
+    // whole tree is taken with its cached hashes
+    if (empty())
+    {
+        *this = rhs;
+        return;
+    }
     for (auto &[k, v] : rhs)
         (*this)[k].mergeMissing(v);
 }
 
 void PackageSettings::mergeAndAssign(const PackageSettings &rhs)
 {
+    if (empty())
+    {
+        *this = rhs;
+        return;
+    }
     for (auto &[k, v] : rhs)
         (*this)[k].mergeAndAssign(v);
 }
@@ -551,13 +713,13 @@ void PackageSettings::mergeFromJson(const nlohmann::json &j)
         if (pystring::endswith(it.key(), "_used_in_hash"))
         {
             if (it.value().get<String>() == "false")
-                (*this)[it.key().substr(0, it.key().size() - strlen("_used_in_hash"))].used_in_hash = false;
+                (*this)[it.key().substr(0, it.key().size() - strlen("_used_in_hash"))].useInHash(false);
             continue;
         }
         if (pystring::endswith(it.key(), "_ignore_in_comparison"))
         {
             if (it.value().get<String>() == "true")
-                (*this)[it.key().substr(0, it.key().size() - strlen("_ignore_in_comparison"))].ignore_in_comparison = true;
+                (*this)[it.key().substr(0, it.key().size() - strlen("_ignore_in_comparison"))].ignoreInComparison(true);
             continue;
         }
         (*this)[it.key()].mergeFromJson(it.value());
@@ -566,7 +728,8 @@ void PackageSettings::mergeFromJson(const nlohmann::json &j)
 
 void PackageSettings::erase(const PackageSettingKey &k)
 {
-    settings.erase(k);
+    if (settings.erase(k))
+        hash.invalidate();
 }
 
 bool PackageSettings::empty() const
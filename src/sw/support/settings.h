@@ -6,6 +6,7 @@
 #include <nlohmann/json_fwd.hpp>
 #include <primitives/filesystem.h>
 
+#include <atomic>
 #include <memory>
 #include <optional>
 #include <variant>
@@ -20,6 +21,85 @@ using PackageSettingValue = String;
 struct PackageSetting;
 struct PackageSettings;
 
+namespace detail
+{
+
+// Memoised structural hash of a settings node.
+// Change of a node drops cached values of the node and all its parents,
+// so unchanged subtrees are never rehashed.
+// Invariant: parent is cached only when all its children are cached.
+struct SettingsHash
+{
+    struct Value
+    {
+        // PackageSettings::getHash()
+        size_t hash = 0;
+        // over values used in comparison, including ones not used in hash
+        size_t comparison_hash = 0;
+        // paths of values ignored in comparison
+        size_t ignored = 0;
+        // false when equal nodes still can have different comparison hashes
+        bool exact = true;
+    };
+
+    SettingsHash *parent = nullptr;
+
+    SettingsHash() = default;
+    SettingsHash(const SettingsHash &) = delete;
+    SettingsHash &operator=(const SettingsHash &) = delete;
+
+    std::optional<Value> get() const
+    {
+        auto s = state.load(std::memory_order_acquire);
+        if (s == Invalid)
+            return {};
+        Value v;
+        v.hash = hash.load(std::memory_order_relaxed);
+        v.comparison_hash = comparison_hash.load(std::memory_order_relaxed);
+        v.ignored = ignored.load(std::memory_order_relaxed);
+        v.exact = s == Exact;
+        return v;
+    }
+
+    void set(const Value &v) const
+    {
+        hash.store(v.hash, std::memory_order_relaxed);
+        comparison_hash.store(v.comparison_hash, std::memory_order_relaxed);
+        ignored.store(v.ignored, std::memory_order_relaxed);
+        state.store(v.exact ? Exact : Valid, std::memory_order_release);
+    }
+
+    void set(const std::optional<Value> &v)
+    {
+        if (v)
+            set(*v);
+        else
+            invalidate();
+    }
+
+    void invalidate()
+    {
+        // parents of invalid node are invalid already
+        for (auto p = this; p && p->state.load(std::memory_order_relaxed) != Invalid; p = p->parent)
+            p->state.store(Invalid, std::memory_order_relaxed);
+    }
+
+private:
+    enum : uint8_t
+    {
+        Invalid,
+        Valid,
+        Exact,
+    };
+
+    mutable std::atomic<size_t> hash{ 0 };
+    mutable std::atomic<size_t> comparison_hash{ 0 };
+    mutable std::atomic<size_t> ignored{ 0 };
+    mutable std::atomic<uint8_t> state{ Invalid };
+};
+
+}
+
 struct SW_SUPPORT_API PackageSettings
 {
     enum StringType : int
@@ -32,6 +112,13 @@ struct SW_SUPPORT_API PackageSettings
         Simple      = KeyValue,
     };
 
+    PackageSettings() = default;
+    /// cached hashes are copied too
+    PackageSettings(const PackageSettings &);
+    PackageSettings(PackageSettings &&);
+    PackageSettings &operator=(const PackageSettings &);
+    PackageSettings &operator=(PackageSettings &&);
+
     PackageSetting &operator[](const PackageSettingKey &);
     const PackageSetting &operator[](const PackageSettingKey &) const;
 
@@ -43,9 +130,11 @@ struct SW_SUPPORT_API PackageSettings
     void mergeFromString(const String &s, int type = Json);
     void mergeFromJson(const nlohmann::json &);
 
+    /// memoised, only changed subtrees are rehashed
     String getHash() const;
     String toString(int type = Json) const;
 
+    /// different hashes give answer without walking the trees
     bool operator==(const PackageSettings &) const;
     bool operator<(const PackageSettings &) const;
     bool isSubsetOf(const PackageSettings &) const;
@@ -59,10 +148,13 @@ struct SW_SUPPORT_API PackageSettings
 
 private:
     std::map<PackageSettingKey, PackageSetting> settings;
+    detail::SettingsHash hash;
 
     //String toStringKeyValue() const;
     nlohmann::json toJson() const;
     size_t getHash1() const;
+    detail::SettingsHash::Value getCachedHash() const;
+    void adopt();
 
     friend struct PackageSetting;
 
@@ -72,6 +164,11 @@ private:
     void serialize(Ar &ar, unsigned)
     {
         ar & settings;
+        if constexpr (Ar::is_loading::value)
+        {
+            adopt();
+            hash.invalidate();
+        }
     }
 #endif
 };
@@ -116,6 +213,7 @@ struct SW_SUPPORT_API PackageSetting
         }
         reset();
         value = u;
+        changed();
         return *this;
     }
 
@@ -191,10 +289,14 @@ private:
     bool serializable_ = true;
     // when adding new member, add it to copy_fields()!
     std::variant<std::monostate, Value, Array, Map, NullType> value;
+    detail::SettingsHash hash;
 
     nlohmann::json toJson() const;
     size_t getHash1() const;
+    detail::SettingsHash::Value getCachedHash() const;
     void copy_fields(const PackageSetting &);
+    void adopt();
+    void changed();
 
     friend struct PackageSettings;
 
@@ -235,6 +337,7 @@ private:
         }
             break;
         }
+        changed();
     }
     template <class Ar>
     void save(Ar &ar, unsigned) const
@@ -52,6 +52,17 @@ void ResolveRequest::setPackage(PackagePtr in)
         r = std::move(in);
 }
 
+bool IResolvableStorage::resolveBatch(const std::vector<ResolveRequest *> &rrs) const
+{
+    bool resolved = true;
+    for (auto rr : rrs)
+    {
+        resolve(*rr);
+        resolved &= rr->isResolved();
+    }
+    return resolved;
+}
+
 bool Resolver::resolve(ResolveRequest &rr) const
 {
     // select the best candidate from all storages
@@ -71,6 +82,20 @@ bool Resolver::resolve(ResolveRequest &rr) const
     return rr.isResolved();
 }
 
+bool Resolver::resolveBatch(const std::vector<ResolveRequest *> &rrs) const
+{
+    auto left = rrs;
+    for (auto &&s : storages)
+    {
+        // when we found a branch, we stop, because following storages cannot give us more preferable branch
+        std::erase_if(left, [](auto rr) { return rr->isResolved() && rr->u.getRange().isBranch(); });
+        if (left.empty())
+            break;
+        s->resolveBatch(left);
+    }
+    return std::all_of(rrs.begin(), rrs.end(), [](auto rr) { return rr->isResolved(); });
+}
+
 void Resolver::addStorage(IStorage &s)
 {
     storages.push_back(&s);
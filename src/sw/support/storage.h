@@ -75,6 +75,10 @@ struct SW_SUPPORT_API IResolvableStorage
 {
     /// modern resolve call
     virtual bool resolve(ResolveRequest &) const = 0;
+
+    /// resolves all requests at once, better packages overwrite already set ones
+    /// returns true when every request is resolved
+    virtual bool resolveBatch(const std::vector<ResolveRequest *> &) const;
 };
 
 struct SW_SUPPORT_API IStorage : IResolvableStorage
@@ -101,6 +105,8 @@ struct SW_SUPPORT_API Resolver
     virtual ~Resolver() = default;
 
     virtual bool resolve(ResolveRequest &) const;
+    /// one call per storage for all requests
+    virtual bool resolveBatch(const std::vector<ResolveRequest *> &) const;
     void addStorage(IStorage &);
 
 private:
@@ -2,6 +2,7 @@
 
 //DIR(arh) // archive storage (mirrors etc.)?
 //DIR(bin) // files are moved to pkg dir
+DIR(blb) // content addressed files of unpacked sources, see BlobStore
 //DIR(cfg) // moved to etc/sw/checks
 //DIR(dat)
 DIR(etc)
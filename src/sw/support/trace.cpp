@@ -0,0 +1,392 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#include "trace.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+namespace sw::trace
+{
+
+namespace
+{
+
+struct Event
+{
+    enum Type : uint8_t
+    {
+        Zone,
+        Counter,
+    };
+
+    const char *name;
+    uint64_t begin;
+    uint64_t end; // zones
+    int64_t value; // counters
+    String detail;
+    Type type;
+};
+
+struct Chunk
+{
+    static constexpr size_t size = 1024;
+
+    std::array<Event, size> events;
+    // published by writer with release, read by collector with acquire
+    std::atomic<size_t> n{ 0 };
+    std::atomic<Chunk *> next{ nullptr };
+
+    ~Chunk() { delete next.load(); }
+};
+
+// written by its thread only, cleared by collector
+struct ThreadBuffer
+{
+    uint32_t tid;
+    Chunk first;
+    Chunk *last = &first;
+    // thread is gone, nobody writes here anymore
+    bool finished = false;
+    // taken by writer for every event (uncontended) and by clear()
+    std::atomic_flag busy;
+
+    void add(Event &&e)
+    {
+        while (busy.test_and_set(std::memory_order_acquire))
+            ;
+        append(std::move(e));
+        busy.clear(std::memory_order_release);
+    }
+
+    void clear()
+    {
+        while (busy.test_and_set(std::memory_order_acquire))
+            ;
+        delete first.next.exchange(nullptr);
+        auto n = first.n.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < n; i++)
+            first.events[i].detail = {};
+        first.n = 0;
+        last = &first;
+        busy.clear(std::memory_order_release);
+    }
+
+    template <class F>
+    void iterate(F &&f) const
+    {
+        for (auto c = &first; c; c = c->next.load(std::memory_order_acquire))
+        {
+            auto n = c->n.load(std::memory_order_acquire);
+            for (size_t i = 0; i < n; i++)
+                f(c->events[i]);
+        }
+    }
+
+private:
+    void append(Event &&e)
+    {
+        auto n = last->n.load(std::memory_order_relaxed);
+        if (n == Chunk::size)
+        {
+            auto c = new Chunk;
+            last->next.store(c, std::memory_order_release);
+            last = c;
+            n = 0;
+        }
+        last->events[n] = std::move(e);
+        last->n.store(n + 1, std::memory_order_release);
+    }
+};
+
+struct Registry
+{
+    std::mutex m;
+    // buffers outlive their threads, so events of finished threads are kept until clear()
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    uint32_t next_tid = 1;
+    // zones started before clear() may end after it
+    std::atomic<uint64_t> start{ 0 };
+
+    ThreadBuffer &add()
+    {
+        std::unique_lock lk(m);
+        auto &b = buffers.emplace_back(std::make_unique<ThreadBuffer>());
+        b->tid = next_tid++;
+        return *b;
+    }
+
+    void finish(ThreadBuffer &b)
+    {
+        std::unique_lock lk(m);
+        b.finished = true;
+    }
+
+    void clear()
+    {
+        std::unique_lock lk(m);
+        std::erase_if(buffers, [](const auto &b) { return b->finished; });
+        for (auto &b : buffers)
+            b->clear();
+    }
+
+    template <class F>
+    void iterate(F &&f)
+    {
+        auto s = start.load();
+        std::unique_lock lk(m);
+        for (auto &b : buffers)
+        {
+            b->iterate([&f, &b, s](const Event &e)
+            {
+                if (e.begin >= s)
+                    f(*b, e);
+            });
+        }
+    }
+};
+
+Registry &getRegistry()
+{
+    static Registry r;
+    return r;
+}
+
+ThreadBuffer &getThreadBuffer()
+{
+    struct ThreadBufferRef
+    {
+        ThreadBuffer &b = getRegistry().add();
+
+        ~ThreadBufferRef() { getRegistry().finish(b); }
+    };
+
+    thread_local ThreadBufferRef r;
+    return r.b;
+}
+
+String escape(const char *s)
+{
+    String r;
+    for (; *s; s++)
+    {
+        switch (*s)
+        {
+        case '"':
+            r += "\\\"";
+            break;
+        case '\\':
+            r += "\\\\";
+            break;
+        case '\n':
+            r += "\\n";
+            break;
+        case '\r':
+            r += "\\r";
+            break;
+        case '\t':
+            r += "\\t";
+            break;
+        default:
+            if ((unsigned char)*s < 0x20)
+                r += ' ';
+            else
+                r += *s;
+            break;
+        }
+    }
+    return r;
+}
+
+String to_us(uint64_t ns)
+{
+    return std::to_string(ns / 1000) + "." + std::to_string(ns % 1000 / 100);
+}
+
+}
+
+namespace detail
+{
+
+std::atomic_bool enabled;
+
+uint64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void addZone(const char *name, uint64_t begin, uint64_t end, String &&detail)
+{
+    getThreadBuffer().add({ name, begin, end, 0, std::move(detail), Event::Zone });
+}
+
+}
+
+void enable()
+{
+    clear();
+    getRegistry().start = detail::now();
+    detail::enabled = true;
+}
+
+void disable()
+{
+    detail::enabled = false;
+}
+
+void clear()
+{
+    getRegistry().clear();
+}
+
+void counter(const char *name, int64_t value)
+{
+    if (!isEnabled())
+        return;
+    auto t = detail::now();
+    getThreadBuffer().add({ name, t, t, value, {}, Event::Counter });
+}
+
+void saveChromeTrace(const path &fn)
+{
+    auto &r = getRegistry();
+    auto s = r.start.load();
+
+    String t;
+    t += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    r.iterate([&t, &first, s](const ThreadBuffer &b, const Event &e)
+    {
+        if (!first)
+            t += ",\n";
+        first = false;
+        t += "{\"name\":\"" + escape(e.name) + "\",\"pid\":1,\"tid\":" + std::to_string(b.tid);
+        t += ",\"ts\":" + to_us(e.begin - s);
+        if (e.type == Event::Zone)
+        {
+            t += ",\"ph\":\"X\",\"cat\":\"sw\",\"dur\":" + to_us(e.end - e.begin);
+            if (!e.detail.empty())
+                t += ",\"args\":{\"detail\":\"" + escape(e.detail.c_str()) + "\"}";
+        }
+        else
+            t += ",\"ph\":\"C\",\"args\":{\"value\":" + std::to_string(e.value) + "}";
+        t += "}";
+    });
+    t += "\n]}\n";
+    write_file(fn, t);
+}
+
+String getSummary(size_t top_n)
+{
+    struct ZoneStats
+    {
+        const char *name;
+        uint64_t total = 0;
+        uint64_t self = 0;
+        uint64_t max = 0;
+        size_t count = 0;
+    };
+
+    struct CounterStats
+    {
+        uint64_t time = 0;
+        int64_t last = 0;
+        int64_t max = 0;
+    };
+
+    struct ZoneRef
+    {
+        const char *name;
+        uint64_t begin;
+        uint64_t end;
+        uint64_t children = 0;
+    };
+
+    // names are literals, but same literal may have several addresses in different modules
+    std::unordered_map<std::string_view, ZoneStats> zones;
+    std::map<std::string_view, CounterStats> counters;
+    std::unordered_map<uint32_t, std::vector<ZoneRef>> per_thread;
+
+    auto &r = getRegistry();
+    auto s = r.start.load();
+    r.iterate([&](const ThreadBuffer &b, const Event &e)
+    {
+        if (e.type == Event::Zone)
+            per_thread[b.tid].push_back({ e.name, e.begin, e.end });
+        else
+        {
+            auto &c = counters[e.name];
+            if (e.begin >= c.time)
+            {
+                c.time = e.begin;
+                c.last = e.value;
+            }
+            c.max = std::max(c.max, e.value);
+        }
+    });
+
+    // self time = zone time - time of nested zones of the same thread
+    for (auto &[_, v] : per_thread)
+    {
+        std::sort(v.begin(), v.end(), [](const auto &a, const auto &b)
+        {
+            return std::tie(a.begin, b.end) < std::tie(b.begin, a.end);
+        });
+        std::vector<ZoneRef *> stack;
+        for (auto &z : v)
+        {
+            while (!stack.empty() && stack.back()->end <= z.begin)
+                stack.pop_back();
+            if (!stack.empty())
+                stack.back()->children += z.end - z.begin;
+            stack.push_back(&z);
+        }
+        for (auto &z : v)
+        {
+            auto d = z.end - z.begin;
+            auto &st = zones[z.name];
+            st.name = z.name;
+            st.total += d;
+            st.self += d - std::min(d, z.children);
+            st.max = std::max(st.max, d);
+            st.count++;
+        }
+    }
+
+    std::vector<ZoneStats> sorted;
+    for (auto &[_, z] : zones)
+        sorted.push_back(z);
+    std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) { return a.total > b.total; });
+    if (sorted.size() > top_n)
+        sorted.resize(top_n);
+
+    auto to_s = [](uint64_t ns) { return ns / 1'000'000'000.0; };
+
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(3);
+    ss << "Trace summary (" << to_s(detail::now() - s) << " s. recorded)\n";
+    ss << std::setw(12) << "total, s" << std::setw(12) << "self, s" << std::setw(12) << "max, s"
+       << std::setw(10) << "count" << "  zone\n";
+    for (auto &z : sorted)
+    {
+        ss << std::setw(12) << to_s(z.total) << std::setw(12) << to_s(z.self) << std::setw(12) << to_s(z.max)
+           << std::setw(10) << z.count << "  " << z.name << "\n";
+    }
+    if (!counters.empty())
+    {
+        ss << std::setw(12) << "last" << std::setw(12) << "max" << "  counter\n";
+        for (auto &[n, c] : counters)
+            ss << std::setw(12) << c.last << std::setw(12) << c.max << "  " << n << "\n";
+    }
+    return ss.str();
+}
+
+}
@@ -0,0 +1,118 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#pragma once
+
+#include <primitives/filesystem.h>
+
+#include <atomic>
+#include <concepts>
+#include <cstdint>
+
+/// Lightweight build self profiling.
+///
+/// Always compiled, costs one relaxed load when disabled.
+/// Every thread writes events into its own buffer guarded by an uncontended flag,
+/// buffers are collected only when trace is saved and freed by clear() or enable().
+///
+/// Usage:
+///     SW_TRACE_ZONE("resolvePackages");
+///     SW_TRACE_ZONE("command", c.getName()); // detail is shown in event args
+///     SW_TRACE_ZONE("command", [&c] { return c.getName(); }); // detail is computed only when enabled
+///     sw::trace::counter("commands left", n);
+///
+/// Zone and counter names must be string literals (pointers are stored).
+
+namespace sw::trace
+{
+
+namespace detail
+{
+
+SW_SUPPORT_API
+extern std::atomic_bool enabled;
+
+SW_SUPPORT_API
+uint64_t now();
+
+SW_SUPPORT_API
+void addZone(const char *name, uint64_t begin, uint64_t end, String &&detail);
+
+}
+
+inline bool isEnabled() { return detail::enabled.load(std::memory_order_relaxed); }
+
+/// starts recording, clears previous events
+SW_SUPPORT_API
+void enable();
+
+SW_SUPPORT_API
+void disable();
+
+/// frees recorded events, call when they are saved
+SW_SUPPORT_API
+void clear();
+
+struct Zone
+{
+    Zone(const char *name)
+        : name(isEnabled() ? name : nullptr)
+    {
+        if (this->name)
+            begin = detail::now();
+    }
+
+    Zone(const char *name, const String &detail)
+        : Zone(name)
+    {
+        if (this->name)
+            info = detail;
+    }
+
+    template <std::invocable F>
+    Zone(const char *name, F &&detail)
+        : Zone(name)
+    {
+        if (this->name)
+            info = detail();
+    }
+
+    Zone(const Zone &) = delete;
+    Zone &operator=(const Zone &) = delete;
+
+    /// for results known at the end of the zone
+    template <std::invocable F>
+    void setDetail(F &&detail)
+    {
+        if (name)
+            info = detail();
+    }
+
+    ~Zone()
+    {
+        if (name)
+            detail::addZone(name, begin, detail::now(), std::move(info));
+    }
+
+private:
+    const char *name;
+    uint64_t begin = 0;
+    String info;
+};
+
+SW_SUPPORT_API
+void counter(const char *name, int64_t value);
+
+/// chrome://tracing or ui.perfetto.dev json
+SW_SUPPORT_API
+void saveChromeTrace(const path &fn);
+
+/// zones aggregated by name, sorted by total time
+SW_SUPPORT_API
+String getSummary(size_t top_n = 20);
+
+}
+
+#define SW_TRACE_CONCATENATE_IMPL(a, b) a##b
+#define SW_TRACE_CONCATENATE(a, b) SW_TRACE_CONCATENATE_IMPL(a, b)
+#define SW_TRACE_ZONE(...) ::sw::trace::Zone SW_TRACE_CONCATENATE(sw_trace_zone_, __LINE__)(__VA_ARGS__)
@@ -0,0 +1,46 @@
+// SPDX-License-Identifier: AGPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#include <sw/manager/package_index.h>
+
+#include <primitives/sw/main.h>
+#include <primitives/sw/cl.h>
+#include <primitives/sw/settings_program_name.h>
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "server.package_index");
+
+// writes packages index next to csv tables of packages database
+// the directory can be used as 'local_dir' of remote database
+int main(int argc, char **argv)
+{
+    static cl::opt<path> dir("dir", cl::Required, cl::desc("Dir with csv tables"));
+    static cl::opt<bool> delta("delta", cl::desc("Write changes since existing index as the next delta"));
+
+    cl::ParseCommandLineOptions(argc, argv);
+
+    auto fn = dir / sw::PackageIndex::filename;
+    if (!delta || !sw::PackageIndex::exists(dir))
+    {
+        sw::PackageIndex::remove(dir);
+        sw::PackageIndex::build(dir, fn);
+        LOG_INFO(logger, "Written: " << fn);
+        return 0;
+    }
+
+    sw::PackageIndex base(dir);
+    int n = 1;
+    while (fs::exists(path(fn) += "." + std::to_string(n)))
+        n++;
+    auto out = path(fn) += "." + std::to_string(n);
+    sw::PackageIndex::build(dir, out, &base);
+    LOG_INFO(logger, "Written: " << out);
+
+    return 0;
+}
+
+EXPORT_FROM_EXECUTABLE
+std::string getProgramName()
+{
+    return PACKAGE_NAME_CLEAN;
+}
@@ -80,7 +80,8 @@ void build(Solution &s)
         manager.Public += "BOOST_DLL_USE_STD_FS"_def;
 
         manager +=
-            "pub.egorpugin.primitives.csv"_dep;
+            "pub.egorpugin.primitives.csv"_dep,
+            "org.sw.demo.Cyan4973.xxHash"_dep;
         manager.Public += support, protos,
             "pub.egorpugin.primitives.db.sqlite3"_dep,
             "pub.egorpugin.primitives.lock"_dep,
@@ -122,10 +123,10 @@ void build(Solution &s)
         builder += cpp20;
         builder += "src/sw/builder/.*"_rr;
         builder.Public += manager,
-            "org.sw.demo.preshing.junction-master"_dep,
             "org.sw.demo.boost.graph"_dep,
             "org.sw.demo.microsoft.gsl"_dep,
             "pub.egorpugin.primitives.emitter"_dep;
+        builder += "org.sw.demo.Cyan4973.xxHash"_dep;
         //if (!s.Variables["SW_SELF_BUILD"])
         {
             /*PrecompiledHeader pch;
@@ -141,6 +142,7 @@ void build(Solution &s)
         builder_distributed += cpp20;
         builder_distributed += "src/sw/builder_distributed/.*"_rr;
         builder_distributed.Public += builder;
+        builder_distributed += "org.sw.demo.Cyan4973.xxHash"_dep;
     }
 
     auto &core = p.addTarget<LibraryTarget>("core");
@@ -374,6 +376,14 @@ void build(Solution &s)
         mirror += manager;
         mirror += "pub.egorpugin.primitives.sw.main"_dep;
     }
+    auto &package_index = sp.addTarget<ExecutableTarget>("package_index");
+    {
+        package_index.PackageDefinitions = true;
+        package_index += cpp20;
+        package_index += "src/sw/tools/package_index.cpp";
+        package_index += manager;
+        package_index += "pub.egorpugin.primitives.sw.main"_dep;
+    }
 
     if (s.getExternalVariables()["with-gui"] != "true")
         return;
@@ -0,0 +1,76 @@
+#include <sw/manager/blob_store.h>
+
+#include <primitives/filesystem.h>
+
+#define CATCH_CONFIG_RUNNER
+#include <catch2/catch.hpp>
+
+using namespace sw;
+
+static bool is_writable(const path &p)
+{
+    return (fs::status(p).permissions() & fs::perms::owner_write) != fs::perms::none;
+}
+
+TEST_CASE("Checking blob store", "[blob_store]")
+{
+    auto root = fs::temp_directory_path() / "sw_blob_store_test";
+    fs::remove_all(root);
+    BlobStore s(root / "blb");
+
+    write_file(root / "p1" / "a.txt", String(1000, 'a'));
+    write_file(root / "p1" / "d" / "b.txt", "bbb");
+    write_file(root / "p1" / "empty", "");
+    write_file(root / "p2" / "a.txt", String(1000, 'a'));
+    write_file(root / "p2" / "c.txt", "ccc");
+
+    auto b1 = s.checkin(root / "p1");
+    auto b2 = s.checkin(root / "p2");
+    // empty files are not stored
+    REQUIRE(b1.size() == 2);
+    REQUIRE(b2.size() == 2);
+    REQUIRE(read_file(root / "p2" / "a.txt") == String(1000, 'a'));
+    // copy-on-write file systems do not link files
+    if (fs::hard_link_count(root / "p2" / "a.txt") == 1)
+    {
+        REQUIRE(is_writable(root / "p2" / "a.txt"));
+        fs::remove_all(root);
+        return;
+    }
+    REQUIRE(fs::hard_link_count(root / "p2" / "a.txt") == 3);
+    REQUIRE_FALSE(is_writable(root / "p2" / "a.txt"));
+
+    auto st = s.getStats();
+    REQUIRE(st.blobs == 3);
+    REQUIRE(st.stored_bytes == 1006);
+    REQUIRE(st.getSavedBytes() == 1000);
+
+    SECTION("unshare")
+    {
+        BlobStore::unshare(root / "p2" / "a.txt");
+        REQUIRE(fs::hard_link_count(root / "p2" / "a.txt") == 1);
+        REQUIRE(fs::hard_link_count(root / "p1" / "a.txt") == 2);
+        REQUIRE(read_file(root / "p2" / "a.txt") == String(1000, 'a'));
+        REQUIRE(is_writable(root / "p2" / "a.txt"));
+        REQUIRE_FALSE(is_writable(root / "p1" / "a.txt"));
+    }
+
+    SECTION("release")
+    {
+        fs::remove_all(root / "p1");
+        // a.txt is still used by p2
+        REQUIRE(s.release(b1) == 3);
+        fs::remove_all(root / "p2");
+        REQUIRE(s.collectGarbage() == 1003);
+        REQUIRE(s.getStats().blobs == 0);
+    }
+
+    fs::remove_all(root);
+}
+
+int main(int argc, char **argv)
+{
+    Catch::Session().run(argc, argv);
+
+    return 0;
+}
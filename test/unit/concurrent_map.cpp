@@ -0,0 +1,215 @@
+#include <sw/builder/command_storage.h>
+#include <sw/builder/concurrent_map.h>
+#include <sw/builder/file.h>
+
+#include <primitives/filesystem.h>
+
+#include <memory>
+#include <random>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+
+#define CATCH_CONFIG_RUNNER
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+using namespace sw;
+
+// single lock map, baseline for comparison
+template <class K, class V>
+struct LockedMap
+{
+    std::shared_mutex m;
+    std::unordered_map<K, std::unique_ptr<V>> map;
+
+    V *insert(const K &k)
+    {
+        {
+            std::shared_lock lk(m);
+            if (auto i = map.find(k); i != map.end())
+                return i->second.get();
+        }
+        std::unique_lock lk(m);
+        auto &v = map[k];
+        if (!v)
+            v = std::make_unique<V>();
+        return v.get();
+    }
+
+    V *find(const K &k)
+    {
+        std::shared_lock lk(m);
+        auto i = map.find(k);
+        return i != map.end() ? i->second.get() : nullptr;
+    }
+};
+
+template <class F>
+static void run_threads(size_t n, F &&f)
+{
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < n; i++)
+        threads.emplace_back([&f, i] { f(i); });
+    for (auto &t : threads)
+        t.join();
+}
+
+static size_t n_threads()
+{
+    return std::max(2u, std::thread::hardware_concurrency());
+}
+
+// many commands register the same headers
+static std::vector<path> make_paths(size_t n)
+{
+    std::vector<path> v;
+    v.reserve(n);
+    for (size_t i = 0; i < n; i++)
+        v.push_back(path("/home/user/project/src") / ("dir" + std::to_string(i % 1000)) / ("file" + std::to_string(i) + ".h"));
+    return v;
+}
+
+static std::vector<size_t> make_hashes(size_t n)
+{
+    std::mt19937_64 g(42);
+    std::vector<size_t> v(n);
+    for (auto &h : v)
+        h = (size_t)g();
+    return v;
+}
+
+struct CollidingHash
+{
+    size_t operator()(const path &) const { return 42; }
+};
+
+TEST_CASE("Checking concurrent map", "[concurrent_map]")
+{
+    SECTION("concurrent inserts")
+    {
+        ConcurrentMap<size_t, size_t> m;
+        const size_t n = 100'000;
+        run_threads(n_threads(), [&m, n](size_t)
+        {
+            for (size_t k = 0; k < n; k++)
+                *m.insert(k, k).first = k;
+        });
+        REQUIRE(m.size() == n);
+        size_t visited = 0;
+        for (const auto &[k, v] : m)
+        {
+            REQUIRE(k == v);
+            visited++;
+        }
+        REQUIRE(visited == n);
+        REQUIRE(m.find(0));
+        REQUIRE_FALSE(m.find(n));
+    }
+
+    SECTION("iteration during inserts")
+    {
+        ConcurrentMap<size_t, size_t> m;
+        std::atomic_bool done = false;
+        std::thread t([&m, &done]
+        {
+            for (size_t k = 0; k < 100'000; k++)
+                m.insert(k, k);
+            done = true;
+        });
+        while (!done)
+        {
+            for (const auto &[k, v] : m)
+                REQUIRE(k == v);
+        }
+        t.join();
+    }
+
+    SECTION("collisions")
+    {
+        ConcurrentMap<path, int, CollidingHash> m;
+        for (int i = 0; i < 1000; i++)
+            m[std::to_string(i)] = i;
+        REQUIRE(m.size() == 1000);
+        for (int i = 0; i < 1000; i++)
+            REQUIRE(*m.find(std::to_string(i)) == i);
+    }
+
+    SECTION("clear")
+    {
+        ConcurrentMap<path, FileData> m;
+        auto p = make_paths(1000);
+        for (auto &f : p)
+            m.insert(f);
+        m.clear();
+        REQUIRE(m.size() == 0);
+        REQUIRE_FALSE(m.find(p[0]));
+        REQUIRE(m.insert(p[0]).second);
+    }
+}
+
+TEST_CASE("Concurrent map workloads", "[.benchmark][concurrent_map]")
+{
+    const auto nt = n_threads();
+
+    // FileStorage: every thread registers the same files
+    auto paths = make_paths(100'000);
+    BENCHMARK("file storage: locked map")
+    {
+        LockedMap<path, FileData> m;
+        run_threads(nt, [&m, &paths](size_t)
+        {
+            for (auto &p : paths)
+                m.insert(p);
+        });
+        return m.find(paths[0]);
+    };
+    BENCHMARK("file storage: sharded map")
+    {
+        ConcurrentMap<path, FileData> m;
+        run_threads(nt, [&m, &paths](size_t)
+        {
+            for (auto &p : paths)
+                m.insert(p);
+        });
+        return m.find(paths[0]);
+    };
+
+    // CommandStorage: commands are inserted once by their thread, then looked up by dependents
+    auto hashes = make_hashes(200'000);
+    BENCHMARK("command storage: locked map")
+    {
+        LockedMap<size_t, CommandRecord> m;
+        run_threads(nt, [&m, &hashes, nt](size_t t)
+        {
+            for (size_t i = t; i < hashes.size(); i += nt)
+                m.insert(hashes[i])->hash = hashes[i];
+            for (auto h : hashes)
+                m.find(h);
+        });
+        std::shared_lock lk(m.m);
+        return m.map.size();
+    };
+    BENCHMARK("command storage: sharded map")
+    {
+        ConcurrentMap<size_t, CommandRecord> m;
+        run_threads(nt, [&m, &hashes, nt](size_t t)
+        {
+            for (size_t i = t; i < hashes.size(); i += nt)
+                m.insert(hashes[i]).first->hash = hashes[i];
+            for (auto h : hashes)
+                m.find(h);
+        });
+        size_t n = 0;
+        for (const auto &[k, r] : m)
+            n++;
+        return n;
+    };
+}
+
+int main(int argc, char **argv)
+{
+    Catch::Session().run(argc, argv);
+
+    return 0;
+}
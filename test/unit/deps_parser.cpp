@@ -0,0 +1,76 @@
+#include <sw/builder/deps_parser.h>
+
+#include <string>
+#include <vector>
+
+#define CATCH_CONFIG_RUNNER
+#include <catch2/catch.hpp>
+
+using namespace sw;
+
+static std::vector<std::string> parse(std::string_view s)
+{
+    std::vector<std::string> deps;
+    parseDepsFile(s, [&deps](std::string_view d) { deps.emplace_back(d); });
+    return deps;
+}
+
+using V = std::vector<std::string>;
+
+TEST_CASE("Checking deps parser", "[deps_parser]")
+{
+    SECTION("single target")
+    {
+        REQUIRE(parse("file.o: file.cpp file.h\n") == V{ "file.cpp", "file.h" });
+        REQUIRE(parse("file.o: file.cpp") == V{ "file.cpp" });
+        REQUIRE(parse("file.o:\n").empty());
+        REQUIRE(parse("").empty());
+    }
+
+    SECTION("line continuations")
+    {
+        REQUIRE(parse("file.o: dep1.cpp dep2.cpp \\\n dep1.h dep2.h \\\n  dep3.h \\\n  dep4.h\n")
+            == V{ "dep1.cpp", "dep2.cpp", "dep1.h", "dep2.h", "dep3.h", "dep4.h" });
+        REQUIRE(parse("file.o: \\\r\n file.cpp \\\r\n file.h\r\n") == V{ "file.cpp", "file.h" });
+        REQUIRE(parse("file.o: file.cpp\\\nfile.h") == V{ "file.cpp", "file.h" });
+    }
+
+    SECTION("multiple targets")
+    {
+        // protoc --dependency_out
+        REQUIRE(parse("a.pb.cc \\\n a.pb.h: a.proto \\\n b.proto\n") == V{ "a.proto", "b.proto" });
+        REQUIRE(parse("a.o b.o : a.cpp\n") == V{ "a.cpp" });
+    }
+
+    SECTION("phony targets")
+    {
+        // gcc -MP
+        REQUIRE(parse("file.o: file.cpp file.h \\\n other.h\n\nfile.h:\n\nother.h:\n")
+            == V{ "file.cpp", "file.h", "other.h" });
+        REQUIRE(parse("a.o: a.cpp\nb.o: b.cpp\n") == V{ "a.cpp", "b.cpp" });
+    }
+
+    SECTION("windows paths")
+    {
+        REQUIRE(parse("C:/path/to/file.o: C:/path/to/file.cpp \\\n C:\\include\\file.h\n")
+            == V{ "C:/path/to/file.cpp", "C:\\include\\file.h" });
+    }
+
+    SECTION("escapes")
+    {
+        REQUIRE(parse("file.o: dir\\ with\\ spaces/file.h next.h\n") == V{ "dir with spaces/file.h", "next.h" });
+        REQUIRE(parse("my\\ file.o: a.h\n") == V{ "a.h" });
+        REQUIRE(parse("file.o: cost$$.h $$a $\n") == V{ "cost$.h", "$a", "$" });
+        REQUIRE(parse("file.o: a\\#b.h\n") == V{ "a#b.h" });
+        // long paths go through the vectorized search
+        std::string p(100, 'x');
+        REQUIRE(parse("file.o: " + p + "\\ " + p + "$$" + p + "\n") == V{ p + " " + p + "$" + p });
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Catch::Session().run(argc, argv);
+
+    return 0;
+}
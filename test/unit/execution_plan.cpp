@@ -0,0 +1,129 @@
+#include <sw/builder/command.h>
+#include <sw/builder/execution_plan.h>
+#include <sw/builder/sw_context.h>
+
+#include <primitives/filesystem.h>
+
+#include <chrono>
+#include <iostream>
+
+#define CATCH_CONFIG_RUNNER
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+using namespace sw;
+
+// compile commands with a link command per every 100 objects
+static Commands make_commands(const SwBuilderContext &swctx, size_t n)
+{
+    const path root = fs::current_path();
+    Commands cmds;
+    std::shared_ptr<builder::Command> link;
+    for (size_t i = 0; i < n; i++)
+    {
+        auto c = std::make_shared<builder::Command>();
+        c->setContext(swctx);
+        c->name = "compile " + std::to_string(i);
+        c->setProgram("/usr/bin/cc");
+        auto src = root / "src" / (std::to_string(i) + ".cpp");
+        auto obj = root / "obj" / (std::to_string(i) + ".o");
+        c->push_back("-c");
+        c->push_back(src);
+        c->push_back("-o");
+        c->push_back(obj);
+        c->environment["LANG"] = "C";
+        c->addInput(src);
+        c->addInput(root / "include" / "common.h");
+        c->addOutput(obj);
+        cmds.insert(c);
+
+        if (i % 100 == 0)
+        {
+            link = std::make_shared<builder::Command>();
+            link->setContext(swctx);
+            link->name = "link " + std::to_string(i / 100);
+            link->setProgram("/usr/bin/ld");
+            auto exe = root / "bin" / std::to_string(i / 100);
+            link->push_back("-o");
+            link->push_back(exe);
+            link->addOutput(exe);
+            cmds.insert(link);
+        }
+        link->push_back(obj);
+        link->addInput(obj);
+    }
+    return cmds;
+}
+
+TEST_CASE("Checking execution plan serialization", "[explan]")
+{
+    SwBuilderContext swctx;
+    auto cmds = make_commands(swctx, 1000);
+    auto ep = ExecutionPlan::create(cmds);
+    REQUIRE(ep->isValid());
+
+    auto fn = fs::temp_directory_path() / "sw_test_explan.bin";
+    REQUIRE_NOTHROW(ep->save(fn));
+    auto cmds2 = ExecutionPlan::load(fn, swctx);
+    REQUIRE(cmds2.size() == cmds.size());
+    auto ep2 = ExecutionPlan::create(cmds2);
+    REQUIRE(ep2->isValid());
+
+    std::map<String, const builder::Command *> by_name;
+    for (auto &c : cmds2)
+        by_name[c->name] = c.get();
+    for (auto &c : cmds)
+    {
+        auto c2 = by_name.at(c->name);
+        REQUIRE(c2->getHash() == c->getHash());
+        REQUIRE(c2->inputs == c->inputs);
+        REQUIRE(c2->outputs == c->outputs);
+        REQUIRE(c2->environment == c->environment);
+        REQUIRE(c2->getDependencies().size() == c->getDependencies().size());
+    }
+    fs::remove(fn);
+}
+
+TEST_CASE("Execution plan save/load round trip", "[.benchmark][explan]")
+{
+    SwBuilderContext swctx;
+    auto cmds = make_commands(swctx, 100'000);
+    auto ep = ExecutionPlan::create(cmds);
+    auto bin = fs::temp_directory_path() / "sw_bench_explan.bin";
+    auto txt = fs::temp_directory_path() / "sw_bench_explan.txt";
+    ep->save(bin, 0);
+    ep->save(txt, 1);
+    std::cout << "binary plan: " << fs::file_size(bin) << " bytes, text plan: " << fs::file_size(txt) << " bytes\n";
+
+    BENCHMARK("save binary")
+    {
+        ep->save(bin, 0);
+    };
+    BENCHMARK("save text")
+    {
+        ep->save(txt, 1);
+    };
+    BENCHMARK("load binary")
+    {
+        return ExecutionPlan::load(bin, swctx).size();
+    };
+    BENCHMARK("load text")
+    {
+        return ExecutionPlan::load(txt, swctx).size();
+    };
+    BENCHMARK("load binary and create plan")
+    {
+        auto c = ExecutionPlan::load(bin, swctx);
+        return ExecutionPlan::create(c)->getCommands().size();
+    };
+
+    fs::remove(bin);
+    fs::remove(txt);
+}
+
+int main(int argc, char **argv)
+{
+    Catch::Session().run(argc, argv);
+
+    return 0;
+}
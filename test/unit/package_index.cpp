@@ -0,0 +1,88 @@
+#include <sw/manager/package_index.h>
+
+#include <primitives/filesystem.h>
+
+#define CATCH_CONFIG_RUNNER
+#include <catch2/catch.hpp>
+
+using namespace sw;
+
+static void write_table(const path &dir, const String &name, const String &data)
+{
+    write_file(dir / (name + ".csv"), data);
+}
+
+static void write_tables(const path &dir, bool updated)
+{
+    write_table(dir, "file", "file_id,hash,size\n1,h1,\n2,h2,\n3,h3,\n");
+    if (!updated)
+    {
+        write_table(dir, "package", "package_id,path,flags\n1,org.sw.demo.madler.zlib,0\n2,org.sw.demo.bzip2,4\n");
+        write_table(dir, "package_version", "package_version_id,package_id,version,flags,prefix,updated,sdir\n"
+            "1,1,1.2.11,0,3,,\n2,1,1.2.12,1,3,,\n3,2,1.0.8,0,,,\n");
+        write_table(dir, "package_version_file", "package_version_file_id,package_version_id,file_id,type,config_id,flags,archive_version,source\n"
+            "1,1,1,1,1,0,1,\n2,2,2,1,1,0,1,src\n3,3,3,1,1,0,1,\n");
+        write_table(dir, "package_version_dependency", "package_version_id,package_id,version_range\n2,2,1\n");
+        return;
+    }
+    // new zlib version, bzip2 is removed, png is added
+    write_table(dir, "package", "package_id,path,flags\n1,org.sw.demo.madler.zlib,0\n3,org.sw.demo.glennrp.png,0\n");
+    write_table(dir, "package_version", "package_version_id,package_id,version,flags,prefix,updated,sdir\n"
+        "1,1,1.2.11,0,3,,\n2,1,1.2.12,1,3,,\n4,1,1.2.13,0,3,,\n5,3,1.6.37,0,3,,\n");
+    write_table(dir, "package_version_file", "package_version_file_id,package_version_id,file_id,type,config_id,flags,archive_version,source\n"
+        "1,1,1,1,1,0,1,\n2,2,2,1,1,0,1,src\n4,4,3,1,1,0,1,\n5,5,3,1,1,0,1,\n");
+    write_table(dir, "package_version_dependency", "package_version_id,package_id,version_range\n2,2,1\n5,1,1\n");
+}
+
+TEST_CASE("Checking packages index", "[package_index]")
+{
+    auto dir = fs::temp_directory_path() / "sw_test_package_index";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+
+    write_tables(dir, false);
+    PackageIndex::build(dir, dir / PackageIndex::filename);
+    REQUIRE(PackageIndex::verify(dir));
+
+    {
+        PackageIndex i(dir);
+        auto p = i.resolve(UnresolvedPackage("ORG.sw.demo.madler.zlib-1"));
+        REQUIRE(p);
+        REQUIRE(p->getVersion() == Version("1.2.12"));
+        auto d = i.getPackageData(*p);
+        REQUIRE(d->hash == "h2");
+        REQUIRE(d->source == "src");
+        REQUIRE(d->prefix == 3);
+        REQUIRE(d->flags.to_ullong() == 1);
+        REQUIRE(d->dependencies.size() == 1);
+        REQUIRE(i.getPackageData(PackageId("org.sw.demo.bzip2-1.0.8"))->prefix == 2);
+        REQUIRE_FALSE(i.resolve(UnresolvedPackage("org.sw.demo.madler.zlib-2")));
+        REQUIRE_FALSE(i.resolve(UnresolvedPackage("org.sw.demo.unknown-1")));
+        REQUIRE_THROWS(i.getPackageData(PackageId("org.sw.demo.madler.zlib-1.2.10")));
+
+        write_tables(dir, true);
+        PackageIndex::build(dir, path(dir / PackageIndex::filename) += ".1", &i);
+    }
+    REQUIRE(PackageIndex::verify(dir));
+
+    PackageIndex i(dir);
+    REQUIRE(i.resolve(UnresolvedPackage("org.sw.demo.madler.zlib-1"))->getVersion() == Version("1.2.13"));
+    REQUIRE(i.getVersions(PackagePath("org.sw.demo.madler.zlib")).size() == 3);
+    REQUIRE_FALSE(i.resolve(UnresolvedPackage("org.sw.demo.bzip2-1")));
+    REQUIRE(i.getPackageData(PackageId("org.sw.demo.glennrp.png-1.6.37"))->dependencies.size() == 1);
+
+    // damaged delta
+    write_file(path(dir / PackageIndex::filename) += ".1", "x");
+    REQUIRE_FALSE(PackageIndex::verify(dir));
+    PackageIndex::remove(dir);
+    REQUIRE_FALSE(PackageIndex::exists(dir));
+
+    fs::remove_all(dir);
+}
+
+int main(int argc, char **argv)
+{
+    Catch::Session().run(argc, argv);
+
+    return 0;
+}
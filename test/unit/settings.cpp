@@ -0,0 +1,160 @@
+#include <sw/support/settings.h>
+
+#include <iostream>
+
+#define CATCH_CONFIG_RUNNER
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+using namespace sw;
+
+// settings of usual native target
+static PackageSettings make_target_settings()
+{
+    PackageSettings s;
+    s["os"]["kernel"] = "com.Microsoft.Windows.NT";
+    s["os"]["arch"] = "x86_64";
+    s["os"]["version"] = "10.0.19041";
+    s["native"]["configuration"] = "release";
+    s["native"]["library"] = "shared";
+    s["native"]["mt"] = "false";
+    s["native"]["stdlib"]["c"] = "com.Microsoft.Windows.SDK.ucrt-10.0.19041";
+    s["native"]["stdlib"]["cpp"] = "com.Microsoft.VisualStudio.VC.libcpp-19.28.29333";
+    s["native"]["stdlib"]["kernel"] = "com.Microsoft.Windows.SDK.um-10.0.19041";
+    s["native"]["stdlib"]["compiler"].push_back("com.Microsoft.VisualStudio.VC.runtime-19.28.29333");
+    s["native"]["program"]["c"] = "com.Microsoft.VisualStudio.VC.cl-19.28.29333";
+    s["native"]["program"]["cpp"] = "com.Microsoft.VisualStudio.VC.cl-19.28.29333";
+    s["native"]["program"]["asm"] = "com.Microsoft.VisualStudio.VC.ml64-19.28.29333";
+    s["native"]["program"]["lib"] = "com.Microsoft.VisualStudio.VC.lib-19.28.29333";
+    s["native"]["program"]["link"] = "com.Microsoft.VisualStudio.VC.link-19.28.29333";
+    for (int i = 0; i < 20; i++)
+    {
+        s["native"]["definitions"]["DEF" + std::to_string(i)] = std::to_string(i);
+        s["native"]["include_directories"].push_back("c:/sw/storage/pkg/" + std::to_string(i) + "/src/sdir/include");
+    }
+    s["rule"]["cpp"]["package"] = "msvc";
+    s["rule"].ignoreInComparison(true);
+    s["rule"].useInHash(false);
+    return s;
+}
+
+TEST_CASE("Checking settings hash", "[settings]")
+{
+    auto s = make_target_settings();
+    auto h = s.getHash();
+
+    SECTION("copies keep hash")
+    {
+        auto s2 = s;
+        REQUIRE(s2.getHash() == h);
+        REQUIRE(s2 == s);
+        auto s3 = std::move(s2);
+        REQUIRE(s3.getHash() == h);
+        REQUIRE(s2.empty());
+    }
+
+    SECTION("changes through nested references")
+    {
+        auto &stdlib = s["native"]["stdlib"];
+        REQUIRE(s.getHash() == h);
+        stdlib["c"] = "com.Microsoft.Windows.SDK.ucrt-10.0.18362";
+        REQUIRE(s.getHash() != h);
+        stdlib["c"] = "com.Microsoft.Windows.SDK.ucrt-10.0.19041";
+        REQUIRE(s.getHash() == h);
+
+        auto &dirs = s["native"]["include_directories"];
+        dirs.push_back("c:/include");
+        REQUIRE(s.getHash() != h);
+    }
+
+    SECTION("unused and empty values")
+    {
+        s["rule"]["cpp"]["package"] = "clang";
+        REQUIRE(s.getHash() == h);
+        s["native"]["empty"];
+        REQUIRE(s.getHash() == h);
+        s["native"]["stdlib"]["c"].useInHash(false);
+        REQUIRE(s.getHash() != h);
+        s["native"]["stdlib"]["c"].useInHash(true);
+        REQUIRE(s.getHash() == h);
+        s["native"].getMap().erase("empty");
+        REQUIRE(s.getHash() == h);
+    }
+
+    SECTION("equality")
+    {
+        auto s2 = make_target_settings();
+        REQUIRE(s2 == s);
+        s2["rule"]["cpp"]["package"] = "clang";
+        REQUIRE(s2 == s); // ignored in comparison
+        s2["native"]["configuration"] = "debug";
+        REQUIRE_FALSE(s2 == s);
+
+        auto s3 = make_target_settings();
+        s3.erase("rule");
+        auto s4 = s3;
+        s4["native"]["configuration"] = "debug";
+        REQUIRE_FALSE(s3 == s4);
+        s4["native"]["configuration"] = "release";
+        REQUIRE(s3 == s4);
+    }
+
+    SECTION("merges")
+    {
+        PackageSettings s2;
+        s2.mergeMissing(s);
+        REQUIRE(s2.getHash() == h);
+        PackageSettings s3;
+        s3["native"]["configuration"] = "debug";
+        s2.mergeAndAssign(s3);
+        REQUIRE(s2.getHash() != h);
+        s3["native"]["configuration"] = "release";
+        s2.mergeAndAssign(s3);
+        REQUIRE(s2.getHash() == h);
+    }
+
+    SECTION("json round trip")
+    {
+        PackageSettings s2;
+        s2.mergeFromString(s.toString());
+        REQUIRE(s2.getHash() == h);
+    }
+}
+
+TEST_CASE("Settings hash workloads", "[.benchmark][settings]")
+{
+    auto s = make_target_settings();
+    std::vector<PackageSettings> targets(100, s);
+    for (size_t i = 0; i < targets.size(); i++)
+        targets[i]["native"]["configuration"] = "cfg" + std::to_string(i);
+
+    BENCHMARK("hash")
+    {
+        return s.getHash();
+    };
+    BENCHMARK("hash after change")
+    {
+        s["native"]["stdlib"]["c"] = "com.Microsoft.Windows.SDK.ucrt-10.0.19041";
+        return s.getHash();
+    };
+    BENCHMARK("copy and hash")
+    {
+        auto s2 = s;
+        return s2.getHash();
+    };
+    // target lookup
+    BENCHMARK("compare with targets")
+    {
+        size_t n = 0;
+        for (auto &t : targets)
+            n += t == s;
+        return n;
+    };
+}
+
+int main(int argc, char **argv)
+{
+    Catch::Session().run(argc, argv);
+
+    return 0;
+}